@@ -0,0 +1,387 @@
+#include <math.h>
+#include <string.h>
+#include "Calibration.h"
+#include "platform.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#define CAL_BENCH_SAMPLES 1024 //column length used by BenchCalibration
+#define CAL_BENCH_ROUNDS 64
+
+/**
+ * @brief The float calibration the fixed-point kernel has to match
+ */
+static inline int32_t CalibrateFloat(const CalibrationQ *cal, int32_t digitalOut)
+{
+  float physOut = (digitalOut * cal->calMultiplier) + cal->calOffset;
+  return (int32_t)physOut;
+}
+
+/**
+ * @brief Sign extends one packed 24-bit little-endian sample
+ */
+static inline int32_t Get24(const uint8_t *in)
+{
+  return (int32_t)((uint32_t)in[0] << 8 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 24) >> 8;
+}
+
+/**
+ * @brief Calibrates one sample in fixed point, falling back to float near a boundary
+ */
+static inline int32_t CalibrateFixed(const CalibrationQ *cal, int32_t digitalOut)
+{
+  int64_t q = (int64_t)digitalOut * cal->gain + cal->bias;
+  uint64_t mask = ((uint64_t)1 << cal->shift) - 1;
+  if ((uint64_t)((q + cal->band) & mask) < (uint64_t)(2 * cal->band))
+  {
+    return CalibrateFloat(cal, digitalOut);
+  }
+  // q is biased positive so the shift is a floor, turn that into truncation toward 0
+  int32_t floorOut = (int32_t)(q >> cal->shift) - cal->biasInt;
+  return floorOut + (floorOut < 0);
+}
+
+/**
+ * @brief Works out the fixed-point gain, bias and recheck band for one channel
+ */
+void CalibrationPrepare(CalibrationQ *cal, float calMultiplier, float calOffset, int sampleBits)
+{
+  cal->sampleBits = sampleBits;
+  cal->calMultiplier = calMultiplier;
+  cal->calOffset = calOffset;
+  cal->floatOnly = true;
+  cal->gain = 0;
+  cal->bias = 0;
+  cal->biasInt = 0;
+  cal->shift = 0;
+  cal->band = 0;
+  if (!isfinite(calMultiplier) || !isfinite(calOffset))
+  {
+    return;
+  }
+
+  // largest magnitudes of the product and the result over every input
+  const double maxDigital = ldexp(1.0, sampleBits - 1);
+  double maxProduct = maxDigital * fabs(calMultiplier);
+  double maxResult = maxProduct + fabs(calOffset);
+  int biasExp;
+  frexp(maxResult + 2, &biasExp);
+  if (biasExp > 30)
+  {
+    return;
+  }
+  double biasInt = ldexp(1.0, biasExp);
+
+  int gainExp;
+  frexp(calMultiplier, &gainExp);
+  int shift = 30 - gainExp; // keeps |gain| below 2^30
+  if (shift > 62)
+  {
+    shift = 62;
+  }
+  // q = digital * gain + bias has to stay well inside an int64
+  while (shift > 0 && ldexp(maxProduct + fabs(calOffset) + biasInt + 1, shift) >= ldexp(1.0, 62))
+  {
+    shift--;
+  }
+  if (shift < 8)
+  {
+    return;
+  }
+
+  double scale = ldexp(1.0, shift);
+  // the float path is off by at most an ulp of the product plus an ulp of the sum,
+  // the fixed path by rounding gain (times |digital|) and bias
+  double floatError = (maxProduct + maxResult) * ldexp(1.0, -23) * scale;
+  double fixedError = maxDigital * 0.5 + 1.0;
+  double band = 2 * (floatError + fixedError) + 1;
+  if (band * 8 > scale)
+  {
+    return;
+  }
+
+  cal->gain = (int32_t)llround(calMultiplier * scale);
+  cal->biasInt = (int32_t)biasInt;
+  cal->bias = llround(calOffset * scale) + (int64_t)biasInt * ((int64_t)1 << shift);
+  cal->shift = shift;
+  cal->band = (int64_t)band;
+  cal->floatOnly = false;
+}
+
+/**
+ * @brief Reference kernel: the float path applied to a whole column
+ */
+void CalibrateColumnFloat(const CalibrationQ *cal, const int16_t *in, int32_t *out, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    out[i] = CalibrateFloat(cal, in[i]);
+  }
+}
+
+void CalibrateColumnFloat24(const CalibrationQ *cal, const uint8_t *in, int32_t *out, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    out[i] = CalibrateFloat(cal, Get24(&in[3 * i]));
+  }
+}
+
+#if defined(__AVX2__)
+/*
+ * The fixed-point calibration of 4 samples at a time, shared by the 16 and
+ * 24-bit kernels, which only differ in how they get the samples into lanes
+ */
+struct CalibrationLanes
+{
+  __m256i gain, bias, band, band2, mask, biasInt, lowHalves;
+  __m128i shift;
+
+  explicit CalibrationLanes(const CalibrationQ *cal)
+  {
+    gain = _mm256_set1_epi64x(cal->gain);
+    bias = _mm256_set1_epi64x(cal->bias);
+    band = _mm256_set1_epi64x(cal->band);
+    band2 = _mm256_set1_epi64x(2 * cal->band);
+    mask = _mm256_set1_epi64x((int64_t)(((uint64_t)1 << cal->shift) - 1));
+    biasInt = _mm256_set1_epi64x(cal->biasInt);
+    lowHalves = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    shift = _mm_cvtsi32_si128(cal->shift);
+  }
+
+  /**
+   * @brief Stores 4 calibrated samples
+   *
+   * @return true if any of them is close enough to a boundary that the float path has to decide
+   */
+  inline bool Calibrate4(__m256i digital, int32_t *out) const
+  {
+    __m256i q = _mm256_add_epi64(_mm256_mul_epi32(digital, gain), bias);
+    __m256i frac = _mm256_and_si256(_mm256_add_epi64(q, band), mask);
+    __m256i nearBoundary = _mm256_cmpgt_epi64(band2, frac);
+    __m256i floorOut = _mm256_sub_epi64(_mm256_srl_epi64(q, shift), biasInt);
+    // subtracting the all-ones "is negative" mask adds 1, i.e. truncates toward 0
+    __m256i truncOut = _mm256_sub_epi64(floorOut, _mm256_cmpgt_epi64(_mm256_setzero_si256(), floorOut));
+    __m128i packed = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(truncOut, lowHalves));
+    _mm_storeu_si128((__m128i *)out, packed);
+    return !_mm256_testz_si256(nearBoundary, nearBoundary);
+  }
+};
+#endif
+
+/**
+ * @brief Calibrates a column of raw samples into physical values in fixed point
+ *
+ * Bit-identical to CalibrateColumnFloat. Uses AVX2 on the host when the
+ * compiler targets it; on the Cortex-M4 each pair of samples is fetched
+ * with one word load and the products use the single-cycle SMLAL.
+ */
+void CalibrateColumnFixed(const CalibrationQ *cal, const int16_t *in, int32_t *out, int count)
+{
+  if (cal->floatOnly)
+  {
+    CalibrateColumnFloat(cal, in, out, count);
+    return;
+  }
+  int i = 0;
+#if defined(__AVX2__)
+  const CalibrationLanes lanes(cal);
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128i raw = _mm_loadl_epi64((const __m128i *)&in[i]);
+    if (lanes.Calibrate4(_mm256_cvtepi16_epi64(raw), &out[i]))
+    {
+      // rare: close enough to a boundary that the float path has to decide
+      for (int j = i; j < i + 4; j++)
+      {
+        out[j] = CalibrateFixed(cal, in[j]);
+      }
+    }
+  }
+#elif defined(__ARM_FEATURE_DSP)
+  for (; i + 2 <= count; i += 2)
+  {
+    uint32_t pair;
+    memcpy(&pair, &in[i], 4);
+    out[i] = CalibrateFixed(cal, (int16_t)(pair & 0xFFFF));
+    out[i + 1] = CalibrateFixed(cal, (int32_t)pair >> 16);
+  }
+#endif
+  for (; i < count; i++)
+  {
+    out[i] = CalibrateFixed(cal, in[i]);
+  }
+}
+
+/**
+ * @brief Calibrates a column of packed 24-bit samples (BDF) into physical values in fixed point
+ *
+ * Bit-identical to CalibrateColumnFloat24. Sign extension costs one shift
+ * per sample: with AVX2 a byte shuffle puts each 3-byte sample in the top
+ * of a 32-bit lane and an arithmetic shift brings it down; elsewhere every
+ * 4 samples are fetched as 3 words and pulled apart with shifts.
+ */
+void CalibrateColumnFixed24(const CalibrationQ *cal, const uint8_t *in, int32_t *out, int count)
+{
+  if (cal->floatOnly)
+  {
+    CalibrateColumnFloat24(cal, in, out, count);
+    return;
+  }
+  int i = 0;
+#if defined(__AVX2__)
+  const CalibrationLanes lanes(cal);
+  const __m128i spread = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+  // the 16-byte load takes 4 bytes past the 4 samples, so stop while 2 more samples remain
+  for (; i + 6 <= count; i += 4)
+  {
+    __m128i raw = _mm_loadu_si128((const __m128i *)&in[3 * i]);
+    __m128i digital = _mm_srai_epi32(_mm_shuffle_epi8(raw, spread), 8);
+    if (lanes.Calibrate4(_mm256_cvtepi32_epi64(digital), &out[i]))
+    {
+      for (int j = i; j < i + 4; j++)
+      {
+        out[j] = CalibrateFixed(cal, Get24(&in[3 * j]));
+      }
+    }
+  }
+#else
+  for (; i + 4 <= count; i += 4)
+  {
+    uint32_t w[3];
+    memcpy(w, &in[3 * i], 12);
+    out[i] = CalibrateFixed(cal, (int32_t)(w[0] << 8) >> 8);
+    out[i + 1] = CalibrateFixed(cal, (int32_t)((w[0] >> 24 | w[1] << 8) << 8) >> 8);
+    out[i + 2] = CalibrateFixed(cal, (int32_t)((w[1] >> 16 | w[2] << 16) << 8) >> 8);
+    out[i + 3] = CalibrateFixed(cal, (int32_t)w[2] >> 8);
+  }
+#endif
+  for (; i < count; i++)
+  {
+    out[i] = CalibrateFixed(cal, Get24(&in[3 * i]));
+  }
+}
+
+/**
+ * @brief Calibrates a column of raw samples into physical values, with the kernel CAL_FIXED_POINT picks
+ */
+void CalibrateColumn(const CalibrationQ *cal, const int16_t *in, int32_t *out, int count)
+{
+  if (CAL_FIXED_POINT)
+  {
+    CalibrateColumnFixed(cal, in, out, count);
+    return;
+  }
+  CalibrateColumnFloat(cal, in, out, count);
+}
+
+void CalibrateColumn24(const CalibrationQ *cal, const uint8_t *in, int32_t *out, int count)
+{
+  if (CAL_FIXED_POINT)
+  {
+    CalibrateColumnFixed24(cal, in, out, count);
+    return;
+  }
+  CalibrateColumnFloat24(cal, in, out, count);
+}
+
+/**
+ * @brief Fills columns with EEG-like (slowly varying) samples, 16-bit and packed 24-bit
+ */
+static void FillBenchSamples(int16_t *in, uint8_t *in24, int count, bool packed24)
+{
+  for (int i = 0; i < count; i++)
+  {
+    int32_t value = (int32_t)(12000 * sin(i * 0.05) + (i * 7919 % 401) - 200);
+    value = packed24 ? value * 256 + (i * 31 % 256) : value;
+    in[i] = (int16_t)value;
+    in24[3 * i] = value & 0xFF;
+    in24[3 * i + 1] = (value >> 8) & 0xFF;
+    in24[3 * i + 2] = (value >> 16) & 0xFF;
+  }
+}
+
+/**
+ * @brief Counts inputs where the fixed-point kernel and the float path disagree,
+ *        over every 16 or 24-bit value (by cal->sampleBits)
+ *
+ * @return 0 unless something is wrong with CalibrationPrepare
+ */
+long CalibrationMismatches(const CalibrationQ *cal)
+{
+  int16_t in[256];
+  uint8_t in24[3 * 256];
+  int32_t fixedOut[256];
+  int32_t floatOut[256];
+  long mismatches = 0;
+  const int32_t limit = (int32_t)1 << (cal->sampleBits - 1);
+  for (int32_t block = -limit; block < limit; block += 256)
+  {
+    for (int i = 0; i < 256; i++)
+    {
+      in[i] = (int16_t)(block + i);
+      in24[3 * i] = (block + i) & 0xFF;
+      in24[3 * i + 1] = ((block + i) >> 8) & 0xFF;
+      in24[3 * i + 2] = ((block + i) >> 16) & 0xFF;
+    }
+    if (cal->sampleBits == 24)
+    {
+      CalibrateColumnFixed24(cal, in24, fixedOut, 256);
+      CalibrateColumnFloat24(cal, in24, floatOut, 256);
+    }
+    else
+    {
+      CalibrateColumnFixed(cal, in, fixedOut, 256);
+      CalibrateColumnFloat(cal, in, floatOut, 256);
+    }
+    for (int i = 0; i < 256; i++)
+    {
+      mismatches += fixedOut[i] != floatOut[i];
+    }
+  }
+  return mismatches;
+}
+
+/**
+ * @brief Measures cycles per sample of the fixed-point and float kernels
+ *        over a column of EEG-like (slowly varying) samples
+ */
+void BenchCalibration(const CalibrationQ *cal, float *fixedCyclesPerSample, float *floatCyclesPerSample)
+{
+  static int16_t in[CAL_BENCH_SAMPLES];
+  static uint8_t in24[3 * CAL_BENCH_SAMPLES];
+  static int32_t out[CAL_BENCH_SAMPLES];
+  const bool packed24 = cal->sampleBits == 24;
+  FillBenchSamples(in, in24, CAL_BENCH_SAMPLES, packed24);
+  const float samples = (float)CAL_BENCH_SAMPLES * CAL_BENCH_ROUNDS;
+
+  uint32_t start = PlatformCycles();
+  for (int round = 0; round < CAL_BENCH_ROUNDS; round++)
+  {
+    if (packed24)
+    {
+      CalibrateColumnFixed24(cal, in24, out, CAL_BENCH_SAMPLES);
+    }
+    else
+    {
+      CalibrateColumnFixed(cal, in, out, CAL_BENCH_SAMPLES);
+    }
+  }
+  *fixedCyclesPerSample = (uint32_t)(PlatformCycles() - start) / samples;
+
+  start = PlatformCycles();
+  for (int round = 0; round < CAL_BENCH_ROUNDS; round++)
+  {
+    if (packed24)
+    {
+      CalibrateColumnFloat24(cal, in24, out, CAL_BENCH_SAMPLES);
+    }
+    else
+    {
+      CalibrateColumnFloat(cal, in, out, CAL_BENCH_SAMPLES);
+    }
+  }
+  *floatCyclesPerSample = (uint32_t)(PlatformCycles() - start) / samples;
+}
@@ -0,0 +1,57 @@
+/**
+ * @file Calibration.h
+ * @brief Batch digital-to-physical calibration of whole record columns
+ *
+ * The reference calibration is the float expression the sender used to
+ * evaluate per sample:
+ *
+ *     (int32_t)((digital * calMultiplier) + calOffset)
+ *
+ * CalibrateColumnFixed produces bit-identical results with 64-bit fixed point:
+ * q = digital * gain + bias, where gain and bias are calMultiplier and
+ * calOffset scaled by 2^shift. Away from integer boundaries both paths
+ * truncate to the same value; within `band` of a boundary the float path's
+ * rounding can go either way, so those (rare) samples are re-evaluated in
+ * float. Build with -ffp-contract=off so the float path isn't fused into an
+ * FMA, which would round differently.
+ *
+ * EDF samples are 16-bit (CalibrateColumn); BDF samples are packed 24-bit
+ * little endian (CalibrateColumn24), sign extended on the fly.
+ *
+ * CalibrateColumn, the send path, uses the float kernel unless the build
+ * sets CAL_FIXED_POINT. Where the float loop is vectorized (AVX2 on the
+ * host) it beats the fixed-point one several times over, and the
+ * Cortex-M4F has a single-cycle FPU multiply and add; the fixed-point
+ * kernel is only worth turning on for a target where CAL_BENCH shows it
+ * ahead.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#ifndef CAL_FIXED_POINT
+#define CAL_FIXED_POINT false //CalibrateColumn uses the fixed-point kernels, e.g. -DCAL_FIXED_POINT=true in a target's build_flags
+#endif
+
+struct CalibrationQ
+{
+  float calMultiplier; // float path, used for samples near a boundary
+  float calOffset;
+  int32_t gain;        // calMultiplier * 2^shift
+  int64_t bias;        // calOffset * 2^shift, plus biasInt * 2^shift so q is never negative
+  int32_t biasInt;
+  int shift;
+  int64_t band;        // fractional parts within this of 0 or 1 are rechecked in float
+  bool floatOnly;      // fixed point can't represent this channel, always use float
+  int sampleBits;      // 16 for EDF, 24 for BDF
+};
+
+void CalibrationPrepare(CalibrationQ *cal, float calMultiplier, float calOffset, int sampleBits);
+void CalibrateColumn(const CalibrationQ *cal, const int16_t *in, int32_t *out, int count);
+void CalibrateColumn24(const CalibrationQ *cal, const uint8_t *in, int32_t *out, int count);
+void CalibrateColumnFixed(const CalibrationQ *cal, const int16_t *in, int32_t *out, int count);
+void CalibrateColumnFixed24(const CalibrationQ *cal, const uint8_t *in, int32_t *out, int count);
+void CalibrateColumnFloat(const CalibrationQ *cal, const int16_t *in, int32_t *out, int count);
+void CalibrateColumnFloat24(const CalibrationQ *cal, const uint8_t *in, int32_t *out, int count);
+long CalibrationMismatches(const CalibrationQ *cal);
+void BenchCalibration(const CalibrationQ *cal, float *fixedCyclesPerSample, float *floatCyclesPerSample);
@@ -0,0 +1,400 @@
+#include <math.h>
+#include <new>
+#include <string.h>
+#include "ChannelFilter.h"
+#include "platform.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#define FILTER_COEFFS 5 //b0, b1, b2, -a1, -a2
+#define FILTER_STATES 4 //x[n-1], x[n-2], y[n-1], y[n-2]
+#define FILTER_BENCH_ROWS 1024 //column length used by BenchFilter
+#define FILTER_BENCH_ROUNDS 16
+
+static const int64_t residueMask = ((int64_t)1 << FILTER_COEFF_SHIFT) - 1;
+
+/**
+ * @brief Arena bytes FilterCreate takes
+ */
+size_t FilterArenaBytes(int numChans)
+{
+  return ArenaSize(numChans * sizeof(bool)) + ArenaSize(numChans * sizeof(int)) +
+         ArenaSize((size_t)FILTER_MAX_SECTIONS * FILTER_COEFFS * numChans * sizeof(int32_t)) +
+         ArenaSize((size_t)FILTER_MAX_SECTIONS * FILTER_STATES * numChans * sizeof(int32_t)) +
+         ArenaSize((size_t)FILTER_MAX_SECTIONS * numChans * sizeof(int32_t));
+}
+
+/**
+ * @brief Allocates the filters of numChans channels from the arena, every section passing samples through
+ *
+ * Every channel starts out active and without sections; FilterAddSection
+ * gives it some.
+ *
+ * @param decimation keep every this many filtered rows, 1 to keep them all
+ * @return false if there wasn't enough room in the arena
+ */
+bool FilterCreate(FilterBank *bank, SampleArena *arena, int numChans, int decimation)
+{
+  bank->numChans = numChans;
+  bank->numSections = 0;
+  bank->decimation = decimation < 1 ? 1 : decimation;
+  bank->chanActive = ArenaNew<bool>(arena, numChans, ARENA_CHANNELS);
+  bank->chanSections = ArenaNew<int>(arena, numChans, ARENA_CHANNELS);
+  bank->coeffs = ArenaNew<int32_t>(arena, (size_t)FILTER_MAX_SECTIONS * FILTER_COEFFS * numChans, ARENA_CHANNELS);
+  bank->state = ArenaNew<int32_t>(arena, (size_t)FILTER_MAX_SECTIONS * FILTER_STATES * numChans, ARENA_CHANNELS);
+  bank->residue = ArenaNew<int32_t>(arena, (size_t)FILTER_MAX_SECTIONS * numChans, ARENA_CHANNELS);
+  if (!bank->chanActive || !bank->chanSections || !bank->coeffs || !bank->state || !bank->residue)
+  {
+    return false;
+  }
+  for (int chan = 0; chan < numChans; chan++)
+  {
+    bank->chanActive[chan] = true;
+    for (int section = 0; section < FILTER_MAX_SECTIONS; section++)
+    {
+      bank->coeffs[section * FILTER_COEFFS * numChans + chan] = (int32_t)1 << FILTER_COEFF_SHIFT;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Designs one section for a channel and appends it to the channel's cascade
+ *
+ * @param hz centre frequency of a notch, cutoff of a high or low-pass
+ * @param q quality factor: FILTER_NOTCH_Q for a notch, 0.7071 for a Butterworth high or low-pass
+ * @param sampleRate samples/second of the channel, before decimation
+ * @return false if hz isn't between 0 and the Nyquist frequency, or the channel has no sections left
+ */
+bool FilterAddSection(FilterBank *bank, int chan, FilterKind kind, float hz, float q, float sampleRate)
+{
+  int section = bank->chanSections[chan];
+  if (section == FILTER_MAX_SECTIONS || !(hz > 0) || !(hz < sampleRate / 2) || !(q > 0))
+  {
+    return false;
+  }
+  const double w0 = 2 * M_PI * hz / sampleRate;
+  const double cosW0 = cos(w0);
+  const double alpha = sin(w0) / (2 * q);
+  double b[3];
+  switch (kind)
+  {
+  case FILTER_NOTCH:
+    b[0] = 1;
+    b[1] = -2 * cosW0;
+    b[2] = 1;
+    break;
+  case FILTER_HIGH_PASS:
+    b[0] = (1 + cosW0) / 2;
+    b[1] = -(1 + cosW0);
+    b[2] = (1 + cosW0) / 2;
+    break;
+  default:
+    b[0] = (1 - cosW0) / 2;
+    b[1] = 1 - cosW0;
+    b[2] = (1 - cosW0) / 2;
+    break;
+  }
+  const double a0 = 1 + alpha;
+  const double coeffs[FILTER_COEFFS] = {b[0] / a0, b[1] / a0, b[2] / a0, 2 * cosW0 / a0, -(1 - alpha) / a0};
+  const int numChans = bank->numChans;
+  for (int k = 0; k < FILTER_COEFFS; k++)
+  {
+    bank->coeffs[(section * FILTER_COEFFS + k) * numChans + chan] = (int32_t)llround(ldexp(coeffs[k], FILTER_COEFF_SHIFT));
+  }
+  bank->chanSections[chan] = section + 1;
+  if (bank->numSections < section + 1)
+  {
+    bank->numSections = section + 1;
+  }
+  return true;
+}
+
+/**
+ * @brief Appends the low-pass that goes before decimating: 4th order Butterworth, as two sections
+ *
+ * @param sampleRate samples/second of the channel, before decimation
+ * @return false if the channel hasn't room for both sections
+ */
+bool FilterAddAntiAlias(FilterBank *bank, int chan, float sampleRate)
+{
+  if (bank->chanSections[chan] + 2 > FILTER_MAX_SECTIONS)
+  {
+    return false;
+  }
+  const float cutoff = FILTER_ANTI_ALIAS * sampleRate / (2 * bank->decimation);
+  // the pole pairs of a 4th order Butterworth: Q = 1 / (2 cos(pi/8)) and 1 / (2 cos(3pi/8))
+  return FilterAddSection(bank, chan, FILTER_LOW_PASS, cutoff, 0.5412f, sampleRate) &&
+         FilterAddSection(bank, chan, FILTER_LOW_PASS, cutoff, 1.3066f, sampleRate);
+}
+
+/**
+ * @brief Forgets every channel's history, as after a seek
+ */
+void FilterReset(FilterBank *bank)
+{
+  memset(bank->state, 0, (size_t)FILTER_MAX_SECTIONS * FILTER_STATES * bank->numChans * sizeof(int32_t));
+  memset(bank->residue, 0, (size_t)FILTER_MAX_SECTIONS * bank->numChans * sizeof(int32_t));
+}
+
+/**
+ * @brief Runs count samples of one channel through one of its sections, in place
+ *
+ * On the Cortex-M4 each product is a single-cycle SMLAL into the 64-bit sum.
+ */
+static void SectionRun(FilterBank *bank, int section, int chan, int32_t *x, int count)
+{
+  const int numChans = bank->numChans;
+  const int32_t *c = &bank->coeffs[section * FILTER_COEFFS * numChans + chan];
+  int32_t *s = &bank->state[section * FILTER_STATES * numChans + chan];
+  const int32_t b0 = c[0], b1 = c[numChans], b2 = c[2 * numChans], na1 = c[3 * numChans], na2 = c[4 * numChans];
+  int32_t x1 = s[0], x2 = s[numChans], y1 = s[2 * numChans], y2 = s[3 * numChans];
+  int64_t residue = bank->residue[section * numChans + chan];
+  for (int i = 0; i < count; i++)
+  {
+    const int32_t in = x[i];
+    int64_t acc = (int64_t)b0 * in + (int64_t)b1 * x1 + (int64_t)b2 * x2 + (int64_t)na1 * y1 + (int64_t)na2 * y2 + residue;
+    const int32_t out = (int32_t)(acc >> FILTER_COEFF_SHIFT);
+    residue = acc & residueMask;
+    x2 = x1;
+    x1 = in;
+    y2 = y1;
+    y1 = out;
+    x[i] = out;
+  }
+  s[0] = x1;
+  s[numChans] = x2;
+  s[2 * numChans] = y1;
+  s[3 * numChans] = y2;
+  bank->residue[section * numChans + chan] = (int32_t)residue;
+}
+
+/**
+ * @brief Keeps every decimation'th row of rows firstRow on, moving each to row / decimation
+ */
+static void DecimateColumn(const FilterBank *bank, int32_t *column, int firstRow, int numRows)
+{
+  const int m = bank->decimation;
+  for (int row = firstRow + (m - firstRow % m) % m; row < firstRow + numRows; row += m)
+  {
+    column[row / m] = column[row];
+  }
+}
+
+/**
+ * @brief Filters one channel's rows in place, section after section
+ */
+static void ChannelRun(FilterBank *bank, int chan, int32_t *column, int firstRow, int numRows)
+{
+  for (int section = 0; section < bank->chanSections[chan]; section++)
+  {
+    SectionRun(bank, section, chan, column + firstRow, numRows);
+  }
+  if (bank->decimation > 1)
+  {
+    DecimateColumn(bank, column, firstRow, numRows);
+  }
+}
+
+/**
+ * @brief Reference kernel: every channel on its own, one sample at a time
+ */
+void FilterRunScalar(FilterBank *bank, int32_t *const *columns, int firstRow, int numRows)
+{
+  for (int chan = 0; chan < bank->numChans; chan++)
+  {
+    if (bank->chanActive[chan])
+    {
+      ChannelRun(bank, chan, columns[chan], firstRow, numRows);
+    }
+  }
+}
+
+#if defined(__AVX2__)
+/**
+ * @brief Loads 4 neighbouring channels' int32s into the low halves of 64-bit lanes
+ */
+static inline __m256i Load4(const int32_t *p)
+{
+  return _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)p));
+}
+
+/**
+ * @brief Stores the low halves of 4 64-bit lanes as 4 int32s
+ */
+static inline void Store4(int32_t *p, __m256i lanes)
+{
+  const __m256i lowHalves = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+  _mm_storeu_si128((__m128i *)p, _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(lanes, lowHalves)));
+}
+
+/**
+ * @brief Filters 4 channels, one to a 64-bit lane, through every section; rows in and out of x
+ *
+ * _mm256_mul_epi32 only looks at the low half of each lane, so samples and
+ * outputs are carried with whatever the logical shift left in the high
+ * half: its low half is exactly the arithmetic shift the scalar kernel
+ * takes.
+ */
+static void Group4Run(FilterBank *bank, int chan, __m256i *x, int count)
+{
+  const int numChans = bank->numChans;
+  const __m256i mask = _mm256_set1_epi64x(residueMask);
+  for (int section = 0; section < bank->numSections; section++)
+  {
+    const int32_t *c = &bank->coeffs[section * FILTER_COEFFS * numChans + chan];
+    int32_t *s = &bank->state[section * FILTER_STATES * numChans + chan];
+    int32_t *r = &bank->residue[section * numChans + chan];
+    const __m256i b0 = Load4(c), b1 = Load4(c + numChans), b2 = Load4(c + 2 * numChans);
+    const __m256i na1 = Load4(c + 3 * numChans), na2 = Load4(c + 4 * numChans);
+    __m256i x1 = Load4(s), x2 = Load4(s + numChans), y1 = Load4(s + 2 * numChans), y2 = Load4(s + 3 * numChans);
+    __m256i residue = Load4(r);
+    for (int i = 0; i < count; i++)
+    {
+      const __m256i in = x[i];
+      __m256i acc = _mm256_add_epi64(_mm256_mul_epi32(b0, in), _mm256_mul_epi32(b1, x1));
+      acc = _mm256_add_epi64(acc, _mm256_mul_epi32(b2, x2));
+      acc = _mm256_add_epi64(acc, _mm256_mul_epi32(na1, y1));
+      acc = _mm256_add_epi64(acc, _mm256_mul_epi32(na2, y2));
+      acc = _mm256_add_epi64(acc, residue);
+      const __m256i out = _mm256_srli_epi64(acc, FILTER_COEFF_SHIFT);
+      residue = _mm256_and_si256(acc, mask);
+      x2 = x1;
+      x1 = in;
+      y2 = y1;
+      y1 = out;
+      x[i] = out;
+    }
+    Store4(s, x1);
+    Store4(s + numChans, x2);
+    Store4(s + 2 * numChans, y1);
+    Store4(s + 3 * numChans, y2);
+    Store4(r, residue);
+  }
+}
+#endif
+
+/**
+ * @brief Filters rows firstRow to firstRow + numRows - 1 of every active channel's column in place,
+ *        then decimates them
+ *
+ * Bit-identical to FilterRunScalar. With AVX2, 4 neighbouring active
+ * channels go through their sections together, one to a lane of 64-bit
+ * sums, FILTER_BLOCK_ROWS rows at a time; the channels left over run on
+ * their own. Elsewhere every channel runs on its own, which on the
+ * Cortex-M4 keeps a section's coefficients and history in registers.
+ *
+ * @param columns [chan], the rows of each channel
+ */
+void FilterRun(FilterBank *bank, int32_t *const *columns, int firstRow, int numRows)
+{
+  int chan = 0;
+#if defined(__AVX2__)
+  alignas(32) __m256i x[FILTER_BLOCK_ROWS];
+  alignas(16) int32_t out[4];
+  for (; chan + 4 <= bank->numChans; chan += 4)
+  {
+    const bool *active = &bank->chanActive[chan];
+    if (!active[0] || !active[1] || !active[2] || !active[3])
+    {
+      for (int lane = 0; lane < 4; lane++)
+      {
+        if (active[lane])
+        {
+          ChannelRun(bank, chan + lane, columns[chan + lane], firstRow, numRows);
+        }
+      }
+      continue;
+    }
+    int32_t *const *cols = &columns[chan];
+    for (int done = 0; done < numRows; done += FILTER_BLOCK_ROWS)
+    {
+      const int first = firstRow + done;
+      const int count = numRows - done < FILTER_BLOCK_ROWS ? numRows - done : FILTER_BLOCK_ROWS;
+      for (int i = 0; i < count; i++)
+      {
+        x[i] = _mm256_setr_epi64x(cols[0][first + i], cols[1][first + i], cols[2][first + i], cols[3][first + i]);
+      }
+      Group4Run(bank, chan, x, count);
+      const int m = bank->decimation;
+      // the same rows as DecimateColumn keeps, all of them if there's no decimation
+      for (int i = (m - first % m) % m; i < count; i += m)
+      {
+        Store4(out, x[i]);
+        const int row = (first + i) / m;
+        cols[0][row] = out[0];
+        cols[1][row] = out[1];
+        cols[2][row] = out[2];
+        cols[3][row] = out[3];
+      }
+    }
+  }
+#endif
+  for (; chan < bank->numChans; chan++)
+  {
+    if (bank->chanActive[chan])
+    {
+      ChannelRun(bank, chan, columns[chan], firstRow, numRows);
+    }
+  }
+}
+
+/**
+ * @brief Measures cycles per sample, per channel, of FilterRun and FilterRunScalar
+ *        on EEG-like samples, leaving the bank reset
+ */
+void BenchFilter(FilterBank *bank, float *cyclesPerSample, float *scalarCyclesPerSample)
+{
+  const int numChans = bank->numChans;
+  int32_t *samples = new (std::nothrow) int32_t[(size_t)numChans * FILTER_BENCH_ROWS];
+  int32_t **columns = new (std::nothrow) int32_t *[numChans];
+  *cyclesPerSample = 0;
+  *scalarCyclesPerSample = 0;
+  if (!samples || !columns)
+  {
+    delete[] samples;
+    delete[] columns;
+    return;
+  }
+  int activeChans = 0;
+  for (int chan = 0; chan < numChans; chan++)
+  {
+    columns[chan] = samples + (size_t)chan * FILTER_BENCH_ROWS;
+    activeChans += bank->chanActive[chan];
+  }
+  const float total = (float)FILTER_BENCH_ROWS * FILTER_BENCH_ROUNDS * (activeChans > 0 ? activeChans : 1);
+  for (int kernel = 0; kernel < 2; kernel++)
+  {
+    uint32_t cycles = 0;
+    FilterReset(bank);
+    for (int round = 0; round < FILTER_BENCH_ROUNDS; round++)
+    {
+      for (int chan = 0; chan < numChans; chan++)
+      {
+        for (int i = 0; i < FILTER_BENCH_ROWS; i++)
+        {
+          columns[chan][i] = (int32_t)(3000 * sin(i * 0.05 + chan) + 800 * sin(i * 0.377)) + (i * 7919 % 401) - 200;
+        }
+      }
+      uint32_t start = PlatformCycles();
+      for (int row = 0; row < FILTER_BENCH_ROWS; row += FILTER_BLOCK_ROWS)
+      {
+        if (kernel == 0)
+        {
+          FilterRun(bank, columns, row, FILTER_BLOCK_ROWS);
+        }
+        else
+        {
+          FilterRunScalar(bank, columns, row, FILTER_BLOCK_ROWS);
+        }
+      }
+      cycles += PlatformCycles() - start;
+    }
+    *(kernel == 0 ? cyclesPerSample : scalarCyclesPerSample) = cycles / total;
+  }
+  FilterReset(bank);
+  delete[] samples;
+  delete[] columns;
+}
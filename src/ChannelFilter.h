@@ -0,0 +1,78 @@
+/**
+ * @file ChannelFilter.h
+ * @brief Per-channel biquad filters and integer decimation, run on whole record columns
+ *
+ * Each kept channel runs a cascade of up to FILTER_MAX_SECTIONS second
+ * order sections (notch, high-pass, low-pass), designed once at setup from
+ * frequencies in Hz (the RBJ cookbook formulas) and stored as Q29
+ * coefficients. A section is Direct Form I:
+ *
+ *     y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2]
+ *
+ * summed in 64 bits, with first-order error feedback: the fraction the
+ * shift back down to a sample drops is added into the next sum, so slow
+ * high-pass poles don't leave a DC offset or settle into a limit cycle.
+ * Every channel runs the same number of sections; the ones it doesn't
+ * need pass samples through exactly. The x and y history is kept from one
+ * call to the next, so records join up without seams.
+ *
+ * Decimating by M keeps every Mth filtered sample, the first of a record
+ * included, after a 4th order Butterworth low-pass at FILTER_ANTI_ALIAS of
+ * the new Nyquist frequency that every channel gets. The kept samples are
+ * moved down the column in place: row r of the input is row r / M of the
+ * output.
+ *
+ * Samples are expected to stay within 24 bits, as calibrated EDF and BDF
+ * values do; the sums then can't overflow.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "SampleArena.h"
+
+#define FILTER_MAX_SECTIONS 6 //biquads per channel: a notch, a band-pass (2) and the anti-alias low-pass (2), one to spare
+#define FILTER_COEFF_SHIFT 29 //coefficients are Q29, so |a1| up to 4 fits
+#define FILTER_NOTCH_Q 20 //notch width is its frequency / this: 3 Hz at 60 Hz
+#define FILTER_ANTI_ALIAS 0.8f //anti-alias low-pass cutoff, as a fraction of the decimated Nyquist frequency
+#define FILTER_BLOCK_ROWS 64 //rows filtered together, the most FilterRun keeps on the stack
+#define FILTER_MAX_CONFIGS 4 //entries of the filter table in main.cpp
+#define FILTER_SECTION_BUDGET_CYCLES 32 //cycles per sample each section may take on the Feather: 8 channels at 1 kHz through 6 sections is 2.4% of 64 MHz
+
+enum FilterKind
+{
+  FILTER_NOTCH,
+  FILTER_HIGH_PASS,
+  FILTER_LOW_PASS
+};
+
+/* filters for a range of channels, see the table in main.cpp */
+struct ChannelFilterConfig
+{
+  int firstChan;
+  int lastChan;
+  float notchHz;    // mains frequency to take out, 0 for none
+  float highPassHz; // band-pass lower edge, 0 for none
+  float lowPassHz;  // band-pass upper edge, 0 for none
+};
+
+struct FilterBank
+{
+  int numChans;
+  int numSections;   // run by every channel, the most any of them was given
+  int decimation;    // keep every this many rows, 1 to keep them all
+  bool *chanActive;  // false for channels left as they are, e.g. ones never read
+  int *chanSections; // sections each channel was given
+  // laid out [section][k][chan], so the same coefficient of neighbouring channels is contiguous
+  int32_t *coeffs;   // b0, b1, b2, -a1, -a2, Q29
+  int32_t *state;    // x[n-1], x[n-2], y[n-1], y[n-2]
+  int32_t *residue;  // fraction of the last sum below the output, 0 to 2^29 - 1
+};
+
+size_t FilterArenaBytes(int numChans);
+bool FilterCreate(FilterBank *bank, SampleArena *arena, int numChans, int decimation);
+bool FilterAddSection(FilterBank *bank, int chan, FilterKind kind, float hz, float q, float sampleRate);
+bool FilterAddAntiAlias(FilterBank *bank, int chan, float sampleRate);
+void FilterReset(FilterBank *bank);
+void FilterRun(FilterBank *bank, int32_t *const *columns, int firstRow, int numRows);
+void FilterRunScalar(FilterBank *bank, int32_t *const *columns, int firstRow, int numRows);
+void BenchFilter(FilterBank *bank, float *cyclesPerSample, float *scalarCyclesPerSample);
@@ -0,0 +1,68 @@
+#include <new>
+#include "EdfHeader.h"
+
+static int ReadFromSource(void *ctx, void *buf, int len)
+{
+  return ((SourceFile *)ctx)->read(buf, len);
+}
+
+/**
+ * @brief Reads and validates the whole header, leaves the file at the first data record
+ *
+ * The only allocation is the signals array, sized from the main header.
+ *
+ * @return 0, or a negative EDFLIB_FILE_* error
+ */
+int EdfReadHeader(SourceFile *file, EdfFileHeader *header)
+{
+  edfHeaderMain raw;
+  header->signals = nullptr;
+  file->rewind();
+  if (file->read(&raw, sizeof(raw)) != (int)sizeof(raw))
+  {
+    return EDFLIB_FILE_READ_ERROR;
+  }
+  int result = edf_parse_main_header(&raw, &header->hdr, &header->layout);
+  if (result != 0)
+  {
+    return result;
+  }
+  header->signals = new (std::nothrow) edf_signal_struct[header->layout.total_signals];
+  if (!header->signals)
+  {
+    return EDFLIB_FILE_TOO_MANY_SIGNALS;
+  }
+  result = edf_parse_signal_headers(ReadFromSource, file, &header->hdr, &header->layout, header->signals);
+  if (result != 0)
+  {
+    EdfFreeHeader(header);
+  }
+  return result;
+}
+
+void EdfFreeHeader(EdfFileHeader *header)
+{
+  delete[] header->signals;
+  header->signals = nullptr;
+}
+
+const char *EdfErrorString(int error)
+{
+  switch (error)
+  {
+  case 0:
+    return "ok";
+  case EDFLIB_FILE_READ_ERROR:
+    return "file too short";
+  case EDFLIB_FILE_CONTAINS_FORMAT_ERRORS:
+    return "header contains format errors";
+  case EDFLIB_FILE_TOO_MANY_SIGNALS:
+    return "too many signals";
+  case EDFLIB_FILE_HEADER_SIZE_MISMATCH:
+    return "header size doesn't match the number of signals";
+  case EDFLIB_FILE_NO_ANNOTATIONS_SIGNAL:
+    return "EDF+/BDF+ file without an annotations signal";
+  default:
+    return "unknown error";
+  }
+}
@@ -0,0 +1,23 @@
+/**
+ * @file EdfHeader.h
+ * @brief Loads and validates the header of an EDF/EDF+/BDF/BDF+ file
+ *
+ * Thin layer over the microedf parser: reads the 256-byte main header, then
+ * streams the channel header block from the file straight into the parser,
+ * so the raw block is never held in memory.
+ */
+#pragma once
+
+#include "platform.h"
+#include "microedf.h"
+
+struct EdfFileHeader
+{
+  edf_hdr_struct hdr;
+  edf_layout_struct layout;
+  edf_signal_struct *signals; // layout.total_signals entries, annotation signals included
+};
+
+int EdfReadHeader(SourceFile *file, EdfFileHeader *header);
+void EdfFreeHeader(EdfFileHeader *header);
+const char *EdfErrorString(int error);
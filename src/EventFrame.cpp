@@ -0,0 +1,108 @@
+#include <string.h>
+#include "EventFrame.h"
+#include "RiceCodec.h"
+#include "SimplePacketMaker.h"
+
+void EventQueueClear(EventQueue *queue)
+{
+  queue->count = 0;
+}
+
+/**
+ * @brief Adds an annotation, in sample order
+ *
+ * Sample numbers are compared as differences, so they can wrap. If the
+ * queue is full, whichever event is latest, this one or the last queued,
+ * is dropped.
+ *
+ * @param sample sample number of the onset; one already sent makes the
+ *        event due straight away
+ */
+void EventQueuePush(EventQueue *queue, uint32_t sample, int32_t durationMillis, const char *text)
+{
+  int at = queue->count;
+  while (at > 0 && (int32_t)(queue->events[at - 1].sample - sample) > 0)
+  {
+    at--;
+  }
+  if (queue->count == EVENT_QUEUE_LENGTH)
+  {
+    queue->dropped++;
+    if (at == EVENT_QUEUE_LENGTH)
+    {
+      return;
+    }
+    queue->count--;
+  }
+  memmove(&queue->events[at + 1], &queue->events[at], (queue->count - at) * sizeof(PendingEvent));
+  PendingEvent *event = &queue->events[at];
+  event->sample = sample;
+  event->durationMillis = durationMillis;
+  strncpy(event->text, text, TAL_TEXT_BYTES - 1);
+  event->text[TAL_TEXT_BYTES - 1] = '\0';
+  queue->count++;
+  queue->queued++;
+}
+
+/**
+ * @brief Takes the soonest event off the queue as an event frame
+ *
+ * @param frame room for EVENT_FRAME_MAX_BYTES
+ * @return bytes of the frame, 0 if the queue is empty
+ */
+size_t EventQueueTakeFrame(EventQueue *queue, uint8_t *frame)
+{
+  if (queue->count == 0)
+  {
+    return 0;
+  }
+  const PendingEvent *event = &queue->events[0];
+  size_t textBytes = strlen(event->text);
+  PutInt16(frame, 0xFFFF);
+  PutInt16(frame + 2, EVENT_FRAME_MARKER);
+  PutInt16(frame + 4, event->sample % 32768);
+  uint32_t duration = (uint32_t)event->durationMillis;
+  for (int i = 0; i < 4; i++)
+  {
+    frame[6 + i] = (duration >> (8 * i)) & 0xFF;
+  }
+  frame[10] = (uint8_t)textBytes;
+  memcpy(frame + EVENT_FRAME_HEADER_BYTES, event->text, textBytes);
+  size_t length = EVENT_FRAME_HEADER_BYTES + textBytes;
+  frame[length] = Crc8(frame + 2, length - 2);
+  queue->count--;
+  memmove(&queue->events[0], &queue->events[1], queue->count * sizeof(PendingEvent));
+  queue->sent++;
+  return length + 1;
+}
+
+/**
+ * @brief Recognises an event frame at the start of a stream
+ *
+ * @return its length in bytes; 0 if the bytes aren't an event frame, -1
+ *         if they could be one that's cut off
+ */
+long EventFrameLength(const uint8_t *buf, size_t length)
+{
+  const uint8_t start[4] = {0xFF, 0xFF, EVENT_FRAME_MARKER & 0xFF, EVENT_FRAME_MARKER >> 8};
+  size_t compare = length < sizeof(start) ? length : sizeof(start);
+  if (memcmp(buf, start, compare) != 0)
+  {
+    return 0;
+  }
+  if (length < EVENT_FRAME_HEADER_BYTES)
+  {
+    return -1;
+  }
+  size_t textBytes = buf[10];
+  if (textBytes > TAL_TEXT_BYTES - 1)
+  {
+    return 0;
+  }
+  size_t total = EVENT_FRAME_HEADER_BYTES + textBytes + 1;
+  if (length < total)
+  {
+    return -1;
+  }
+  return Crc8(buf + 2, total - 3) == buf[total - 1] ? (long)total : 0;
+}
@@ -0,0 +1,61 @@
+/**
+ * @file EventFrame.h
+ * @brief In-band event frames: the file's annotations, sent among the packets at the samples they belong to
+ *
+ * Annotations read from the EDF+/BDF+ annotation signals (see TalParser.h)
+ * wait in an EventQueue, in sample order, until the packet carrying their
+ * onset sample has been sent; then each goes out as an event frame between
+ * two packets (or frames, or compressed blocks). Layout, little endian:
+ *
+ *     0xFFFF              sync
+ *     0x8001              marker; a packet counter never has bit 15 set
+ *     counter (16 bits)   sample number of the onset, modulo 32768, as the packet counters
+ *     duration (32 bits)  milliseconds, 0xFFFFFFFF if the annotation has none
+ *     length (8 bits)     bytes of text, up to TAL_TEXT_BYTES - 1
+ *     text                UTF-8, not null terminated
+ *     CRC-8 (poly 0x07) of everything from the marker to the end of the text
+ *
+ * A receiver that only knows packets sees a counter with bit 15 set and
+ * can skip to the next sync.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "TalParser.h"
+
+#define EVENT_QUEUE_LENGTH 16 //annotations waiting for their sample to be sent; the latest is dropped when it's full
+#define EVENT_FRAME_MARKER 0x8001
+#define EVENT_FRAME_HEADER_BYTES 11 //sync, marker, counter, duration and length
+#define EVENT_FRAME_MAX_BYTES (EVENT_FRAME_HEADER_BYTES + TAL_TEXT_BYTES - 1 + 1)
+#define EVENT_NO_DURATION -1
+
+struct PendingEvent
+{
+  uint32_t sample;        // sample number of the onset, counting every packet sent or skipped
+  int32_t durationMillis; // EVENT_NO_DURATION if none
+  char text[TAL_TEXT_BYTES];
+};
+
+struct EventQueue
+{
+  PendingEvent events[EVENT_QUEUE_LENGTH]; // soonest first
+  int count;
+  // totals
+  unsigned long queued;
+  unsigned long sent;
+  unsigned long dropped;
+};
+
+void EventQueueClear(EventQueue *queue);
+void EventQueuePush(EventQueue *queue, uint32_t sample, int32_t durationMillis, const char *text);
+size_t EventQueueTakeFrame(EventQueue *queue, uint8_t *frame);
+long EventFrameLength(const uint8_t *buf, size_t length);
+
+/**
+ * @brief True if the soonest event's sample has been sent, i.e. comes before nextSample
+ */
+inline bool EventQueueDue(const EventQueue *queue, uint32_t nextSample)
+{
+  return queue->count > 0 && (int32_t)(queue->events[0].sample - nextSample) < 0;
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <string.h>
+#include "platform.h"
+#include "FramePacker.h"
+
+/**
+ * @brief Writes one sample period of every channel of the frame
+ *
+ * @return where the next row goes
+ */
+template <int Channels, int Bits>
+static uint8_t *WriteFrameRow(uint8_t *dest, int32_t *const *columns, int numColumns, int row)
+{
+  int source = 0;
+  for (int chan = 0; chan < Channels; chan++)
+  {
+    int32_t value = columns[source][row];
+    if (Bits == 24)
+    {
+      PutInt24(dest, value);
+    }
+    else
+    {
+      PutInt16(dest, value);
+    }
+    dest += Bits / 8;
+    // frame channels past the source's wrap around to its first channel
+    source = source + 1 == numColumns ? 0 : source + 1;
+  }
+  return dest;
+}
+
+struct FrameWriterEntry
+{
+  int channels;
+  int bits;
+  FrameRowWriter writeRow;
+};
+
+static const FrameWriterEntry frameWriters[] = {
+  {8, 16, WriteFrameRow<8, 16>},   {8, 24, WriteFrameRow<8, 24>},   {16, 16, WriteFrameRow<16, 16>},
+  {16, 24, WriteFrameRow<16, 24>}, {32, 16, WriteFrameRow<32, 16>}, {32, 24, WriteFrameRow<32, 24>},
+  {64, 16, WriteFrameRow<64, 16>}, {64, 24, WriteFrameRow<64, 24>},
+};
+
+/**
+ * @brief Picks the row writer for a frame layout
+ *
+ * @return false if there's no writer for that channel count and bit depth,
+ *         or the frame would hold more than FRAME_MAX_SAMPLES rows
+ */
+bool FramePackerCreate(FramePacker *packer, int channels, int bits, int samplesPerFrame)
+{
+  if (samplesPerFrame < 1 || samplesPerFrame > FRAME_MAX_SAMPLES)
+  {
+    return false;
+  }
+  for (const FrameWriterEntry &entry : frameWriters)
+  {
+    if (entry.channels == channels && entry.bits == bits)
+    {
+      packer->channels = channels;
+      packer->bits = bits;
+      packer->samplesPerFrame = samplesPerFrame;
+      packer->rowBytes = channels * bits / 8;
+      packer->frameBytes = FRAME_HEADER_BYTES + samplesPerFrame * packer->rowBytes;
+      packer->writeRow = entry.writeRow;
+      packer->rowsInFrame = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Appends one sample period to the frame being built, starting a new frame if there isn't one
+ *
+ * A frame can be split over several transport writes when the run fills
+ * up, the byte stream is the same.
+ *
+ * @param sampleNumber the sample's number in the stream, i.e. the packet counter
+ * @return true if this row completed the frame
+ */
+bool AppendFrameRow(PacketRun *run, FramePacker *packer, uint32_t sampleNumber, int32_t *const *columns,
+                    int numColumns, int row)
+{
+  bool startsFrame = packer->rowsInFrame == 0;
+  size_t needed = packer->rowBytes + (startsFrame ? FRAME_HEADER_BYTES : 0);
+  if (run->length + needed > sizeof(run->bytes))
+  {
+    FlushPacketRun(run);
+  }
+  uint8_t *dest = run->bytes + run->length;
+  if (startsFrame)
+  {
+    PutInt16(dest, 0xFFFF);
+    PutInt16(dest + 2, sampleNumber % 32768);
+    dest += FRAME_HEADER_BYTES;
+  }
+  dest = packer->writeRow(dest, columns, numColumns, row);
+  run->length = dest - run->bytes;
+  if (++packer->rowsInFrame < packer->samplesPerFrame)
+  {
+    return false;
+  }
+  packer->rowsInFrame = 0;
+  return true;
+}
+
+/**
+ * @brief AppendFrameRow for a row that's already in wire format, from a playback image
+ *
+ * @param row packer->rowBytes bytes of samples
+ * @return true if this row completed the frame
+ */
+bool AppendFrameBytes(PacketRun *run, FramePacker *packer, uint32_t sampleNumber, const uint8_t *row)
+{
+  bool startsFrame = packer->rowsInFrame == 0;
+  size_t needed = packer->rowBytes + (startsFrame ? FRAME_HEADER_BYTES : 0);
+  if (run->length + needed > sizeof(run->bytes))
+  {
+    FlushPacketRun(run);
+  }
+  uint8_t *dest = run->bytes + run->length;
+  if (startsFrame)
+  {
+    PutInt16(dest, 0xFFFF);
+    PutInt16(dest + 2, sampleNumber % 32768);
+    dest += FRAME_HEADER_BYTES;
+  }
+  memcpy(dest, row, packer->rowBytes);
+  run->length = dest + packer->rowBytes - run->bytes;
+  if (++packer->rowsInFrame < packer->samplesPerFrame)
+  {
+    return false;
+  }
+  packer->rowsInFrame = 0;
+  return true;
+}
+
+/**
+ * @brief Highest sample rate a link sustains with this frame size, 8N1 framing
+ */
+uint32_t LinkMaxSampleRate(uint32_t baud, int bytesPerFrame, int samplesPerFrame)
+{
+  // 10 bits on the wire per byte: start, 8 data, stop
+  return (uint32_t)((uint64_t)baud / 10 * samplesPerFrame / bytesPerFrame);
+}
+
+/**
+ * @brief Prints the highest sample rate each packet layout sustains at this baud rate
+ *
+ * One line per channel count and bit depth, simple packets first, then
+ * frames of 1, 2, 4, 8 and 16 sample periods.
+ */
+void LinkBudgetReport(uint32_t baud)
+{
+  char line[120];
+  snprintf(line, sizeof(line), "link budget at %lu baud, 8N1: max samples/s per channel", (unsigned long)baud);
+  DebugPrintln(line);
+  snprintf(line, sizeof(line), "  simple packet, 8 ch: 16-bit %lu, 24-bit %lu",
+           (unsigned long)LinkMaxSampleRate(baud, SIMPLE_PACKET_BYTES, 1),
+           (unsigned long)LinkMaxSampleRate(baud, SIMPLE_PACKET24_BYTES, 1));
+  DebugPrintln(line);
+  DebugPrintln("  frame              x1      x2      x4      x8     x16  (sample periods per frame)");
+  for (const FrameWriterEntry &entry : frameWriters)
+  {
+    int length = snprintf(line, sizeof(line), "  %2d ch %d-bit   ", entry.channels, entry.bits);
+    for (int samples = 1; samples <= FRAME_MAX_SAMPLES; samples *= 2)
+    {
+      int frameBytes = FRAME_HEADER_BYTES + samples * entry.channels * entry.bits / 8;
+      length += snprintf(line + length, sizeof(line) - length, " %7lu",
+                         (unsigned long)LinkMaxSampleRate(baud, frameBytes, samples));
+    }
+    DebugPrintln(line);
+  }
+}
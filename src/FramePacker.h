@@ -0,0 +1,50 @@
+/**
+ * @file FramePacker.h
+ * @brief Multi-channel, multi-sample frames for headsets with more than 8 channels
+ *
+ * A frame is the simple packet generalised:
+ *
+ *     sync 0xFFFF, counter, then samplesPerFrame rows of channels samples
+ *
+ * all little endian. The counter (16 bits, modulo 32768 as in the simple
+ * packet) is the sample number of the frame's first row, so it normally
+ * goes up by samplesPerFrame from one frame to the next; skipped samples
+ * show up as a bigger step, as with simple packets. Samples are 16 or 24 bits.
+ * Packing several sample periods in a frame spreads the 4 header bytes
+ * over all of them.
+ *
+ * The row writer is a template on channel count and bit depth, one
+ * instantiation per supported combination (8, 16, 32 or 64 channels,
+ * 16 or 24 bits), picked once at setup by FramePackerCreate(). If the
+ * source has fewer channels than the frame, its channels are repeated to
+ * fill it. Rows from a playback image are already in this format and are
+ * copied as they are (AppendFrameBytes).
+ */
+#pragma once
+
+#include <stdint.h>
+#include "SimplePacketMaker.h"
+
+#define FRAME_HEADER_BYTES 4
+#define FRAME_MAX_CHANNELS 64
+#define FRAME_MAX_SAMPLES 16 //most sample periods in one frame
+
+typedef uint8_t *(*FrameRowWriter)(uint8_t *dest, int32_t *const *columns, int numColumns, int row);
+
+struct FramePacker
+{
+  int channels;
+  int bits;
+  int samplesPerFrame;
+  int rowBytes;          // one sample period of every channel
+  int frameBytes;        // header and samplesPerFrame rows
+  FrameRowWriter writeRow;
+  int rowsInFrame;       // rows of the frame being built, 0 between frames
+};
+
+bool FramePackerCreate(FramePacker *packer, int channels, int bits, int samplesPerFrame);
+bool AppendFrameRow(PacketRun *run, FramePacker *packer, uint32_t sampleNumber, int32_t *const *columns,
+                    int numColumns, int row);
+bool AppendFrameBytes(PacketRun *run, FramePacker *packer, uint32_t sampleNumber, const uint8_t *row);
+uint32_t LinkMaxSampleRate(uint32_t baud, int bytesPerFrame, int samplesPerFrame);
+void LinkBudgetReport(uint32_t baud);
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <string.h>
+#include "platform.h"
+#include "LinkAggregator.h"
+
+/**
+ * @param flushMicros longest a partly filled transfer is held back waiting for more bytes
+ */
+void AggregatorCreate(LinkAggregator *agg, uint32_t flushMicros, LinkSinkWrite sinkWrite, LinkSinkFlush sinkFlush)
+{
+  memset(agg, 0, sizeof(*agg));
+  agg->flushMicros = flushMicros;
+  agg->sinkWrite = sinkWrite;
+  agg->sinkFlush = sinkFlush;
+}
+
+/**
+ * @brief Offers the sink the whole transfers held, or everything if all is set
+ *
+ * @return true if the sink took everything it was offered
+ */
+static bool Drain(LinkAggregator *agg, bool all)
+{
+  size_t pending = AggregatorPending(agg);
+  size_t offer = all ? pending : pending / LINK_TRANSFER_BYTES * LINK_TRANSFER_BYTES;
+  if (offer == 0)
+  {
+    return true;
+  }
+  size_t taken = agg->sinkWrite(agg->buf + agg->start, offer);
+  if (taken > 0)
+  {
+    agg->transfers++;
+    agg->bytesSent += taken;
+    agg->start += taken;
+  }
+  if (agg->start == agg->end)
+  {
+    agg->start = agg->end = 0;
+  }
+  if (taken == offer)
+  {
+    // at most a partly filled transfer left, the host has caught up
+    agg->backPressured = false;
+    return true;
+  }
+  if (!agg->backPressured)
+  {
+    agg->backPressured = true;
+    agg->stalls++;
+  }
+  return false;
+}
+
+/**
+ * @brief Takes a write for the link, handing whole transfers to the sink as they fill
+ *
+ * @return len, or 0 if the write was dropped because the host has fallen too far behind
+ */
+size_t AggregatorWrite(LinkAggregator *agg, const uint8_t *buf, size_t len, uint32_t nowMicros)
+{
+  if (LINK_AGGREGATOR_BYTES - agg->end < len && agg->start > 0)
+  {
+    size_t pending = AggregatorPending(agg);
+    memmove(agg->buf, agg->buf + agg->start, pending);
+    agg->start = 0;
+    agg->end = pending;
+  }
+  if (LINK_AGGREGATOR_BYTES - agg->end < len)
+  {
+    agg->droppedWrites++;
+    agg->droppedBytes += len;
+    if (!agg->backPressured)
+    {
+      agg->backPressured = true;
+      agg->stalls++;
+    }
+    return 0;
+  }
+  if (AggregatorPending(agg) == 0)
+  {
+    agg->oldestMicros = nowMicros;
+  }
+  memcpy(agg->buf + agg->end, buf, len);
+  agg->end += len;
+  agg->bytesWritten += len;
+  size_t before = AggregatorPending(agg);
+  Drain(agg, false);
+  if (AggregatorPending(agg) != before && AggregatorPending(agg) < LINK_TRANSFER_BYTES)
+  {
+    // what's left is the tail of this write
+    agg->oldestMicros = nowMicros;
+  }
+  return len;
+}
+
+/**
+ * @brief Sends a partly filled transfer once it's waited long enough
+ *
+ * @param idleMicros how long the caller is about to go without writing or
+ *        polling; the transfer goes now if its deadline falls in that time
+ */
+void AggregatorPoll(LinkAggregator *agg, uint32_t nowMicros, uint32_t idleMicros)
+{
+  if (!Drain(agg, false) || AggregatorPending(agg) == 0)
+  {
+    return;
+  }
+  if (nowMicros + idleMicros - agg->oldestMicros >= agg->flushMicros)
+  {
+    Drain(agg, true);
+    agg->sinkFlush();
+    agg->shortFlushes++;
+  }
+}
+
+/**
+ * @brief Prints the aggregator's totals on the debug console
+ */
+void AggregatorReport(const LinkAggregator *agg)
+{
+  char line[160];
+  snprintf(line, sizeof(line), "link: %llu bytes written, %llu sent in %lu sink writes (%.0f bytes each), %lu short flushes",
+           (unsigned long long)agg->bytesWritten, (unsigned long long)agg->bytesSent, agg->transfers,
+           agg->transfers ? (double)agg->bytesSent / agg->transfers : 0.0, agg->shortFlushes);
+  DebugPrintln(line);
+  snprintf(line, sizeof(line), "link: host fell behind %lu times, %lu writes (%llu bytes) dropped, %lu bytes held",
+           agg->stalls, agg->droppedWrites, (unsigned long long)agg->droppedBytes, (unsigned long)AggregatorPending(agg));
+  DebugPrintln(line);
+}
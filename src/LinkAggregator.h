@@ -0,0 +1,56 @@
+/**
+ * @file LinkAggregator.h
+ * @brief Collects packets into whole USB bulk transfers for a non-blocking sink
+ *
+ * Over USB CDC, every short transfer costs a whole (micro)frame slot, so
+ * writing one 20-byte packet at a time caps the link far below what the bus
+ * carries. The aggregator holds written bytes and hands them to the sink
+ * LINK_TRANSFER_BYTES at a time; a partly filled transfer goes out once its
+ * first byte has waited flushMicros, so latency stays bounded at low rates.
+ *
+ * The sink takes what it has room for without blocking. When it takes less
+ * than it's offered the host isn't keeping up: the aggregator is
+ * back-pressured until it has drained its whole transfers, and writes that
+ * don't fit in what's left of its buffer are dropped whole, never split, so
+ * a packet is either sent entirely or not at all and the sender never stalls.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LINK_TRANSFER_BYTES 64 //USB full speed bulk packet
+#define LINK_AGGREGATOR_BYTES 4096 //bytes held while the host isn't reading, a multiple of LINK_TRANSFER_BYTES
+
+typedef size_t (*LinkSinkWrite)(const uint8_t *buf, size_t len); // takes what it can without blocking
+typedef void (*LinkSinkFlush)(); // sends whatever the sink holds, even a short transfer
+
+struct LinkAggregator
+{
+  uint8_t buf[LINK_AGGREGATOR_BYTES];
+  size_t start;            // first byte not yet taken by the sink
+  size_t end;              // one past the last byte written
+  uint32_t flushMicros;    // longest a partly filled transfer waits
+  uint32_t oldestMicros;   // when the oldest byte still held was written
+  LinkSinkWrite sinkWrite;
+  LinkSinkFlush sinkFlush;
+  bool backPressured;      // the sink turned bytes down, cleared once it takes every whole transfer held
+  // totals
+  uint64_t bytesWritten;
+  uint64_t bytesSent;
+  unsigned long transfers;     // offers of one or more whole transfers
+  unsigned long shortFlushes;  // partly filled transfers sent on the deadline
+  unsigned long stalls;        // times back-pressure started
+  unsigned long droppedWrites;
+  uint64_t droppedBytes;
+};
+
+void AggregatorCreate(LinkAggregator *agg, uint32_t flushMicros, LinkSinkWrite sinkWrite, LinkSinkFlush sinkFlush);
+size_t AggregatorWrite(LinkAggregator *agg, const uint8_t *buf, size_t len, uint32_t nowMicros);
+void AggregatorPoll(LinkAggregator *agg, uint32_t nowMicros, uint32_t idleMicros);
+void AggregatorReport(const LinkAggregator *agg);
+
+inline size_t AggregatorPending(const LinkAggregator *agg)
+{
+  return agg->end - agg->start;
+}
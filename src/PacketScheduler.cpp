@@ -0,0 +1,109 @@
+#include "PacketScheduler.h"
+#include "platform.h"
+
+/**
+ * @brief Starts the timeline: the first packet is due now
+ *
+ * @param periodNum numerator of the packet period in microseconds
+ * @param periodDen denominator of the packet period
+ * @param policy SCHED_CATCH_UP_BURST, SCHED_CATCH_UP_SKIP or SCHED_CATCH_UP_RESYNC
+ * @param maxBurstMicros how late a packet can be and still be sent, with SCHED_CATCH_UP_BURST
+ */
+void SchedulerStart(PacketScheduler *sched, uint64_t periodNum, uint32_t periodDen, int policy, uint32_t maxBurstMicros)
+{
+  sched->periodWhole = (uint32_t)(periodNum / periodDen);
+  sched->periodRem = (uint32_t)(periodNum % periodDen);
+  sched->periodDen = periodDen;
+  sched->remAcc = 0;
+  sched->policy = policy;
+  sched->maxBurstMicros = maxBurstMicros;
+  sched->latePackets = 0;
+  sched->skippedPackets = 0;
+  sched->resyncs = 0;
+  sched->lastLateMicros = 0;
+  sched->lastRawMicros = PlatformMicros();
+  sched->nowMicros = 0;
+  sched->deadlineMicros = 0;
+}
+
+/**
+ * @brief Current time, 64 bits so it never wraps
+ */
+uint64_t SchedulerNow(PacketScheduler *sched)
+{
+  uint32_t raw = PlatformMicros();
+  // unsigned subtraction gives the right delta across a wrap of the 32-bit counter
+  sched->nowMicros += (uint32_t)(raw - sched->lastRawMicros);
+  sched->lastRawMicros = raw;
+  return sched->nowMicros;
+}
+
+static void AdvanceDeadline(PacketScheduler *sched)
+{
+  sched->deadlineMicros += sched->periodWhole;
+  sched->remAcc += sched->periodRem;
+  if (sched->remAcc >= sched->periodDen)
+  {
+    sched->remAcc -= sched->periodDen;
+    sched->deadlineMicros++;
+  }
+}
+
+/**
+ * @brief Whether the next packet is due, applying the catch-up policy if it's late
+ *
+ * Moves on to the following deadline whenever it returns SCHEDULER_SEND or
+ * SCHEDULER_SKIP, so the caller must act on what it gets.
+ */
+SchedulerAction SchedulerNextAction(PacketScheduler *sched)
+{
+  uint64_t now = SchedulerNow(sched);
+  if (now < sched->deadlineMicros)
+  {
+    return SCHEDULER_IDLE;
+  }
+  uint64_t lateMicros = now - sched->deadlineMicros;
+  sched->lastLateMicros = lateMicros > 0xFFFFFFFFULL ? 0xFFFFFFFFUL : (uint32_t)lateMicros;
+  bool late = lateMicros > sched->periodWhole;
+  SchedulerAction action = SCHEDULER_SEND;
+  if (late)
+  {
+    switch (sched->policy)
+    {
+    case SCHED_CATCH_UP_SKIP:
+      action = SCHEDULER_SKIP;
+      break;
+    case SCHED_CATCH_UP_RESYNC:
+      sched->deadlineMicros = now;
+      sched->remAcc = 0;
+      sched->resyncs++;
+      break;
+    default:
+      action = lateMicros > sched->maxBurstMicros ? SCHEDULER_SKIP : SCHEDULER_SEND;
+      break;
+    }
+  }
+  if (action == SCHEDULER_SKIP)
+  {
+    sched->skippedPackets++;
+  }
+  else if (late)
+  {
+    sched->latePackets++;
+  }
+  AdvanceDeadline(sched);
+  return action;
+}
+
+/**
+ * @brief Microseconds until the next packet is due, as of the last SchedulerNow()
+ */
+uint32_t SchedulerMicrosUntilDue(PacketScheduler *sched)
+{
+  if (sched->nowMicros >= sched->deadlineMicros)
+  {
+    return 0;
+  }
+  uint64_t wait = sched->deadlineMicros - sched->nowMicros;
+  return wait > 0xFFFFFFFFULL ? 0xFFFFFFFFUL : (uint32_t)wait;
+}
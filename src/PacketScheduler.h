@@ -0,0 +1,52 @@
+/**
+ * @file PacketScheduler.h
+ * @brief Drift-free packet deadlines on a 64-bit microsecond time base
+ *
+ * The packet period is kept as an exact fraction of microseconds,
+ * periodNum / periodDen (e.g. record duration / samples per record), and
+ * deadlines are advanced with an integer remainder, so packet k is due at
+ * exactly start + floor(k * periodNum / periodDen) however long it runs.
+ *
+ * PlatformMicros() is only 32 bits and wraps every ~71 minutes; the
+ * scheduler extends it to 64 bits, so it has to be asked for the time
+ * (SchedulerNow) at least once per wrap.
+ *
+ * When a deadline has been missed by a period or more, the catch-up policy
+ * decides what happens to the late packets.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define SCHED_CATCH_UP_BURST 0  //send late packets back to back; beyond maxBurstMicros late, skip them
+#define SCHED_CATCH_UP_SKIP 1   //skip late packets, their samples and counter values are dropped
+#define SCHED_CATCH_UP_RESYNC 2 //send the next packet now and restart the timeline from it
+
+enum SchedulerAction
+{
+  SCHEDULER_IDLE, // nothing due yet
+  SCHEDULER_SEND, // send the next packet
+  SCHEDULER_SKIP  // drop the next packet, it's too late to be worth sending
+};
+
+struct PacketScheduler
+{
+  uint64_t nowMicros;       // PlatformMicros() extended to 64 bits
+  uint32_t lastRawMicros;
+  uint64_t deadlineMicros;  // when the next packet is due
+  uint32_t periodWhole;     // periodNum / periodDen
+  uint32_t periodRem;       // periodNum % periodDen
+  uint32_t periodDen;
+  uint32_t remAcc;          // accumulated remainder, always < periodDen
+  int policy;
+  uint32_t maxBurstMicros;  // SCHED_CATCH_UP_BURST: most lateness made up by bursting
+  uint32_t lastLateMicros;  // how far past its deadline the last sent or skipped packet was
+  unsigned long latePackets;    // sent a period or more after their deadline
+  unsigned long skippedPackets;
+  unsigned long resyncs;
+};
+
+void SchedulerStart(PacketScheduler *sched, uint64_t periodNum, uint32_t periodDen, int policy, uint32_t maxBurstMicros);
+uint64_t SchedulerNow(PacketScheduler *sched);
+SchedulerAction SchedulerNextAction(PacketScheduler *sched);
+uint32_t SchedulerMicrosUntilDue(PacketScheduler *sched);
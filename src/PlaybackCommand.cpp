@@ -0,0 +1,77 @@
+#include <string.h>
+#include "PlaybackCommand.h"
+
+void PlaybackCommandParserInit(PlaybackCommandParser *parser)
+{
+  parser->length = 0;
+  parser->badFrames = 0;
+}
+
+static bool IsKnownCommand(uint8_t type)
+{
+  return type >= PLAYBACK_CMD_START && type <= PLAYBACK_CMD_SPEED;
+}
+
+/**
+ * @brief Adds one received byte to the frame being assembled
+ *
+ * @param command filled in when the byte completes a valid frame
+ * @return true if it did
+ */
+bool PlaybackCommandFeed(PlaybackCommandParser *parser, uint8_t byte, PlaybackCommand *command)
+{
+  if (parser->length == 0 && byte != PLAYBACK_CMD_SYNC)
+  {
+    // between frames, anything but a sync byte is noise
+    return false;
+  }
+  parser->frame[parser->length++] = byte;
+  if (parser->length < PLAYBACK_CMD_BYTES)
+  {
+    return false;
+  }
+  parser->length = 0;
+
+  uint8_t sum = 0;
+  for (int i = 1; i < PLAYBACK_CMD_BYTES; i++)
+  {
+    sum += parser->frame[i];
+  }
+  if (sum != 0 || !IsKnownCommand(parser->frame[1]))
+  {
+    parser->badFrames++;
+    // a real frame may have started inside the bad one: carry on from its next sync byte
+    for (int start = 1; start < PLAYBACK_CMD_BYTES; start++)
+    {
+      if (parser->frame[start] == PLAYBACK_CMD_SYNC)
+      {
+        parser->length = PLAYBACK_CMD_BYTES - start;
+        memmove(parser->frame, parser->frame + start, parser->length);
+        break;
+      }
+    }
+    return false;
+  }
+  command->type = parser->frame[1];
+  command->argument = (uint32_t)parser->frame[2] | ((uint32_t)parser->frame[3] << 8) |
+                      ((uint32_t)parser->frame[4] << 16) | ((uint32_t)parser->frame[5] << 24);
+  return true;
+}
+
+/**
+ * @brief Builds a frame, for the PC side and for tests
+ *
+ * @param frame PLAYBACK_CMD_BYTES long
+ */
+void PlaybackCommandEncode(uint8_t type, uint32_t argument, uint8_t *frame)
+{
+  frame[0] = PLAYBACK_CMD_SYNC;
+  frame[1] = type;
+  uint8_t sum = type;
+  for (int i = 0; i < 4; i++)
+  {
+    frame[2 + i] = (argument >> (8 * i)) & 0xFF;
+    sum += frame[2 + i];
+  }
+  frame[6] = (uint8_t)(0 - sum);
+}
@@ -0,0 +1,50 @@
+/**
+ * @file PlaybackCommand.h
+ * @brief Binary playback control commands received on the packet link
+ *
+ * Every command is a fixed 7-byte frame:
+ *
+ *     0xA5, command, argument (uint32, little endian), checksum
+ *
+ * where the checksum makes command + argument bytes + checksum sum to 0
+ * (mod 256). A frame with a bad checksum or an unknown command is dropped
+ * and the parser looks for the next 0xA5, among the bytes of the dropped
+ * frame first, so a real frame that started inside it isn't lost.
+ *
+ * The parser takes one byte at a time and never waits for the rest of a
+ * frame, so the caller can feed it whatever has arrived and get back to
+ * sending packets.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define PLAYBACK_CMD_SYNC 0xA5
+#define PLAYBACK_CMD_BYTES 7
+
+enum PlaybackCommandType
+{
+  PLAYBACK_CMD_START = 0x01,       // start or resume sending packets
+  PLAYBACK_CMD_STOP = 0x02,        // stop sending packets, keep the position
+  PLAYBACK_CMD_SEEK_RECORD = 0x03, // argument: data record to continue from
+  PLAYBACK_CMD_SEEK_MILLIS = 0x04, // argument: file time in milliseconds to continue from
+  PLAYBACK_CMD_LOOP = 0x05,        // argument: 1 to loop at the end of the file, 0 to stop there
+  PLAYBACK_CMD_SPEED = 0x06        // argument: rate in percent of real time, 0 for as fast as the link allows
+};
+
+struct PlaybackCommand
+{
+  uint8_t type;
+  uint32_t argument;
+};
+
+struct PlaybackCommandParser
+{
+  uint8_t frame[PLAYBACK_CMD_BYTES];
+  int length;          // bytes of the current frame received so far
+  unsigned long badFrames;
+};
+
+void PlaybackCommandParserInit(PlaybackCommandParser *parser);
+bool PlaybackCommandFeed(PlaybackCommandParser *parser, uint8_t byte, PlaybackCommand *command);
+void PlaybackCommandEncode(uint8_t type, uint32_t argument, uint8_t *frame);
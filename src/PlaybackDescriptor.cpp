@@ -0,0 +1,247 @@
+#include <string.h>
+#include <new>
+#include "PlaybackDescriptor.h"
+#include "PlaybackImage.h"
+
+static const char descriptorMagic[8] = {'V', 'E', 'E', 'G', 'D', 'E', 'S', 'C'};
+static const int entriesPerChunk = DESCRIPTOR_SECTOR_BYTES / DESCRIPTOR_SIGNAL_BYTES;
+
+static void Put32(uint8_t *dest, uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    dest[i] = (value >> (8 * i)) & 0xFF;
+  }
+}
+
+static uint32_t Get32(const uint8_t *src)
+{
+  return src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+static void PutFloat(uint8_t *dest, float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  Put32(dest, bits);
+}
+
+static float GetFloat(const uint8_t *src)
+{
+  uint32_t bits = Get32(src);
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/**
+ * @brief What the descriptor is checked against: the EDF file's size, modification time and main header
+ *
+ * Leaves the file just past its main header.
+ */
+static bool SourceFingerprint(SourceFile *edf, edfHeaderMain *raw, uint32_t *size, uint32_t *stamp, uint32_t *crc)
+{
+  uint16_t date, time;
+  if (!edf->getModifyDateTime(&date, &time))
+  {
+    return false;
+  }
+  *size = edf->fileSize();
+  *stamp = (uint32_t)date << 16 | time;
+  edf->rewind();
+  if (edf->read(raw, sizeof(*raw)) != (int)sizeof(*raw))
+  {
+    return false;
+  }
+  *crc = ImageCrc32(0, (const uint8_t *)raw, sizeof(*raw));
+  return true;
+}
+
+/**
+ * @brief Writes a descriptor of the EDF file, from its parsed header, to descFile
+ *
+ * The header sector goes last, so a descriptor cut short never checks
+ * out. Leaves the EDF file at its first data record.
+ *
+ * @return 0, or one of the DESCRIPTOR_ERR_ codes
+ */
+int DescriptorWrite(SourceFile *descFile, SourceFile *edf, const EdfFileHeader *header)
+{
+  edfHeaderMain raw;
+  uint32_t edfSize, edfStamp, edfCrc;
+  bool fingerprinted = SourceFingerprint(edf, &raw, &edfSize, &edfStamp, &edfCrc);
+  edf->seekSet(header->layout.header_bytes);
+  if (!fingerprinted)
+  {
+    return DESCRIPTOR_ERR_READ;
+  }
+  uint8_t sector[DESCRIPTOR_SECTOR_BYTES];
+  memset(sector, 0, sizeof(sector));
+  if (descFile->write(sector, sizeof(sector)) != (int)sizeof(sector))
+  {
+    return DESCRIPTOR_ERR_WRITE;
+  }
+  const int numSignals = header->layout.total_signals;
+  uint32_t entriesCrc = 0;
+  int entries = 0;
+  for (int i = 0; i < numSignals; i++)
+  {
+    const edf_signal_struct *signal = &header->signals[i];
+    uint8_t *entry = sector + entries * DESCRIPTOR_SIGNAL_BYTES;
+    PutFloat(entry, signal->phys_min);
+    PutFloat(entry + 4, signal->phys_max);
+    Put32(entry + 8, (uint32_t)signal->dig_min);
+    Put32(entry + 12, (uint32_t)signal->dig_max);
+    Put32(entry + 16, (uint32_t)signal->smp_per_record);
+    Put32(entry + 20, signal->annotation ? 1 : 0);
+    entries++;
+    if (entries == entriesPerChunk || i == numSignals - 1)
+    {
+      int bytes = entries * DESCRIPTOR_SIGNAL_BYTES;
+      entriesCrc = ImageCrc32(entriesCrc, sector, bytes);
+      if (descFile->write(sector, bytes) != bytes)
+      {
+        return DESCRIPTOR_ERR_WRITE;
+      }
+      entries = 0;
+    }
+  }
+
+  memset(sector, 0, sizeof(sector));
+  memcpy(sector, descriptorMagic, sizeof(descriptorMagic));
+  Put32(sector + 8, DESCRIPTOR_VERSION);
+  Put32(sector + 12, edfSize);
+  Put32(sector + 16, edfStamp);
+  Put32(sector + 20, edfCrc);
+  Put32(sector + 24, (uint32_t)numSignals);
+  Put32(sector + 28, entriesCrc);
+  Put32(sector + DESCRIPTOR_HEADER_FIELDS_BYTES, ImageCrc32(0, sector, DESCRIPTOR_HEADER_FIELDS_BYTES));
+  if (!descFile->seekSet(0) || descFile->write(sector, sizeof(sector)) != (int)sizeof(sector))
+  {
+    return DESCRIPTOR_ERR_WRITE;
+  }
+  return 0;
+}
+
+/**
+ * @brief Fills in header as EdfReadHeader would, from the EDF file's main header and the descriptor
+ *
+ * The signal headers aren't read at all. Leaves the EDF file at its first
+ * data record, as EdfReadHeader does.
+ *
+ * @return 0, or one of the DESCRIPTOR_ERR_ codes; DESCRIPTOR_ERR_STALE if
+ *         the EDF file has changed since it was made
+ */
+int DescriptorLoad(SourceFile *descFile, SourceFile *edf, EdfFileHeader *header)
+{
+  uint8_t sector[DESCRIPTOR_SECTOR_BYTES];
+  header->signals = nullptr;
+  descFile->rewind();
+  if (descFile->read(sector, sizeof(sector)) != (int)sizeof(sector))
+  {
+    return DESCRIPTOR_ERR_READ;
+  }
+  if (memcmp(sector, descriptorMagic, sizeof(descriptorMagic)) != 0)
+  {
+    return DESCRIPTOR_ERR_MAGIC;
+  }
+  if (Get32(sector + 8) != DESCRIPTOR_VERSION)
+  {
+    return DESCRIPTOR_ERR_VERSION;
+  }
+  if (Get32(sector + DESCRIPTOR_HEADER_FIELDS_BYTES) != ImageCrc32(0, sector, DESCRIPTOR_HEADER_FIELDS_BYTES))
+  {
+    return DESCRIPTOR_ERR_CRC;
+  }
+  edfHeaderMain raw;
+  uint32_t edfSize, edfStamp, edfCrc;
+  if (!SourceFingerprint(edf, &raw, &edfSize, &edfStamp, &edfCrc))
+  {
+    return DESCRIPTOR_ERR_READ;
+  }
+  if (Get32(sector + 12) != edfSize || Get32(sector + 16) != edfStamp || Get32(sector + 20) != edfCrc)
+  {
+    return DESCRIPTOR_ERR_STALE;
+  }
+  const uint32_t entriesCrc = Get32(sector + 28);
+  if (edf_parse_main_header(&raw, &header->hdr, &header->layout) != 0 ||
+      Get32(sector + 24) != (uint32_t)header->layout.total_signals)
+  {
+    return DESCRIPTOR_ERR_LAYOUT;
+  }
+
+  const int numSignals = header->layout.total_signals;
+  header->signals = new (std::nothrow) edf_signal_struct[numSignals];
+  if (!header->signals)
+  {
+    return DESCRIPTOR_ERR_LAYOUT;
+  }
+  const bool plus = header->hdr.filetype == EDFLIB_FILETYPE_EDFPLUS || header->hdr.filetype == EDFLIB_FILETYPE_BDFPLUS;
+  uint32_t crc = 0;
+  int recordOffset = 0;
+  int edfSignals = 0;
+  bool valid = true;
+  for (int first = 0; first < numSignals && valid; first += entriesPerChunk)
+  {
+    int entries = numSignals - first < entriesPerChunk ? numSignals - first : entriesPerChunk;
+    int bytes = entries * DESCRIPTOR_SIGNAL_BYTES;
+    if (descFile->read(sector, bytes) != bytes)
+    {
+      EdfFreeHeader(header);
+      return DESCRIPTOR_ERR_READ;
+    }
+    crc = ImageCrc32(crc, sector, bytes);
+    for (int i = 0; i < entries; i++)
+    {
+      const uint8_t *entry = sector + i * DESCRIPTOR_SIGNAL_BYTES;
+      edf_signal_struct *signal = &header->signals[first + i];
+      signal->label[0] = '\0';
+      signal->phys_min = GetFloat(entry);
+      signal->phys_max = GetFloat(entry + 4);
+      signal->dig_min = (int)Get32(entry + 8);
+      signal->dig_max = (int)Get32(entry + 12);
+      signal->smp_per_record = (int)Get32(entry + 16);
+      signal->annotation = plus && (Get32(entry + 20) & 1);
+      signal->record_offset = recordOffset;
+      // the parser's checks, so a descriptor can't describe what it would have refused
+      valid = valid && signal->smp_per_record >= 1 && signal->dig_max > signal->dig_min &&
+              signal->phys_max != signal->phys_min;
+      recordOffset += signal->smp_per_record * header->layout.bytes_per_sample;
+      edfSignals += !signal->annotation;
+    }
+  }
+  if (!valid || crc != entriesCrc)
+  {
+    EdfFreeHeader(header);
+    return valid ? DESCRIPTOR_ERR_CRC : DESCRIPTOR_ERR_LAYOUT;
+  }
+  header->layout.record_bytes = recordOffset;
+  header->hdr.edfsignals = edfSignals;
+  edf->seekSet(header->layout.header_bytes);
+  return 0;
+}
+
+const char *DescriptorErrorString(int error)
+{
+  switch (error)
+  {
+  case 0:
+    return "ok";
+  case DESCRIPTOR_ERR_READ:
+    return "file too short";
+  case DESCRIPTOR_ERR_MAGIC:
+    return "not a playback descriptor";
+  case DESCRIPTOR_ERR_VERSION:
+    return "made by another version";
+  case DESCRIPTOR_ERR_CRC:
+    return "descriptor is corrupt";
+  case DESCRIPTOR_ERR_STALE:
+    return "out of date, the EDF file has changed";
+  case DESCRIPTOR_ERR_LAYOUT:
+    return "describes signals the file can't have";
+  case DESCRIPTOR_ERR_WRITE:
+    return "can't write it";
+  default:
+    return "unknown error";
+  }
+}
@@ -0,0 +1,52 @@
+/**
+ * @file PlaybackDescriptor.h
+ * @brief Sidecar copy of output.edf's parsed signal headers, so boots after the first don't parse them again
+ *
+ * The signal headers are 256 bytes of fixed-width ASCII per signal, every
+ * field converted and checked: 164 KB of reads and parsing for a
+ * 640-signal file, most of the time from reset to the first packet. The
+ * first boot with a file writes what playback takes from them to a
+ * descriptor next to it; later boots read that instead, once it's shown
+ * to be for the file as it is now. The 256-byte main header is still read
+ * and parsed, it's one short read and quick to parse.
+ *
+ * Layout: one header sector, then a DESCRIPTOR_SIGNAL_BYTES entry per
+ * signal. The header, little endian:
+ *
+ *     0   "VEEGDESC"
+ *     8   version (32 bits, DESCRIPTOR_VERSION)
+ *     12  size of the EDF file it was made from (32 bits)
+ *     16  that file's modification time, FAT date << 16 | FAT time (32 bits)
+ *     20  CRC-32 of that file's first 256 bytes (32 bits)
+ *     24  signals (32 bits)
+ *     28  CRC-32 of the signal entries (32 bits)
+ *     32  CRC-32 of bytes 0 to 31
+ *
+ * Each signal entry, 32 bits each: physical minimum and maximum (IEEE
+ * floats), digital minimum and maximum, samples per record, flags (bit 0:
+ * annotation signal). Labels and the other text fields aren't kept,
+ * playback doesn't use them.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "platform.h"
+#include "EdfHeader.h"
+
+#define DESCRIPTOR_FILE_NAME "output.vpd"
+#define DESCRIPTOR_VERSION 1
+#define DESCRIPTOR_SECTOR_BYTES 512
+#define DESCRIPTOR_HEADER_FIELDS_BYTES 32 //header bytes covered by its CRC
+#define DESCRIPTOR_SIGNAL_BYTES 24
+
+#define DESCRIPTOR_ERR_READ 1
+#define DESCRIPTOR_ERR_MAGIC 2
+#define DESCRIPTOR_ERR_VERSION 3
+#define DESCRIPTOR_ERR_CRC 4
+#define DESCRIPTOR_ERR_STALE 5
+#define DESCRIPTOR_ERR_LAYOUT 6
+#define DESCRIPTOR_ERR_WRITE 7
+
+int DescriptorWrite(SourceFile *descFile, SourceFile *edf, const EdfFileHeader *header);
+int DescriptorLoad(SourceFile *descFile, SourceFile *edf, EdfFileHeader *header);
+const char *DescriptorErrorString(int error);
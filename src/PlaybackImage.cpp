@@ -0,0 +1,160 @@
+#include <string.h>
+#include "PlaybackImage.h"
+
+static const char imageMagic[8] = {'V', 'E', 'E', 'G', 'P', 'L', 'A', 'Y'};
+
+/**
+ * @brief CRC-32 (IEEE, reflected), 4 bits at a time from a 16-entry table;
+ *        a playback descriptor takes it over several KB at boot
+ *
+ * @param crc 0 to start, or the CRC so far to continue it
+ */
+uint32_t ImageCrc32(uint32_t crc, const uint8_t *data, size_t length)
+{
+  static const uint32_t nibbleTable[16] = {
+      0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+      0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ nibbleTable[crc & 0x0F];
+    crc = (crc >> 4) ^ nibbleTable[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+static void Put32(uint8_t *dest, uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    dest[i] = (value >> (8 * i)) & 0xFF;
+  }
+}
+
+static void Put64(uint8_t *dest, uint64_t value)
+{
+  Put32(dest, (uint32_t)value);
+  Put32(dest + 4, (uint32_t)(value >> 32));
+}
+
+static uint32_t Get32(const uint8_t *src)
+{
+  return src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+static uint64_t Get64(const uint8_t *src)
+{
+  return Get32(src) | (uint64_t)Get32(src + 4) << 32;
+}
+
+/**
+ * @brief Writes the header sector, IMAGE_SECTOR_BYTES long
+ */
+void ImageEncodeHeader(const PlaybackImageHeader *header, uint8_t *sector)
+{
+  memset(sector, 0, IMAGE_SECTOR_BYTES);
+  memcpy(sector, imageMagic, sizeof(imageMagic));
+  Put32(sector + 8, IMAGE_VERSION);
+  Put32(sector + 12, header->channels);
+  Put32(sector + 16, header->bits);
+  Put32(sector + 20, header->rowsPerRecord);
+  Put32(sector + 24, header->rowBytes);
+  Put32(sector + 28, header->recordBytes);
+  Put32(sector + 32, header->numRecords);
+  Put64(sector + 36, header->periodNum);
+  Put32(sector + 44, header->periodDen);
+  Put64(sector + 48, (uint64_t)header->recordDuration);
+  Put32(sector + 56, header->sourceBytes);
+  Put32(sector + 60, header->sourceHeaderCrc);
+  Put32(sector + IMAGE_HEADER_FIELDS_BYTES, ImageCrc32(0, sector, IMAGE_HEADER_FIELDS_BYTES));
+}
+
+/**
+ * @brief Reads and checks the header sector, leaving the file at the first record
+ *
+ * @return 0, or one of the IMAGE_ERR_ codes
+ */
+int ImageReadHeader(SourceFile *file, PlaybackImageHeader *header)
+{
+  uint8_t sector[IMAGE_SECTOR_BYTES];
+  file->rewind();
+  if (file->read(sector, sizeof(sector)) != (int)sizeof(sector))
+  {
+    return IMAGE_ERR_READ;
+  }
+  if (memcmp(sector, imageMagic, sizeof(imageMagic)) != 0)
+  {
+    return IMAGE_ERR_MAGIC;
+  }
+  if (Get32(sector + 8) != IMAGE_VERSION)
+  {
+    return IMAGE_ERR_VERSION;
+  }
+  if (Get32(sector + IMAGE_HEADER_FIELDS_BYTES) != ImageCrc32(0, sector, IMAGE_HEADER_FIELDS_BYTES))
+  {
+    return IMAGE_ERR_CRC;
+  }
+  header->channels = Get32(sector + 12);
+  header->bits = Get32(sector + 16);
+  header->rowsPerRecord = Get32(sector + 20);
+  header->rowBytes = Get32(sector + 24);
+  header->recordBytes = Get32(sector + 28);
+  header->numRecords = Get32(sector + 32);
+  header->periodNum = Get64(sector + 36);
+  header->periodDen = Get32(sector + 44);
+  header->recordDuration = (int64_t)Get64(sector + 48);
+  header->sourceBytes = Get32(sector + 56);
+  header->sourceHeaderCrc = Get32(sector + 60);
+  if ((header->bits != 16 && header->bits != 24) || header->channels == 0 || header->rowsPerRecord == 0 ||
+      header->rowBytes != header->channels * header->bits / 8 ||
+      header->recordBytes < header->rowsPerRecord * header->rowBytes || header->recordBytes % IMAGE_SECTOR_BYTES != 0 ||
+      header->periodNum == 0 || header->periodDen == 0)
+  {
+    return IMAGE_ERR_LAYOUT;
+  }
+  if ((uint64_t)IMAGE_SECTOR_BYTES + (uint64_t)header->numRecords * header->recordBytes > file->fileSize())
+  {
+    return IMAGE_ERR_SIZE;
+  }
+  return 0;
+}
+
+const char *ImageErrorString(int error)
+{
+  switch (error)
+  {
+  case 0:
+    return "ok";
+  case IMAGE_ERR_READ:
+    return "file too short";
+  case IMAGE_ERR_MAGIC:
+    return "not a playback image";
+  case IMAGE_ERR_VERSION:
+    return "made by another version";
+  case IMAGE_ERR_CRC:
+    return "header is corrupt";
+  case IMAGE_ERR_LAYOUT:
+    return "header describes an impossible layout";
+  case IMAGE_ERR_SIZE:
+    return "file is shorter than its header says";
+  default:
+    return "unknown error";
+  }
+}
+
+/**
+ * @brief True if the image was made from this EDF file: same size, same main header
+ *
+ * Leaves the source file rewound.
+ */
+bool ImageMatchesSource(const PlaybackImageHeader *header, SourceFile *source)
+{
+  uint8_t mainHeader[256];
+  source->rewind();
+  bool matches = source->fileSize() == header->sourceBytes &&
+                 source->read(mainHeader, sizeof(mainHeader)) == (int)sizeof(mainHeader) &&
+                 ImageCrc32(0, mainHeader, sizeof(mainHeader)) == header->sourceHeaderCrc;
+  source->rewind();
+  return matches;
+}
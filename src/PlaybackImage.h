@@ -0,0 +1,69 @@
+/**
+ * @file PlaybackImage.h
+ * @brief Preconverted playback image: an EDF file turned into packet rows, for sequential reads
+ *
+ * Reading EDF live means a read per channel per record, seeks past the
+ * channels that aren't sent, then calibrating, resampling and transposing
+ * every sample. The native build's --make-image does all of that once and
+ * writes the result as an image: each data record becomes rowsPerRecord
+ * rows of exactly the sample bytes a packet or frame carries (channels in
+ * send order, 16 or 24 bits, little endian), padded to a whole number of
+ * 512-byte sectors. Playing it is one sequential multi-sector read per
+ * record and a copy per packet.
+ *
+ * Layout: one header sector, then numRecords records of recordBytes each.
+ * The header, little endian:
+ *
+ *     0   "VEEGPLAY"
+ *     8   version (32 bits, IMAGE_VERSION)
+ *     12  channels, bits, rowsPerRecord, rowBytes, recordBytes, numRecords (32 bits each)
+ *     36  sample period as periodNum / periodDen microseconds (64 and 32 bits)
+ *     48  data record duration, 100 ns units (64 bits)
+ *     56  size of the EDF file it was made from (32 bits)
+ *     60  CRC-32 of that file's first 256 bytes (32 bits)
+ *     64  CRC-32 of bytes 0 to 63
+ *
+ * The last two source fields let the player tell an image that's out of
+ * date with the EDF file next to it.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "platform.h"
+
+#define IMAGE_FILE_NAME "output.vpi"
+#define IMAGE_SECTOR_BYTES 512
+#define IMAGE_VERSION 1
+#define IMAGE_HEADER_FIELDS_BYTES 64 //header bytes covered by its CRC
+
+#define IMAGE_ERR_READ 1
+#define IMAGE_ERR_MAGIC 2
+#define IMAGE_ERR_VERSION 3
+#define IMAGE_ERR_CRC 4
+#define IMAGE_ERR_LAYOUT 5
+#define IMAGE_ERR_SIZE 6
+
+struct PlaybackImageHeader
+{
+  uint32_t channels;
+  uint32_t bits;           // 16 or 24
+  uint32_t rowsPerRecord;
+  uint32_t rowBytes;       // channels * bits / 8
+  uint32_t recordBytes;    // rowsPerRecord rows, padded to whole sectors
+  uint32_t numRecords;
+  uint64_t periodNum;      // sample period is periodNum / periodDen microseconds
+  uint32_t periodDen;
+  int64_t recordDuration;  // 100 ns units, as in the EDF header
+  uint32_t sourceBytes;
+  uint32_t sourceHeaderCrc;
+};
+
+uint32_t ImageCrc32(uint32_t crc, const uint8_t *data, size_t length);
+void ImageEncodeHeader(const PlaybackImageHeader *header, uint8_t *sector);
+int ImageReadHeader(SourceFile *file, PlaybackImageHeader *header);
+const char *ImageErrorString(int error);
+bool ImageMatchesSource(const PlaybackImageHeader *header, SourceFile *source);
+
+#ifndef ARDUINO
+int MakePlaybackImage(const char *path); // native build only, from the EDF setup() loaded
+#endif
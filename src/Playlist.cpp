@@ -0,0 +1,90 @@
+#include <string.h>
+#include "Playlist.h"
+
+/**
+ * @brief Reads the names in a playlist file
+ *
+ * @return false if it couldn't be read or lists no files
+ */
+bool PlaylistRead(SourceFile *file, Playlist *playlist)
+{
+  static char text[PLAYLIST_MAX_BYTES + 1];
+  playlist->numFiles = 0;
+  playlist->skippedLines = 0;
+  file->rewind();
+  int length = file->read(text, PLAYLIST_MAX_BYTES);
+  if (length <= 0)
+  {
+    return false;
+  }
+  text[length] = '\0';
+  for (char *line = text; line < text + length;)
+  {
+    char *end = line + strcspn(line, "\r\n");
+    char *next = end + strspn(end, "\r\n");
+    // trailing spaces aren't part of the name
+    while (end > line && (end[-1] == ' ' || end[-1] == '\t'))
+    {
+      end--;
+    }
+    int nameLength = (int)(end - line);
+    if (nameLength > 0 && line[0] != '#')
+    {
+      if (nameLength >= PLAYLIST_NAME_BYTES || playlist->numFiles == PLAYLIST_MAX_FILES)
+      {
+        playlist->skippedLines++;
+      }
+      else
+      {
+        memcpy(playlist->names[playlist->numFiles], line, nameLength);
+        playlist->names[playlist->numFiles][nameLength] = '\0';
+        playlist->numFiles++;
+      }
+    }
+    line = next;
+  }
+  return playlist->numFiles > 0;
+}
+
+void PlaylistRemove(Playlist *playlist, int index)
+{
+  for (int i = index; i + 1 < playlist->numFiles; i++)
+  {
+    memcpy(playlist->names[i], playlist->names[i + 1], PLAYLIST_NAME_BYTES);
+  }
+  playlist->numFiles--;
+}
+
+/**
+ * @brief Why a file can't be played after the playlist's first, if it can't
+ *
+ * @return nullptr if its records are laid out the same way
+ */
+const char *PlaylistMismatch(const EdfFileHeader *first, const EdfFileHeader *other)
+{
+  if (other->layout.bytes_per_sample != first->layout.bytes_per_sample)
+  {
+    return "sample size differs";
+  }
+  if (other->layout.total_signals != first->layout.total_signals)
+  {
+    return "number of signals differs";
+  }
+  if (other->hdr.datarecord_duration != first->hdr.datarecord_duration)
+  {
+    return "data record duration differs";
+  }
+  for (int i = 0; i < first->layout.total_signals; i++)
+  {
+    if (other->signals[i].smp_per_record != first->signals[i].smp_per_record ||
+        other->signals[i].annotation != first->signals[i].annotation)
+    {
+      return "a signal's samples per record differ";
+    }
+  }
+  if (other->hdr.datarecords_in_file == 0)
+  {
+    return "no data records";
+  }
+  return nullptr;
+}
@@ -0,0 +1,32 @@
+/**
+ * @file Playlist.h
+ * @brief A list of EDF files on the card, played one after the other as one recording
+ *
+ * PLAYLIST_FILE_NAME lists the files to play, one name per line, in the
+ * order they're played; blank lines and lines starting with # are skipped.
+ * Every file has to have the same record layout as the first (signals,
+ * samples per record, sample size and record duration), so the record
+ * ring and packet format carry on unchanged from one to the next; only
+ * the calibration may differ. PlaylistMismatch says why a file can't
+ * follow the first.
+ */
+#pragma once
+
+#include "platform.h"
+#include "EdfHeader.h"
+
+#define PLAYLIST_FILE_NAME "playlist.txt"
+#define PLAYLIST_MAX_FILES 64
+#define PLAYLIST_NAME_BYTES 40 //longest file name in the list, with its terminating null
+#define PLAYLIST_MAX_BYTES 4096 //most of the list file that's read
+
+struct Playlist
+{
+  char names[PLAYLIST_MAX_FILES][PLAYLIST_NAME_BYTES];
+  int numFiles;
+  int skippedLines; // names too long, or past PLAYLIST_MAX_FILES
+};
+
+bool PlaylistRead(SourceFile *file, Playlist *playlist);
+void PlaylistRemove(Playlist *playlist, int index);
+const char *PlaylistMismatch(const EdfFileHeader *first, const EdfFileHeader *other);
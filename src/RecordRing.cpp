@@ -0,0 +1,793 @@
+#include <string.h>
+#include "RecordRing.h"
+#include "TimingStats.h"
+
+/**
+ * @brief Arena bytes RingCreate takes
+ */
+size_t RingArenaBytes(int numSlots, int numColumns, int rowsPerRecord, int maxChanSamps, int bytesPerSample)
+{
+  int stagingRows = maxChanSamps > rowsPerRecord ? maxChanSamps : rowsPerRecord;
+  return ArenaSize((size_t)numSlots * numColumns * rowsPerRecord * sizeof(int32_t)) +
+         ArenaSize(numSlots * numColumns * sizeof(int32_t *)) + ArenaSize(numSlots * sizeof(long)) +
+         ArenaSize(numSlots * sizeof(uint32_t)) + ArenaSize(stagingRows * bytesPerSample);
+}
+
+/**
+ * @brief Allocates the slots of the ring from the arena
+ *
+ * Columns are filled in by RingAttachSource and RingRefillStep. Only the
+ * file's first numColumns channels are kept; the ones after them can't
+ * go in a packet, so they're never read. A slot's columns are one block,
+ * column after column.
+ *
+ * @param numChans channels in each record of the file
+ * @param numColumns channels kept, from the first
+ * @param rowsPerRecord output samples per record of every channel
+ * @param maxChanSamps most samples per record of any channel read from the file
+ *
+ * @return false if there wasn't enough room in the arena
+ */
+bool RingCreate(RecordRing *ring, SampleArena *arena, int numSlots, int numChans, int numColumns, int rowsPerRecord,
+                int maxChanSamps, int bytesPerSample)
+{
+  ring->numSlots = numSlots;
+  ring->numChans = numChans;
+  ring->numColumns = numColumns;
+  ring->rowsPerRecord = rowsPerRecord;
+  ring->bytesPerSample = bytesPerSample;
+  ring->filledCount = 0;
+  ring->releasedCount = 0;
+  ring->backgroundRefill = false;
+  ring->file = nullptr;
+  ring->generator = nullptr;
+  ring->filter = nullptr;
+  ring->sourceFailed = false;
+  ring->loopSource = true;
+  ring->endOfSource = false;
+  ring->seekTarget = -1;
+  ring->seekFlushTo = 0;
+  ring->seekPending = false;
+  ring->seekSourceNum = 0;
+  ring->underruns = 0;
+  ring->awaitSource = false;
+  ring->sourceQueued = false;
+  ring->sourceNum = 0;
+  ring->releasedSourceNum = 0;
+  ring->images = nullptr;
+  ring->chanAnnotation = nullptr;
+  ring->slotEvents = nullptr;
+  ring->slotEventCount = nullptr;
+  ring->annotationBytes = nullptr;
+  ring->droppedEvents = 0;
+  int32_t *samples = ArenaNew<int32_t>(arena, (size_t)numSlots * numColumns * rowsPerRecord, ARENA_SAMPLES);
+  ring->columns = ArenaNew<int32_t *>(arena, numSlots * numColumns, ARENA_RING);
+  ring->slotRecordNum = ArenaNew<long>(arena, numSlots, ARENA_RING);
+  ring->slotSourceNum = ArenaNew<uint32_t>(arena, numSlots, ARENA_RING);
+  int stagingRows = maxChanSamps > rowsPerRecord ? maxChanSamps : rowsPerRecord;
+  ring->staging = ArenaNew<uint8_t>(arena, stagingRows * bytesPerSample, ARENA_RING);
+  if ((!samples && numColumns > 0) || !ring->columns || !ring->slotRecordNum || !ring->slotSourceNum || !ring->staging)
+  {
+    return false;
+  }
+  for (int slot = 0; slot < numSlots; slot++)
+  {
+    ring->slotRecordNum[slot] = -1;
+    for (int col = 0; col < numColumns; col++)
+    {
+      ring->columns[slot * numColumns + col] = samples + ((size_t)slot * numColumns + col) * rowsPerRecord;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Calibrates the raw column in staging, for a channel that's kept
+ */
+static void CalibrateStaging(RecordRing *ring, int chan, int32_t *out, int count)
+{
+  if (ring->bytesPerSample == 3)
+  {
+    CalibrateColumn24(&ring->chanCal[chan], ring->staging, out, count);
+  }
+  else
+  {
+    CalibrateColumn(&ring->chanCal[chan], (const int16_t *)ring->staging, out, count);
+  }
+}
+
+/**
+ * @brief Tells the ring where to read records from
+ *
+ * Unused channels are never read, so the columns kept for them get their
+ * "fake data" here: all values in channel 0 are 0, all values in channel 1
+ * are 1, etc, calibrated like real samples would be.
+ *
+ * @param file open file, positioned anywhere
+ * @param dataStart byte offset of the first data record (numHeaderBytes)
+ * @param numRecords number of data records, -1 to read until the file runs out
+ * @param chanSamps samples per record of each channel
+ * @param chanUsed whether each channel is read into the ring or skipped;
+ *        only the kept channels (the first numColumns) can be read
+ * @param chanCal calibration of each kept channel
+ * @param chanResampler resampler of each kept channel, or null if every
+ *        used channel is already at the output rate
+ */
+void RingAttachSource(RecordRing *ring, SourceFile *file, uint32_t dataStart, long numRecords,
+                      const int *chanSamps, const bool *chanUsed, const CalibrationQ *chanCal,
+                      ChannelResampler *chanResampler)
+{
+  ring->file = file;
+  ring->dataStart = dataStart;
+  ring->numRecords = numRecords;
+  ring->chanSamps = chanSamps;
+  ring->chanUsed = chanUsed;
+  ring->chanCal = chanCal;
+  ring->chanResampler = chanResampler;
+  for (int chan = 0; chan < ring->numColumns; chan++)
+  {
+    if (chanUsed[chan])
+    {
+      continue;
+    }
+    for (int row = 0; row < ring->rowsPerRecord; row++)
+    {
+      // little endian, as in the file; the top byte is only there for BDF
+      uint8_t *sample = &ring->staging[row * ring->bytesPerSample];
+      sample[0] = chan & 0xFF;
+      sample[1] = (chan >> 8) & 0xFF;
+      if (ring->bytesPerSample == 3)
+      {
+        sample[2] = 0;
+      }
+    }
+    for (int slot = 0; slot < ring->numSlots; slot++)
+    {
+      CalibrateStaging(ring, chan, ring->columns[slot * ring->numColumns + chan], ring->rowsPerRecord);
+    }
+  }
+  ring->fillRecord = 0;
+  ring->fillChan = 0;
+  ring->fillOffset = 0;
+  ring->fillRow = 0;
+  ring->sourceFailed = false;
+  file->seekSet(dataStart);
+}
+
+/**
+ * @brief Arena bytes RingAttachAnnotations takes
+ */
+size_t RingAnnotationArenaBytes(int numSlots)
+{
+  return ArenaSize(numSlots * RING_MAX_EVENTS * sizeof(RecordEvent)) + ArenaSize(numSlots * sizeof(int)) +
+         ArenaSize(RING_SLICE_BYTES);
+}
+
+/**
+ * @brief Reads the file's annotation signals too, keeping each record's annotations with it
+ *
+ * Call after RingAttachSource, with the annotation signals marked unused
+ * there. The first annotation signal's timekeeping TAL gives each record's
+ * start time, and each annotation's onset is placed on the output row it
+ * falls on from there; a record without one is taken to start at its
+ * number times recordDuration.
+ *
+ * @param chanAnnotation true for each annotation signal
+ * @param recordDuration data record duration, 100 ns units
+ * @return false if there are no annotation signals or there wasn't enough room in the arena
+ */
+bool RingAttachAnnotations(RecordRing *ring, SampleArena *arena, const bool *chanAnnotation, int64_t recordDuration)
+{
+  ring->firstAnnotationChan = -1;
+  for (int chan = ring->numChans - 1; chan >= 0; chan--)
+  {
+    if (chanAnnotation[chan])
+    {
+      ring->firstAnnotationChan = chan;
+    }
+  }
+  if (ring->firstAnnotationChan < 0 || recordDuration <= 0)
+  {
+    return false;
+  }
+  ring->slotEvents = ArenaNew<RecordEvent>(arena, ring->numSlots * RING_MAX_EVENTS, ARENA_RING);
+  ring->slotEventCount = ArenaNew<int>(arena, ring->numSlots, ARENA_RING);
+  ring->annotationBytes = ArenaNew<uint8_t>(arena, RING_SLICE_BYTES, ARENA_RING);
+  if (!ring->slotEvents || !ring->slotEventCount || !ring->annotationBytes)
+  {
+    ring->slotEvents = nullptr;
+    return false;
+  }
+  TalParserInit(&ring->talParser);
+  ring->recordDuration = recordDuration;
+  ring->chanAnnotation = chanAnnotation;
+  return true;
+}
+
+/**
+ * @brief Makes the generator the source of every record, in place of a file
+ *
+ * Every channel is used and there is no end to loop back from.
+ */
+void RingAttachGenerator(RecordRing *ring, SignalGenerator *generator)
+{
+  ring->generator = generator;
+  ring->numRecords = -1;
+  ring->fillRecord = 0;
+  ring->fillChan = 0;
+  ring->fillOffset = 0;
+  ring->fillRow = 0;
+  ring->sourceFailed = false;
+}
+
+/**
+ * @brief Runs every record through a bank of filters, one per kept column, before the sender gets it
+ *
+ * The filters' history carries on at the end of the file, through
+ * looping and playlist switches, and is forgotten on a seek, as the
+ * resamplers' is. Only for rings of columns, not playback images.
+ */
+void RingAttachFilter(RecordRing *ring, FilterBank *filter)
+{
+  FilterReset(filter);
+  ring->filter = filter;
+}
+
+/**
+ * @brief Arena bytes RingCreateImage takes
+ */
+size_t RingImageArenaBytes(int numSlots, int rowsPerRecord, uint32_t recordBytes)
+{
+  return RingArenaBytes(numSlots, 0, rowsPerRecord, 0, 1) + ArenaSize(numSlots * sizeof(uint8_t *)) +
+         numSlots * ArenaSize(recordBytes);
+}
+
+/**
+ * @brief Creates a ring of playback image records instead of columns
+ *
+ * @param recordBytes bytes of one record in the image, padding included
+ * @return false if there wasn't enough room in the arena
+ */
+bool RingCreateImage(RecordRing *ring, SampleArena *arena, int numSlots, int rowsPerRecord, uint32_t recordBytes)
+{
+  if (!RingCreate(ring, arena, numSlots, 0, 0, rowsPerRecord, 0, 1))
+  {
+    return false;
+  }
+  ring->imageRecordBytes = recordBytes;
+  ring->images = ArenaNew<uint8_t *>(arena, numSlots, ARENA_RING);
+  if (!ring->images)
+  {
+    return false;
+  }
+  for (int slot = 0; slot < numSlots; slot++)
+  {
+    ring->images[slot] = ArenaNew<uint8_t>(arena, recordBytes, ARENA_SAMPLES);
+    if (!ring->images[slot])
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Tells an image ring where its records are
+ *
+ * @param file open image file
+ * @param dataStart byte offset of the first record, a sector boundary
+ * @param numRecords number of records in the image
+ */
+void RingAttachImage(RecordRing *ring, SourceFile *file, uint32_t dataStart, long numRecords)
+{
+  ring->file = file;
+  ring->dataStart = dataStart;
+  ring->numRecords = numRecords;
+  ring->fillRecord = 0;
+  ring->fillChan = 0;
+  ring->fillOffset = 0;
+  ring->fillRow = 0;
+  ring->sourceFailed = false;
+  file->seekSet(dataStart);
+}
+
+/**
+ * @brief Goes back to the first data record at end of file, unless looping is off
+ *
+ * @return false if the file has no complete record to go back to, or it's not looping
+ */
+static bool RewindSource(RecordRing *ring)
+{
+  if (ring->fillRecord == 0 && ring->fillChan == 0 && ring->fillOffset == 0)
+  {
+    // already at the start and still couldn't read a record
+    ring->sourceFailed = true;
+    return false;
+  }
+  if (!ring->loopSource.load())
+  {
+    ring->endOfSource = true;
+    return false;
+  }
+  ring->fillRecord = 0;
+  ring->fillChan = 0;
+  ring->fillOffset = 0;
+  ring->fillRow = 0;
+  return ring->file->seekSet(ring->dataStart);
+}
+
+/**
+ * @brief Makes a source the one records are read from, from its first record
+ */
+static void UseSource(RecordRing *ring, const RingSource *source)
+{
+  ring->file = source->file;
+  ring->dataStart = source->dataStart;
+  ring->numRecords = source->numRecords;
+  ring->chanCal = source->chanCal;
+  ring->fillRecord = 0;
+  ring->fillChan = 0;
+  ring->fillOffset = 0;
+  ring->fillRow = 0;
+  ring->file->seekSet(ring->dataStart);
+}
+
+static RingSource CurrentSource(const RecordRing *ring)
+{
+  RingSource source = {ring->file, ring->dataStart, ring->numRecords, ring->chanCal};
+  return source;
+}
+
+/**
+ * @brief At the end of the file: carries on with the queued source, waits for one, or goes back to the first record
+ *
+ * A record left partly read is abandoned. The resamplers carry on, so the
+ * next file follows on as if it were the same recording.
+ *
+ * @return false if there's nothing to read until the consumer does something
+ */
+static bool EndOfSource(RecordRing *ring)
+{
+  if (ring->sourceQueued.load())
+  {
+    ring->previousSource = CurrentSource(ring);
+    UseSource(ring, &ring->nextSource);
+    ring->sourceNum++;
+    ring->sourceQueued = false;
+    return true;
+  }
+  if (ring->awaitSource.load())
+  {
+    return false;
+  }
+  return RewindSource(ring);
+}
+
+/**
+ * @brief Moves the refill position to the start of a data record
+ *
+ * Whatever was partly read is abandoned and the resamplers and filters
+ * start over, since the history they hold belongs to another part of the
+ * file.
+ */
+static void SeekSource(RecordRing *ring, long record)
+{
+  if (ring->seekSourceNum != ring->sourceNum)
+  {
+    // the consumer is still in the previous source, go back to it and queue this one again
+    ring->nextSource = CurrentSource(ring);
+    UseSource(ring, &ring->previousSource);
+    ring->sourceNum = ring->seekSourceNum;
+    ring->sourceQueued = true;
+  }
+  if (ring->numRecords > 0 && record >= ring->numRecords)
+  {
+    record = ring->numRecords - 1;
+  }
+  ring->fillRecord = record;
+  ring->fillChan = 0;
+  ring->fillOffset = 0;
+  ring->fillRow = 0;
+  ring->endOfSource = false;
+  if (ring->filter)
+  {
+    FilterReset(ring->filter);
+  }
+  if (ring->generator)
+  {
+    GeneratorSeek(ring->generator, (uint64_t)record * ring->rowsPerRecord);
+  }
+  else if (ring->images)
+  {
+    ring->file->seekSet((uint32_t)(ring->dataStart + (uint64_t)record * ring->imageRecordBytes));
+  }
+  else
+  {
+    uint64_t recordBytes = 0;
+    for (int chan = 0; chan < ring->numChans; chan++)
+    {
+      recordBytes += ring->chanSamps[chan] * ring->bytesPerSample;
+    }
+    for (int chan = 0; ring->chanResampler && chan < ring->numColumns; chan++)
+    {
+      ring->chanResampler[chan].primed = false;
+    }
+    uint32_t target = (uint32_t)(ring->dataStart + record * recordBytes);
+    if (!ring->file->seekSet(target) && ring->file->curPosition() > target)
+    {
+      // a stream can't go back, so it carries on from the next whole record
+      record = (long)((ring->file->curPosition() - ring->dataStart + recordBytes - 1) / recordBytes);
+      ring->fillRecord = record;
+      ring->file->seekSet((uint32_t)(ring->dataStart + record * recordBytes));
+    }
+  }
+  // publish the flush point before telling the consumer the seek is done
+  ring->seekFlushTo.store(ring->filledCount.load());
+  ring->seekTarget.store(-1);
+}
+
+/**
+ * @brief Hands the record in a slot over to the sender
+ */
+static void PublishRecord(RecordRing *ring, uint32_t slot)
+{
+  ring->slotRecordNum[slot] = ring->fillRecord;
+  ring->slotSourceNum[slot] = ring->sourceNum;
+  ring->fillChan = 0;
+  ring->fillOffset = 0;
+  ring->fillRecord++;
+  ring->filledCount.fetch_add(1);
+}
+
+/**
+ * @brief Keeps an annotation of the record being filled, on the output row its onset falls on
+ */
+static void KeepAnnotation(void *ctx, int64_t onset, int64_t duration, const char *text)
+{
+  RecordRing *ring = (RecordRing *)ctx;
+  uint32_t slot = ring->filledCount.load() % ring->numSlots;
+  int *count = &ring->slotEventCount[slot];
+  if (*count == RING_MAX_EVENTS)
+  {
+    ring->droppedEvents++;
+    return;
+  }
+  const TalParser *parser = &ring->talParser;
+  int64_t recordStart = parser->haveRecordStart ? parser->recordStart : ring->fillRecord * ring->recordDuration;
+  // the rows the sender gets, fewer than are filled if the filters decimate
+  const int rows = ring->filter ? ring->rowsPerRecord / ring->filter->decimation : ring->rowsPerRecord;
+  int64_t offset = (onset - recordStart) * rows;
+  // rounded down, also before the record
+  int64_t row = offset / ring->recordDuration - (offset % ring->recordDuration < 0 ? 1 : 0);
+  RecordEvent *event = &ring->slotEvents[slot * RING_MAX_EVENTS + *count];
+  event->row = row > INT32_MAX ? INT32_MAX : row < INT32_MIN ? INT32_MIN : (int32_t)row;
+  int64_t millis = duration / 10000;
+  event->durationMillis = duration < 0 ? -1 : millis > INT32_MAX ? INT32_MAX : (int32_t)millis;
+  strncpy(event->text, text, TAL_TEXT_BYTES - 1);
+  event->text[TAL_TEXT_BYTES - 1] = '\0';
+  (*count)++;
+}
+
+/**
+ * @brief Reads and parses the next slice of an annotation signal
+ *
+ * @return false if the file ran out
+ */
+static bool AnnotationStep(RecordRing *ring, int chan, int chanBytes)
+{
+  if (ring->fillOffset == 0)
+  {
+    TalParserBeginSignal(&ring->talParser, chan == ring->firstAnnotationChan);
+  }
+  int toRead = chanBytes - ring->fillOffset;
+  if (toRead > RING_SLICE_BYTES)
+  {
+    toRead = RING_SLICE_BYTES;
+  }
+  STATS_START(readStart);
+  int bytesRead = ring->file->read(ring->annotationBytes, toRead);
+  STATS_STOP(STATS_SD_READ, readStart);
+  if (bytesRead != toRead)
+  {
+    return false;
+  }
+  TalParserFeed(&ring->talParser, ring->annotationBytes, toRead, KeepAnnotation, ring);
+  ring->fillOffset += toRead;
+  return true;
+}
+
+/**
+ * @brief Turns a fully read column into the slot's output column
+ *
+ * Calibrates it, then if the channel needs resampling, resamples it
+ * RING_SLICE_ROWS rows per call.
+ *
+ * @return true once the column is complete
+ */
+static bool FinishColumn(RecordRing *ring, int chan, uint32_t slot)
+{
+  int32_t *column = ring->columns[slot * ring->numColumns + chan];
+  ChannelResampler *rs = ring->chanResampler ? &ring->chanResampler[chan] : nullptr;
+  if (!rs || !rs->table)
+  {
+    CalibrateStaging(ring, chan, column, ring->rowsPerRecord);
+    return true;
+  }
+  if (ring->fillRow == 0)
+  {
+    CalibrateStaging(ring, chan, ResamplerInput(rs), rs->inRows);
+  }
+  int rows = rs->outRows - ring->fillRow;
+  if (rows > RING_SLICE_ROWS)
+  {
+    rows = RING_SLICE_ROWS;
+  }
+  ResamplerRun(rs, column, ring->fillRow, rows);
+  ring->fillRow += rows;
+  if (ring->fillRow < rs->outRows)
+  {
+    return false;
+  }
+  ResamplerFinishRecord(rs);
+  ring->fillRow = 0;
+  return true;
+}
+
+/**
+ * @brief Filters RING_SLICE_ROWS rows of the record being filled, whose channels are all in,
+ *        publishing it after the last
+ */
+static bool FilterStep(RecordRing *ring)
+{
+  uint32_t slot = ring->filledCount.load() % ring->numSlots;
+  int rows = ring->rowsPerRecord - ring->fillRow;
+  if (rows > RING_SLICE_ROWS)
+  {
+    rows = RING_SLICE_ROWS;
+  }
+  FilterRun(ring->filter, &ring->columns[slot * ring->numColumns], ring->fillRow, rows);
+  ring->fillRow += rows;
+  if (ring->fillRow == ring->rowsPerRecord)
+  {
+    ring->fillRow = 0;
+    PublishRecord(ring, slot);
+  }
+  return true;
+}
+
+/**
+ * @brief Generates one channel of the record being filled, publishing it after the last channel
+ *        unless it's still to be filtered
+ */
+static bool GenerateStep(RecordRing *ring)
+{
+  uint32_t slot = ring->filledCount.load() % ring->numSlots;
+  int chan = ring->fillChan;
+  GeneratorRun(ring->generator, chan, ring->columns[slot * ring->numColumns + chan], ring->rowsPerRecord);
+  if (++ring->fillChan == ring->numChans && !ring->filter)
+  {
+    PublishRecord(ring, slot);
+  }
+  return true;
+}
+
+/**
+ * @brief Reads the next piece of the image record being filled, publishing it once it's all in
+ *
+ * Records start on sector boundaries and pieces are whole sectors, so the
+ * card does multi-block reads straight into the slot.
+ */
+static bool ImageStep(RecordRing *ring)
+{
+  uint32_t slot = ring->filledCount.load() % ring->numSlots;
+  int toRead = ring->imageRecordBytes - ring->fillOffset;
+  if (toRead > RING_IMAGE_READ_BYTES)
+  {
+    toRead = RING_IMAGE_READ_BYTES;
+  }
+  STATS_START(readStart);
+  int bytesRead = ring->file->read(ring->images[slot] + ring->fillOffset, toRead);
+  STATS_STOP(STATS_SD_READ, readStart);
+  if (bytesRead != toRead)
+  {
+    return EndOfSource(ring);
+  }
+  ring->fillOffset += toRead;
+  if ((uint32_t)ring->fillOffset == ring->imageRecordBytes)
+  {
+    PublishRecord(ring, slot);
+  }
+  return true;
+}
+
+/**
+ * @brief Does one slice of refill work if there's a free slot
+ *
+ * A slice is a read of at most RING_SLICE_BYTES from one channel, or a
+ * seek past one unused channel, or resampling or filtering
+ * RING_SLICE_ROWS rows. A column is calibrated into its slot once all of
+ * it has been read, and when the last channel of a record is done (and
+ * the whole record filtered) the record is published to the sender.
+ * From a playback image, a slice is a read of at most
+ * RING_IMAGE_READ_BYTES.
+ *
+ * @return true if any work was done
+ */
+bool RingRefillStep(RecordRing *ring)
+{
+  if (!ring->file && !ring->generator)
+  {
+    return false;
+  }
+  long seekRecord = ring->seekTarget.load();
+  if (seekRecord >= 0)
+  {
+    // a seek can be asked for when the ring is full, so it comes first
+    SeekSource(ring, seekRecord);
+    return true;
+  }
+  if (RingIsFull(ring) || ring->sourceFailed)
+  {
+    return false;
+  }
+  if (ring->filter && ring->fillChan == ring->numChans)
+  {
+    return FilterStep(ring);
+  }
+  if (ring->generator)
+  {
+    return GenerateStep(ring);
+  }
+  if (ring->endOfSource.load())
+  {
+    if (!ring->loopSource.load())
+    {
+      return false;
+    }
+    // looping was turned back on after the end was reached
+    ring->endOfSource = false;
+  }
+  if (ring->numRecords >= 0 && ring->fillRecord >= ring->numRecords)
+  {
+    return EndOfSource(ring);
+  }
+
+  if (ring->images)
+  {
+    return ImageStep(ring);
+  }
+
+  uint32_t slot = ring->filledCount.load() % ring->numSlots;
+  int chan = ring->fillChan;
+  int chanBytes = ring->chanSamps[chan] * ring->bytesPerSample;
+  if (chan == 0 && ring->fillOffset == 0 && ring->chanAnnotation)
+  {
+    // starting a record, whatever was kept for one abandoned part way goes
+    ring->slotEventCount[slot] = 0;
+  }
+  if (ring->fillOffset == chanBytes)
+  {
+    // read already, still being resampled
+  }
+  else if (ring->chanAnnotation && ring->chanAnnotation[chan])
+  {
+    if (!AnnotationStep(ring, chan, chanBytes))
+    {
+      return EndOfSource(ring);
+    }
+  }
+  else if (ring->chanUsed[chan])
+  {
+    int toRead = chanBytes - ring->fillOffset;
+    if (toRead > RING_SLICE_BYTES)
+    {
+      toRead = RING_SLICE_BYTES;
+    }
+    char *dest = (char *)ring->staging + ring->fillOffset;
+    STATS_START(readStart);
+    int bytesRead = ring->file->read(dest, toRead);
+    STATS_STOP(STATS_SD_READ, readStart);
+    if (bytesRead != toRead)
+    {
+      return EndOfSource(ring);
+    }
+    ring->fillOffset += toRead;
+  }
+  else
+  {
+    // past this channel and any unused ones after it in one seek
+    int lastChan = chan;
+    int32_t skipBytes = chanBytes - ring->fillOffset;
+    while (lastChan + 1 < ring->numChans && !ring->chanUsed[lastChan + 1] &&
+           !(ring->chanAnnotation && ring->chanAnnotation[lastChan + 1]))
+    {
+      lastChan++;
+      skipBytes += ring->chanSamps[lastChan] * ring->bytesPerSample;
+    }
+    if (!ring->file->seekCur(skipBytes))
+    {
+      return EndOfSource(ring);
+    }
+    chan = ring->fillChan = lastChan;
+    chanBytes = ring->chanSamps[chan] * ring->bytesPerSample;
+    ring->fillOffset = chanBytes;
+  }
+
+  if (ring->fillOffset == chanBytes)
+  {
+    if (ring->chanUsed[chan] && !FinishColumn(ring, chan, slot))
+    {
+      return true;
+    }
+    ring->fillOffset = 0;
+    ring->fillChan++;
+    if (ring->fillChan == ring->numChans && !ring->filter)
+    {
+      PublishRecord(ring, slot);
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Consumer side: asks for the records after the ones now buffered to start at a data record
+ *
+ * The records already in the ring are dropped once the seek has happened;
+ * until RingSeekDone() returns true the consumer mustn't use the ring.
+ */
+void RingRequestSeek(RecordRing *ring, long record)
+{
+  ring->seekPending = true;
+  ring->seekSourceNum = RingHasRecord(ring) ? RingCurrentSourceNum(ring) : ring->releasedSourceNum;
+  ring->seekTarget.store(record < 0 ? 0 : record);
+}
+
+/**
+ * @brief Consumer side: drops the records buffered before a seek, once the producer has done it
+ *
+ * @return true if no seek is waiting on the producer
+ */
+bool RingSeekDone(RecordRing *ring)
+{
+  if (!ring->seekPending)
+  {
+    return true;
+  }
+  if (ring->seekTarget.load() >= 0)
+  {
+    return false;
+  }
+  ring->releasedCount.store(ring->seekFlushTo.load());
+  ring->seekPending = false;
+  return true;
+}
+
+/**
+ * @brief Consumer side: sets the file to carry on with at the end of the current one
+ *
+ * Only one source can be queued at a time: the next can be queued once
+ * RingCurrentSourceNum() shows the sender has got to this one. With
+ * awaitSource set, the producer waits at the end of the file until a
+ * source is queued, rather than going back to its first record.
+ *
+ * @param file open file, positioned anywhere
+ * @param chanCal its calibration, which has to stay as it is until the sender gets past the file
+ */
+void RingQueueSource(RecordRing *ring, SourceFile *file, uint32_t dataStart, long numRecords, const CalibrationQ *chanCal)
+{
+  ring->nextSource.file = file;
+  ring->nextSource.dataStart = dataStart;
+  ring->nextSource.numRecords = numRecords;
+  ring->nextSource.chanCal = chanCal;
+  ring->sourceQueued.store(true);
+}
+
+/**
+ * @brief Refills synchronously until every slot holds a record
+ */
+void RingFill(RecordRing *ring)
+{
+  while (RingRefillStep(ring))
+  {
+  }
+}
@@ -0,0 +1,217 @@
+/**
+ * @file RecordRing.h
+ * @brief Ring of EDF data records, refilled incrementally from the source file
+ *
+ * The sender consumes whole records from the read end while the refill side
+ * reads the next records in small slices (at most RING_SLICE_BYTES of one
+ * channel, or one seek past unused channels, per call), so no single call
+ * costs more than one short SD transaction regardless of record size or
+ * channel count. Each channel's column is calibrated (CalibrateColumn) as
+ * soon as it has been read, so the sender only copies physical values.
+ * Channels sampled at another rate than the output are then resampled
+ * (ResamplerRun), at most RING_SLICE_ROWS output rows per call. With a
+ * filter bank (RingAttachFilter), a record whose channels are all in goes
+ * through the filters RING_SLICE_ROWS rows per call before it's published,
+ * and if they decimate, the sender gets rowsPerRecord / decimation rows of
+ * it.
+ *
+ * There is exactly one producer (RingRefillStep) and one consumer
+ * (RingCurrentRecord/RingReleaseRecord); they may run on different threads.
+ * Instead of a file, the records can come from a SignalGenerator
+ * (RingAttachGenerator), one channel of one record per refill slice, or
+ * from a playback image (RingCreateImage, RingAttachImage), whose records
+ * are already packet rows and are read RING_IMAGE_READ_BYTES at a time
+ * into slots of bytes instead of columns.
+ *
+ * A seek is asked for by the consumer (RingRequestSeek) and carried out by
+ * the next RingRefillStep, which also tells the consumer how many of the
+ * records already in the ring to drop (RingSeekDone).
+ *
+ * For a playlist, the consumer queues the file to carry on with
+ * (RingQueueSource) while the current one plays. The producer switches to
+ * it as soon as it has read the current file's last record, so the next
+ * file's first records are in the ring before the sender gets to them.
+ * Every record is tagged with the number of the source it came from
+ * (RingCurrentSourceNum), which is how the consumer sees the switch. A seek
+ * is in the source of the record being played, so the producer goes back
+ * to the previous source if it had already moved on.
+ *
+ * With RingAttachAnnotations, the file's annotation signals are read as
+ * well, a slice at a time like the other channels, and parsed as each slice
+ * comes in (see TalParser.h). Each slot keeps up to RING_MAX_EVENTS of its
+ * record's annotations, placed on the record's output rows
+ * (RingCurrentEvents).
+ */
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <stdint.h>
+#include "platform.h"
+#include "SampleArena.h"
+#include "Calibration.h"
+#include "Resampler.h"
+#include "ChannelFilter.h"
+#include "SignalGenerator.h"
+#include "TalParser.h"
+
+#define RING_SLICE_BYTES 512 //most bytes read by one refill slice, one SD sector
+#define RING_SLICE_ROWS 64 //most output rows resampled by one refill slice
+#define RING_IMAGE_READ_BYTES 4096 //most bytes of a playback image read by one refill slice, 8 sectors
+#define RING_MAX_EVENTS 8 //annotations kept per record, more are dropped and counted
+
+/* a file records are read from, see RingQueueSource */
+struct RingSource
+{
+  SourceFile *file;
+  uint32_t dataStart;
+  long numRecords;
+  const CalibrationQ *chanCal;
+};
+
+/* an annotation of a record, see RingAttachAnnotations */
+struct RecordEvent
+{
+  int32_t row;            // output row of the record its onset falls on, may be before or after the record
+  int32_t durationMillis; // -1 if it has none
+  char text[TAL_TEXT_BYTES];
+};
+
+struct RecordRing
+{
+  int32_t **columns;     // [slot * numColumns + chan], rowsPerRecord calibrated samples each
+  uint8_t **images;      // playback image only: [slot], imageRecordBytes of packet rows each
+  uint32_t imageRecordBytes;
+  uint8_t *staging;      // raw samples of the column being read, as stored in the file
+  long *slotRecordNum;   // which data record of the file each slot holds
+  uint32_t *slotSourceNum; // which source that file was, counting RingQueueSource switches
+  int numSlots;
+  int numChans;          // channels in each record of the file
+  int numColumns;        // of which the first numColumns are kept in the slots
+  int rowsPerRecord;
+  int bytesPerSample;    // 2 for EDF, 3 for BDF
+  std::atomic<uint32_t> filledCount;   // records made available, only written by the refill side
+  std::atomic<uint32_t> releasedCount; // records finished with, only written by the sender
+  bool backgroundRefill; // true if another thread calls RingRefillStep
+
+  // where the records come from
+  SourceFile *file;
+  uint32_t dataStart;    // byte offset of the first data record
+  long numRecords;       // data records in the file, -1 if unknown
+  const int *chanSamps;  // samples per record for each channel
+  const bool *chanUsed;  // false if the channel is skipped rather than read
+  const CalibrationQ *chanCal; // calibration of each kept channel
+  ChannelResampler *chanResampler; // per kept channel, table is null if it's already at the output rate
+  SignalGenerator *generator; // if set, records are generated rather than read from file
+  FilterBank *filter;    // if set, every record goes through it before it's published
+
+  // annotations, see RingAttachAnnotations
+  const bool *chanAnnotation; // true for the file's annotation signals, null if they aren't read
+  int firstAnnotationChan;    // the one that starts with the timekeeping TAL
+  int64_t recordDuration;     // 100 ns units
+  RecordEvent *slotEvents;    // [slot * RING_MAX_EVENTS]
+  int *slotEventCount;
+  uint8_t *annotationBytes;   // the slice of an annotation signal being parsed
+  TalParser talParser;
+  unsigned long droppedEvents; // annotations past RING_MAX_EVENTS in their record
+
+  // incremental refill position
+  long fillRecord;       // data record being read into the next free slot
+  int fillChan;          // channel being read
+  int fillOffset;        // bytes of that channel already read
+  int fillRow;           // output rows of that channel already resampled, or of the record filtered
+  bool sourceFailed;     // set if the file can't produce a whole record
+  std::atomic<bool> loopSource;  // go back to the first record at the end of the file, else stop there
+  std::atomic<bool> endOfSource; // the last record has been read and loopSource is off
+
+  // playlist, see RingQueueSource
+  std::atomic<bool> awaitSource;   // at the end of the file, wait for the next to be queued instead of looping
+  std::atomic<bool> sourceQueued;  // nextSource is set, cleared by the producer when it switches to it
+  RingSource nextSource;
+  RingSource previousSource;       // the source before this one, for seeks that go back to it
+  uint32_t sourceNum;              // producer side: sources switched to
+  uint32_t releasedSourceNum;      // consumer side: source of the last record released
+
+  // seeking, see RingRequestSeek
+  std::atomic<long> seekTarget;        // record the consumer asked for, -1 once the producer has seeked
+  std::atomic<uint32_t> seekFlushTo;   // filledCount when the producer seeked, older records are stale
+  uint32_t seekSourceNum;              // source the seek is in, written before seekTarget
+  bool seekPending;      // consumer side: asked for a seek, stale records not dropped yet
+  unsigned long underruns; // times the sender had to wait for a record
+};
+
+size_t RingArenaBytes(int numSlots, int numColumns, int rowsPerRecord, int maxChanSamps, int bytesPerSample);
+bool RingCreate(RecordRing *ring, SampleArena *arena, int numSlots, int numChans, int numColumns, int rowsPerRecord,
+                int maxChanSamps, int bytesPerSample);
+void RingAttachSource(RecordRing *ring, SourceFile *file, uint32_t dataStart, long numRecords,
+                      const int *chanSamps, const bool *chanUsed, const CalibrationQ *chanCal,
+                      ChannelResampler *chanResampler);
+void RingAttachGenerator(RecordRing *ring, SignalGenerator *generator);
+void RingAttachFilter(RecordRing *ring, FilterBank *filter);
+size_t RingImageArenaBytes(int numSlots, int rowsPerRecord, uint32_t recordBytes);
+bool RingCreateImage(RecordRing *ring, SampleArena *arena, int numSlots, int rowsPerRecord, uint32_t recordBytes);
+void RingAttachImage(RecordRing *ring, SourceFile *file, uint32_t dataStart, long numRecords);
+size_t RingAnnotationArenaBytes(int numSlots);
+bool RingAttachAnnotations(RecordRing *ring, SampleArena *arena, const bool *chanAnnotation, int64_t recordDuration);
+bool RingRefillStep(RecordRing *ring);
+void RingFill(RecordRing *ring);
+void RingRequestSeek(RecordRing *ring, long record);
+bool RingSeekDone(RecordRing *ring);
+void RingQueueSource(RecordRing *ring, SourceFile *file, uint32_t dataStart, long numRecords, const CalibrationQ *chanCal);
+
+inline bool RingIsFull(const RecordRing *ring)
+{
+  return ring->filledCount.load() - ring->releasedCount.load() >= (uint32_t)ring->numSlots;
+}
+
+inline bool RingHasRecord(const RecordRing *ring)
+{
+  return ring->filledCount.load() != ring->releasedCount.load();
+}
+
+/**
+ * @brief Columns of the oldest record that hasn't been released,
+ *        only valid while RingHasRecord() is true
+ */
+inline int32_t **RingCurrentRecord(const RecordRing *ring)
+{
+  uint32_t slot = ring->releasedCount.load() % ring->numSlots;
+  return &ring->columns[slot * ring->numColumns];
+}
+
+/**
+ * @brief Packet rows of the oldest record that hasn't been released, playback image only
+ */
+inline const uint8_t *RingCurrentImage(const RecordRing *ring)
+{
+  return ring->images[ring->releasedCount.load() % ring->numSlots];
+}
+
+/**
+ * @brief Annotations of the oldest record that hasn't been released, in the order they're in the file
+ */
+inline const RecordEvent *RingCurrentEvents(const RecordRing *ring, int *count)
+{
+  if (!ring->slotEvents)
+  {
+    *count = 0;
+    return nullptr;
+  }
+  uint32_t slot = ring->releasedCount.load() % ring->numSlots;
+  *count = ring->slotEventCount[slot];
+  return &ring->slotEvents[slot * RING_MAX_EVENTS];
+}
+
+/**
+ * @brief Which source the oldest record that hasn't been released came from, see RingQueueSource
+ */
+inline uint32_t RingCurrentSourceNum(const RecordRing *ring)
+{
+  return ring->slotSourceNum[ring->releasedCount.load() % ring->numSlots];
+}
+
+inline void RingReleaseRecord(RecordRing *ring)
+{
+  ring->releasedSourceNum = RingCurrentSourceNum(ring);
+  ring->releasedCount.fetch_add(1);
+}
@@ -0,0 +1,167 @@
+#include <math.h>
+#include <new>
+#include <string.h>
+#include "Resampler.h"
+
+static ResamplerTable tables[RESAMPLE_MAX_TABLES];
+static int numTables = 0;
+
+static int Gcd(int a, int b)
+{
+  while (b != 0)
+  {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/**
+ * @brief Designs the polyphase tables for one ratio
+ *
+ * Blackman-windowed sinc at the upsampled rate, cut off at 90% of the lower
+ * of the two Nyquist rates. Each phase is quantized to Q14 separately and
+ * its rounding error folded into its largest tap, so every phase has unity
+ * DC gain exactly.
+ */
+static bool DesignTable(ResamplerTable *table, int up, int down)
+{
+  int taps = RESAMPLE_TAPS * ((down + up - 1) / up);
+  if (taps > RESAMPLE_MAX_TAPS)
+  {
+    taps = RESAMPLE_MAX_TAPS;
+  }
+  table->coeffs = new (std::nothrow) int16_t[up * taps];
+  if (!table->coeffs)
+  {
+    return false;
+  }
+  table->up = up;
+  table->down = down;
+  table->taps = taps;
+
+  const int length = up * taps;
+  const float center = (length - 1) / 2.0f;
+  const float cutoff = 0.45f / (up > down ? up : down); // cycles per upsampled sample
+  float phaseCoeffs[RESAMPLE_MAX_TAPS];
+  for (int phase = 0; phase < up; phase++)
+  {
+    float sum = 0;
+    for (int k = 0; k < taps; k++)
+    {
+      float x = k * up + phase - center;
+      float sinc = x == 0 ? 1.0f : sinf(2 * (float)M_PI * cutoff * x) / ((float)M_PI * x * 2 * cutoff);
+      float w = 2 * (float)M_PI * (k * up + phase) / (length - 1);
+      float window = 0.42f - 0.5f * cosf(w) + 0.08f * cosf(2 * w);
+      phaseCoeffs[k] = sinc * window;
+      sum += phaseCoeffs[k];
+    }
+    int total = 0;
+    int largest = 0;
+    int16_t *coeffs = &table->coeffs[phase * taps];
+    for (int k = 0; k < taps; k++)
+    {
+      coeffs[k] = (int16_t)lrintf(phaseCoeffs[k] / sum * (1 << RESAMPLE_COEFF_SHIFT));
+      total += coeffs[k];
+      largest = coeffs[k] > coeffs[largest] ? k : largest;
+    }
+    coeffs[largest] += (1 << RESAMPLE_COEFF_SHIFT) - total;
+  }
+  return true;
+}
+
+/**
+ * @brief The shared tables for a ratio, designed the first time they're asked for
+ *
+ * @return nullptr if the ratio needs more than RESAMPLE_MAX_PHASES phases
+ *         or there's no room or memory left for another table
+ */
+const ResamplerTable *ResamplerTableFor(int up, int down)
+{
+  int divisor = Gcd(up, down);
+  up /= divisor;
+  down /= divisor;
+  for (int i = 0; i < numTables; i++)
+  {
+    if (tables[i].up == up && tables[i].down == down)
+    {
+      return &tables[i];
+    }
+  }
+  if (up > RESAMPLE_MAX_PHASES || numTables == RESAMPLE_MAX_TABLES || !DesignTable(&tables[numTables], up, down))
+  {
+    return nullptr;
+  }
+  return &tables[numTables++];
+}
+
+/**
+ * @brief Sets up a channel going from inRows to outRows samples per record
+ *
+ * @return false if the ratio isn't supported or there wasn't enough memory
+ */
+bool ResamplerCreate(ChannelResampler *rs, int inRows, int outRows)
+{
+  rs->table = ResamplerTableFor(outRows, inRows);
+  if (!rs->table)
+  {
+    return false;
+  }
+  rs->inRows = inRows;
+  rs->outRows = outRows;
+  rs->primed = false;
+  rs->buf = new (std::nothrow) int32_t[rs->table->taps - 1 + inRows];
+  return rs->buf != nullptr;
+}
+
+/**
+ * @brief Where the next record's inRows input samples have to be put
+ */
+int32_t *ResamplerInput(ChannelResampler *rs)
+{
+  return rs->buf + rs->table->taps - 1;
+}
+
+/**
+ * @brief Produces output rows firstRow to firstRow + numRows - 1 of the current record
+ *
+ * The record can be done in several calls, so the work can be sliced, as
+ * long as ResamplerFinishRecord is called once all outRows are done.
+ */
+void ResamplerRun(ChannelResampler *rs, int32_t *out, int firstRow, int numRows)
+{
+  const ResamplerTable *table = rs->table;
+  const int taps = table->taps;
+  int32_t *input = ResamplerInput(rs);
+  if (!rs->primed)
+  {
+    // no history yet, pretend the first sample had always been there
+    for (int k = 1; k < taps; k++)
+    {
+      input[-k] = input[0];
+    }
+    rs->primed = true;
+  }
+  uint32_t position = (uint32_t)firstRow * table->down; // in input samples times up
+  for (int n = firstRow; n < firstRow + numRows; n++, position += table->down)
+  {
+    const int16_t *coeffs = &table->coeffs[(position % table->up) * taps];
+    const int32_t *x = &input[position / table->up];
+    int64_t acc = (int64_t)1 << (RESAMPLE_COEFF_SHIFT - 1);
+    for (int k = 0; k < taps; k++)
+    {
+      acc += (int64_t)coeffs[k] * x[-k];
+    }
+    out[n] = (int32_t)(acc >> RESAMPLE_COEFF_SHIFT);
+  }
+}
+
+/**
+ * @brief Keeps the end of this record's input as history for the next one
+ */
+void ResamplerFinishRecord(ChannelResampler *rs)
+{
+  int history = rs->table->taps - 1;
+  memmove(rs->buf, rs->buf + rs->inRows, history * sizeof(int32_t));
+}
@@ -0,0 +1,50 @@
+/**
+ * @file Resampler.h
+ * @brief Streaming polyphase resampler that brings every channel to the output rate
+ *
+ * A channel with inRows samples per data record is resampled to outRows
+ * samples per record by the ratio up/down = outRows/inRows (reduced). The
+ * FIR is a windowed sinc designed once per ratio at setup and stored as
+ * Q14 polyphase tables: coeffs[phase * taps + k]. Output n of a record is
+ *
+ *     sum over k of coeffs[(n * down) % up][k] * x[(n * down) / up - k]
+ *
+ * where x is the channel's input, continued from the previous record
+ * through a history of taps - 1 samples, so there are no seams at record
+ * boundaries. Each phase sums to exactly 1 << 14, so DC passes unchanged.
+ *
+ * The filter is causal: a resampled channel lags its input by about taps/2
+ * input samples.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define RESAMPLE_MAX_PHASES 256 //largest reduced "up" factor handled, e.g. 256 for 250 Hz -> 256 Hz
+#define RESAMPLE_TAPS 16 //taps per phase when upsampling, scaled by down/up when decimating
+#define RESAMPLE_MAX_TAPS 128
+#define RESAMPLE_MAX_TABLES 8 //distinct ratios in one file
+#define RESAMPLE_COEFF_SHIFT 14
+
+struct ResamplerTable
+{
+  int up;
+  int down;
+  int taps;          // per phase
+  int16_t *coeffs;   // [phase * taps + k], Q14
+};
+
+struct ChannelResampler
+{
+  const ResamplerTable *table;
+  int inRows;        // input samples per record
+  int outRows;       // output samples per record
+  int32_t *buf;      // taps - 1 samples of history, then the record's inRows samples
+  bool primed;       // false until the history has been filled from the first record
+};
+
+const ResamplerTable *ResamplerTableFor(int up, int down);
+bool ResamplerCreate(ChannelResampler *rs, int inRows, int outRows);
+int32_t *ResamplerInput(ChannelResampler *rs);
+void ResamplerRun(ChannelResampler *rs, int32_t *out, int firstRow, int numRows);
+void ResamplerFinishRecord(ChannelResampler *rs);
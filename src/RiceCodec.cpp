@@ -0,0 +1,432 @@
+#include <string.h>
+#include "RiceCodec.h"
+
+/**
+ * @brief CRC-8, polynomial 0x07, initial value 0
+ */
+uint8_t Crc8(const uint8_t *data, size_t length)
+{
+  uint8_t crc = 0;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+    {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+/*
+ * MSB-first bit stream into a byte buffer. The 64-bit accumulator takes
+ * up to 32 bits per put and is drained a byte at a time.
+ */
+struct BitWriter
+{
+  uint8_t *dest;
+  uint8_t *end;
+  uint64_t acc;
+  int count;   // bits in acc
+  bool overflow;
+};
+
+static inline void PutBits(BitWriter *bw, uint32_t value, int count)
+{
+  bw->acc = (bw->acc << count) | value;
+  bw->count += count;
+  while (bw->count >= 8)
+  {
+    bw->count -= 8;
+    if (bw->dest == bw->end)
+    {
+      bw->overflow = true;
+      return;
+    }
+    *bw->dest++ = (uint8_t)(bw->acc >> bw->count);
+  }
+}
+
+static inline void FlushBits(BitWriter *bw)
+{
+  if (bw->count > 0)
+  {
+    PutBits(bw, 0, 8 - bw->count);
+  }
+}
+
+static inline int32_t SignExtend(int32_t value, int bits)
+{
+  return (int32_t)((uint32_t)value << (32 - bits)) >> (32 - bits);
+}
+
+/**
+ * @brief Prediction residual of x[i] from the samples before it, x[-1..-3] being history
+ */
+static inline int32_t Residual(const int32_t *x, int i, int order)
+{
+  switch (order)
+  {
+  case 0:
+    return x[i];
+  case 1:
+    return x[i] - x[i - 1];
+  case 2:
+    return x[i] - 2 * x[i - 1] + x[i - 2];
+  default:
+    return x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+  }
+}
+
+/**
+ * @param bits 16 or 24, the sample size of the uncompressed packets
+ * @param rows sample periods per block, up to RICE_MAX_ROWS
+ * @param keyframeInterval a keyframe every this many blocks, 1 for every block
+ * @return false if the layout isn't supported
+ */
+bool RiceEncoderCreate(RiceEncoder *enc, int channels, int bits, int rows, int keyframeInterval)
+{
+  if (channels < 1 || channels > RICE_MAX_CHANNELS || rows < 1 || rows > RICE_MAX_ROWS || (bits != 16 && bits != 24) ||
+      keyframeInterval < 1)
+  {
+    return false;
+  }
+  enc->channels = channels;
+  enc->bits = bits;
+  enc->rows = rows;
+  enc->keyframeInterval = keyframeInterval;
+  enc->rowsInBlock = 0;
+  enc->firstSample = 0;
+  enc->sequence = 0;
+  enc->blocksToKeyframe = 0;
+  memset(enc->history, 0, sizeof(enc->history));
+  return true;
+}
+
+/**
+ * @brief Codes one channel of the block, returns false if it ran out of room
+ */
+static bool EncodeChannel(RiceEncoder *enc, BitWriter *bw, int chan, bool keyframe)
+{
+  const int rows = enc->rows;
+  // x[-3..-1] is the history, x[0..rows-1] the block
+  int32_t buf[RICE_MAX_ORDER + RICE_MAX_ROWS];
+  int32_t *x = buf + RICE_MAX_ORDER;
+  // a keyframe starts from zeros, as the decoder does, so blocks shorter than the history don't carry it over
+  for (int i = 0; i < RICE_MAX_ORDER; i++)
+  {
+    x[-1 - i] = keyframe ? 0 : enc->history[chan][i];
+  }
+  memcpy(x, &enc->block[chan * rows], rows * sizeof(int32_t));
+
+  // a keyframe can't look before its first sample; judge every order on the same samples
+  int first = keyframe ? (rows > RICE_MAX_ORDER ? RICE_MAX_ORDER : rows) : 0;
+  uint64_t cost[RICE_MAX_ORDER + 1] = {0, 0, 0, 0};
+  for (int i = first; i < rows; i++)
+  {
+    int32_t d0 = x[i];
+    int32_t d1 = d0 - x[i - 1];
+    int32_t d2 = d1 - (x[i - 1] - x[i - 2]);
+    int32_t d3 = d2 - (x[i - 1] - 2 * x[i - 2] + x[i - 3]);
+    cost[0] += d0 < 0 ? -(int64_t)d0 : d0;
+    cost[1] += d1 < 0 ? -(int64_t)d1 : d1;
+    cost[2] += d2 < 0 ? -(int64_t)d2 : d2;
+    cost[3] += d3 < 0 ? -(int64_t)d3 : d3;
+  }
+  int order = 0;
+  for (int o = 1; o <= RICE_MAX_ORDER; o++)
+  {
+    order = cost[o] < cost[order] ? o : order;
+  }
+  int warmup = keyframe ? (order < rows ? order : rows) : 0;
+
+  // k such that 2^k is about the mean zigzagged residual
+  uint64_t sumU = 2 * cost[order];
+  uint64_t count = rows - first > 0 ? rows - first : 1;
+  int k = 0;
+  while (k < enc->bits + 2 && (count << (k + 1)) <= sumU)
+  {
+    k++;
+  }
+
+  PutBits(bw, (uint32_t)(order << 5 | k), 7);
+  for (int i = 0; i < warmup; i++)
+  {
+    PutBits(bw, (uint32_t)x[i] & ((1u << enc->bits) - 1), enc->bits);
+  }
+  const int escapeBits = enc->bits + 4;
+  for (int i = warmup; i < rows; i++)
+  {
+    int32_t r = Residual(x, i, order);
+    uint32_t u = ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+    uint32_t q = u >> k;
+    if (q < RICE_ESCAPE)
+    {
+      PutBits(bw, ((1u << q) - 1) << 1, q + 1);
+      if (k > 0)
+      {
+        PutBits(bw, u & ((1u << k) - 1), k);
+      }
+    }
+    else
+    {
+      PutBits(bw, (1u << RICE_ESCAPE) - 1, RICE_ESCAPE);
+      PutBits(bw, u, escapeBits);
+    }
+  }
+
+  // newest first, for the next block
+  for (int i = 0; i < RICE_MAX_ORDER; i++)
+  {
+    enc->history[chan][i] = x[rows - 1 - i];
+  }
+  return !bw->overflow;
+}
+
+/**
+ * @brief Codes the collected block into enc->out
+ *
+ * @return bytes of the finished block
+ */
+static size_t EncodeBlock(RiceEncoder *enc)
+{
+  bool keyframe = enc->blocksToKeyframe == 0;
+  enc->blocksToKeyframe = keyframe ? enc->keyframeInterval - 1 : enc->blocksToKeyframe - 1;
+  const size_t rawBytes = (size_t)enc->channels * enc->rows * enc->bits / 8;
+  uint8_t flags = (keyframe ? RICE_FLAG_KEYFRAME : 0) | (enc->bits == 24 ? RICE_FLAG_24BIT : 0);
+
+  // the coded payload has to beat the raw samples, or they're sent instead
+  BitWriter bw = {enc->out + RICE_HEADER_BYTES, enc->out + RICE_HEADER_BYTES + rawBytes, 0, 0, false};
+  int32_t savedHistory[RICE_MAX_CHANNELS][RICE_MAX_ORDER];
+  memcpy(savedHistory, enc->history, sizeof(savedHistory));
+  bool coded = true;
+  for (int chan = 0; chan < enc->channels && coded; chan++)
+  {
+    coded = EncodeChannel(enc, &bw, chan, keyframe);
+  }
+  FlushBits(&bw);
+  coded = coded && !bw.overflow;
+  size_t payload = bw.dest - (enc->out + RICE_HEADER_BYTES);
+  if (!coded)
+  {
+    flags |= RICE_FLAG_VERBATIM;
+    BitWriter raw = {enc->out + RICE_HEADER_BYTES, enc->out + RICE_HEADER_BYTES + rawBytes, 0, 0, false};
+    for (int chan = 0; chan < enc->channels; chan++)
+    {
+      const int32_t *x = &enc->block[chan * enc->rows];
+      for (int i = 0; i < enc->rows; i++)
+      {
+        PutBits(&raw, (uint32_t)x[i] & ((1u << enc->bits) - 1), enc->bits);
+      }
+      // oldest first, so the older history shifted along isn't overwritten before it's read
+      for (int i = RICE_MAX_ORDER - 1; i >= 0; i--)
+      {
+        savedHistory[chan][i] = i < enc->rows ? x[enc->rows - 1 - i] : keyframe ? 0 : savedHistory[chan][i - enc->rows];
+      }
+    }
+    memcpy(enc->history, savedHistory, sizeof(savedHistory));
+    payload = rawBytes;
+  }
+
+  uint8_t *header = enc->out;
+  header[0] = 0xFF;
+  header[1] = 0xFF;
+  header[2] = enc->firstSample & 0xFF;
+  header[3] = (enc->firstSample >> 8) & 0x7F;
+  header[4] = enc->sequence++;
+  header[5] = (uint8_t)enc->channels;
+  header[6] = (uint8_t)enc->rows;
+  header[7] = flags;
+  header[8] = payload & 0xFF;
+  header[9] = (payload >> 8) & 0xFF;
+  enc->out[RICE_HEADER_BYTES + payload] = Crc8(enc->out + 2, RICE_HEADER_BYTES - 2 + payload);
+  return RICE_HEADER_BYTES + payload + 1;
+}
+
+/**
+ * @brief Adds one sample period to the block, coding it once it's full
+ *
+ * Block channels past numColumns wrap around to the first column, as frames do.
+ *
+ * @param sampleNumber the sample's number in the stream, i.e. the packet counter
+ * @return bytes of the block now in enc->out, 0 if the block isn't full yet
+ */
+size_t RiceAppendRow(RiceEncoder *enc, uint32_t sampleNumber, int32_t *const *columns, int numColumns, int row)
+{
+  if (enc->rowsInBlock == 0)
+  {
+    enc->firstSample = sampleNumber;
+  }
+  int source = 0;
+  for (int chan = 0; chan < enc->channels; chan++)
+  {
+    enc->block[chan * enc->rows + enc->rowsInBlock] = SignExtend(columns[source][row], enc->bits);
+    source = source + 1 == numColumns ? 0 : source + 1;
+  }
+  if (++enc->rowsInBlock < enc->rows)
+  {
+    return 0;
+  }
+  enc->rowsInBlock = 0;
+  return EncodeBlock(enc);
+}
+
+void RiceDecoderInit(RiceDecoder *dec)
+{
+  dec->synced = false;
+  dec->sequence = 0;
+  dec->channels = 0;
+  dec->blocks = 0;
+  dec->badBlocks = 0;
+  dec->waitedBlocks = 0;
+}
+
+struct BitReader
+{
+  const uint8_t *src;
+  const uint8_t *end;
+  uint64_t acc;
+  int count;
+  bool overrun;
+};
+
+static inline uint32_t GetBits(BitReader *br, int count)
+{
+  while (br->count < count)
+  {
+    if (br->src == br->end)
+    {
+      br->overrun = true;
+      return 0;
+    }
+    br->acc = (br->acc << 8) | *br->src++;
+    br->count += 8;
+  }
+  br->count -= count;
+  return (uint32_t)(br->acc >> br->count) & (uint32_t)((1ull << count) - 1);
+}
+
+/**
+ * @brief Decodes one block from the start of buf
+ *
+ * A decoder that isn't synced (just started, or a block went missing)
+ * drops blocks until a keyframe.
+ *
+ * @param samples rows * channels values out, [row * channels + chan]
+ * @return bytes used if a block was decoded; 0 if buf doesn't hold a whole
+ *         block yet; -1 if buf doesn't start with a valid block (skip a
+ *         byte and look for the next sync); -2 if the block was valid but
+ *         dropped while waiting for a keyframe (skip RICE_HEADER_BYTES +
+ *         its length + 1 bytes, *rows is set to 0)
+ */
+long RiceDecodeBlock(RiceDecoder *dec, const uint8_t *buf, size_t length, int32_t *samples, int *channels,
+                     int *rows, uint32_t *counter)
+{
+  if (length < RICE_HEADER_BYTES + 1)
+  {
+    return 0;
+  }
+  if (buf[0] != 0xFF || buf[1] != 0xFF)
+  {
+    return -1;
+  }
+  size_t payload = buf[8] | (size_t)buf[9] << 8;
+  int numChans = buf[5];
+  int numRows = buf[6];
+  uint8_t flags = buf[7];
+  int bits = (flags & RICE_FLAG_24BIT) ? 24 : 16;
+  if (numChans < 1 || numChans > RICE_MAX_CHANNELS || numRows < 1 || numRows > RICE_MAX_ROWS ||
+      payload > (size_t)numChans * numRows * 3)
+  {
+    dec->badBlocks++;
+    return -1;
+  }
+  size_t total = RICE_HEADER_BYTES + payload + 1;
+  if (length < total)
+  {
+    return 0;
+  }
+  if (Crc8(buf + 2, RICE_HEADER_BYTES - 2 + payload) != buf[RICE_HEADER_BYTES + payload])
+  {
+    dec->badBlocks++;
+    return -1;
+  }
+
+  bool keyframe = flags & RICE_FLAG_KEYFRAME;
+  uint8_t sequence = buf[4];
+  if (!keyframe && (!dec->synced || sequence != dec->sequence || numChans != dec->channels))
+  {
+    dec->synced = false;
+    dec->waitedBlocks++;
+    *rows = 0;
+    return -2;
+  }
+  dec->sequence = sequence + 1;
+  dec->channels = numChans;
+  *channels = numChans;
+  *rows = numRows;
+  *counter = buf[2] | (uint32_t)buf[3] << 8;
+
+  BitReader br = {buf + RICE_HEADER_BYTES, buf + RICE_HEADER_BYTES + payload, 0, 0, false};
+  const uint32_t sampleMask = (1u << bits) - 1;
+  for (int chan = 0; chan < numChans; chan++)
+  {
+    int32_t buffer[RICE_MAX_ORDER + RICE_MAX_ROWS];
+    int32_t *x = buffer + RICE_MAX_ORDER;
+    for (int i = 0; i < RICE_MAX_ORDER; i++)
+    {
+      x[-1 - i] = keyframe ? 0 : dec->history[chan][i];
+    }
+    if (flags & RICE_FLAG_VERBATIM)
+    {
+      for (int i = 0; i < numRows; i++)
+      {
+        x[i] = SignExtend(GetBits(&br, bits), bits);
+      }
+    }
+    else
+    {
+      int order = GetBits(&br, 7);
+      int k = order & 0x1F;
+      order >>= 5;
+      int warmup = keyframe ? (order < numRows ? order : numRows) : 0;
+      for (int i = 0; i < warmup; i++)
+      {
+        x[i] = SignExtend(GetBits(&br, bits), bits);
+      }
+      for (int i = warmup; i < numRows && !br.overrun; i++)
+      {
+        uint32_t q = 0;
+        while (q < RICE_ESCAPE && GetBits(&br, 1) && !br.overrun)
+        {
+          q++;
+        }
+        uint32_t u = q < RICE_ESCAPE ? (q << k) | (k > 0 ? GetBits(&br, k) : 0) : GetBits(&br, bits + 4);
+        int32_t r = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+        // the prediction, i.e. x[i] - Residual(x, i, order) with x[i] = 0
+        int32_t prediction = order == 0 ? 0
+                             : order == 1 ? x[i - 1]
+                             : order == 2 ? 2 * x[i - 1] - x[i - 2]
+                                          : 3 * x[i - 1] - 3 * x[i - 2] + x[i - 3];
+        x[i] = SignExtend((int32_t)(((uint32_t)prediction + (uint32_t)r) & sampleMask), bits);
+      }
+    }
+    if (br.overrun)
+    {
+      dec->synced = false;
+      dec->badBlocks++;
+      return -1;
+    }
+    for (int i = 0; i < numRows; i++)
+    {
+      samples[i * numChans + chan] = x[i];
+    }
+    for (int i = 0; i < RICE_MAX_ORDER; i++)
+    {
+      dec->history[chan][i] = i < numRows ? x[numRows - 1 - i] : x[-1 - (i - numRows)];
+    }
+  }
+  dec->synced = true;
+  dec->blocks++;
+  return (long)total;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file RiceCodec.h
+ * @brief Lossless compressed stream: per-channel linear prediction and Rice coding over blocks
+ *
+ * Sample periods are collected into blocks of `rows` periods of every
+ * channel. Each channel of a block is predicted with the best of the fixed
+ * polynomial predictors of order 0 to 3 (the sample itself, its first,
+ * second or third difference, as in FLAC) and the residuals are Rice coded
+ * with a parameter chosen per channel per block. Prediction runs on across
+ * blocks, so the decoder needs the previous block, except for keyframes,
+ * which start from nothing: their first `order` samples of each channel
+ * are sent as they are. Keyframes come every keyframeInterval blocks, so a
+ * decoder that joins late or loses bytes resyncs at the next one.
+ *
+ * Values are coded as they'd be sent in an uncompressed packet, i.e. their
+ * low 16 or 24 bits sign-extended, so decoding gives back exactly what the
+ * simple packet or frame would have carried.
+ *
+ * Block layout, little endian:
+ *
+ *     0xFFFF                 sync
+ *     counter (16 bits)      sample number of the first row, modulo 32768
+ *     sequence (8 bits)      block number, modulo 256, to spot lost blocks
+ *     channels, rows         (8 bits each)
+ *     flags (8 bits)         RICE_FLAG_*
+ *     length (16 bits)       payload bytes
+ *     payload
+ *     CRC-8 (poly 0x07) of everything from counter to the end of the payload
+ *
+ * Payload, a bit stream MSB first, padded to a byte: for each channel,
+ * 2 bits of predictor order and 5 bits of Rice parameter k, then on
+ * keyframes `order` raw samples, then the residuals. A residual r is
+ * zigzagged to u = 2r or -2r - 1, then sent as u >> k in unary (that many
+ * 1s and a 0) and the low k bits of u; if u >> k would be RICE_ESCAPE or
+ * more, RICE_ESCAPE 1s are sent followed by u in sampleBits + 4 bits.
+ * Blocks that would come out bigger than their raw samples are sent raw
+ * instead (RICE_FLAG_VERBATIM, channel by channel, sampleBits each);
+ * prediction history still runs on through them.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RICE_MAX_CHANNELS 64
+#define RICE_MAX_ROWS 32 //most sample periods in one block
+#define RICE_HEADER_BYTES 10
+#define RICE_ESCAPE 20 //unary length that means "raw value follows"
+#define RICE_MAX_ORDER 3
+#define RICE_FLAG_KEYFRAME 0x01
+#define RICE_FLAG_VERBATIM 0x02
+#define RICE_FLAG_24BIT 0x04
+// biggest block: header, a raw payload of 24-bit samples and the CRC
+#define RICE_MAX_BLOCK_BYTES (RICE_HEADER_BYTES + RICE_MAX_CHANNELS * RICE_MAX_ROWS * 3 + 1)
+
+struct RiceEncoder
+{
+  int channels;
+  int bits;              // 16 or 24
+  int rows;              // sample periods per block
+  int keyframeInterval;  // blocks from one keyframe to the next
+  int rowsInBlock;       // rows collected so far
+  uint32_t firstSample;  // sample number of the block's first row
+  uint8_t sequence;
+  int blocksToKeyframe;  // 0 means the next block is a keyframe
+  int32_t history[RICE_MAX_CHANNELS][RICE_MAX_ORDER]; // last samples of the previous block, newest first
+  int32_t block[RICE_MAX_CHANNELS * RICE_MAX_ROWS];   // [chan * rows + row]
+  uint8_t out[RICE_MAX_BLOCK_BYTES];
+};
+
+struct RiceDecoder
+{
+  bool synced;           // have the history of the previous block
+  uint8_t sequence;      // expected sequence number of the next block
+  int channels;
+  int32_t history[RICE_MAX_CHANNELS][RICE_MAX_ORDER];
+  unsigned long blocks;        // decoded
+  unsigned long badBlocks;     // failed their CRC or made no sense
+  unsigned long waitedBlocks;  // valid but dropped while waiting for a keyframe
+};
+
+bool RiceEncoderCreate(RiceEncoder *enc, int channels, int bits, int rows, int keyframeInterval);
+size_t RiceAppendRow(RiceEncoder *enc, uint32_t sampleNumber, int32_t *const *columns, int numColumns, int row);
+
+void RiceDecoderInit(RiceDecoder *dec);
+uint8_t Crc8(const uint8_t *data, size_t length);
+long RiceDecodeBlock(RiceDecoder *dec, const uint8_t *buf, size_t length, int32_t *samples, int *channels,
+                     int *rows, uint32_t *counter);
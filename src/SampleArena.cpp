@@ -0,0 +1,52 @@
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include "SampleArena.h"
+
+/**
+ * @brief Readies the arena, in storage or in one allocation of capacity bytes
+ *
+ * @param storage ARENA_ALIGN-aligned RAM set aside at compile time, or null
+ *        to allocate it from the heap
+ * @return false if there wasn't enough memory
+ */
+bool ArenaCreate(SampleArena *arena, void *storage, size_t capacity)
+{
+  memset(arena, 0, sizeof(*arena));
+  arena->base = storage ? (uint8_t *)storage : new (std::nothrow) uint8_t[capacity];
+  if (!arena->base)
+  {
+    return false;
+  }
+  arena->capacity = capacity;
+  return true;
+}
+
+/**
+ * @brief Takes the next bytes of the arena, zeroed
+ *
+ * @return null if there isn't room
+ */
+void *ArenaAlloc(SampleArena *arena, size_t bytes, ArenaUse use)
+{
+  size_t size = ArenaSize(bytes);
+  if (!arena->base || size > arena->capacity - arena->used)
+  {
+    return nullptr;
+  }
+  uint8_t *block = arena->base + arena->used;
+  arena->used += size;
+  arena->useBytes[use] += size;
+  memset(block, 0, size);
+  return block;
+}
+
+/**
+ * @brief One line of what the arena holds, for the console
+ */
+void ArenaReport(const SampleArena *arena, char *line, size_t lineBytes)
+{
+  snprintf(line, lineBytes, "RAM: %lu of %lu bytes: samples %lu, channel tables %lu, ring %lu",
+           (unsigned long)arena->used, (unsigned long)arena->capacity, (unsigned long)arena->useBytes[ARENA_SAMPLES],
+           (unsigned long)arena->useBytes[ARENA_CHANNELS], (unsigned long)arena->useBytes[ARENA_RING]);
+}
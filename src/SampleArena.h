@@ -0,0 +1,58 @@
+/**
+ * @file SampleArena.h
+ * @brief One block of RAM for the record ring and the per-channel tables
+ *
+ * Everything playback keeps for the life of the file (the ring's sample
+ * columns and slot bookkeeping, and the tables of the channels read) is
+ * carved out of one block, sized once at startup from the file's layout,
+ * or reserved at compile time for a fixed configuration. Nothing is freed,
+ * so the heap isn't fragmented by thousands of small column allocations,
+ * and the samples of a record are contiguous: column after column of
+ * rowsPerRecord values, slot after slot.
+ *
+ * Each allocation is counted against what it's for (ArenaUse), which is
+ * what the RAM budget report prints.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ARENA_ALIGN 8 //every allocation starts on a multiple of this
+
+enum ArenaUse
+{
+  ARENA_SAMPLES,  // calibrated columns, or playback image records
+  ARENA_CHANNELS, // per-channel and per-column tables
+  ARENA_RING,     // slot bookkeeping, staging and annotations
+  ARENA_USE_COUNT
+};
+
+struct SampleArena
+{
+  uint8_t *base;
+  size_t capacity;
+  size_t used;
+  size_t useBytes[ARENA_USE_COUNT];
+};
+
+bool ArenaCreate(SampleArena *arena, void *storage, size_t capacity);
+void *ArenaAlloc(SampleArena *arena, size_t bytes, ArenaUse use);
+void ArenaReport(const SampleArena *arena, char *line, size_t lineBytes);
+
+/**
+ * @brief Bytes an allocation takes up in the arena, padding included
+ */
+inline size_t ArenaSize(size_t bytes)
+{
+  return (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/**
+ * @brief Zeroed room for count Ts, null if the arena is out of room; only for plain structs
+ */
+template <typename T>
+T *ArenaNew(SampleArena *arena, size_t count, ArenaUse use)
+{
+  return (T *)ArenaAlloc(arena, count * sizeof(T), use);
+}
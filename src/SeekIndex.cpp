@@ -0,0 +1,307 @@
+#include <string.h>
+#include "SeekIndex.h"
+#include "TalParser.h"
+
+static const char indexMagic[8] = {'V', 'E', 'E', 'G', 'S', 'I', 'D', 'X'};
+static const int entriesPerSector = SEEK_INDEX_SECTOR_BYTES / 8;
+
+static void Put32(uint8_t *dest, uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    dest[i] = (value >> (8 * i)) & 0xFF;
+  }
+}
+
+static void Put64(uint8_t *dest, uint64_t value)
+{
+  Put32(dest, (uint32_t)value);
+  Put32(dest + 4, (uint32_t)(value >> 32));
+}
+
+static uint32_t Get32(const uint8_t *src)
+{
+  return src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+static uint64_t Get64(const uint8_t *src)
+{
+  return Get32(src) | (uint64_t)Get32(src + 4) << 32;
+}
+
+/**
+ * @brief The EDF file's size and modification time, as the index header keeps them
+ */
+static bool SourceStamp(SourceFile *edf, uint32_t *size, uint32_t *stamp)
+{
+  uint16_t date, time;
+  if (!edf->getModifyDateTime(&date, &time))
+  {
+    return false;
+  }
+  *size = edf->fileSize();
+  *stamp = (uint32_t)date << 16 | time;
+  return true;
+}
+
+/**
+ * @brief Writes an index of the EDF file's record start times to indexFile
+ *
+ * Reads the timekeeping TAL of every data record, SEEK_INDEX_TAL_BYTES
+ * each. The EDF file is left wherever the last read was.
+ *
+ * @param badRecord set to the record whose TAL couldn't be read, with SEEK_INDEX_ERR_TAL
+ * @return 0, or one of the SEEK_INDEX_ERR_ codes
+ */
+int SeekIndexBuild(SourceFile *indexFile, SourceFile *edf, const EdfFileHeader *header, int *badRecord)
+{
+  const edf_signal_struct *annotations = nullptr;
+  for (int i = 0; i < header->layout.total_signals && annotations == nullptr; i++)
+  {
+    if (header->signals[i].annotation)
+    {
+      annotations = &header->signals[i];
+    }
+  }
+  if (annotations == nullptr)
+  {
+    return SEEK_INDEX_ERR_NO_ANNOTATIONS;
+  }
+  uint32_t edfSize, edfStamp;
+  if (!SourceStamp(edf, &edfSize, &edfStamp))
+  {
+    return SEEK_INDEX_ERR_READ;
+  }
+
+  uint8_t sector[SEEK_INDEX_SECTOR_BYTES];
+  // a placeholder header until every record has been read
+  memset(sector, 0, sizeof(sector));
+  indexFile->rewind();
+  if (indexFile->write(sector, sizeof(sector)) != (int)sizeof(sector))
+  {
+    return SEEK_INDEX_ERR_WRITE;
+  }
+
+  const uint32_t numRecords = (uint32_t)header->hdr.datarecords_in_file;
+  const int talBytes = annotations->smp_per_record * header->layout.bytes_per_sample;
+  const int readBytes = talBytes < SEEK_INDEX_TAL_BYTES ? talBytes : SEEK_INDEX_TAL_BYTES;
+  char tal[SEEK_INDEX_TAL_BYTES];
+  int64_t previous = INT64_MIN;
+  int entries = 0;
+  for (uint32_t record = 0; record < numRecords; record++)
+  {
+    uint64_t offset = header->layout.header_bytes + (uint64_t)record * header->layout.record_bytes + annotations->record_offset;
+    int64_t onset;
+    if (!edf->seekSet((uint32_t)offset) || edf->read(tal, readBytes) != readBytes)
+    {
+      return SEEK_INDEX_ERR_READ;
+    }
+    if (!TalParseOnset(tal, readBytes, &onset) || onset <= previous)
+    {
+      // missing, or out of order so the index couldn't be searched
+      *badRecord = (int)record;
+      return SEEK_INDEX_ERR_TAL;
+    }
+    previous = onset;
+    Put64(sector + entries * 8, (uint64_t)onset);
+    entries++;
+    if (entries == entriesPerSector || record == numRecords - 1)
+    {
+      if (indexFile->write(sector, entries * 8) != entries * 8)
+      {
+        return SEEK_INDEX_ERR_WRITE;
+      }
+      entries = 0;
+    }
+  }
+
+  memset(sector, 0, sizeof(sector));
+  memcpy(sector, indexMagic, sizeof(indexMagic));
+  Put32(sector + 8, SEEK_INDEX_VERSION);
+  Put32(sector + 12, edfSize);
+  Put32(sector + 16, edfStamp);
+  Put32(sector + 20, numRecords);
+  Put64(sector + 24, (uint64_t)header->hdr.datarecord_duration);
+  if (!indexFile->seekSet(0) || indexFile->write(sector, sizeof(sector)) != (int)sizeof(sector))
+  {
+    return SEEK_INDEX_ERR_WRITE;
+  }
+  return 0;
+}
+
+/**
+ * @brief Reads count start times from the index, beginning with the first'th
+ */
+static bool ReadStarts(SeekIndex *index, uint32_t first, uint32_t count, int64_t *starts)
+{
+  uint8_t bytes[SEEK_INDEX_SECTOR_BYTES];
+  index->reads++;
+  if (!index->file->seekSet(SEEK_INDEX_SECTOR_BYTES + first * 8) ||
+      index->file->read(bytes, count * 8) != (int)(count * 8))
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < count; i++)
+  {
+    starts[i] = (int64_t)Get64(bytes + i * 8);
+  }
+  return true;
+}
+
+/**
+ * @brief Checks the index is for this EDF file as it is now, and readies it for finds
+ *
+ * @return 0, or one of the SEEK_INDEX_ERR_ codes; SEEK_INDEX_ERR_STALE if
+ *         the EDF file has changed since it was made
+ */
+int SeekIndexOpen(SeekIndex *index, SourceFile *indexFile, SourceFile *edf, const EdfFileHeader *header)
+{
+  uint8_t sector[SEEK_INDEX_SECTOR_BYTES];
+  memset(index, 0, sizeof(*index));
+  index->file = indexFile;
+  indexFile->rewind();
+  if (indexFile->read(sector, sizeof(sector)) != (int)sizeof(sector))
+  {
+    return SEEK_INDEX_ERR_READ;
+  }
+  if (memcmp(sector, indexMagic, sizeof(indexMagic)) != 0)
+  {
+    return SEEK_INDEX_ERR_MAGIC;
+  }
+  if (Get32(sector + 8) != SEEK_INDEX_VERSION)
+  {
+    return SEEK_INDEX_ERR_VERSION;
+  }
+  uint32_t edfSize, edfStamp;
+  if (!SourceStamp(edf, &edfSize, &edfStamp))
+  {
+    return SEEK_INDEX_ERR_READ;
+  }
+  index->numRecords = Get32(sector + 20);
+  index->recordDuration = (int64_t)Get64(sector + 24);
+  if (Get32(sector + 12) != edfSize || Get32(sector + 16) != edfStamp ||
+      index->numRecords != (uint32_t)header->hdr.datarecords_in_file ||
+      index->recordDuration != header->hdr.datarecord_duration)
+  {
+    return SEEK_INDEX_ERR_STALE;
+  }
+  if (index->numRecords == 0 ||
+      (uint64_t)SEEK_INDEX_SECTOR_BYTES + (uint64_t)index->numRecords * 8 > indexFile->fileSize())
+  {
+    return SEEK_INDEX_ERR_SIZE;
+  }
+  index->sampleStride = (index->numRecords + SEEK_INDEX_SAMPLES - 1) / SEEK_INDEX_SAMPLES;
+  index->numSamples = (index->numRecords + index->sampleStride - 1) / index->sampleStride;
+  for (uint32_t i = 0; i < index->numSamples; i++)
+  {
+    if (!ReadStarts(index, i * index->sampleStride, 1, &index->samples[i]))
+    {
+      return SEEK_INDEX_ERR_READ;
+    }
+  }
+  index->reads = 0;
+  return 0;
+}
+
+/**
+ * @brief Finds where playback of fileTime is
+ *
+ * The RAM samples narrow the search to one stride of the index, halving
+ * it by single reads until it fits a sector, which is read whole.
+ *
+ * @param fileTime 100 ns units from the file's start time
+ * @param record set to the last record starting at or before fileTime; if
+ *        fileTime falls in a gap between records, the record after the gap
+ * @param offset set to fileTime's offset into that record, 0 to recordDuration - 1
+ * @return false if the index couldn't be read
+ */
+bool SeekIndexFind(SeekIndex *index, int64_t fileTime, long *record, int64_t *offset)
+{
+  index->finds++;
+  uint32_t sample = 0;
+  while (sample < index->numSamples && index->samples[sample] <= fileTime)
+  {
+    sample++;
+  }
+  if (sample == 0)
+  {
+    // before the first record
+    *record = 0;
+    *offset = 0;
+    return true;
+  }
+  // the answer is in [lo, hi)
+  uint32_t lo = (sample - 1) * index->sampleStride;
+  uint32_t hi = lo + index->sampleStride < index->numRecords ? lo + index->sampleStride : index->numRecords;
+  int64_t start;
+  while (hi - lo > (uint32_t)entriesPerSector)
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (!ReadStarts(index, mid, 1, &start))
+    {
+      return false;
+    }
+    if (start <= fileTime)
+    {
+      lo = mid;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  int64_t starts[entriesPerSector];
+  if (!ReadStarts(index, lo, hi - lo, starts))
+  {
+    return false;
+  }
+  uint32_t found = 0;
+  while (found + 1 < hi - lo && starts[found + 1] <= fileTime)
+  {
+    found++;
+  }
+  *record = (long)(lo + found);
+  *offset = fileTime - starts[found];
+  if (*offset >= index->recordDuration)
+  {
+    if ((uint32_t)*record + 1 < index->numRecords)
+    {
+      // in a gap, carry on from the record after it
+      (*record)++;
+      *offset = 0;
+    }
+    else
+    {
+      // past the end, the last sample of the file
+      *offset = index->recordDuration - 1;
+    }
+  }
+  return true;
+}
+
+const char *SeekIndexErrorString(int error)
+{
+  switch (error)
+  {
+  case 0:
+    return "ok";
+  case SEEK_INDEX_ERR_READ:
+    return "couldn't read it";
+  case SEEK_INDEX_ERR_MAGIC:
+    return "not a seek index";
+  case SEEK_INDEX_ERR_VERSION:
+    return "made by another version";
+  case SEEK_INDEX_ERR_STALE:
+    return "out of date with output.edf";
+  case SEEK_INDEX_ERR_SIZE:
+    return "file is shorter than its header says";
+  case SEEK_INDEX_ERR_NO_ANNOTATIONS:
+    return "EDF file has no annotations signal";
+  case SEEK_INDEX_ERR_TAL:
+    return "a data record doesn't start with a timekeeping TAL";
+  case SEEK_INDEX_ERR_WRITE:
+    return "couldn't write it";
+  default:
+    return "unknown error";
+  }
+}
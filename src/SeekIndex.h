@@ -0,0 +1,67 @@
+/**
+ * @file SeekIndex.h
+ * @brief Sidecar index of data record start times, for seeking by time in EDF+D/BDF+D files
+ *
+ * In a discontinuous file the records aren't back to back in time, so the
+ * record playing at a given file time can only be found from the
+ * timekeeping TAL that starts each record's first annotation signal. Reading
+ * that from every record on each seek would mean a read per record of a
+ * multi-GB file, so it's done once and the start times kept in an index file
+ * next to output.edf. Seeks then binary search the index: a few short reads,
+ * whatever the length of the recording.
+ *
+ * Only start times are stored: records are all the same size, so record i
+ * begins at header_bytes + i * record_bytes in the EDF file.
+ *
+ * Layout: one header sector, then numRecords start times, each 64 bits
+ * little endian in 100 ns units from the file's start time. The header,
+ * little endian:
+ *
+ *     0   "VEEGSIDX"
+ *     8   version (32 bits, SEEK_INDEX_VERSION)
+ *     12  size of the EDF file it was made from (32 bits)
+ *     16  that file's modification time, FAT date << 16 | FAT time (32 bits)
+ *     20  numRecords (32 bits)
+ *     24  data record duration, 100 ns units (64 bits)
+ *
+ * The index is rebuilt when the EDF file's size or modification time no
+ * longer match.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "platform.h"
+#include "EdfHeader.h"
+
+#define SEEK_INDEX_FILE_NAME "output.idx"
+#define SEEK_INDEX_VERSION 1
+#define SEEK_INDEX_SECTOR_BYTES 512
+#define SEEK_INDEX_TAL_BYTES 48 //bytes read from the start of each record's annotations, enough for its timekeeping TAL
+#define SEEK_INDEX_SAMPLES 64 //start times kept in RAM, evenly spaced through the index, to start each search
+
+#define SEEK_INDEX_ERR_READ 1
+#define SEEK_INDEX_ERR_MAGIC 2
+#define SEEK_INDEX_ERR_VERSION 3
+#define SEEK_INDEX_ERR_STALE 4
+#define SEEK_INDEX_ERR_SIZE 5
+#define SEEK_INDEX_ERR_NO_ANNOTATIONS 6
+#define SEEK_INDEX_ERR_TAL 7
+#define SEEK_INDEX_ERR_WRITE 8
+
+struct SeekIndex
+{
+  SourceFile *file;
+  uint32_t numRecords;
+  int64_t recordDuration;                  // 100 ns units
+  int64_t samples[SEEK_INDEX_SAMPLES];     // start time of every sampleStride-th record
+  uint32_t sampleStride;
+  uint32_t numSamples;
+  // totals
+  unsigned long finds;
+  unsigned long reads;                     // index file reads made by finds
+};
+
+int SeekIndexBuild(SourceFile *indexFile, SourceFile *edf, const EdfFileHeader *header, int *badRecord);
+int SeekIndexOpen(SeekIndex *index, SourceFile *indexFile, SourceFile *edf, const EdfFileHeader *header);
+bool SeekIndexFind(SeekIndex *index, int64_t fileTime, long *record, int64_t *offset);
+const char *SeekIndexErrorString(int error);
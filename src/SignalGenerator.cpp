@@ -0,0 +1,257 @@
+#include "SignalGenerator.h"
+
+/*
+ * Compile-time tables. The firmware is built as C++11, so constexpr
+ * functions are single expressions (hence the recursion) and the table
+ * initialisers are expanded from a list of indices built by doubling.
+ */
+static constexpr double GEN_PI = 3.14159265358979323846;
+
+static constexpr double TaylorSin(double x, double term, double sum, int n)
+{
+  return n > 25 ? sum : TaylorSin(x, -term * x * x / ((n + 1) * (n + 2)), sum + term, n + 2);
+}
+
+// sin(x) for x in [0, 2 pi), accurate to well under 1e-12
+static constexpr double ConstSin(double x)
+{
+  return x > GEN_PI ? -TaylorSin(x - GEN_PI, x - GEN_PI, 0, 1) : TaylorSin(x, x, 0, 1);
+}
+
+static constexpr int16_t RoundQ15(double v)
+{
+  return (int16_t)(v >= 0 ? v * 32767 + 0.5 : v * 32767 - 0.5);
+}
+
+static constexpr int16_t SineEntry(int i, int length)
+{
+  return RoundQ15(ConstSin(2 * GEN_PI * i / length));
+}
+
+// one cycle of sin(x) * (1 - cos(x)) / 2, scaled so its peak (at x = 2 pi / 3) is full scale
+static constexpr int16_t SpikeEntry(int i, int length)
+{
+  return RoundQ15(ConstSin(2 * GEN_PI * i / length) * (1 - ConstSin(2 * GEN_PI * ((i + length / 4) % length) / length)) /
+                  2 / 0.649519052838329);
+}
+
+template <int... I> struct IndexList
+{
+  typedef IndexList<I..., (int)sizeof...(I) + I...> Doubled;
+};
+
+template <int N> struct MakeIndexList
+{
+  typedef typename MakeIndexList<N / 2>::type::Doubled type; // N must be a power of two
+};
+
+template <> struct MakeIndexList<1>
+{
+  typedef IndexList<0> type;
+};
+
+template <typename List> struct WaveTables;
+
+template <int... I> struct WaveTables<IndexList<I...>>
+{
+  static constexpr int16_t sine[sizeof...(I)] = {SineEntry(I, sizeof...(I))...};
+  static constexpr int16_t spike[sizeof...(I)] = {SpikeEntry(I, sizeof...(I))...};
+};
+
+template <int... I> constexpr int16_t WaveTables<IndexList<I...>>::sine[sizeof...(I)];
+template <int... I> constexpr int16_t WaveTables<IndexList<I...>>::spike[sizeof...(I)];
+
+typedef WaveTables<MakeIndexList<1 << GEN_SINE_BITS>::type> SineTables;
+typedef WaveTables<MakeIndexList<GEN_SPIKE_SAMPLES>::type> SpikeTables;
+
+static const int16_t *const sineTable = SineTables::sine;
+static const int16_t *const spikeTable = SpikeTables::spike;
+
+#define GEN_PHASE_SHIFT (32 - GEN_SINE_BITS)
+
+static uint32_t PhaseIncrement(double hz, uint32_t sampleRate)
+{
+  double cycles = hz / sampleRate;
+  cycles -= (long)cycles; // only the fraction of a cycle per sample matters
+  return (uint32_t)(cycles * 4294967296.0);
+}
+
+/**
+ * @brief Entry of the sine table, full scale is 32767
+ */
+int16_t GeneratorSineQ15(uint32_t index)
+{
+  return sineTable[index & ((1 << GEN_SINE_BITS) - 1)];
+}
+
+/**
+ * @brief Sets up every channel and puts them all at sample 0
+ *
+ * @param configs one per channel
+ * @param lineHz mains frequency, 50 or 60
+ * @param lineAmplitude peak of the mains interference added to every channel, 0 for none
+ */
+void GeneratorCreate(SignalGenerator *gen, int numChans, uint32_t sampleRate, const GeneratorChannelConfig *configs,
+                     float lineHz, int32_t lineAmplitude)
+{
+  gen->numChans = numChans > GEN_MAX_CHANNELS ? GEN_MAX_CHANNELS : numChans;
+  gen->sampleRate = sampleRate;
+  gen->lineAmplitude = lineAmplitude;
+  gen->lineIncrement = PhaseIncrement(lineHz, sampleRate);
+  for (int chan = 0; chan < gen->numChans; chan++)
+  {
+    const GeneratorChannelConfig *config = &configs[chan];
+    GeneratorChannel *ch = &gen->chans[chan];
+    ch->waveform = config->waveform;
+    ch->amplitude = config->amplitude;
+    ch->startIncrement = PhaseIncrement(config->frequency, sampleRate);
+    ch->sweepSamples = 0;
+    ch->incrementStep = 0;
+    if (config->waveform == GEN_CHIRP && config->sweepSecs > 0)
+    {
+      ch->sweepSamples = (uint32_t)(config->sweepSecs * sampleRate);
+      uint32_t endIncrement = PhaseIncrement(config->endFrequency, sampleRate);
+      ch->incrementStep = (uint32_t)(((int64_t)endIncrement - (int64_t)ch->startIncrement) / (int64_t)ch->sweepSamples);
+    }
+  }
+  GeneratorSeek(gen, 0);
+}
+
+/**
+ * @brief Puts every channel where a run from sample 0 would be at this sample
+ *
+ * Pink noise can't be wound forward, it's restarted from a seed that
+ * depends on the sample number instead.
+ */
+void GeneratorSeek(SignalGenerator *gen, uint64_t sample)
+{
+  for (int chan = 0; chan < gen->numChans; chan++)
+  {
+    GeneratorChannel *ch = &gen->chans[chan];
+    // phase arithmetic is modulo 2^32, so the products only need their low 32 bits
+    uint64_t pos = ch->sweepSamples ? sample % ch->sweepSamples : sample;
+    ch->sweepPos = (uint32_t)pos;
+    ch->increment = ch->startIncrement + (uint32_t)pos * ch->incrementStep;
+    ch->phase = (uint32_t)(pos * ch->startIncrement + (pos * (pos - (pos > 0))) / 2 * ch->incrementStep);
+    ch->spikePos = ch->increment ? ch->phase / ch->increment : GEN_SPIKE_SAMPLES;
+    if (ch->spikePos > GEN_SPIKE_SAMPLES)
+    {
+      ch->spikePos = GEN_SPIKE_SAMPLES;
+    }
+    ch->noiseState = (uint32_t)(sample * 2654435761u) | 1;
+    ch->noiseCounter = 0;
+    ch->noiseSum = 0;
+    for (int row = 0; row < GEN_PINK_ROWS; row++)
+    {
+      ch->noiseRows[row] = 0;
+    }
+    int64_t span = 2 * (int64_t)ch->amplitude;
+    ch->rampValue = span > 0 ? (int32_t)(sample % span) - ch->amplitude : 0;
+    ch->linePhase = (uint32_t)(sample * gen->lineIncrement);
+  }
+}
+
+static inline int32_t NextWhite(GeneratorChannel *ch)
+{
+  uint32_t x = ch->noiseState;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  ch->noiseState = x;
+  return (int32_t)x >> 20; // +-2048
+}
+
+/**
+ * @brief Produces the next count samples of one channel
+ */
+void GeneratorRun(SignalGenerator *gen, int chan, int32_t *out, int count)
+{
+  GeneratorChannel *ch = &gen->chans[chan];
+  const int32_t amplitude = ch->amplitude;
+  uint32_t phase = ch->phase;
+  uint32_t increment = ch->increment;
+  switch (ch->waveform)
+  {
+  case GEN_SINE:
+    for (int i = 0; i < count; i++)
+    {
+      out[i] = (sineTable[phase >> GEN_PHASE_SHIFT] * amplitude) >> 15;
+      phase += increment;
+    }
+    break;
+  case GEN_CHIRP:
+    for (int i = 0; i < count; i++)
+    {
+      out[i] = (sineTable[phase >> GEN_PHASE_SHIFT] * amplitude) >> 15;
+      phase += increment;
+      increment += ch->incrementStep;
+      if (++ch->sweepPos == ch->sweepSamples)
+      {
+        ch->sweepPos = 0;
+        phase = 0;
+        increment = ch->startIncrement;
+      }
+    }
+    break;
+  case GEN_SQUARE:
+    for (int i = 0; i < count; i++)
+    {
+      out[i] = (phase & 0x80000000u) ? -amplitude : amplitude;
+      phase += increment;
+    }
+    break;
+  case GEN_SPIKES:
+    for (int i = 0; i < count; i++)
+    {
+      if (phase < increment)
+      {
+        ch->spikePos = 0; // the phase has just wrapped
+      }
+      out[i] = ch->spikePos < GEN_SPIKE_SAMPLES ? (spikeTable[ch->spikePos++] * amplitude) >> 15 : 0;
+      phase += increment;
+    }
+    break;
+  case GEN_PINK_NOISE:
+    for (int i = 0; i < count; i++)
+    {
+      // Voss-McCartney: row k is redrawn every 2^(k+1) samples, staggered so only one changes per sample
+      uint32_t counter = ++ch->noiseCounter;
+      int row = __builtin_ctz(counter);
+      if (row < GEN_PINK_ROWS)
+      {
+        int32_t white = NextWhite(ch);
+        ch->noiseSum += white - ch->noiseRows[row];
+        ch->noiseRows[row] = white;
+      }
+      // GEN_PINK_ROWS + 1 values of +-2^11
+      out[i] = (int32_t)(((int64_t)(ch->noiseSum + NextWhite(ch)) * amplitude) >> 14);
+    }
+    break;
+  case GEN_RAMP:
+  {
+    int32_t value = ch->rampValue;
+    for (int i = 0; i < count; i++)
+    {
+      out[i] = value;
+      value = value == amplitude - 1 ? -amplitude : value + 1;
+    }
+    ch->rampValue = value;
+    break;
+  }
+  }
+  ch->phase = phase;
+  ch->increment = increment;
+
+  if (gen->lineAmplitude != 0)
+  {
+    const int32_t lineAmplitude = gen->lineAmplitude;
+    const uint32_t lineIncrement = gen->lineIncrement;
+    uint32_t linePhase = ch->linePhase;
+    for (int i = 0; i < count; i++)
+    {
+      out[i] += (sineTable[linePhase >> GEN_PHASE_SHIFT] * lineAmplitude) >> 15;
+      linePhase += lineIncrement;
+    }
+    ch->linePhase = linePhase;
+  }
+}
@@ -0,0 +1,82 @@
+/**
+ * @file SignalGenerator.h
+ * @brief Synthetic test signals, a stand-in for the EDF file when there's no SD card
+ *
+ * Each channel is a sine, chirp, square wave, pink noise, spike train or
+ * ramp, optionally with mains interference added. Every periodic waveform
+ * runs off a 32-bit phase accumulator (2^32 = one cycle) indexing tables
+ * that are computed at compile time, so a sample costs a table lookup, a
+ * multiply and a few adds.
+ *
+ * The output is in the same physical units the EDF path produces, so it
+ * goes through the record ring and the packet code unchanged. Everything
+ * but pink noise is a pure function of the sample number: GeneratorSeek()
+ * lands on exactly the samples a straight run would have produced, and the
+ * PC side can check what it receives against the formula.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define GEN_MAX_CHANNELS 8
+#define GEN_SINE_BITS 10 //log2 of the sine table length
+#define GEN_SPIKE_SAMPLES 32 //length of one spike
+#define GEN_PINK_ROWS 8 //octaves of the Voss-McCartney pink noise
+
+enum GeneratorWaveform
+{
+  GEN_SINE,       // frequency, amplitude is the peak
+  GEN_CHIRP,      // sweeps frequency to endFrequency over sweepSecs, then starts again
+  GEN_SQUARE,     // +amplitude for the first half cycle, -amplitude for the second
+  GEN_PINK_NOISE, // 1/f noise, amplitude is roughly the peak
+  GEN_SPIKES,     // a biphasic spike GEN_SPIKES_SAMPLES long, frequency times a second
+  GEN_RAMP        // counts up by one per sample from -amplitude to amplitude - 1, then wraps
+};
+
+struct GeneratorChannelConfig
+{
+  int waveform;
+  float frequency;     // Hz
+  float endFrequency;  // GEN_CHIRP only, Hz
+  float sweepSecs;     // GEN_CHIRP only
+  int32_t amplitude;   // physical units, e.g. uV, 1 to 65535
+};
+
+struct GeneratorChannel
+{
+  int waveform;
+  int32_t amplitude;
+  uint32_t phase;
+  uint32_t increment;       // phase step per sample
+  // GEN_CHIRP
+  uint32_t startIncrement;
+  uint32_t incrementStep;   // added to increment every sample, modulo 2^32
+  uint32_t sweepSamples;
+  uint32_t sweepPos;
+  // GEN_SPIKES
+  uint32_t spikePos;        // sample of the current spike, GEN_SPIKE_SAMPLES when between spikes
+  // GEN_PINK_NOISE
+  uint32_t noiseState;      // xorshift32
+  uint32_t noiseCounter;
+  int32_t noiseRows[GEN_PINK_ROWS];
+  int32_t noiseSum;
+  // GEN_RAMP
+  int32_t rampValue;
+  // mains interference, same phase on every channel
+  uint32_t linePhase;
+};
+
+struct SignalGenerator
+{
+  int numChans;
+  uint32_t sampleRate;
+  int32_t lineAmplitude;    // 0 for no mains interference
+  uint32_t lineIncrement;
+  GeneratorChannel chans[GEN_MAX_CHANNELS];
+};
+
+void GeneratorCreate(SignalGenerator *gen, int numChans, uint32_t sampleRate, const GeneratorChannelConfig *configs,
+                     float lineHz, int32_t lineAmplitude);
+void GeneratorSeek(SignalGenerator *gen, uint64_t sample);
+void GeneratorRun(SignalGenerator *gen, int chan, int32_t *out, int count);
+int16_t GeneratorSineQ15(uint32_t index);
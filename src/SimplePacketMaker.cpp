@@ -1,11 +1,111 @@
-#include <Arduino.h>
+#include "platform.h"
 #include "SimplePacketMaker.h"
+#include "TimingStats.h"
 
 void WriteOutInt32AsInt16(int32_t toConvert);
 
+/**
+ * @brief Sends one packet with a single transport write
+ *        and advances its counter, like SendOutPacketBytewise
+ */
 extern void SendOutPacket(OutPacket* ToSend) 
 {
-    uint32_t lastCounter = 0;
+    uint8_t bytes[SIMPLE_PACKET_BYTES];
+    EncodeOutPacket(ToSend, bytes);
+    TransportWrite(bytes, sizeof(bytes));
+    ToSend->counter += 1; 
+}
+
+/**
+ * @brief Writes the wire format of a packet into dest, SIMPLE_PACKET_BYTES long
+ */
+void EncodeOutPacket(const OutPacket* ToEncode, uint8_t* dest)
+{
+    PutInt16(dest, ToEncode->sync);
+    PutInt16(dest + 2, ToEncode->counter);
+    for (int i = 0; i < SIMPLE_PACKET_CHANNELS; i++)
+    {
+        PutInt16(dest + 4 + 2 * i, ToEncode->values[i]);
+    }
+}
+
+/**
+ * @brief Appends a packet built straight from calibrated record columns
+ * 
+ * Channels past numColumns are sent as 0. The caller flushes the run,
+ * after every packet or once it's full.
+ * 
+ * @param columns one column per channel, as held by the record ring
+ * @param row which sample of each column goes in this packet
+ */
+void AppendSimplePacket(PacketRun* run, uint32_t counter, int32_t* const* columns, int numColumns, int row)
+{
+    if (PacketRunFull(run))
+    {
+        FlushPacketRun(run);
+    }
+    uint8_t* dest = run->bytes + run->length;
+    PutInt16(dest, 0xFFFF);
+    PutInt16(dest + 2, counter);
+    int chan = 0;
+    for (; chan < numColumns && chan < SIMPLE_PACKET_CHANNELS; chan++)
+    {
+        PutInt16(dest + 4 + 2 * chan, columns[chan][row]);
+    }
+    for (; chan < SIMPLE_PACKET_CHANNELS; chan++)
+    {
+        PutInt16(dest + 4 + 2 * chan, 0);
+    }
+    run->length += SIMPLE_PACKET_BYTES;
+}
+
+/**
+ * @brief The 24-bit variant of AppendSimplePacket, for a 24-bit front end
+ * 
+ * Same sync and counter, then each channel's lowest 24 bits.
+ */
+void AppendSimplePacket24(PacketRun* run, uint32_t counter, int32_t* const* columns, int numColumns, int row)
+{
+    if (PacketRunFull(run))
+    {
+        FlushPacketRun(run);
+    }
+    uint8_t* dest = run->bytes + run->length;
+    PutInt16(dest, 0xFFFF);
+    PutInt16(dest + 2, counter);
+    int chan = 0;
+    for (; chan < numColumns && chan < SIMPLE_PACKET_CHANNELS; chan++)
+    {
+        PutInt24(dest + 4 + 3 * chan, columns[chan][row]);
+    }
+    for (; chan < SIMPLE_PACKET_CHANNELS; chan++)
+    {
+        PutInt24(dest + 4 + 3 * chan, 0);
+    }
+    run->length += SIMPLE_PACKET24_BYTES;
+}
+
+/**
+ * @brief Hands every packet in the run to the transport in one write
+ */
+void FlushPacketRun(PacketRun* run)
+{
+    if (run->length > 0)
+    {
+        STATS_START(writeStart);
+        TransportWrite(run->bytes, run->length);
+        STATS_STOP(STATS_SERIAL_WRITE, writeStart);
+        run->length = 0;
+    }
+}
+
+/**
+ * @brief The original serializer, two transport writes per 16-bit field
+ * 
+ * Kept as the reference SendOutPacket has to match byte for byte.
+ */
+void SendOutPacketBytewise(OutPacket* ToSend) 
+{
     WriteOutInt32AsInt16(ToSend->sync);
     WriteOutInt32AsInt16(ToSend->counter);
     ToSend->counter += 1; 
@@ -22,14 +122,29 @@ void WriteOutInt32AsInt16(int32_t ToSend) //, char* chars[2])
     char byteBuffer;
     uint32_t tempInt;
     byteBuffer = ToSend & 0xFF;
-    Serial1.print(byteBuffer);
+    TransportWrite((const uint8_t *)&byteBuffer, 1);
     tempInt = (ToSend >> 8);        //WARNING!!! This line seems to break Segger HW debugger, 
                                     //when examined in debugger, tempInt is always 0 
                                     //and causes ripple effects(IIRC)
                                     //but this is only when examining values in the debugger
                                     //the application actually behaves as it should
     byteBuffer = tempInt & 0xFF;
-    Serial1.print(byteBuffer);
+    TransportWrite((const uint8_t *)&byteBuffer, 1);
+}
+
+/**
+ * @brief Reference for AppendSimplePacket24, one transport write per byte
+ */
+void SendOutPacket24Bytewise(OutPacket* ToSend) 
+{
+    WriteOutInt32AsInt16(ToSend->sync);
+    WriteOutInt32AsInt16(ToSend->counter);
+    ToSend->counter += 1; 
+
+    for (int i=0; i<SIMPLE_PACKET_CHANNELS; i++)
+    {
+        SendLowest24Bits(ToSend->values[i]);
+    }
 }
 
 void SendLowest24Bits(uint32_t ToSend)
@@ -37,11 +152,11 @@ void SendLowest24Bits(uint32_t ToSend)
   char byteBuffer;
   uint32_t tempInt;
   byteBuffer = ToSend & 0xFF;
-  Serial1.print(byteBuffer);
+  TransportWrite((const uint8_t *)&byteBuffer, 1);
   tempInt = (ToSend >> 8);
   byteBuffer = tempInt & 0xFF;
-  Serial1.print(byteBuffer);
+  TransportWrite((const uint8_t *)&byteBuffer, 1);
   tempInt = (ToSend >> 16);
   byteBuffer = tempInt & 0xFF;
-  Serial1.print(byteBuffer);
-}
\ No newline at end of file
+  TransportWrite((const uint8_t *)&byteBuffer, 1);
+}
@@ -1,3 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SIMPLE_PACKET_CHANNELS 8
+#define SIMPLE_PACKET_BYTES 20 //sync, counter and 8 samples, 16 bits each, little endian
+#define SIMPLE_PACKET24_BYTES 28 //sync, counter (16 bits each) and 8 samples, 24 bits each, little endian
+#define PACKET_RUN_MAX 32 //packets of either size a PacketRun holds before it has to be flushed
+
 struct OutPacket
 {
   uint32_t sync = 0xFFFF;
@@ -5,7 +15,48 @@ struct OutPacket
   int32_t values[8];
 };
 
+/*
+ * Wire-format bytes of one or more packets waiting to go to the transport
+ * in a single write
+ */
+struct PacketRun
+{
+  uint8_t bytes[PACKET_RUN_MAX * SIMPLE_PACKET24_BYTES];
+  size_t length = 0;
+};
+
 void SendOutPacket(OutPacket* ToSend);
+void SendOutPacketBytewise(OutPacket* ToSend);
+void EncodeOutPacket(const OutPacket* ToEncode, uint8_t* dest);
+void AppendSimplePacket(PacketRun* run, uint32_t counter, int32_t* const* columns, int numColumns, int row);
+void AppendSimplePacket24(PacketRun* run, uint32_t counter, int32_t* const* columns, int numColumns, int row);
+void SendOutPacket24Bytewise(OutPacket* ToSend);
+void FlushPacketRun(PacketRun* run);
 void SendLowest24Bits(uint32_t ToSend);
 
+/**
+ * @brief True if the run can't be sure to take another packet of either size
+ */
+inline bool PacketRunFull(const PacketRun* run)
+{
+    return run->length + SIMPLE_PACKET24_BYTES > sizeof(run->bytes);
+}
 
+/**
+ * @brief Stores the lowest 16 bits of a value, little endian
+ */
+inline void PutInt16(uint8_t* dest, int32_t value)
+{
+    dest[0] = value & 0xFF;
+    dest[1] = (value >> 8) & 0xFF;
+}
+
+/**
+ * @brief Stores the lowest 24 bits of a value, little endian
+ */
+inline void PutInt24(uint8_t* dest, int32_t value)
+{
+    dest[0] = value & 0xFF;
+    dest[1] = (value >> 8) & 0xFF;
+    dest[2] = (value >> 16) & 0xFF;
+}
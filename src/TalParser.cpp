@@ -0,0 +1,233 @@
+#include <string.h>
+#include "TalParser.h"
+
+#define TAL_BETWEEN 0  // padding between TALs
+#define TAL_ONSET 1
+#define TAL_DURATION 2
+#define TAL_TEXT 3
+#define TAL_SKIP 4     // a TAL that didn't parse, up to its end
+
+/**
+ * @brief Reads the onset at the start of a TAL, "+123.4567\x14..." or "-0.5\x14..."
+ *
+ * @param onset set to the onset in 100 ns units; digits past the seventh
+ *        decimal are dropped
+ * @return false if the bytes don't start with an onset
+ */
+bool TalParseOnset(const char *tal, int length, int64_t *onset)
+{
+  if (length < 3 || (tal[0] != '+' && tal[0] != '-'))
+  {
+    return false;
+  }
+  int64_t seconds = 0;
+  int64_t fraction = 0;
+  int64_t scale = 10000000;
+  int i = 1;
+  int digits = 0;
+  for (; i < length && tal[i] >= '0' && tal[i] <= '9'; i++, digits++)
+  {
+    seconds = seconds * 10 + (tal[i] - '0');
+  }
+  if (i < length && tal[i] == '.')
+  {
+    for (i++; i < length && tal[i] >= '0' && tal[i] <= '9'; i++)
+    {
+      if (scale > 1)
+      {
+        scale /= 10;
+        fraction += (tal[i] - '0') * scale;
+      }
+    }
+  }
+  // the onset ends at the duration marker (21) or the end of the TAL (20)
+  if (digits == 0 || digits > 11 || i == length || (tal[i] != 20 && tal[i] != 21))
+  {
+    return false;
+  }
+  *onset = seconds * 10000000 + fraction;
+  if (tal[0] == '-')
+  {
+    *onset = -*onset;
+  }
+  return true;
+}
+
+void TalParserInit(TalParser *parser)
+{
+  memset(parser, 0, sizeof(*parser));
+  parser->state = TAL_BETWEEN;
+}
+
+/**
+ * @brief Readies the parser for an annotation signal's bytes in a new data record
+ *
+ * @param firstOfRecord true for the record's first annotation signal, which
+ *        starts with the timekeeping TAL
+ */
+void TalParserBeginSignal(TalParser *parser, bool firstOfRecord)
+{
+  parser->state = TAL_BETWEEN;
+  parser->timekeeping = firstOfRecord;
+  if (firstOfRecord)
+  {
+    parser->haveRecordStart = false;
+  }
+}
+
+/**
+ * @brief Drops a multi-byte UTF-8 character cut short at the end of a truncated annotation
+ */
+static void TrimPartialCharacter(TalParser *parser)
+{
+  int end = parser->textLength;
+  int continuation = 0;
+  while (continuation < 3 && end - continuation > 0 &&
+         ((uint8_t)parser->text[end - continuation - 1] & 0xC0) == 0x80)
+  {
+    continuation++;
+  }
+  int lead = end - continuation - 1;
+  if (lead < 0 || (uint8_t)parser->text[lead] < 0xC0)
+  {
+    return;
+  }
+  uint8_t leadByte = (uint8_t)parser->text[lead];
+  int needed = leadByte >= 0xF0 ? 3 : leadByte >= 0xE0 ? 2 : 1;
+  if (continuation < needed)
+  {
+    parser->textLength = lead;
+  }
+}
+
+/**
+ * @brief Takes the number gathered so far as the TAL's onset or duration
+ */
+static bool EndNumber(TalParser *parser, int64_t *value)
+{
+  parser->number[parser->numberLength] = 20;
+  return TalParseOnset(parser->number, parser->numberLength + 1, value);
+}
+
+static void EndAnnotation(TalParser *parser, TalAnnotationFn onAnnotation, void *ctx)
+{
+  if (parser->textLength == 0)
+  {
+    // the empty annotation of a timekeeping TAL
+    if (parser->timekeeping && !parser->haveRecordStart)
+    {
+      parser->recordStart = parser->onset;
+      parser->haveRecordStart = true;
+    }
+    return;
+  }
+  if (parser->textCut)
+  {
+    parser->cutTexts++;
+    TrimPartialCharacter(parser);
+  }
+  parser->text[parser->textLength] = '\0';
+  parser->annotations++;
+  onAnnotation(ctx, parser->onset, parser->duration, parser->text);
+}
+
+/**
+ * @brief Parses the next length bytes of an annotation signal
+ *
+ * TALs may be split anywhere between calls. onAnnotation is called for
+ * each annotation as its closing 20 byte arrives.
+ */
+void TalParserFeed(TalParser *parser, const uint8_t *bytes, int length, TalAnnotationFn onAnnotation, void *ctx)
+{
+  for (int i = 0; i < length; i++)
+  {
+    uint8_t b = bytes[i];
+    switch (parser->state)
+    {
+    case TAL_BETWEEN:
+      if (b == '+' || b == '-')
+      {
+        parser->number[0] = (char)b;
+        parser->numberLength = 1;
+        parser->duration = -1;
+        parser->state = TAL_ONSET;
+      }
+      else if (b != 0)
+      {
+        parser->badTals++;
+        parser->timekeeping = false;
+        parser->state = TAL_SKIP;
+      }
+      break;
+    case TAL_ONSET:
+    case TAL_DURATION:
+      if (b == 20 || b == 21)
+      {
+        bool ok = parser->state == TAL_ONSET ? EndNumber(parser, &parser->onset)
+                                              : b == 20 && EndNumber(parser, &parser->duration);
+        if (!ok)
+        {
+          parser->badTals++;
+          parser->timekeeping = false;
+          parser->state = TAL_SKIP;
+        }
+        else if (b == 21)
+        {
+          // durations are unsigned; a sign lets the onset parser read them
+          parser->number[0] = '+';
+          parser->numberLength = 1;
+          parser->state = TAL_DURATION;
+        }
+        else
+        {
+          parser->textLength = 0;
+          parser->textCut = false;
+          parser->state = TAL_TEXT;
+        }
+      }
+      else if (b == 0 || parser->numberLength == TAL_NUMBER_BYTES)
+      {
+        parser->badTals++;
+        parser->timekeeping = false;
+        parser->state = b == 0 ? TAL_BETWEEN : TAL_SKIP;
+      }
+      else
+      {
+        parser->number[parser->numberLength++] = (char)b;
+      }
+      break;
+    case TAL_TEXT:
+      if (b == 20)
+      {
+        EndAnnotation(parser, onAnnotation, ctx);
+        parser->textLength = 0;
+        parser->textCut = false;
+      }
+      else if (b == 0)
+      {
+        // the end of the TAL; an annotation without its closing 20 is dropped
+        if (parser->textLength > 0)
+        {
+          parser->badTals++;
+        }
+        parser->timekeeping = false;
+        parser->state = TAL_BETWEEN;
+      }
+      else if (parser->textLength < TAL_TEXT_BYTES - 1)
+      {
+        parser->text[parser->textLength++] = (char)b;
+      }
+      else
+      {
+        parser->textCut = true;
+      }
+      break;
+    default:
+      if (b == 0)
+      {
+        parser->state = TAL_BETWEEN;
+      }
+      break;
+    }
+  }
+}
@@ -0,0 +1,49 @@
+/**
+ * @file TalParser.h
+ * @brief Streaming parser for the TALs (time-stamped annotation lists) of EDF+/BDF+ annotation signals
+ *
+ * Each data record's annotation signals hold TALs, one after the other,
+ * padded with zero bytes:
+ *
+ *     +onset [\x15 duration] \x14 annotation \x14 [annotation \x14 ...] \x00
+ *
+ * with onset and duration in seconds, the onset from the file's start time.
+ * The first TAL of a record's first annotation signal is its timekeeping
+ * TAL, whose onset is when the record starts and whose annotation is empty.
+ *
+ * The parser takes the signal's bytes a slice at a time, as they're read,
+ * and calls back once per non-empty annotation; nothing is allocated and
+ * annotations longer than TAL_TEXT_BYTES - 1 bytes are cut short.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define TAL_TEXT_BYTES 40 //longest annotation kept, with its terminating null; longer ones are cut
+#define TAL_NUMBER_BYTES 24 //longest onset or duration
+
+typedef void (*TalAnnotationFn)(void *ctx, int64_t onset, int64_t duration, const char *text);
+
+struct TalParser
+{
+  int state;
+  char number[TAL_NUMBER_BYTES + 1]; // onset or duration text so far
+  int numberLength;
+  int64_t onset;          // 100 ns units
+  int64_t duration;       // 100 ns units, -1 if the TAL has none
+  char text[TAL_TEXT_BYTES];
+  int textLength;
+  bool textCut;           // bytes of the annotation have been dropped
+  bool timekeeping;       // the next TAL is the record's timekeeping TAL
+  bool haveRecordStart;
+  int64_t recordStart;    // onset of the timekeeping TAL, 100 ns units
+  // totals
+  unsigned long annotations;
+  unsigned long badTals;  // TALs that didn't parse, skipped to their end
+  unsigned long cutTexts; // annotations longer than TAL_TEXT_BYTES - 1
+};
+
+bool TalParseOnset(const char *tal, int length, int64_t *onset);
+void TalParserInit(TalParser *parser);
+void TalParserBeginSignal(TalParser *parser, bool firstOfRecord);
+void TalParserFeed(TalParser *parser, const uint8_t *bytes, int length, TalAnnotationFn onAnnotation, void *ctx);
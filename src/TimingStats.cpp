@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <string.h>
+#include "TimingStats.h"
+
+/**
+ * @brief Smallest value that would go in the bucket after this one
+ */
+static uint64_t BucketEnd(int bucket)
+{
+  if (bucket < STATS_SUB_BUCKETS)
+  {
+    return bucket + 1;
+  }
+  int exponent = bucket / STATS_SUB_BUCKETS + 1;
+  uint64_t step = (uint64_t)1 << (exponent - 2);
+  return (STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS + 1) * step;
+}
+
+/**
+ * @brief Upper edge of the bucket the given fraction of values falls in
+ */
+uint32_t StatsPercentile(const StatsHistogram *hist, uint32_t perMille)
+{
+  uint64_t target = ((uint64_t)hist->count * perMille + 999) / 1000;
+  uint64_t seen = 0;
+  for (int bucket = 0; bucket < STATS_BUCKETS; bucket++)
+  {
+    seen += hist->buckets[bucket];
+    if (seen >= target)
+    {
+      return (uint32_t)(BucketEnd(bucket) - 1);
+    }
+  }
+  return hist->max;
+}
+
+#if TIMING_STATS
+
+#ifndef STATS_DUMP_SECS
+#define STATS_DUMP_SECS 0 //default for statsDumpSecs
+#endif
+#define STATS_CMD_DUMP 's' //debug console byte that prints the histograms
+#define STATS_CMD_RESET 'r' //debug console byte that clears them
+
+StatsHistogram statsHistograms[STATS_COUNT];
+uint32_t statsDumpSecs = STATS_DUMP_SECS;
+
+static const char *const statsNames[STATS_COUNT] = {"packet interval", "lateness", "refill", "serial write", "SD read"};
+static uint32_t lastDumpMicros = 0;
+
+void StatsReset()
+{
+  memset(statsHistograms, 0, sizeof(statsHistograms));
+}
+
+/**
+ * @brief Prints every histogram on the debug console, one summary line
+ *        and one line of non-empty buckets each, all in microseconds
+ */
+void StatsDump()
+{
+  char line[256];
+  for (int id = 0; id < STATS_COUNT; id++)
+  {
+    const StatsHistogram *hist = &statsHistograms[id];
+    if (hist->count == 0)
+    {
+      snprintf(line, sizeof(line), "%-16s n=0", statsNames[id]);
+      DebugPrintln(line);
+      continue;
+    }
+    snprintf(line, sizeof(line), "%-16s n=%lu min=%lu mean=%lu max=%lu p50<=%lu p99<=%lu p99.9<=%lu", statsNames[id],
+             (unsigned long)hist->count, (unsigned long)hist->min, (unsigned long)(hist->sum / hist->count),
+             (unsigned long)hist->max, (unsigned long)StatsPercentile(hist, 500),
+             (unsigned long)StatsPercentile(hist, 990), (unsigned long)StatsPercentile(hist, 999));
+    DebugPrintln(line);
+    int length = snprintf(line, sizeof(line), "%-16s", "");
+    for (int bucket = 0; bucket < STATS_BUCKETS && length < (int)sizeof(line) - 24; bucket++)
+    {
+      if (hist->buckets[bucket] != 0)
+      {
+        length += snprintf(line + length, sizeof(line) - length, " <%lu:%lu",
+                           (unsigned long)(BucketEnd(bucket) > UINT32_MAX ? UINT32_MAX : BucketEnd(bucket)),
+                           (unsigned long)hist->buckets[bucket]);
+      }
+    }
+    DebugPrintln(line);
+  }
+}
+
+/**
+ * @brief Answers requests from the debug console and does the periodic dump
+ *
+ * Call it when there's idle time; it only costs a few cycles when there's
+ * nothing to do.
+ */
+void StatsPoll(uint32_t nowMicros)
+{
+  int command = DebugRead();
+  if (command == STATS_CMD_DUMP)
+  {
+    StatsDump();
+  }
+  else if (command == STATS_CMD_RESET)
+  {
+    StatsReset();
+  }
+  if (statsDumpSecs > 0 && nowMicros - lastDumpMicros >= statsDumpSecs * 1000000UL)
+  {
+    lastDumpMicros = nowMicros;
+    StatsDump();
+  }
+}
+
+#endif // TIMING_STATS
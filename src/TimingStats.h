@@ -0,0 +1,116 @@
+/**
+ * @file TimingStats.h
+ * @brief Histograms of packet timing, refill, serial write and SD read durations
+ *
+ * Replaces watching GPIOs on a logic analyser: every value is dropped in a
+ * bucket found with one CLZ, four buckets per power of two so they're never
+ * more than 25% wide, and min/max/sum are kept alongside, so recording costs
+ * a few cycles. The histograms are printed on the debug
+ * console (USB serial on the Feather, stderr on the host) on request or
+ * every STATS_DUMP_SECS.
+ *
+ * Build with -DTIMING_STATS=0 and every STATS_ macro expands to nothing:
+ * no code, no RAM.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "platform.h"
+
+#ifndef TIMING_STATS
+#define TIMING_STATS 1
+#endif
+
+#define STATS_SUB_BUCKETS 4 //buckets per power of two
+#define STATS_BUCKETS 124 //0..3 hold themselves, then 4 per power of two up to 2^32
+
+enum StatsId
+{
+  STATS_PACKET_INTERVAL, // time between packets going out
+  STATS_LATENESS,        // how long after its deadline each packet went out
+  STATS_REFILL,          // one refill slice (or the whole RefillBuffer at startup)
+  STATS_SERIAL_WRITE,    // one transport write of a packet run
+  STATS_SD_READ,         // one read from the source file
+  STATS_COUNT
+};
+
+struct StatsHistogram
+{
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+  uint32_t lastMark;     // for intervals, the previous StatsRecordInterval time
+  bool marked;           // lastMark is valid
+  uint32_t buckets[STATS_BUCKETS];
+};
+
+inline int StatsBucket(uint32_t micros)
+{
+  if (micros < STATS_SUB_BUCKETS)
+  {
+    return micros;
+  }
+  int exponent = 31 - __builtin_clz(micros);
+  // the two bits after the leading one pick the sub-bucket
+  return (exponent - 1) * STATS_SUB_BUCKETS + ((micros >> (exponent - 2)) & (STATS_SUB_BUCKETS - 1));
+}
+
+/**
+ * @brief Drops a value in a histogram of its own, outside statsHistograms
+ */
+inline void StatsAdd(StatsHistogram *hist, uint32_t micros)
+{
+  int bucket = StatsBucket(micros);
+  hist->buckets[bucket]++;
+  hist->min = (hist->count == 0 || micros < hist->min) ? micros : hist->min;
+  hist->max = micros > hist->max ? micros : hist->max;
+  hist->count++;
+  hist->sum += micros;
+}
+
+uint32_t StatsPercentile(const StatsHistogram *hist, uint32_t perMille);
+
+#if TIMING_STATS
+
+extern StatsHistogram statsHistograms[STATS_COUNT];
+extern uint32_t statsDumpSecs; // print every histogram this often, 0 to only print on request
+
+inline void StatsRecord(StatsId id, uint32_t micros)
+{
+  StatsAdd(&statsHistograms[id], micros);
+}
+
+/**
+ * @brief Records the time since the previous call for the same histogram
+ */
+inline void StatsRecordInterval(StatsId id, uint32_t nowMicros)
+{
+  StatsHistogram *hist = &statsHistograms[id];
+  if (hist->marked)
+  {
+    StatsRecord(id, nowMicros - hist->lastMark);
+  }
+  hist->lastMark = nowMicros;
+  hist->marked = true;
+}
+
+void StatsReset();
+void StatsDump();
+void StatsPoll(uint32_t nowMicros);
+
+#define STATS_START(var) uint32_t var = PlatformMicros()
+#define STATS_STOP(id, var) StatsRecord(id, PlatformMicros() - (var))
+#define STATS_RECORD(id, micros) StatsRecord(id, micros)
+#define STATS_INTERVAL(id, nowMicros) StatsRecordInterval(id, nowMicros)
+#define STATS_POLL(nowMicros) StatsPoll(nowMicros)
+
+#else
+
+#define STATS_START(var)
+#define STATS_STOP(id, var)
+#define STATS_RECORD(id, micros)
+#define STATS_INTERVAL(id, nowMicros)
+#define STATS_POLL(nowMicros)
+
+#endif
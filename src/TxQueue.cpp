@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <string.h>
+#include "platform.h"
+#include "TxQueue.h"
+
+static inline uint32_t Pack(uint32_t writes, uint32_t bytes)
+{
+  return (writes << 16) | (bytes & 0xFFFF);
+}
+
+static inline uint32_t Writes(uint32_t packed)
+{
+  return packed >> 16;
+}
+
+static inline uint32_t Bytes(uint32_t packed)
+{
+  return packed & 0xFFFF;
+}
+
+/**
+ * @brief Position just past the queue entry at from
+ */
+static inline uint32_t After(const TxQueue *queue, uint32_t from)
+{
+  uint16_t length = queue->lengths[Writes(from) % TX_QUEUE_WRITES];
+  return Pack(Writes(from) + 1, Bytes(from) + (length & ~TX_PAD));
+}
+
+/**
+ * @param policy what a write that doesn't fit does
+ * @param wait called over and over while a TX_BLOCK write waits for room
+ */
+void TxQueueCreate(TxQueue *queue, TxPolicy policy, TxWait wait)
+{
+  memset(queue->lengths, 0, sizeof(queue->lengths));
+  queue->head.store(0);
+  queue->next.store(0);
+  queue->released.store(0);
+  queue->claimEnd = 0;
+  queue->policy.store(policy);
+  queue->wait = wait;
+  queue->writes = 0;
+  queue->bytes = 0;
+  queue->droppedWrites = 0;
+  queue->droppedBytes = 0;
+  queue->waits = 0;
+  queue->highWater = 0;
+}
+
+/**
+ * @brief Drops the oldest write the consumer hasn't claimed
+ *
+ * If nothing is on the wire, its bytes are free straight away; otherwise
+ * they're freed with the consumer's release of what is.
+ *
+ * @return false if there's nothing left to drop
+ */
+static bool DropOldest(TxQueue *queue)
+{
+  uint32_t head = queue->head.load();
+  uint32_t oldest = queue->next.load();
+  while (oldest != head)
+  {
+    uint32_t end = oldest;
+    while (queue->lengths[Writes(end) % TX_QUEUE_WRITES] & TX_PAD)
+    {
+      end = After(queue, end);
+    }
+    uint16_t length = queue->lengths[Writes(end) % TX_QUEUE_WRITES];
+    end = After(queue, end);
+    if (queue->next.compare_exchange_strong(oldest, end))
+    {
+      queue->droppedWrites++;
+      queue->droppedBytes += length;
+      uint32_t idle = oldest;
+      queue->released.compare_exchange_strong(idle, end);
+      return true;
+    }
+    // the consumer claimed it first, oldest is now what's left after its claim
+  }
+  return false;
+}
+
+/**
+ * @brief True if a write taking bytes and writes of the queue fits in what's free from head back round to from
+ */
+static inline bool Fits(uint32_t head, uint32_t from, size_t bytes, uint32_t writes)
+{
+  return ((Bytes(head) - Bytes(from)) & 0xFFFF) + bytes <= TX_QUEUE_BYTES &&
+         ((Writes(head) - Writes(from)) & 0xFFFF) + writes <= TX_QUEUE_WRITES;
+}
+
+/**
+ * @brief Queues a write for the wire without waiting for it, unless the policy is TX_BLOCK
+ *
+ * A write that arrives while the room freed for it by dropping the oldest
+ * is still on the wire is dropped too, as is one longer than half the
+ * queue.
+ *
+ * @return len, or 0 if it was dropped
+ */
+size_t TxQueueWrite(TxQueue *queue, const uint8_t *buf, size_t len)
+{
+  if (len == 0)
+  {
+    return 0;
+  }
+  if (len > TX_QUEUE_BYTES / 2)
+  {
+    // with the pad in front of it, it may never fit
+    queue->droppedWrites++;
+    queue->droppedBytes += len;
+    return 0;
+  }
+  uint32_t head = queue->head.load();
+  uint32_t pos = Bytes(head) % TX_QUEUE_BYTES;
+  size_t pad = pos + len > TX_QUEUE_BYTES ? TX_QUEUE_BYTES - pos : 0;
+  size_t needBytes = pad + len;
+  uint32_t needWrites = pad > 0 ? 2 : 1;
+  bool waited = false;
+  while (!Fits(head, queue->released.load(), needBytes, needWrites))
+  {
+    int policy = queue->policy.load();
+    if (policy == TX_BLOCK)
+    {
+      if (!waited)
+      {
+        queue->waits++;
+        waited = true;
+      }
+      queue->wait();
+      continue;
+    }
+    if (policy == TX_DROP_OLDEST)
+    {
+      // only as many as it takes for this write to fit once what's on the wire is released
+      while (!Fits(head, queue->next.load(), needBytes, needWrites) && DropOldest(queue))
+      {
+      }
+      if (Fits(head, queue->released.load(), needBytes, needWrites))
+      {
+        break;
+      }
+    }
+    queue->droppedWrites++;
+    queue->droppedBytes += len;
+    return 0;
+  }
+  if (pad > 0)
+  {
+    queue->lengths[Writes(head) % TX_QUEUE_WRITES] = TX_PAD | pad;
+    head = Pack(Writes(head) + 1, Bytes(head) + pad);
+    pos = 0;
+  }
+  memcpy(queue->buf + pos, buf, len);
+  queue->lengths[Writes(head) % TX_QUEUE_WRITES] = len;
+  head = Pack(Writes(head) + 1, Bytes(head) + len);
+  queue->head.store(head);
+  queue->writes++;
+  queue->bytes += len;
+  size_t queued = (Bytes(head) - Bytes(queue->released.load())) & 0xFFFF;
+  if (queued > queue->highWater)
+  {
+    queue->highWater = queued;
+  }
+  return len;
+}
+
+/**
+ * @brief Takes the oldest queued writes for the wire, as many as are contiguous, up to TX_CLAIM_BYTES
+ *
+ * They stay the consumer's, safe from being dropped or overwritten, until
+ * it calls TxQueueRelease; it mustn't claim again before then.
+ *
+ * @param bytes set to the first byte
+ * @return bytes claimed, 0 if the queue is empty
+ */
+size_t TxQueueClaim(TxQueue *queue, const uint8_t **bytes)
+{
+  uint32_t start = queue->next.load();
+  for (;;)
+  {
+    uint32_t head = queue->head.load();
+    uint32_t first = start;
+    while (first != head && (queue->lengths[Writes(first) % TX_QUEUE_WRITES] & TX_PAD))
+    {
+      first = After(queue, first);
+    }
+    uint32_t end = first;
+    while (end != head && !(queue->lengths[Writes(end) % TX_QUEUE_WRITES] & TX_PAD) &&
+           (end == first || ((Bytes(After(queue, end)) - Bytes(first)) & 0xFFFF) <= TX_CLAIM_BYTES))
+    {
+      end = After(queue, end);
+    }
+    if (end == first)
+    {
+      return 0;
+    }
+    // fails if the producer dropped the oldest meanwhile, start is then where that left it
+    if (queue->next.compare_exchange_strong(start, end))
+    {
+      queue->claimEnd = end;
+      *bytes = queue->buf + Bytes(first) % TX_QUEUE_BYTES;
+      return (Bytes(end) - Bytes(first)) & 0xFFFF;
+    }
+  }
+}
+
+/**
+ * @brief Gives back the claimed bytes once they're on the wire
+ */
+void TxQueueRelease(TxQueue *queue)
+{
+  uint32_t end = queue->claimEnd;
+  queue->released.store(end);
+  // writes dropped while they were on the wire are free now too
+  queue->released.compare_exchange_strong(end, queue->next.load());
+}
+
+/**
+ * @brief Bytes queued or on the wire
+ */
+size_t TxQueuePending(const TxQueue *queue)
+{
+  return (Bytes(queue->head.load()) - Bytes(queue->released.load())) & 0xFFFF;
+}
+
+/**
+ * @brief True if the queue is more than half full, in bytes or writes: the wire isn't keeping up
+ */
+bool TxQueueBackPressured(const TxQueue *queue)
+{
+  uint32_t head = queue->head.load();
+  uint32_t released = queue->released.load();
+  return ((Bytes(head) - Bytes(released)) & 0xFFFF) > TX_QUEUE_BYTES / 2 ||
+         ((Writes(head) - Writes(released)) & 0xFFFF) > TX_QUEUE_WRITES / 2;
+}
+
+/**
+ * @brief Prints the queue's totals on the debug console
+ */
+void TxQueueReport(const TxQueue *queue)
+{
+  static const char *policies[] = {"block", "drop oldest", "drop newest"};
+  char line[160];
+  snprintf(line, sizeof(line), "tx queue (%s): %lu writes (%llu bytes), high water %lu of %d bytes, %lu waits",
+           policies[queue->policy.load()], queue->writes, (unsigned long long)queue->bytes,
+           (unsigned long)queue->highWater, TX_QUEUE_BYTES, queue->waits);
+  DebugPrintln(line);
+  snprintf(line, sizeof(line), "tx queue: %lu writes (%llu bytes) dropped, %lu bytes held", queue->droppedWrites,
+           (unsigned long long)queue->droppedBytes, (unsigned long)TxQueuePending(queue));
+  DebugPrintln(line);
+}
@@ -0,0 +1,73 @@
+/**
+ * @file TxQueue.h
+ * @brief Lock-free queue of writes between the packet sender and the wire
+ *
+ * The sender (the one producer) copies each write into the queue and goes
+ * straight back to making packets; the transport (the one consumer) takes
+ * runs of queued bytes for the wire (TxQueueClaim) and hands them back
+ * once they're sent (TxQueueRelease), from a DMA completion on the Feather
+ * or a writer thread on the host. The bytes of each write are contiguous
+ * in the queue, so a claim can go straight to EasyDMA; a write that would
+ * wrap around the end starts at the beginning instead, past a pad entry
+ * the consumer skips.
+ *
+ * A write that doesn't fit is handled by the queue's policy:
+ *
+ *     TX_BLOCK        wait (through the wait function) for the wire to make room
+ *     TX_DROP_OLDEST  drop the oldest writes not yet on the wire until it fits,
+ *                     or this one if those aren't enough
+ *     TX_DROP_NEWEST  drop this one
+ *
+ * Writes are dropped whole, never split, so the wire only ever carries
+ * whole packets (or frames, or blocks); a receiver sees the gap in their
+ * counters. Queued writes and bytes are counted modulo 65536, packed into
+ * one 32-bit word (write count in the high half), so the consumer claiming
+ * and the producer dropping the oldest agree with a single compare and
+ * swap.
+ */
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+#define TX_QUEUE_BYTES 16384 //bytes waiting for the wire, a power of 2 up to 32768; twice the largest compressed block, as longer writes are dropped
+#define TX_QUEUE_WRITES 1024 //writes waiting for the wire, a power of 2
+#define TX_CLAIM_BYTES 256 //most bytes on the wire at once unless a single write is longer; the rest can still be dropped
+#define TX_PAD 0x8000 //in lengths, the entry is the unused end of buf, skipped
+
+enum TxPolicy
+{
+  TX_BLOCK,
+  TX_DROP_OLDEST,
+  TX_DROP_NEWEST
+};
+
+typedef void (*TxWait)(); // lets the wire make progress while a TX_BLOCK write waits for room
+
+struct TxQueue
+{
+  uint8_t buf[TX_QUEUE_BYTES];
+  uint16_t lengths[TX_QUEUE_WRITES]; // bytes of each write, or TX_PAD and the bytes skipped
+  std::atomic<uint32_t> head;     // writes and bytes queued, only written by the producer
+  std::atomic<uint32_t> next;     // first not yet claimed, moved on by the consumer's claims and the producer's drops
+  std::atomic<uint32_t> released; // everything before it is free, see TxQueueRelease
+  uint32_t claimEnd;              // consumer only: end of its claim
+  std::atomic<int> policy;        // TxPolicy
+  TxWait wait;
+  // totals, kept by the producer
+  unsigned long writes;
+  uint64_t bytes;
+  unsigned long droppedWrites;
+  uint64_t droppedBytes;
+  unsigned long waits;            // TX_BLOCK writes that had to wait
+  size_t highWater;               // most bytes queued or on the wire at once
+};
+
+void TxQueueCreate(TxQueue *queue, TxPolicy policy, TxWait wait);
+size_t TxQueueWrite(TxQueue *queue, const uint8_t *buf, size_t len);
+size_t TxQueueClaim(TxQueue *queue, const uint8_t **bytes);
+void TxQueueRelease(TxQueue *queue);
+size_t TxQueuePending(const TxQueue *queue);
+bool TxQueueBackPressured(const TxQueue *queue);
+void TxQueueReport(const TxQueue *queue);
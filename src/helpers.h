@@ -1,5 +0,0 @@
-#include <string>
-using namespace std;
-
-string CharArrayToString(char* charArray, int charArrayLength);
-float CharArrayToFloat(char* charArray, int charArrayLength);
\ No newline at end of file
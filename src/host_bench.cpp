@@ -0,0 +1,1481 @@
+#ifndef ARDUINO
+
+#include <algorithm>
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "platform.h"
+#include "Calibration.h"
+#include "SimplePacketMaker.h"
+#include "FramePacker.h"
+#include "EdfHeader.h"
+#include "Resampler.h"
+#include "ChannelFilter.h"
+#include "SignalGenerator.h"
+#include "RecordRing.h"
+#include "RiceCodec.h"
+#include "SeekIndex.h"
+#include "PlaybackDescriptor.h"
+#include "EventFrame.h"
+#include "host_bench.h"
+
+#define BENCH_PACKETS 200000 //packets sent by each serializer benchmark
+#define CONFORMANCE_PACKETS 10000
+#define HEADER_BENCH_ROUNDS 200 //header loads timed by BenchHeaderParse
+#define RESAMPLER_BENCH_SECS 600 //seconds of signal pushed through each resampler
+#define GENERATOR_BENCH_SAMPLES 50000000 //samples timed per waveform
+#define FILTER_BENCH_RATE 1000 //samples/second the filters are checked and timed at, in 1 s records
+#define COMPRESSION_BENCH_ROWS 1000000 //most sample periods of the source compressed by BenchCompression
+#define SEEK_BENCH_FINDS 100000 //random seeks timed by BenchSeekIndex
+#define SEEK_BENCH_RUN_RECORDS 1000 //1 s records recorded back to back before each gap
+#define SEEK_BENCH_GAP 305000000LL //100 ns units between runs of records, 30.5 s
+#define HEAP_BLOCK_OVERHEAD 8 //bytes the heap adds to each allocation, as newlib's malloc does
+#define SUITE_RING_FILLS 64 //ring refills timed by each TimeRefillRecord
+
+extern int numOutArrayChans;
+extern CalibrationQ *chanCal;
+extern RecordRing recordRing;
+extern int numOutArrayRows;
+extern int *sendChans;
+extern int numSendChans;
+extern int packetBits;
+extern int frameChannels;
+extern int riceKeyframeBlocks;
+extern int numRingRecords;
+
+size_t FileArenaBytes(int numSignals, int numColumns, int rows, int stagingSamps, int bytesPerSample);
+
+static double MonotonicSecs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Checks every channel's fixed-point calibration against the float
+ *        path over all 16-bit inputs and reports cycles/sample of both
+ */
+int BenchCalibrationAllChans()
+{
+  long totalMismatches = 0;
+  for (int chan = 0; chan < numOutArrayChans; chan++)
+  {
+    float fixedCycles, floatCycles;
+    long mismatches = CalibrationMismatches(&chanCal[chan]);
+    BenchCalibration(&chanCal[chan], &fixedCycles, &floatCycles);
+    fprintf(stderr, "chan %2d: %d-bit %s, mismatches %ld, cycles/sample fixed %.2f float %.2f\n", chan,
+            chanCal[chan].sampleBits,
+            chanCal[chan].floatOnly ? "float only" : CAL_FIXED_POINT ? "sent in fixed point" : "sent in float",
+            mismatches, fixedCycles, floatCycles);
+    totalMismatches += mismatches;
+  }
+  return totalMismatches == 0 ? 0 : 1;
+}
+
+static void RandomPacket(OutPacket *packet)
+{
+  packet->counter = rand();
+  for (int i = 0; i < SIMPLE_PACKET_CHANNELS; i++)
+  {
+    // full 32-bit range, so truncation to 16 bits is exercised too
+    packet->values[i] = (int32_t)(((uint32_t)rand() << 16) ^ (uint32_t)rand());
+  }
+}
+
+/**
+ * @brief Checks SendOutPacket and AppendSimplePacket produce exactly the bytes
+ *        SendOutPacketBytewise does, and AppendSimplePacket24 the bytes
+ *        SendOutPacket24Bytewise does
+ *
+ * @return number of packets that differed
+ */
+static long CheckPacketConformance()
+{
+  uint8_t expected[SIMPLE_PACKET24_BYTES];
+  uint8_t actual[SIMPLE_PACKET24_BYTES];
+  size_t expectedLength, actualLength;
+  long mismatches = 0;
+  srand(1);
+  for (int n = 0; n < CONFORMANCE_PACKETS; n++)
+  {
+    OutPacket reference;
+    RandomPacket(&reference);
+    OutPacket packet = reference;
+
+    TransportCaptureHost(expected, sizeof(expected), &expectedLength);
+    SendOutPacketBytewise(&reference);
+    TransportCaptureHost(actual, sizeof(actual), &actualLength);
+    SendOutPacket(&packet);
+    bool same = expectedLength == SIMPLE_PACKET_BYTES && actualLength == SIMPLE_PACKET_BYTES &&
+                memcmp(expected, actual, SIMPLE_PACKET_BYTES) == 0 && packet.counter == reference.counter;
+
+    // the same values again, as one-row columns
+    int32_t columnValues[SIMPLE_PACKET_CHANNELS];
+    int32_t *columns[SIMPLE_PACKET_CHANNELS];
+    for (int i = 0; i < SIMPLE_PACKET_CHANNELS; i++)
+    {
+      columnValues[i] = packet.values[i];
+      columns[i] = &columnValues[i];
+    }
+    PacketRun run;
+    TransportCaptureHost(actual, sizeof(actual), &actualLength);
+    AppendSimplePacket(&run, reference.counter - 1, columns, SIMPLE_PACKET_CHANNELS, 0);
+    FlushPacketRun(&run);
+    same = same && actualLength == SIMPLE_PACKET_BYTES && memcmp(expected, actual, SIMPLE_PACKET_BYTES) == 0;
+
+    OutPacket reference24 = reference;
+    reference24.counter--;
+    TransportCaptureHost(expected, sizeof(expected), &expectedLength);
+    SendOutPacket24Bytewise(&reference24);
+    TransportCaptureHost(actual, sizeof(actual), &actualLength);
+    AppendSimplePacket24(&run, reference.counter - 1, columns, SIMPLE_PACKET_CHANNELS, 0);
+    FlushPacketRun(&run);
+    same = same && expectedLength == SIMPLE_PACKET24_BYTES && actualLength == SIMPLE_PACKET24_BYTES &&
+           memcmp(expected, actual, SIMPLE_PACKET24_BYTES) == 0;
+
+    // an 8-channel frame of one sample period is the simple packet; frame counters are modulo 32768
+    FramePacker packer;
+    FramePackerCreate(&packer, SIMPLE_PACKET_CHANNELS, 24, 1);
+    expected[3] &= 0x7F;
+    TransportCaptureHost(actual, sizeof(actual), &actualLength);
+    AppendFrameRow(&run, &packer, reference.counter - 1, columns, SIMPLE_PACKET_CHANNELS, 0);
+    FlushPacketRun(&run);
+    same = same && actualLength == SIMPLE_PACKET24_BYTES && memcmp(expected, actual, SIMPLE_PACKET24_BYTES) == 0;
+    mismatches += !same;
+  }
+  TransportCaptureHost(nullptr, 0, nullptr);
+  return mismatches;
+}
+
+static void ReportRate(const char *name, double secs)
+{
+  fprintf(stderr, "%-28s %10.0f packets/sec %8.1f ns/packet\n", name, BENCH_PACKETS / secs, secs * 1e9 / BENCH_PACKETS);
+}
+
+/**
+ * @brief Conformance check, then throughput of the serializers into the
+ *        configured output (use --out /dev/null to leave out the sink's cost)
+ */
+int BenchPacketSerializers()
+{
+  long mismatches = CheckPacketConformance();
+  fprintf(stderr, "conformance: %d packets, %ld mismatches\n", CONFORMANCE_PACKETS, mismatches);
+
+  OutPacket packet;
+  RandomPacket(&packet);
+  double start = MonotonicSecs();
+  for (int n = 0; n < BENCH_PACKETS; n++)
+  {
+    SendOutPacketBytewise(&packet);
+  }
+  ReportRate("bytewise (20 writes)", MonotonicSecs() - start);
+
+  start = MonotonicSecs();
+  for (int n = 0; n < BENCH_PACKETS; n++)
+  {
+    SendOutPacket(&packet);
+  }
+  ReportRate("SendOutPacket (1 write)", MonotonicSecs() - start);
+
+  int32_t *columns[SIMPLE_PACKET_CHANNELS];
+  for (int i = 0; i < SIMPLE_PACKET_CHANNELS; i++)
+  {
+    columns[i] = &packet.values[i];
+  }
+  PacketRun run;
+  start = MonotonicSecs();
+  for (int n = 0; n < BENCH_PACKETS; n++)
+  {
+    AppendSimplePacket(&run, n, columns, SIMPLE_PACKET_CHANNELS, 0);
+  }
+  FlushPacketRun(&run);
+  ReportRate("AppendSimplePacket (runs)", MonotonicSecs() - start);
+
+  start = MonotonicSecs();
+  for (int n = 0; n < BENCH_PACKETS; n++)
+  {
+    AppendSimplePacket24(&run, n, columns, SIMPLE_PACKET_CHANNELS, 0);
+  }
+  FlushPacketRun(&run);
+  ReportRate("AppendSimplePacket24 (runs)", MonotonicSecs() - start);
+
+  // 64-channel frames from the same 8 columns, repeated; one "packet" is one sample period
+  static const int frameSamples[] = {1, 8};
+  for (int bits = 16; bits <= 24; bits += 8)
+  {
+    for (int samples : frameSamples)
+    {
+      FramePacker packer;
+      FramePackerCreate(&packer, FRAME_MAX_CHANNELS, bits, samples);
+      start = MonotonicSecs();
+      for (int n = 0; n < BENCH_PACKETS; n++)
+      {
+        AppendFrameRow(&run, &packer, n, columns, SIMPLE_PACKET_CHANNELS, 0);
+      }
+      FlushPacketRun(&run);
+      char name[40];
+      snprintf(name, sizeof(name), "64ch %d-bit frames x%d", bits, samples);
+      ReportRate(name, MonotonicSecs() - start);
+    }
+  }
+  return mismatches == 0 ? 0 : 1;
+}
+
+/* copies text into a space-padded header field */
+static void PutField(char *field, int width, const char *text)
+{
+  int length = (int)strlen(text);
+  memset(field, ' ', width);
+  memcpy(field, text, length < width ? length : width);
+}
+
+/**
+ * @brief Builds an EDF+ header with EDFLIB_MAXSIGNALS signals, the last one annotations
+ *
+ * @return its length in bytes
+ */
+static int MakeMaxSignalsHeader(char *buf)
+{
+  const int ns = EDFLIB_MAXSIGNALS;
+  char text[32];
+  edfHeaderMain *main = (edfHeaderMain *)buf;
+  PutField(main->FormatVersion, sizeof(main->FormatVersion), "0");
+  PutField(main->localPatientId, sizeof(main->localPatientId), "MCH-0234567 F 02-MAY-1951 Haagse_Harry");
+  PutField(main->localRecordingId, sizeof(main->localRecordingId), "Startdate 02-MAR-2002 EMG561 BK/JOP Sony. MNC R Median Nerve.");
+  PutField(main->startDate, sizeof(main->startDate), "02.03.02");
+  PutField(main->startTime, sizeof(main->startTime), "16.15.00");
+  snprintf(text, sizeof(text), "%d", 256 * (ns + 1));
+  PutField(main->numHeaderBytes, sizeof(main->numHeaderBytes), text);
+  PutField(main->reserved, sizeof(main->reserved), "EDF+C");
+  PutField(main->numDataRecords, sizeof(main->numDataRecords), "600");
+  PutField(main->durationDataRcordsSecs, sizeof(main->durationDataRcordsSecs), "0.5");
+  snprintf(text, sizeof(text), "%d", ns);
+  PutField(main->numSignals, sizeof(main->numSignals), text);
+
+  // the channel block is field-major: ns labels, then ns transducer types, ...
+  char *p = buf + sizeof(edfHeaderMain);
+  const edfHeaderChan *c = nullptr;
+#define PUT_ALL(member, format, value)                     \
+  for (int i = 0; i < ns; i++)                             \
+  {                                                        \
+    snprintf(text, sizeof(text), format, value);           \
+    PutField(p, sizeof(c->member), text);                  \
+    p += sizeof(c->member);                                \
+  }
+  PUT_ALL(label, "%s", i == ns - 1 ? "EDF Annotations" : "EEG Fpz-Cz")
+  PUT_ALL(transducerType, "%s", i == ns - 1 ? "" : "AgAgCl electrode")
+  PUT_ALL(physicalDimension, "%s", i == ns - 1 ? "" : "uV")
+  PUT_ALL(physicalMin, "%.3f", -3276.8 + i)
+  PUT_ALL(physicalMax, "%.3f", 3276.7 + i)
+  PUT_ALL(digitalMin, "%d", -32768)
+  PUT_ALL(digitalMax, "%d", 32767)
+  PUT_ALL(preFiltering, "%s", i == ns - 1 ? "" : "HP:0.1Hz LP:75Hz")
+  PUT_ALL(numDataSamplesPerRecord, "%d", i == ns - 1 ? 60 : 100 + i % 3 * 50)
+  PUT_ALL(reserved, "%s", "")
+#undef PUT_ALL
+  return (int)(p - buf);
+}
+
+struct MemoryReader
+{
+  const char *buf;
+  int pos;
+  int len;
+};
+
+static int ReadFromMemory(void *ctx, void *buf, int len)
+{
+  MemoryReader *reader = (MemoryReader *)ctx;
+  if (len > reader->len - reader->pos)
+  {
+    len = reader->len - reader->pos;
+  }
+  memcpy(buf, reader->buf + reader->pos, len);
+  reader->pos += len;
+  return len;
+}
+
+/**
+ * @brief Checks the parser on a EDFLIB_MAXSIGNALS header and times loading it,
+ *        both from memory and from a file through SourceFile, then from its
+ *        playback descriptor, checked against the parse
+ */
+int BenchHeaderParse()
+{
+  static char buf[256 * (EDFLIB_MAXSIGNALS + 1)];
+  static edf_signal_struct signals[EDFLIB_MAXSIGNALS];
+  int length = MakeMaxSignalsHeader(buf);
+
+  edf_hdr_struct hdr;
+  edf_layout_struct layout;
+  double best = 1e9;
+  int result = 0;
+  for (int round = 0; round < HEADER_BENCH_ROUNDS && result == 0; round++)
+  {
+    double start = MonotonicSecs();
+    MemoryReader reader = {buf, (int)sizeof(edfHeaderMain), length};
+    result = edf_parse_main_header((const edfHeaderMain *)buf, &hdr, &layout);
+    if (result == 0)
+    {
+      result = edf_parse_signal_headers(ReadFromMemory, &reader, &hdr, &layout, signals);
+    }
+    double secs = MonotonicSecs() - start;
+    best = secs < best ? secs : best;
+  }
+  if (result != 0)
+  {
+    fprintf(stderr, "header parse failed: %s\n", EdfErrorString(result));
+    return 1;
+  }
+  const edf_signal_struct &last = signals[EDFLIB_MAXSIGNALS - 2];
+  bool correct = hdr.filetype == EDFLIB_FILETYPE_EDFPLUS && hdr.edfsignals == EDFLIB_MAXSIGNALS - 1 &&
+                 hdr.datarecord_duration == 5000000 && hdr.startdate_year == 2002 &&
+                 strcmp(hdr.patient_name, "Haagse Harry") == 0 && strcmp(hdr.gender, "Female") == 0 &&
+                 strcmp(hdr.equipment, "Sony.") == 0 && signals[EDFLIB_MAXSIGNALS - 1].annotation &&
+                 !last.annotation && last.phys_min == -3276.8f + (EDFLIB_MAXSIGNALS - 2) &&
+                 last.dig_min == -32768 && strcmp(last.label, "EEG Fpz-Cz") == 0 &&
+                 last.record_offset + last.smp_per_record * 2 == signals[EDFLIB_MAXSIGNALS - 1].record_offset &&
+                 layout.record_bytes == signals[EDFLIB_MAXSIGNALS - 1].record_offset + 60 * 2;
+  fprintf(stderr, "%d signals, %d header bytes: %s\n", layout.total_signals, layout.header_bytes,
+          correct ? "parsed correctly" : "PARSED WRONG");
+  fprintf(stderr, "parse from memory:  %8.3f ms\n", best * 1e3);
+
+  char path[] = "/tmp/volkseeg-header-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0 || write(fd, buf, length) != length)
+  {
+    perror(path);
+    return 1;
+  }
+  close(fd);
+  SourceFile file;
+  file.open(path, hostOptions.useMmap);
+  best = 1e9;
+  for (int round = 0; round < HEADER_BENCH_ROUNDS && result == 0; round++)
+  {
+    EdfFileHeader header;
+    double start = MonotonicSecs();
+    result = EdfReadHeader(&file, &header);
+    double secs = MonotonicSecs() - start;
+    best = secs < best ? secs : best;
+    EdfFreeHeader(&header);
+  }
+  fprintf(stderr, "load from file:     %8.3f ms (%s)\n", best * 1e3, EdfErrorString(result));
+
+  char descPath[PATH_MAX];
+  snprintf(descPath, sizeof(descPath), "%s.vpd", path);
+  SourceFile descFile;
+  EdfFileHeader parsed;
+  int descResult = EdfReadHeader(&file, &parsed);
+  if (descResult == 0)
+  {
+    descResult = descFile.create(descPath) ? DescriptorWrite(&descFile, &file, &parsed) : DESCRIPTOR_ERR_WRITE;
+    descFile.close();
+  }
+  bool matches = descResult == 0;
+  best = 1e9;
+  for (int round = 0; round < HEADER_BENCH_ROUNDS && descResult == 0; round++)
+  {
+    EdfFileHeader header;
+    double start = MonotonicSecs();
+    descResult = descFile.open(descPath, hostOptions.useMmap) ? DescriptorLoad(&descFile, &file, &header)
+                                                               : DESCRIPTOR_ERR_READ;
+    descFile.close();
+    double secs = MonotonicSecs() - start;
+    best = secs < best ? secs : best;
+    // everything playback takes from the header, the labels aside
+    matches = matches && descResult == 0 && file.curPosition() == (uint32_t)parsed.layout.header_bytes &&
+              header.hdr.edfsignals == parsed.hdr.edfsignals &&
+              header.hdr.datarecords_in_file == parsed.hdr.datarecords_in_file &&
+              header.hdr.datarecord_duration == parsed.hdr.datarecord_duration &&
+              memcmp(&header.layout, &parsed.layout, sizeof(header.layout)) == 0;
+    for (int i = 0; matches && i < parsed.layout.total_signals; i++)
+    {
+      const edf_signal_struct &a = header.signals[i], &b = parsed.signals[i];
+      matches = a.phys_min == b.phys_min && a.phys_max == b.phys_max && a.dig_min == b.dig_min && a.dig_max == b.dig_max &&
+                a.smp_per_record == b.smp_per_record && a.record_offset == b.record_offset && a.annotation == b.annotation;
+    }
+    EdfFreeHeader(&header);
+  }
+  EdfFreeHeader(&parsed);
+  struct stat st;
+  long descBytes = stat(descPath, &st) == 0 ? (long)st.st_size : 0;
+  file.close();
+  unlink(path);
+  unlink(descPath);
+  fprintf(stderr, "load from descriptor: %6.3f ms, %ld bytes (%s): %s\n", best * 1e3, descBytes,
+          DescriptorErrorString(descResult), matches ? "matches the parse" : "DIFFERS FROM THE PARSE");
+  return correct && result == 0 && matches ? 0 : 1;
+}
+
+/**
+ * @brief Runs one input record (a 1 s record of inRate samples) through a resampler
+ */
+static void ResampleRecord(ChannelResampler *rs, const int32_t *in, int32_t *out)
+{
+  memcpy(ResamplerInput(rs), in, rs->inRows * sizeof(int32_t));
+  ResamplerRun(rs, out, 0, rs->outRows);
+  ResamplerFinishRecord(rs);
+}
+
+/**
+ * @brief Checks one ratio passes DC exactly and a slow sine at full amplitude,
+ *        then times it
+ *
+ * @return true if the checks passed
+ */
+static bool BenchResamplerRatio(int inRate, int outRate)
+{
+  ChannelResampler rs;
+  if (!ResamplerCreate(&rs, inRate, outRate))
+  {
+    fprintf(stderr, "%5d -> %5d Hz: not supported\n", inRate, outRate);
+    return false;
+  }
+  int32_t *in = new int32_t[inRate];
+  int32_t *out = new int32_t[outRate];
+
+  bool dcExact = true;
+  for (int i = 0; i < inRate; i++)
+  {
+    in[i] = -12345;
+  }
+  for (int record = 0; record < 2; record++)
+  {
+    ResampleRecord(&rs, in, out);
+    for (int i = 0; i < outRate; i++)
+    {
+      dcExact = dcExact && out[i] == -12345;
+    }
+  }
+
+  // 5 Hz at amplitude 100000, well inside both passbands
+  int32_t peak = 0;
+  for (int record = 0; record < 4; record++)
+  {
+    for (int i = 0; i < inRate; i++)
+    {
+      in[i] = (int32_t)lrint(100000 * sin(2 * M_PI * 5 * (record * inRate + i) / inRate));
+    }
+    ResampleRecord(&rs, in, out);
+    for (int i = 0; i < outRate && record > 0; i++)
+    {
+      peak = out[i] > peak ? out[i] : peak;
+    }
+  }
+  bool gainOk = peak > 99500 && peak < 100500;
+
+  double start = MonotonicSecs();
+  for (int record = 0; record < RESAMPLER_BENCH_SECS; record++)
+  {
+    ResampleRecord(&rs, in, out);
+  }
+  double secs = MonotonicSecs() - start;
+  fprintf(stderr, "%5d -> %5d Hz (%3d/%3d, %3d taps): %s, 5 Hz peak %6d, %7.1f M in + %6.1f M out samples/sec/channel, %5.1f ns/out sample\n",
+          inRate, outRate, rs.table->up, rs.table->down, rs.table->taps, dcExact ? "DC exact" : "DC WRONG", peak,
+          RESAMPLER_BENCH_SECS * (double)inRate / secs / 1e6, RESAMPLER_BENCH_SECS * (double)outRate / secs / 1e6,
+          secs * 1e9 / (RESAMPLER_BENCH_SECS * (double)outRate));
+  delete[] in;
+  delete[] out;
+  return dcExact && gainOk;
+}
+
+/**
+ * @brief Checks and times the resampler on the rate mixes clinical EDFs have
+ */
+int BenchResampler()
+{
+  static const int ratios[][2] = {{512, 256}, {1024, 256}, {1000, 256}, {250, 256}, {128, 256}, {256, 1000}, {400, 200}};
+  bool ok = true;
+  for (const auto &ratio : ratios)
+  {
+    ok = BenchResamplerRatio(ratio[0], ratio[1]) && ok;
+  }
+  return ok ? 0 : 1;
+}
+
+/**
+ * @brief Generates count samples of every channel in chunks, as the ring would
+ */
+static void GenerateChunked(SignalGenerator *gen, int32_t *const *out, int count, int chunk)
+{
+  for (int chan = 0; chan < gen->numChans; chan++)
+  {
+    for (int done = 0; done < count; done += chunk)
+    {
+      GeneratorRun(gen, chan, out[chan] + done, count - done < chunk ? count - done : chunk);
+    }
+  }
+}
+
+/**
+ * @brief Checks the generator's tables, waveforms and seeking, and times each waveform
+ */
+int BenchGenerator()
+{
+  const uint32_t rate = 1000;
+  const int total = 20000;
+  const int seekTo = 12345;
+  const int seekCount = 2000;
+  static const GeneratorChannelConfig configs[GEN_MAX_CHANNELS] = {
+    {GEN_SINE, 10, 0, 0, 1000},   {GEN_CHIRP, 1, 100, 10, 1000}, {GEN_SQUARE, 3, 0, 0, 1000},
+    {GEN_SPIKES, 7, 0, 0, 1000},  {GEN_RAMP, 0, 0, 0, 32768},    {GEN_PINK_NOISE, 0, 0, 0, 1000},
+    {GEN_SINE, 0.01f, 0, 0, 30000}, {GEN_SINE, 333, 0, 0, 1}};
+  static const char *const names[] = {"sine", "chirp", "square", "pink noise", "spikes", "ramp"};
+  bool ok = true;
+
+  int tableErrors = 0;
+  for (int i = 0; i < 1 << GEN_SINE_BITS; i++)
+  {
+    long expected = lround(32767 * sin(2 * M_PI * i / (1 << GEN_SINE_BITS)));
+    tableErrors += labs(GeneratorSineQ15(i) - expected) > 0;
+  }
+  printf("generator: sine table entries off by one or more: %d\n", tableErrors);
+  ok = ok && tableErrors == 0;
+
+  int32_t *forward[GEN_MAX_CHANNELS];
+  int32_t *seeked[GEN_MAX_CHANNELS];
+  for (int chan = 0; chan < GEN_MAX_CHANNELS; chan++)
+  {
+    forward[chan] = new int32_t[total];
+    seeked[chan] = new int32_t[seekCount];
+  }
+  SignalGenerator gen;
+  GeneratorCreate(&gen, GEN_MAX_CHANNELS, rate, configs, 60, 0);
+  GenerateChunked(&gen, forward, total, 37);
+
+  // table lookup without interpolation: phase is off by up to one entry
+  double sineError = 0;
+  for (int n = 0; n < total; n++)
+  {
+    double err = fabs(forward[0][n] - 1000 * sin(2 * M_PI * 10 * n / rate));
+    sineError = err > sineError ? err : sineError;
+  }
+  double sineBound = 1000 * 2 * M_PI / (1 << GEN_SINE_BITS) + 1;
+  printf("generator: 10 Hz sine worst error %.2f (bound %.2f)\n", sineError, sineBound);
+  ok = ok && sineError <= sineBound;
+
+  long rampErrors = 0;
+  for (int n = 1; n < total; n++)
+  {
+    rampErrors += forward[4][n] != (forward[4][n - 1] == 32767 ? -32768 : forward[4][n - 1] + 1);
+  }
+  printf("generator: ramp steps other than +1: %ld\n", rampErrors);
+  ok = ok && rampErrors == 0 && forward[4][0] == -32768;
+
+  GeneratorSeek(&gen, seekTo);
+  GenerateChunked(&gen, seeked, seekCount, 64);
+  for (int chan = 0; chan < GEN_MAX_CHANNELS; chan++)
+  {
+    if (configs[chan].waveform == GEN_PINK_NOISE)
+    {
+      continue; // restarted from a seed, not wound forward
+    }
+    long mismatches = 0;
+    for (int n = 0; n < seekCount; n++)
+    {
+      mismatches += seeked[chan][n] != forward[chan][seekTo + n];
+    }
+    if (mismatches)
+    {
+      printf("generator: channel %d differs after seeking on %ld samples\n", chan, mismatches);
+      ok = false;
+    }
+  }
+  printf("generator: seeking %s\n", ok ? "matches straight generation" : "FAILED");
+
+  for (int waveform = GEN_SINE; waveform <= GEN_RAMP; waveform++)
+  {
+    GeneratorChannelConfig config = {waveform, 10, 100, 10, 1000};
+    if (waveform == GEN_RAMP)
+    {
+      config.amplitude = 32768;
+    }
+    for (int withLine = 0; withLine < 2; withLine++)
+    {
+      GeneratorCreate(&gen, 1, rate, &config, 60, withLine ? 50 : 0);
+      const int chunk = 256;
+      double start = MonotonicSecs();
+      for (long done = 0; done < GENERATOR_BENCH_SAMPLES; done += chunk)
+      {
+        GeneratorRun(&gen, 0, forward[0], chunk);
+      }
+      double secs = MonotonicSecs() - start;
+      printf("generator: %-10s %s %6.2f ns/sample\n", names[waveform], withLine ? "+ mains" : "       ",
+             secs * 1e9 / GENERATOR_BENCH_SAMPLES);
+    }
+  }
+
+  for (int chan = 0; chan < GEN_MAX_CHANNELS; chan++)
+  {
+    delete[] forward[chan];
+    delete[] seeked[chan];
+  }
+  return ok ? 0 : 1;
+}
+
+/* one filter set up on a channel by BenchChannelFilter: a notch, a band-pass, either or neither */
+struct BenchFilterSpec
+{
+  float notchHz;
+  float highPassHz;
+  float lowPassHz;
+};
+
+/**
+ * @brief Gives a channel of the bank the filters in spec, and the anti-alias low-pass if it decimates
+ */
+static bool AddBenchFilters(FilterBank *bank, int chan, const BenchFilterSpec *spec)
+{
+  const float rate = FILTER_BENCH_RATE;
+  bool ok = true;
+  if (spec->notchHz > 0)
+  {
+    ok = FilterAddSection(bank, chan, FILTER_NOTCH, spec->notchHz, FILTER_NOTCH_Q, rate) && ok;
+  }
+  if (spec->highPassHz > 0)
+  {
+    ok = FilterAddSection(bank, chan, FILTER_HIGH_PASS, spec->highPassHz, 0.7071f, rate) && ok;
+  }
+  if (spec->lowPassHz > 0)
+  {
+    ok = FilterAddSection(bank, chan, FILTER_LOW_PASS, spec->lowPassHz, 0.7071f, rate) && ok;
+  }
+  if (bank->decimation > 1)
+  {
+    ok = FilterAddAntiAlias(bank, chan, rate) && ok;
+  }
+  return ok;
+}
+
+/**
+ * @brief Filters one 1 s record of each column in place, RING_SLICE_ROWS rows at a time as the ring does
+ */
+static void FilterRecord(FilterBank *bank, int32_t *const *columns, bool scalar)
+{
+  for (int row = 0; row < FILTER_BENCH_RATE; row += RING_SLICE_ROWS)
+  {
+    int rows = FILTER_BENCH_RATE - row < RING_SLICE_ROWS ? FILTER_BENCH_RATE - row : RING_SLICE_ROWS;
+    if (scalar)
+    {
+      FilterRunScalar(bank, columns, row, rows);
+    }
+    else
+    {
+      FilterRun(bank, columns, row, rows);
+    }
+  }
+}
+
+/**
+ * @brief Puts 4 s of a sine (or DC, at 0 Hz) of amplitude 10000 through one channel's filters
+ *
+ * @param low, high set to the smallest and largest output of the last second, once it's settled
+ */
+static void FilterResponse(const BenchFilterSpec *spec, int decimation, double hz, int32_t *low, int32_t *high)
+{
+  SampleArena arena;
+  FilterBank bank;
+  ArenaCreate(&arena, nullptr, FilterArenaBytes(1));
+  FilterCreate(&bank, &arena, 1, decimation);
+  AddBenchFilters(&bank, 0, spec);
+  int32_t *column = new int32_t[FILTER_BENCH_RATE];
+  const int outRows = FILTER_BENCH_RATE / decimation;
+  for (int record = 0; record < 4; record++)
+  {
+    for (int i = 0; i < FILTER_BENCH_RATE; i++)
+    {
+      column[i] = (int32_t)lrint(10000 * cos(2 * M_PI * hz * (record * FILTER_BENCH_RATE + i) / FILTER_BENCH_RATE));
+    }
+    FilterRecord(&bank, &column, false);
+  }
+  *low = *high = column[0];
+  for (int i = 1; i < outRows; i++)
+  {
+    *low = column[i] < *low ? column[i] : *low;
+    *high = column[i] > *high ? column[i] : *high;
+  }
+  delete[] column;
+  delete[] arena.base;
+}
+
+/**
+ * @brief Checks the peak a sine of amplitude 10000 comes out with is within [minPeak, maxPeak]
+ */
+static bool CheckGain(const char *name, const BenchFilterSpec *spec, int decimation, double hz, int32_t minPeak,
+                      int32_t maxPeak)
+{
+  int32_t low, high;
+  FilterResponse(spec, decimation, hz, &low, &high);
+  int32_t peak = -low > high ? -low : high;
+  bool ok = peak >= minPeak && peak <= maxPeak;
+  printf("filter: %-26s %6.1f Hz peak %6d (%6.1f dB), expected %d to %d: %s\n", name, hz, peak,
+         20 * log10((peak > 0 ? peak : 1) / 10000.0), minPeak, maxPeak, ok ? "ok" : "WRONG");
+  return ok;
+}
+
+/**
+ * @brief Runs the same channels through FilterRun and FilterRunScalar, 8 records of them
+ *
+ * Channel 5 is left inactive, so the second group of 4 goes channel by
+ * channel, and 10 channels leave 2 over for the scalar tail.
+ *
+ * @return samples, state and residues that differ
+ */
+static long FilterKernelMismatches(int decimation)
+{
+  static const BenchFilterSpec specs[] = {{60, 0, 0}, {50, 0.5f, 40}, {0, 0, 0}, {0, 1, 70}, {60, 0.3f, 0},
+                                          {0, 0, 0},  {0, 0, 100},    {50, 0, 0}, {60, 2, 45}, {0, 0.5f, 0}};
+  const int numChans = sizeof(specs) / sizeof(specs[0]);
+  SampleArena arenas[2];
+  FilterBank banks[2];
+  int32_t *samples[2];
+  int32_t *columns[2][numChans];
+  for (int k = 0; k < 2; k++)
+  {
+    ArenaCreate(&arenas[k], nullptr, FilterArenaBytes(numChans));
+    FilterCreate(&banks[k], &arenas[k], numChans, decimation);
+    samples[k] = new int32_t[numChans * FILTER_BENCH_RATE];
+    for (int chan = 0; chan < numChans; chan++)
+    {
+      AddBenchFilters(&banks[k], chan, &specs[chan]);
+      columns[k][chan] = samples[k] + chan * FILTER_BENCH_RATE;
+    }
+    banks[k].chanActive[5] = false;
+  }
+  long mismatches = 0;
+  uint32_t noise = 12345;
+  for (int record = 0; record < 8; record++)
+  {
+    for (int chan = 0; chan < numChans; chan++)
+    {
+      for (int i = 0; i < FILTER_BENCH_RATE; i++)
+      {
+        noise = noise * 1103515245 + 12345;
+        int32_t value = (int32_t)(20000 * sin((record * FILTER_BENCH_RATE + i) * (0.01 + 0.05 * chan))) +
+                        (int32_t)(noise >> 20) - 2048 + (chan == 3 ? 5000 : 0);
+        columns[0][chan][i] = columns[1][chan][i] = chan == 9 ? value * 256 : value;
+      }
+    }
+    FilterRecord(&banks[0], columns[0], false);
+    FilterRecord(&banks[1], columns[1], true);
+    // only the rows kept, the ones past them are left as either kernel happens to leave them
+    for (int chan = 0; chan < numChans; chan++)
+    {
+      for (int i = 0; i < FILTER_BENCH_RATE / decimation; i++)
+      {
+        mismatches += columns[0][chan][i] != columns[1][chan][i];
+      }
+    }
+  }
+  for (int i = 0; i < FILTER_MAX_SECTIONS * numChans; i++)
+  {
+    mismatches += banks[0].residue[i] != banks[1].residue[i];
+    for (int k = 0; k < 4; k++)
+    {
+      const int section = i / numChans, chan = i % numChans;
+      // sections past a channel's own pass samples through, only the kernel that runs them keeps their history
+      if (section < banks[0].chanSections[chan])
+      {
+        int at = (section * 4 + k) * numChans + chan;
+        mismatches += banks[0].state[at] != banks[1].state[at];
+      }
+    }
+  }
+  for (int k = 0; k < 2; k++)
+  {
+    delete[] samples[k];
+    delete[] arenas[k].base;
+  }
+  return mismatches;
+}
+
+/**
+ * @brief Times 8 channels through one filter set against FILTER_SECTION_BUDGET_CYCLES per section
+ *
+ * @return false if it's over its budget
+ */
+static bool TimeFilter(const char *name, const BenchFilterSpec *spec, int decimation)
+{
+  const int numChans = 8;
+  SampleArena arena;
+  FilterBank bank;
+  ArenaCreate(&arena, nullptr, FilterArenaBytes(numChans));
+  FilterCreate(&bank, &arena, numChans, decimation);
+  for (int chan = 0; chan < numChans; chan++)
+  {
+    AddBenchFilters(&bank, chan, spec);
+  }
+  float cycles, scalarCycles;
+  BenchFilter(&bank, &cycles, &scalarCycles);
+  const int budget = bank.numSections * FILTER_SECTION_BUDGET_CYCLES;
+  bool ok = scalarCycles <= budget;
+  printf("filter: %-26s %d sections, cycles/sample %6.2f, one channel at a time %6.2f, budget %d: %s\n", name,
+         bank.numSections, cycles, scalarCycles, budget, ok ? "ok" : "OVER");
+  delete[] arena.base;
+  return ok;
+}
+
+/**
+ * @brief Checks the notch, band-pass and decimating filters' responses, that the vector
+ *        kernel matches the scalar one exactly, and times each against its budget
+ *
+ * Cycles are the host's time stamp counter; the budget is what the
+ * Feather can afford, so the host should be well inside it.
+ */
+int BenchChannelFilter()
+{
+  static const BenchFilterSpec notch60 = {60, 0, 0}, notch50 = {50, 0, 0}, bandPass = {0, 0.5f, 40},
+                               none = {0, 0, 0}, all = {60, 0.5f, 40};
+  bool ok = true;
+  ok = CheckGain("60 Hz notch", &notch60, 1, 60, 0, 100) && ok;
+  ok = CheckGain("60 Hz notch", &notch60, 1, 10, 9900, 10100) && ok;
+  ok = CheckGain("50 Hz notch", &notch50, 1, 50, 0, 100) && ok;
+  ok = CheckGain("50 Hz notch", &notch50, 1, 100, 9900, 10100) && ok;
+  ok = CheckGain("0.5 to 40 Hz band-pass", &bandPass, 1, 0, 0, 50) && ok;
+  ok = CheckGain("0.5 to 40 Hz band-pass", &bandPass, 1, 10, 9800, 10100) && ok;
+  ok = CheckGain("0.5 to 40 Hz band-pass", &bandPass, 1, 100, 0, 2000) && ok;
+  ok = CheckGain("decimate by 4", &none, 4, 10, 9900, 10100) && ok;
+  ok = CheckGain("decimate by 4", &none, 4, 200, 0, 1000) && ok;
+  int32_t low, high;
+  FilterResponse(&none, 4, 0, &low, &high);
+  bool dcExact = low == 10000 && high == 10000;
+  printf("filter: decimate by 4, DC of 10000 comes out %d to %d: %s\n", low, high, dcExact ? "ok" : "WRONG");
+  ok = ok && dcExact;
+
+  for (int decimation = 1; decimation <= 4; decimation += 3)
+  {
+    long mismatches = FilterKernelMismatches(decimation);
+    printf("filter: vector and scalar kernels, decimating by %d, differ on %ld values\n", decimation, mismatches);
+    ok = ok && mismatches == 0;
+  }
+
+  ok = TimeFilter("60 Hz notch", &notch60, 1) && ok;
+  ok = TimeFilter("0.5 to 40 Hz band-pass", &bandPass, 1) && ok;
+  ok = TimeFilter("decimate by 4", &none, 4) && ok;
+  ok = TimeFilter("all of them", &all, 4) && ok;
+  return ok ? 0 : 1;
+}
+
+/**
+ * @brief Decodes every block in a captured stream, skipping to the next sync after a bad one
+ *
+ * @param samples room for RICE_MAX_ROWS * RICE_MAX_CHANNELS values, each block is decoded into it
+ * @param onBlock called with each decoded block and its offset in the stream
+ */
+template <typename OnBlock>
+static void DecodeRiceStream(RiceDecoder *dec, const uint8_t *stream, size_t length, int32_t *samples, OnBlock onBlock,
+                             void (*onEvent)(const uint8_t *frame, size_t length) = nullptr)
+{
+  size_t pos = 0;
+  while (pos < length)
+  {
+    // event frames sit between blocks
+    long eventBytes = EventFrameLength(stream + pos, length - pos);
+    if (eventBytes < 0)
+    {
+      break;
+    }
+    if (eventBytes > 0)
+    {
+      if (onEvent)
+      {
+        onEvent(stream + pos, eventBytes);
+      }
+      pos += eventBytes;
+      continue;
+    }
+    int channels, rows;
+    uint32_t counter;
+    long used = RiceDecodeBlock(dec, stream + pos, length - pos, samples, &channels, &rows, &counter);
+    if (used == 0)
+    {
+      break; // a block cut off at the end
+    }
+    if (used == -1)
+    {
+      pos++;
+      continue;
+    }
+    if (used == -2)
+    {
+      pos += RICE_HEADER_BYTES + (stream[pos + 8] | (size_t)stream[pos + 9] << 8) + 1;
+      continue;
+    }
+    onBlock(pos, channels, rows, counter);
+    pos += used;
+  }
+}
+
+/**
+ * @brief Compresses the playing source at several block sizes, checks it
+ *        decodes back exactly, and reports compression ratio and speed
+ *
+ * The source is read through the record ring once, up to
+ * COMPRESSION_BENCH_ROWS sample periods, with the channels and bit depth
+ * the compressed stream would have. A copy of each stream with a few bytes
+ * overwritten checks the decoder drops what it has to and picks up again
+ * at the next keyframe.
+ */
+int BenchCompression()
+{
+  const int channels = frameChannels > 0 ? frameChannels : SIMPLE_PACKET_CHANNELS;
+  const int bits = packetBits;
+  if (channels > RICE_MAX_CHANNELS || numSendChans < 1)
+  {
+    fprintf(stderr, "compression: nothing to compress\n");
+    return 1;
+  }
+
+  // the sent columns, record after record, as the stream would carry them
+  long maxRows = COMPRESSION_BENCH_ROWS / numOutArrayRows * numOutArrayRows;
+  int32_t **columns = new int32_t *[numSendChans];
+  for (int i = 0; i < numSendChans; i++)
+  {
+    columns[i] = new int32_t[maxRows];
+  }
+  long totalRows = 0;
+  recordRing.loopSource = false;
+  while (totalRows < maxRows)
+  {
+    RingFill(&recordRing);
+    if (!RingHasRecord(&recordRing))
+    {
+      break;
+    }
+    int32_t **record = RingCurrentRecord(&recordRing);
+    for (int i = 0; i < numSendChans; i++)
+    {
+      memcpy(columns[i] + totalRows, record[sendChans[i]], numOutArrayRows * sizeof(int32_t));
+    }
+    totalRows += numOutArrayRows;
+    RingReleaseRecord(&recordRing);
+  }
+  const long samples = totalRows * channels;
+  const size_t rawBytes = (size_t)totalRows * (FRAME_HEADER_BYTES + channels * bits / 8);
+  fprintf(stderr, "compression: %ld sample periods of %d channels, %d-bit; uncompressed 1-sample frames %zu bytes\n",
+          totalRows, channels, bits, rawBytes);
+
+  static RiceEncoder enc;
+  static RiceDecoder dec;
+  static int32_t decoded[RICE_MAX_ROWS * RICE_MAX_CHANNELS];
+  // no block is bigger than its raw samples and a header
+  uint8_t *stream = new uint8_t[(size_t)totalRows * (channels * 3 + RICE_HEADER_BYTES + 1)];
+  size_t *blockStarts = new size_t[totalRows];
+  bool ok = true;
+  static const int blockRows[] = {1, 2, 4, 8, 16, 32};
+  for (int rows : blockRows)
+  {
+    RiceEncoderCreate(&enc, channels, bits, rows, riceKeyframeBlocks);
+    size_t streamBytes = 0;
+    long numBlocks = 0;
+    uint64_t cycles = 0;
+    for (long n = 0; n < totalRows; n++)
+    {
+      uint32_t start = PlatformCycles();
+      size_t blockBytes = RiceAppendRow(&enc, n, columns, numSendChans, n);
+      cycles += (uint32_t)(PlatformCycles() - start);
+      if (blockBytes > 0)
+      {
+        blockStarts[numBlocks++] = streamBytes;
+        memcpy(stream + streamBytes, enc.out, blockBytes);
+        streamBytes += blockBytes;
+      }
+    }
+    long codedRows = totalRows / rows * rows;
+
+    // every sample back, exactly
+    long mismatches = 0;
+    long decodedRows = 0;
+    RiceDecoderInit(&dec);
+    double decodeStart = MonotonicSecs();
+    DecodeRiceStream(&dec, stream, streamBytes, decoded, [&](size_t, int numChans, int numRows, uint32_t counter) {
+      for (int r = 0; r < numRows; r++)
+      {
+        long n = decodedRows + r;
+        for (int chan = 0; chan < numChans; chan++)
+        {
+          int32_t value = columns[chan % numSendChans][n];
+          int32_t expected = (int32_t)((uint32_t)value << (32 - bits)) >> (32 - bits);
+          mismatches += decoded[r * numChans + chan] != expected;
+        }
+      }
+      mismatches += counter != (uint32_t)(decodedRows % 32768);
+      decodedRows += numRows;
+    });
+    double decodeSecs = MonotonicSecs() - decodeStart;
+    mismatches += decodedRows != codedRows;
+
+    // overwrite a few bytes a third of the way in: the blocks hit are lost, and
+    // the ones after them until a keyframe, but nothing wrong comes out
+    size_t corruptAt = streamBytes / 3;
+    for (size_t i = corruptAt; i < corruptAt + 3 && i < streamBytes; i++)
+    {
+      stream[i] ^= 0x5A;
+    }
+    long corruptMismatches = 0;
+    long recoveredBlocks = 0;
+    RiceDecoderInit(&dec);
+    DecodeRiceStream(&dec, stream, streamBytes, decoded, [&](size_t pos, int numChans, int numRows, uint32_t) {
+      // the damage doesn't move anything, so the block is the one that started there
+      const size_t *found = std::lower_bound(blockStarts, blockStarts + numBlocks, pos);
+      if (found == blockStarts + numBlocks || *found != pos)
+      {
+        corruptMismatches++;
+        return;
+      }
+      long firstRow = (found - blockStarts) * (long)rows;
+      for (int r = 0; r < numRows; r++)
+      {
+        for (int chan = 0; chan < numChans; chan++)
+        {
+          int32_t value = columns[chan % numSendChans][firstRow + r];
+          int32_t expected = (int32_t)((uint32_t)value << (32 - bits)) >> (32 - bits);
+          corruptMismatches += decoded[r * numChans + chan] != expected;
+        }
+      }
+      recoveredBlocks += pos > corruptAt;
+    });
+    bool resynced = corruptMismatches == 0 && recoveredBlocks > 0 && dec.badBlocks > 0;
+
+    double ratio = (double)rawBytes / streamBytes;
+    printf("compression: %2d samples/block  %6.2f bits/sample  ratio %.2f  encode %5.1f cycles/sample  decode "
+           "%5.1f ns/sample  max rate at 115200 baud %lu samples/s  %s\n",
+           rows, streamBytes * 8.0 / samples, ratio, (double)cycles / samples, decodeSecs * 1e9 / samples,
+           (unsigned long)(LinkMaxSampleRate(115200, FRAME_HEADER_BYTES + channels * bits / 8, 1) * ratio),
+           mismatches == 0 && resynced ? "lossless, resyncs" : "FAILED");
+    if (!resynced)
+    {
+      printf("compression: after corruption %ld wrong samples, %ld blocks recovered, %lu bad, %lu waited\n",
+             corruptMismatches, recoveredBlocks, dec.badBlocks, dec.waitedBlocks);
+    }
+    ok = ok && mismatches == 0 && resynced;
+  }
+
+  delete[] stream;
+  delete[] blockStarts;
+  for (int i = 0; i < numSendChans; i++)
+  {
+    delete[] columns[i];
+  }
+  delete[] columns;
+  return ok ? 0 : 1;
+}
+
+/**
+ * @brief Decodes a captured compressed stream back into 1-sample frames on the transport
+ *
+ * The frames are the ones that would have been sent uncompressed: sync,
+ * counter and one sample period of every channel (see FramePacker.h).
+ * Event frames are passed through as they are.
+ */
+int RiceDecodeFile(const char *path)
+{
+  FILE *in = fopen(path, "rb");
+  if (in == nullptr)
+  {
+    perror(path);
+    return 1;
+  }
+  fseek(in, 0, SEEK_END);
+  long length = ftell(in);
+  fseek(in, 0, SEEK_SET);
+  uint8_t *stream = new uint8_t[length > 0 ? length : 1];
+  size_t got = fread(stream, 1, length, in);
+  fclose(in);
+
+  static RiceDecoder dec;
+  static int32_t decoded[RICE_MAX_ROWS * RICE_MAX_CHANNELS];
+  static uint8_t frame[FRAME_HEADER_BYTES + RICE_MAX_CHANNELS * 3];
+  unsigned long rowsOut = 0;
+  RiceDecoderInit(&dec);
+  DecodeRiceStream(&dec, stream, got, decoded, [&](size_t pos, int numChans, int numRows, uint32_t counter) {
+    int sampleBytes = (stream[pos + 7] & RICE_FLAG_24BIT) ? 3 : 2;
+    for (int r = 0; r < numRows; r++)
+    {
+      PutInt16(frame, 0xFFFF);
+      PutInt16(frame + 2, (counter + r) % 32768);
+      uint8_t *dest = frame + FRAME_HEADER_BYTES;
+      for (int chan = 0; chan < numChans; chan++, dest += sampleBytes)
+      {
+        if (sampleBytes == 3)
+        {
+          PutInt24(dest, decoded[r * numChans + chan]);
+        }
+        else
+        {
+          PutInt16(dest, decoded[r * numChans + chan]);
+        }
+      }
+      TransportWrite(frame, dest - frame);
+    }
+    rowsOut += numRows;
+  }, [](const uint8_t *frame, size_t length) { TransportWrite(frame, length); });
+  delete[] stream;
+  fprintf(stderr, "decoded %lu blocks, %lu sample periods; %lu bad, %lu dropped waiting for a keyframe\n", dec.blocks,
+          rowsOut, dec.badBlocks, dec.waitedBlocks);
+  return dec.badBlocks == 0 ? 0 : 1;
+}
+
+/**
+ * @brief Builds the header of an EDF+D file of 1 s records: 8 signals at 256 Hz and annotations
+ *
+ * @return its length in bytes
+ */
+static int MakeDiscontinuousHeader(char *buf, long numRecords)
+{
+  const int ns = 9;
+  char text[32];
+  edfHeaderMain *main = (edfHeaderMain *)buf;
+  PutField(main->FormatVersion, sizeof(main->FormatVersion), "0");
+  PutField(main->localPatientId, sizeof(main->localPatientId), "X X X X");
+  PutField(main->localRecordingId, sizeof(main->localRecordingId), "Startdate 01-JAN-2022 X X X");
+  PutField(main->startDate, sizeof(main->startDate), "01.01.22");
+  PutField(main->startTime, sizeof(main->startTime), "00.00.00");
+  snprintf(text, sizeof(text), "%d", 256 * (ns + 1));
+  PutField(main->numHeaderBytes, sizeof(main->numHeaderBytes), text);
+  PutField(main->reserved, sizeof(main->reserved), "EDF+D");
+  snprintf(text, sizeof(text), "%ld", numRecords);
+  PutField(main->numDataRecords, sizeof(main->numDataRecords), text);
+  PutField(main->durationDataRcordsSecs, sizeof(main->durationDataRcordsSecs), "1");
+  snprintf(text, sizeof(text), "%d", ns);
+  PutField(main->numSignals, sizeof(main->numSignals), text);
+
+  char *p = buf + sizeof(edfHeaderMain);
+  const edfHeaderChan *c = nullptr;
+  for (int field = 0; field < 10; field++)
+  {
+    for (int i = 0; i < ns; i++)
+    {
+      bool annotations = i == ns - 1;
+      int width = 0;
+      const char *value = "";
+      switch (field)
+      {
+      case 0: width = sizeof(c->label); value = annotations ? "EDF Annotations" : "EEG"; break;
+      case 1: width = sizeof(c->transducerType); break;
+      case 2: width = sizeof(c->physicalDimension); value = annotations ? "" : "uV"; break;
+      case 3: width = sizeof(c->physicalMin); value = "-3276.8"; break;
+      case 4: width = sizeof(c->physicalMax); value = "3276.7"; break;
+      case 5: width = sizeof(c->digitalMin); value = "-32768"; break;
+      case 6: width = sizeof(c->digitalMax); value = "32767"; break;
+      case 7: width = sizeof(c->preFiltering); break;
+      case 8: width = sizeof(c->numDataSamplesPerRecord); value = annotations ? "60" : "256"; break;
+      case 9: width = sizeof(c->reserved); break;
+      }
+      PutField(p, width, value);
+      p += width;
+    }
+  }
+  return (int)(p - buf);
+}
+
+/**
+ * @brief Start time of a record of the bench file, 100 ns units
+ */
+static int64_t BenchRecordStart(long record)
+{
+  return record * 10000000LL + record / SEEK_BENCH_RUN_RECORDS * SEEK_BENCH_GAP;
+}
+
+/**
+ * @brief Checks and times the seek index on a sparse EDF+D file of about gigabytes GB
+ *
+ * The file has runs of SEEK_BENCH_RUN_RECORDS records with SEEK_BENCH_GAP
+ * between them; only its header and timekeeping TALs are written. The index
+ * build is timed with the file dropped from the page cache, so it pays for
+ * its reads as it would on first use.
+ */
+int BenchSeekIndex(double gigabytes)
+{
+  char dir[] = "/tmp/volkseeg-seek-XXXXXX";
+  if (mkdtemp(dir) == nullptr)
+  {
+    perror(dir);
+    return 1;
+  }
+  char edfPath[64], indexPath[64];
+  snprintf(edfPath, sizeof(edfPath), "%s/output.edf", dir);
+  snprintf(indexPath, sizeof(indexPath), "%s/%s", dir, SEEK_INDEX_FILE_NAME);
+
+  static char header[256 * 10];
+  const long recordBytes = 8 * 256 * 2 + 60 * 2;
+  long numRecords = (long)(gigabytes * 1e9 / recordBytes);
+  // positions are 32 bits, as on a FAT32 card
+  const long maxRecords = (long)((UINT32_MAX - sizeof(header)) / recordBytes);
+  numRecords = numRecords < maxRecords ? numRecords : maxRecords;
+  numRecords = numRecords > 1 ? numRecords : 1;
+  int headerBytes = MakeDiscontinuousHeader(header, numRecords);
+  uint64_t fileBytes = headerBytes + (uint64_t)numRecords * recordBytes;
+  double start = MonotonicSecs();
+  int fd = open(edfPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  bool ok = fd >= 0 && write(fd, header, headerBytes) == headerBytes && ftruncate(fd, fileBytes) == 0;
+  for (long record = 0; ok && record < numRecords; record++)
+  {
+    char tal[40];
+    int64_t onset = BenchRecordStart(record);
+    int length = snprintf(tal, sizeof(tal), "+%lld.%07lld\x14\x14", (long long)(onset / 10000000), (long long)(onset % 10000000));
+    ok = pwrite(fd, tal, length + 1, headerBytes + record * recordBytes + 8 * 256 * 2) == length + 1;
+  }
+  ok = ok && fsync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+  if (fd >= 0)
+  {
+    close(fd);
+  }
+  if (!ok)
+  {
+    perror(edfPath);
+    unlink(edfPath);
+    rmdir(dir);
+    return 1;
+  }
+  fprintf(stderr, "%s: %.2f GB, %ld records, %.0f h recorded, written in %.1f s\n", edfPath, fileBytes / 1e9, numRecords,
+          BenchRecordStart(numRecords) / 3.6e10, MonotonicSecs() - start);
+
+  SourceFile edf, indexFile;
+  EdfFileHeader edfHeader;
+  int result = edf.open(edfPath, false) ? EdfReadHeader(&edf, &edfHeader) : EDFLIB_FILE_READ_ERROR;
+  if (result != 0)
+  {
+    fprintf(stderr, "header: %s\n", EdfErrorString(result));
+    return 1;
+  }
+  int badRecord = -1;
+  start = MonotonicSecs();
+  result = indexFile.create(indexPath) ? SeekIndexBuild(&indexFile, &edf, &edfHeader, &badRecord) : SEEK_INDEX_ERR_WRITE;
+  double buildSecs = MonotonicSecs() - start;
+  indexFile.close();
+  fprintf(stderr, "index build:   %8.3f s, %.1f us/record (%s)\n", buildSecs, buildSecs * 1e6 / numRecords,
+          SeekIndexErrorString(result));
+
+  SeekIndex index;
+  start = MonotonicSecs();
+  result = result == 0 && indexFile.open(indexPath, false) ? SeekIndexOpen(&index, &indexFile, &edf, &edfHeader) : result;
+  fprintf(stderr, "index open:    %8.3f ms, %u bytes (%s)\n", (MonotonicSecs() - start) * 1e3, indexFile.fileSize(),
+          SeekIndexErrorString(result));
+
+  // random times from before the first record to past the last, gaps included
+  long wrong = 0;
+  double worst = 0;
+  int64_t span = BenchRecordStart(numRecords) + 20000000;
+  uint64_t seed = 12345;
+  start = MonotonicSecs();
+  for (int i = 0; i < SEEK_BENCH_FINDS && result == 0; i++)
+  {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    int64_t fileTime = (int64_t)((seed >> 11) % (uint64_t)span) - 10000000;
+    double findStart = MonotonicSecs();
+    long record;
+    int64_t offset;
+    if (!SeekIndexFind(&index, fileTime, &record, &offset))
+    {
+      wrong++;
+      continue;
+    }
+    double secs = MonotonicSecs() - findStart;
+    worst = secs > worst ? secs : worst;
+
+    // where it should be, worked out from how the file was made
+    long expected = 0;
+    int64_t expectedOffset = 0;
+    if (fileTime >= 0)
+    {
+      int64_t runLength = SEEK_BENCH_RUN_RECORDS * 10000000LL + SEEK_BENCH_GAP;
+      int64_t run = fileTime / runLength;
+      int64_t intoRun = fileTime % runLength;
+      expected = (long)(run * SEEK_BENCH_RUN_RECORDS + intoRun / 10000000);
+      expectedOffset = intoRun % 10000000;
+      if (intoRun >= SEEK_BENCH_RUN_RECORDS * 10000000LL)
+      {
+        expected = (long)((run + 1) * SEEK_BENCH_RUN_RECORDS);
+        expectedOffset = 0;
+      }
+      if (expected >= numRecords)
+      {
+        expected = numRecords - 1;
+        expectedOffset = 10000000 - 1;
+      }
+    }
+    wrong += record != expected || offset != expectedOffset;
+  }
+  double findSecs = MonotonicSecs() - start;
+  if (result == 0)
+  {
+    fprintf(stderr, "seek:          %8.3f us mean, %.3f us worst, %.1f index reads each, %ld wrong of %d\n",
+            findSecs * 1e6 / SEEK_BENCH_FINDS, worst * 1e6, (double)index.reads / index.finds, wrong, SEEK_BENCH_FINDS);
+  }
+
+  // touching the EDF file has to make the index stale
+  struct timeval times[2];
+  gettimeofday(&times[0], nullptr);
+  times[1] = times[0];
+  times[1].tv_sec -= 3600;
+  bool staleSeen = utimes(edfPath, times) == 0 &&
+                   SeekIndexOpen(&index, &indexFile, &edf, &edfHeader) == SEEK_INDEX_ERR_STALE;
+  fprintf(stderr, "stale after the EDF file changes: %s\n", staleSeen ? "yes" : "NO");
+
+  indexFile.close();
+  edf.close();
+  EdfFreeHeader(&edfHeader);
+  unlink(indexPath);
+  unlink(edfPath);
+  rmdir(dir);
+  return result == 0 && wrong == 0 && staleSeen ? 0 : 1;
+}
+
+/**
+ * @brief Bytes a 16-bit file took before the sample arena
+ *
+ * Every channel had its own heap block in every slot, and its own entry in
+ * every per-channel table, whether or not it could go in a packet, and the
+ * signal headers were kept.
+ */
+static size_t HeapLayoutBytes(int numSignals, int rows)
+{
+  size_t perChannel = sizeof(bool) + sizeof(int) + sizeof(chanAttributes) + sizeof(CalibrationQ) +
+                      sizeof(ChannelResampler) + sizeof(int) + sizeof(int32_t *) + sizeof(bool) +
+                      sizeof(edf_signal_struct) + numRingRecords * (sizeof(int32_t *) + HEAP_BLOCK_OVERHEAD +
+                                                                    ArenaSize(rows * sizeof(int32_t)));
+  return numSignals * perChannel + numRingRecords * (sizeof(long) + sizeof(uint32_t)) + rows * 2 +
+         RingAnnotationArenaBytes(numRingRecords);
+}
+
+/**
+ * @brief Most samples per record whose file fits in kilobytes, by either layout
+ */
+static int MaxRows(unsigned long kilobytes, int numSignals, int packetChannels, bool arena)
+{
+  int numColumns = numSignals < packetChannels ? numSignals : packetChannels;
+  int low = 0;
+  int high = 1 << 20;
+  while (low < high)
+  {
+    int rows = (low + high + 1) / 2;
+    size_t bytes = arena ? FileArenaBytes(numSignals, numColumns, rows, rows, 2) : HeapLayoutBytes(numSignals, rows);
+    if (bytes <= kilobytes * 1024)
+    {
+      low = rows;
+    }
+    else
+    {
+      high = rows - 1;
+    }
+  }
+  return low;
+}
+
+/**
+ * @brief Prints how long the records of 8, 64 and 640-signal 16-bit files can be in kilobytes of RAM,
+ *        with the sample arena and as it was before
+ */
+int RamBudgetReport(unsigned long kilobytes)
+{
+  const int packetChannels = frameChannels > 0 ? frameChannels : SIMPLE_PACKET_CHANNELS;
+  const int signalCounts[] = {8, 64, EDFLIB_MAXSIGNALS};
+  fprintf(stderr, "%lu KB, %d-record ring, %d-channel packets: most samples per record\n", kilobytes, numRingRecords,
+          packetChannels);
+  for (int signals : signalCounts)
+  {
+    int before = MaxRows(kilobytes, signals, packetChannels, false);
+    int after = MaxRows(kilobytes, signals, packetChannels, true);
+    fprintf(stderr, "%4d signals: per-channel heap blocks %7d, sample arena %7d (x%.1f)\n", signals, before, after,
+            before > 0 ? (double)after / before : 0.0);
+  }
+  return 0;
+}
+
+/**
+ * @brief Best time of a 640-signal header parse from memory, in ms, for the benchmark suite in test/
+ */
+double TimeHeaderParse()
+{
+  static char buf[256 * (EDFLIB_MAXSIGNALS + 1)];
+  static edf_signal_struct signals[EDFLIB_MAXSIGNALS];
+  int length = MakeMaxSignalsHeader(buf);
+  edf_hdr_struct hdr;
+  edf_layout_struct layout;
+  double best = 1e9;
+  for (int round = 0; round < HEADER_BENCH_ROUNDS; round++)
+  {
+    double start = MonotonicSecs();
+    MemoryReader reader = {buf, (int)sizeof(edfHeaderMain), length};
+    edf_parse_main_header((const edfHeaderMain *)buf, &hdr, &layout);
+    edf_parse_signal_headers(ReadFromMemory, &reader, &hdr, &layout, signals);
+    double secs = MonotonicSecs() - start;
+    best = secs < best ? secs : best;
+  }
+  return best * 1e3;
+}
+
+/**
+ * @brief Time to read, calibrate and publish one record of the source setup() loaded, in us
+ *
+ * The ring is emptied and filled again SUITE_RING_FILLS times; playback
+ * loops, so the file is read round and round.
+ */
+double TimeRefillRecord()
+{
+  double start = MonotonicSecs();
+  for (int fill = 0; fill < SUITE_RING_FILLS; fill++)
+  {
+    while (RingHasRecord(&recordRing))
+    {
+      RingReleaseRecord(&recordRing);
+    }
+    RingFill(&recordRing);
+  }
+  return (MonotonicSecs() - start) * 1e6 / (SUITE_RING_FILLS * recordRing.numSlots);
+}
+
+/**
+ * @brief Serializer time per packet (per sample period for frames), in ns, into a capture so the sink isn't timed
+ *
+ * @param frameBits 0 for simple packets of packetBits, otherwise 64-channel frames of this many bits
+ */
+double TimeSerializer(int packetBits, int frameBits)
+{
+  static uint8_t sink[sizeof(PacketRun::bytes)];
+  size_t sinkLength;
+  OutPacket packet;
+  RandomPacket(&packet);
+  int32_t *columns[SIMPLE_PACKET_CHANNELS];
+  for (int i = 0; i < SIMPLE_PACKET_CHANNELS; i++)
+  {
+    columns[i] = &packet.values[i];
+  }
+  FramePacker packer;
+  FramePackerCreate(&packer, FRAME_MAX_CHANNELS, frameBits ? frameBits : 16, 1);
+  PacketRun run;
+  TransportCaptureHost(sink, sizeof(sink), &sinkLength);
+  double start = MonotonicSecs();
+  for (int n = 0; n < BENCH_PACKETS; n++)
+  {
+    if (frameBits)
+    {
+      AppendFrameRow(&run, &packer, n, columns, SIMPLE_PACKET_CHANNELS, 0);
+    }
+    else if (packetBits == 24)
+    {
+      AppendSimplePacket24(&run, n, columns, SIMPLE_PACKET_CHANNELS, 0);
+    }
+    else
+    {
+      AppendSimplePacket(&run, n, columns, SIMPLE_PACKET_CHANNELS, 0);
+    }
+    sinkLength = 0;
+  }
+  FlushPacketRun(&run);
+  double secs = MonotonicSecs() - start;
+  TransportCaptureHost(nullptr, 0, nullptr);
+  return secs * 1e9 / BENCH_PACKETS;
+}
+
+#endif // !ARDUINO
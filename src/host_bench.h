@@ -0,0 +1,26 @@
+/**
+ * @file host_bench.h
+ * @brief Conformance checks and microbenchmarks run by the native build
+ *
+ * Each returns a process exit code: 0 if every check passed.
+ */
+#pragma once
+
+#include <signal.h>
+
+int BenchCalibrationAllChans();
+int BenchPacketSerializers();
+int BenchHeaderParse();
+int BenchResampler();
+int BenchGenerator();
+int BenchChannelFilter();
+int BenchCompression();
+int RiceDecodeFile(const char *path);
+int BenchSeekIndex(double gigabytes);
+int RamBudgetReport(unsigned long kilobytes);
+int RunFleet(int numDevices, int numWorkers, const char *output, volatile sig_atomic_t *stop);
+
+// timings the benchmark suite in test/test_bench_suite compares with its baseline
+double TimeHeaderParse();
+double TimeRefillRecord();
+double TimeSerializer(int packetBits, int frameBits);
@@ -0,0 +1,658 @@
+/**
+ * @file host_fleet.cpp
+ * @brief Many simulated devices in one process, to load the acquisition side
+ *
+ * Each virtual device has its own copy of what the single simulator keeps
+ * in globals: a source (output.edf opened again, or the signal generator),
+ * a record ring in its own arena, a packet scheduler and counter, and an
+ * output of its own (a pty, a UDP port or /dev/null). The devices are dealt
+ * round robin to a few worker threads; a worker keeps its devices in a
+ * min-heap by next deadline and sleeps in epoll on one timerfd armed for
+ * the earliest, so 256 devices cost a handful of threads, not 256.
+ * Devices start spread evenly over one packet period so their packets
+ * don't all fall due at once.
+ *
+ * Writes never block: a device whose output isn't keeping up holds what
+ * it didn't take in the device's packet run, and new packets queue behind
+ * it until the run is full, then are dropped whole and counted, so one
+ * stalled reader doesn't hold up the rest.
+ *
+ * Only simple packets are sent, 16 or 24 bits as --packet-bits says, with
+ * the catch-up policy of --catch-up.
+ */
+#ifndef ARDUINO
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include "platform.h"
+#include "Calibration.h"
+#include "EdfHeader.h"
+#include "PacketScheduler.h"
+#include "RecordRing.h"
+#include "Resampler.h"
+#include "SampleArena.h"
+#include "SignalGenerator.h"
+#include "SimplePacketMaker.h"
+#include "TimingStats.h"
+#include "host_bench.h"
+
+#define FLEET_LINE_HZ 60 //mains frequency of the generated interference, as GEN_LINE_HZ
+#define FLEET_MAX_ROWS_PER_RECORD 250 //generated records are 100 ms long, or this many samples if that's fewer
+#define FLEET_MAX_BURST_MICROS 250000 //with SCHED_CATCH_UP_BURST, packets later than this are skipped instead
+#define FLEET_REFILL_STEPS 4 //most ring refill slices a device does each time it's serviced
+#define FLEET_START_MILLIS 20 //from the end of setup to the first deadline
+
+extern const GeneratorChannelConfig generatorConfigs[GEN_MAX_CHANNELS];
+extern bool syntheticSource;
+extern uint32_t generatorRate;
+extern int generatorChans;
+extern int32_t generatorLineAmplitude;
+extern int numRingRecords;
+extern int catchUpPolicy;
+extern int packetBits;
+
+enum FleetOutput
+{
+  FLEET_PTY,
+  FLEET_UDP,
+  FLEET_NULL
+};
+
+struct VirtualDevice
+{
+  int id;
+  int fd;                    // pty master, UDP socket or /dev/null
+  struct sockaddr_in udpTo;  // FLEET_UDP only
+  bool failed;               // the output gave an error other than being full
+  SampleArena arena;
+  SourceFile file;
+  SignalGenerator generator;
+  RecordRing ring;
+  int rows;                  // packets per record
+  int numSendChans;
+  int *sendChans;            // columns that go in packets
+  int32_t **sendColumns;     // of the current record
+  int nextRow;               // row of the current record the next packet takes
+  int packetBits;
+  uint64_t periodNum;        // packet period in microseconds, periodNum / periodDen
+  uint32_t periodDen;
+  PacketScheduler sched;
+  uint64_t originNanos;      // CLOCK_MONOTONIC when sched's timeline started
+  uint32_t counter;
+  PacketRun run;             // packets made but not yet taken by the output
+  // totals
+  unsigned long packets;     // made and queued for the output
+  unsigned long dropped;     // due, but the output was still full
+  unsigned long underruns;   // due, but the ring had no record
+  uint64_t bytes;            // taken by the output
+  StatsHistogram lateness;   // of the packets made, microseconds after their deadline
+};
+
+struct FleetWorker
+{
+  std::vector<VirtualDevice *> heap; // earliest deadline first
+  int epollFd;
+  int timerFd;
+  int wakeFd;                        // eventfd, written to stop the worker
+  unsigned long wakeups;
+  std::thread thread;
+};
+
+static std::atomic<bool> fleetStopping(false);
+
+static uint64_t MonotonicNanos()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief When the device's next packet is due, on CLOCK_MONOTONIC
+ */
+static inline uint64_t DueNanos(const VirtualDevice *dev)
+{
+  return dev->originNanos + dev->sched.deadlineMicros * 1000;
+}
+
+/**
+ * @brief Orders the worker's heap so the earliest deadline is at the front
+ */
+static bool DueLater(const VirtualDevice *a, const VirtualDevice *b)
+{
+  return DueNanos(a) > DueNanos(b);
+}
+
+/**
+ * @brief Sends the generator's test signals, each device a second further into them than the one before
+ */
+static bool DeviceSetupGenerator(VirtualDevice *dev)
+{
+  int numChans = generatorChans;
+  int rows = generatorRate / 10;
+  rows = rows < 1 ? 1 : rows > FLEET_MAX_ROWS_PER_RECORD ? FLEET_MAX_ROWS_PER_RECORD : rows;
+  dev->rows = rows;
+  dev->periodNum = 1000000;
+  dev->periodDen = generatorRate;
+  dev->packetBits = packetBits ? packetBits : 16;
+  GeneratorCreate(&dev->generator, numChans, generatorRate, generatorConfigs, FLEET_LINE_HZ, generatorLineAmplitude);
+  GeneratorSeek(&dev->generator, (uint64_t)dev->id * generatorRate);
+  size_t bytes = RingArenaBytes(numRingRecords, numChans, rows, rows, 2) + ArenaSize(numChans * sizeof(int)) +
+                 ArenaSize(numChans * sizeof(int32_t *));
+  if (!ArenaCreate(&dev->arena, nullptr, bytes) ||
+      !RingCreate(&dev->ring, &dev->arena, numRingRecords, numChans, numChans, rows, rows, 2))
+  {
+    return false;
+  }
+  RingAttachGenerator(&dev->ring, &dev->generator);
+  dev->sendChans = ArenaNew<int>(&dev->arena, numChans, ARENA_CHANNELS);
+  dev->sendColumns = ArenaNew<int32_t *>(&dev->arena, numChans, ARENA_CHANNELS);
+  for (dev->numSendChans = 0; dev->numSendChans < numChans; dev->numSendChans++)
+  {
+    dev->sendChans[dev->numSendChans] = dev->numSendChans;
+  }
+  return true;
+}
+
+/**
+ * @brief Plays output.edf from its own file handle, the way setup() does
+ *        for the first SIMPLE_PACKET_CHANNELS signals, without annotations
+ */
+static bool DeviceSetupFile(VirtualDevice *dev)
+{
+  EdfFileHeader header;
+  if (!StorageOpen("output.edf", dev->file))
+  {
+    fprintf(stderr, "device %d: can't open output.edf under %s\n", dev->id, hostOptions.sdRoot);
+    return false;
+  }
+  int headerResult = EdfReadHeader(&dev->file, &header);
+  if (headerResult != 0)
+  {
+    fprintf(stderr, "device %d: bad EDF header: %s\n", dev->id, EdfErrorString(headerResult));
+    return false;
+  }
+  const edf_signal_struct *signals = header.signals;
+  const int numSignals = header.layout.total_signals;
+  const int numColumns = numSignals < SIMPLE_PACKET_CHANNELS ? numSignals : SIMPLE_PACKET_CHANNELS;
+  const int bytesPerSample = header.layout.bytes_per_sample;
+  int firstChan = 0;
+  while (firstChan < numSignals - 1 && signals[firstChan].annotation)
+  {
+    firstChan++;
+  }
+  const int rows = signals[firstChan].smp_per_record;
+  if (header.hdr.datarecord_duration <= 0)
+  {
+    fprintf(stderr, "device %d: EDF data records have no duration\n", dev->id);
+    EdfFreeHeader(&header);
+    return false;
+  }
+  dev->rows = rows;
+  dev->periodNum = header.hdr.datarecord_duration;
+  dev->periodDen = 10 * rows;
+  dev->packetBits = packetBits ? packetBits : bytesPerSample * 8;
+  int stagingSamps = rows;
+  for (int i = 0; i < numColumns; i++)
+  {
+    if (!signals[i].annotation && signals[i].smp_per_record > stagingSamps)
+    {
+      stagingSamps = signals[i].smp_per_record;
+    }
+  }
+  size_t bytes = ArenaSize(numSignals * sizeof(int)) + ArenaSize(numSignals * sizeof(bool)) +
+                 ArenaSize(numColumns * sizeof(ChannelResampler)) + ArenaSize(numColumns * sizeof(CalibrationQ)) +
+                 ArenaSize(numColumns * sizeof(int)) + ArenaSize(numColumns * sizeof(int32_t *)) +
+                 RingArenaBytes(numRingRecords, numColumns, rows, stagingSamps, bytesPerSample);
+  if (!ArenaCreate(&dev->arena, nullptr, bytes))
+  {
+    EdfFreeHeader(&header);
+    return false;
+  }
+  bool *chanUsed = ArenaNew<bool>(&dev->arena, numSignals, ARENA_CHANNELS);
+  int *chanSamps = ArenaNew<int>(&dev->arena, numSignals, ARENA_CHANNELS);
+  CalibrationQ *chanCal = ArenaNew<CalibrationQ>(&dev->arena, numColumns, ARENA_CHANNELS);
+  ChannelResampler *chanResampler = ArenaNew<ChannelResampler>(&dev->arena, numColumns, ARENA_CHANNELS);
+  dev->sendChans = ArenaNew<int>(&dev->arena, numColumns, ARENA_CHANNELS);
+  dev->sendColumns = ArenaNew<int32_t *>(&dev->arena, numColumns, ARENA_CHANNELS);
+  int maxChanSamps = rows;
+  dev->numSendChans = 0;
+  for (int i = 0; i < numSignals; i++)
+  {
+    chanSamps[i] = signals[i].smp_per_record;
+    if (i >= numColumns)
+    {
+      continue;
+    }
+    bool isUsable = !signals[i].annotation;
+    if (isUsable && chanSamps[i] != rows)
+    {
+      isUsable = ResamplerCreate(&chanResampler[i], chanSamps[i], rows);
+    }
+    if (isUsable && chanSamps[i] > maxChanSamps)
+    {
+      maxChanSamps = chanSamps[i];
+    }
+    chanUsed[i] = isUsable;
+    if (isUsable)
+    {
+      dev->sendChans[dev->numSendChans++] = i;
+    }
+    float calMultiplier = (signals[i].phys_max - signals[i].phys_min) / (signals[i].dig_max - signals[i].dig_min);
+    float calOffset = signals[i].phys_min - calMultiplier * signals[i].dig_min;
+    CalibrationPrepare(&chanCal[i], calMultiplier, calOffset, bytesPerSample * 8);
+  }
+  bool created = RingCreate(&dev->ring, &dev->arena, numRingRecords, numSignals, numColumns, rows, maxChanSamps,
+                            bytesPerSample);
+  if (created)
+  {
+    RingAttachSource(&dev->ring, &dev->file, header.layout.header_bytes, header.hdr.datarecords_in_file, chanSamps,
+                     chanUsed, chanCal, chanResampler);
+    dev->ring.loopSource = true;
+  }
+  EdfFreeHeader(&header);
+  return created;
+}
+
+/**
+ * @brief Opens the device's output, non-blocking
+ *
+ * @param udpPort FLEET_UDP only: device 0 sends to this port on localhost, device 1 to the next, and so on
+ */
+static bool DeviceOpenOutput(VirtualDevice *dev, FleetOutput output, int udpPort)
+{
+  switch (output)
+  {
+  case FLEET_PTY:
+  {
+    dev->fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (dev->fd < 0 || grantpt(dev->fd) != 0 || unlockpt(dev->fd) != 0)
+    {
+      perror("posix_openpt");
+      return false;
+    }
+    struct termios tio;
+    tcgetattr(dev->fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(dev->fd, TCSANOW, &tio);
+    fprintf(stderr, "device %d: packets on %s\n", dev->id, ptsname(dev->fd));
+    return true;
+  }
+  case FLEET_UDP:
+    dev->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (dev->fd < 0)
+    {
+      perror("socket");
+      return false;
+    }
+    memset(&dev->udpTo, 0, sizeof(dev->udpTo));
+    dev->udpTo.sin_family = AF_INET;
+    dev->udpTo.sin_port = htons(udpPort + dev->id);
+    dev->udpTo.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return true;
+  default:
+    dev->fd = ::open("/dev/null", O_WRONLY | O_NONBLOCK);
+    if (dev->fd < 0)
+    {
+      perror("/dev/null");
+      return false;
+    }
+    return true;
+  }
+}
+
+/**
+ * @brief Gives the output as much of the device's packet run as it will take, keeping the rest
+ */
+static void DeviceWrite(VirtualDevice *dev, FleetOutput output)
+{
+  if (dev->run.length == 0 || dev->failed)
+  {
+    return;
+  }
+  ssize_t written;
+  if (output == FLEET_UDP)
+  {
+    written = sendto(dev->fd, dev->run.bytes, dev->run.length, 0, (const struct sockaddr *)&dev->udpTo,
+                     sizeof(dev->udpTo));
+  }
+  else
+  {
+    written = ::write(dev->fd, dev->run.bytes, dev->run.length);
+  }
+  if (written < 0)
+  {
+    // nobody listening on the port is no reason to stop
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED)
+    {
+      dev->failed = true;
+    }
+    if (output == FLEET_UDP)
+    {
+      // a datagram is whole or not at all; these ones are gone
+      dev->run.length = 0;
+    }
+    return;
+  }
+  dev->bytes += written;
+  dev->run.length -= written;
+  memmove(dev->run.bytes, dev->run.bytes + written, dev->run.length);
+}
+
+/**
+ * @brief Row of the current record the next packet takes, moving on to the next record when one runs out
+ *
+ * @return false if the ring has no record for it
+ */
+static bool DeviceTakeRow(VirtualDevice *dev, int *row)
+{
+  if (dev->nextRow == 0)
+  {
+    while (!RingHasRecord(&dev->ring))
+    {
+      if (dev->ring.sourceFailed || !RingRefillStep(&dev->ring))
+      {
+        return false;
+      }
+    }
+    int32_t **record = RingCurrentRecord(&dev->ring);
+    for (int i = 0; i < dev->numSendChans; i++)
+    {
+      dev->sendColumns[i] = record[dev->sendChans[i]];
+    }
+  }
+  *row = dev->nextRow;
+  return true;
+}
+
+static void DeviceFinishRow(VirtualDevice *dev)
+{
+  if (++dev->nextRow == dev->rows)
+  {
+    dev->nextRow = 0;
+    RingReleaseRecord(&dev->ring);
+  }
+}
+
+/**
+ * @brief Makes every packet that's due, hands them to the output and tops the ring up a little
+ */
+static void DeviceService(VirtualDevice *dev, FleetOutput output)
+{
+  // whatever the output didn't take last time goes first, new packets queue behind it
+  DeviceWrite(dev, output);
+  SchedulerAction action;
+  while ((action = SchedulerNextAction(&dev->sched)) != SCHEDULER_IDLE)
+  {
+    int row;
+    if (!DeviceTakeRow(dev, &row))
+    {
+      dev->underruns++;
+      dev->counter++;
+      continue;
+    }
+    if (action == SCHEDULER_SEND)
+    {
+      if (PacketRunFull(&dev->run))
+      {
+        DeviceWrite(dev, output);
+      }
+      if (!PacketRunFull(&dev->run))
+      {
+        if (dev->packetBits == 24)
+        {
+          AppendSimplePacket24(&dev->run, dev->counter, dev->sendColumns, dev->numSendChans, row);
+        }
+        else
+        {
+          AppendSimplePacket(&dev->run, dev->counter, dev->sendColumns, dev->numSendChans, row);
+        }
+        dev->packets++;
+        StatsAdd(&dev->lateness, dev->sched.lastLateMicros);
+      }
+      else
+      {
+        dev->dropped++;
+      }
+    }
+    dev->counter++;
+    DeviceFinishRow(dev);
+  }
+  DeviceWrite(dev, output);
+  for (int i = 0; i < FLEET_REFILL_STEPS && !RingIsFull(&dev->ring) && RingRefillStep(&dev->ring); i++)
+  {
+  }
+}
+
+/**
+ * @brief Services the worker's devices as they fall due, sleeping on its timerfd in between
+ */
+static void WorkerRun(FleetWorker *worker, FleetOutput output)
+{
+  std::vector<VirtualDevice *> &heap = worker->heap;
+  while (!fleetStopping.load())
+  {
+    uint64_t now = MonotonicNanos();
+    while (DueNanos(heap.front()) <= now)
+    {
+      std::pop_heap(heap.begin(), heap.end(), DueLater);
+      DeviceService(heap.back(), output);
+      std::push_heap(heap.begin(), heap.end(), DueLater);
+      now = MonotonicNanos();
+    }
+    uint64_t due = DueNanos(heap.front());
+    struct itimerspec timer = {};
+    timer.it_value.tv_sec = due / 1000000000ULL;
+    timer.it_value.tv_nsec = due % 1000000000ULL;
+    timerfd_settime(worker->timerFd, TFD_TIMER_ABSTIME, &timer, nullptr);
+    struct epoll_event events[2];
+    int ready = epoll_wait(worker->epollFd, events, 2, -1);
+    for (int i = 0; i < ready; i++)
+    {
+      uint64_t expirations;
+      (void)!::read(events[i].data.fd, &expirations, sizeof(expirations));
+    }
+    worker->wakeups++;
+  }
+}
+
+static bool WorkerCreate(FleetWorker *worker)
+{
+  worker->epollFd = epoll_create1(0);
+  worker->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  worker->wakeFd = eventfd(0, EFD_NONBLOCK);
+  worker->wakeups = 0;
+  if (worker->epollFd < 0 || worker->timerFd < 0 || worker->wakeFd < 0)
+  {
+    perror("worker");
+    return false;
+  }
+  int fds[2] = {worker->timerFd, worker->wakeFd};
+  for (int fd : fds)
+  {
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, fd, &event);
+  }
+  return true;
+}
+
+/**
+ * @brief Parses --device-out: pty, null or udp:PORT
+ */
+static bool ParseFleetOutput(const char *spec, FleetOutput *output, int *udpPort)
+{
+  if (strcmp(spec, "pty") == 0)
+  {
+    *output = FLEET_PTY;
+  }
+  else if (strcmp(spec, "null") == 0)
+  {
+    *output = FLEET_NULL;
+  }
+  else if (strncmp(spec, "udp:", 4) == 0 && atoi(spec + 4) > 0)
+  {
+    *output = FLEET_UDP;
+    *udpPort = atoi(spec + 4);
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Adds one histogram into another
+ */
+static void MergeLateness(StatsHistogram *total, const StatsHistogram *hist)
+{
+  if (hist->count == 0)
+  {
+    return;
+  }
+  total->min = (total->count == 0 || hist->min < total->min) ? hist->min : total->min;
+  total->max = hist->max > total->max ? hist->max : total->max;
+  total->count += hist->count;
+  total->sum += hist->sum;
+  for (int bucket = 0; bucket < STATS_BUCKETS; bucket++)
+  {
+    total->buckets[bucket] += hist->buckets[bucket];
+  }
+}
+
+/**
+ * @brief Runs numDevices virtual devices on numWorkers threads until stop is set or --seconds is up
+ *
+ * @param output pty, null or udp:PORT
+ * @return process exit code
+ */
+int RunFleet(int numDevices, int numWorkers, const char *output, volatile sig_atomic_t *stop)
+{
+  FleetOutput outputKind;
+  int udpPort = 0;
+  if (!ParseFleetOutput(output, &outputKind, &udpPort))
+  {
+    fprintf(stderr, "--device-out is pty, null or udp:PORT, not %s\n", output);
+    return 2;
+  }
+  numWorkers = numWorkers < 1 ? 1 : numWorkers > numDevices ? numDevices : numWorkers;
+  VirtualDevice *devices = new VirtualDevice[numDevices]();
+  for (int i = 0; i < numDevices; i++)
+  {
+    VirtualDevice *dev = &devices[i];
+    dev->id = i;
+    dev->fd = -1;
+    bool ready = syntheticSource ? DeviceSetupGenerator(dev) : DeviceSetupFile(dev);
+    if (!ready || !DeviceOpenOutput(dev, outputKind, udpPort))
+    {
+      fprintf(stderr, "device %d: setup failed\n", i);
+      return 1;
+    }
+    RingFill(&dev->ring);
+  }
+
+  std::vector<FleetWorker> workers(numWorkers);
+  for (FleetWorker &worker : workers)
+  {
+    if (!WorkerCreate(&worker))
+    {
+      return 1;
+    }
+  }
+  // every timeline starts together, then each device's first deadline is its share of one period in
+  uint64_t startNanos = MonotonicNanos() + FLEET_START_MILLIS * 1000000ULL;
+  for (int i = 0; i < numDevices; i++)
+  {
+    VirtualDevice *dev = &devices[i];
+    SchedulerStart(&dev->sched, dev->periodNum, dev->periodDen, catchUpPolicy, FLEET_MAX_BURST_MICROS);
+    dev->originNanos = MonotonicNanos();
+    dev->sched.deadlineMicros = (startNanos - dev->originNanos) / 1000 + dev->periodNum * i / numDevices / dev->periodDen;
+    workers[i % numWorkers].heap.push_back(dev);
+  }
+  fleetStopping.store(false);
+  for (FleetWorker &worker : workers)
+  {
+    std::make_heap(worker.heap.begin(), worker.heap.end(), DueLater);
+    worker.thread = std::thread(WorkerRun, &worker, outputKind);
+  }
+
+  double wallSecs = 0;
+  while (!*stop && (hostOptions.maxSeconds <= 0 || wallSecs < hostOptions.maxSeconds))
+  {
+    struct timespec tick = {0, 10000000};
+    nanosleep(&tick, nullptr);
+    wallSecs = (int64_t)(MonotonicNanos() - startNanos) / 1e9;
+  }
+  fleetStopping.store(true);
+  unsigned long wakeups = 0;
+  for (FleetWorker &worker : workers)
+  {
+    uint64_t one = 1;
+    (void)!::write(worker.wakeFd, &one, sizeof(one));
+    worker.thread.join();
+    wakeups += worker.wakeups;
+    ::close(worker.epollFd);
+    ::close(worker.timerFd);
+    ::close(worker.wakeFd);
+  }
+
+  StatsHistogram lateness = {};
+  unsigned long packets = 0, dropped = 0, skipped = 0, underruns = 0, late = 0;
+  uint64_t bytes = 0;
+  int failed = 0;
+  for (int i = 0; i < numDevices; i++)
+  {
+    const VirtualDevice *dev = &devices[i];
+    const StatsHistogram *hist = &dev->lateness;
+    fprintf(stderr,
+            "device %3d: %lu packets (%.0f/s), %lu dropped, %lu skipped, %lu underruns, lateness us mean %lu "
+            "p99<=%lu max %lu%s\n",
+            i, dev->packets, dev->packets / wallSecs, dev->dropped, dev->sched.skippedPackets, dev->underruns,
+            (unsigned long)(hist->count ? hist->sum / hist->count : 0), (unsigned long)StatsPercentile(hist, 990),
+            (unsigned long)hist->max, dev->failed ? ", output failed" : "");
+    MergeLateness(&lateness, hist);
+    packets += dev->packets;
+    dropped += dev->dropped;
+    skipped += dev->sched.skippedPackets;
+    late += dev->sched.latePackets;
+    underruns += dev->underruns;
+    bytes += dev->bytes;
+    failed += dev->failed;
+    ::close(dev->fd);
+  }
+  fprintf(stderr, "fleet:          %d devices on %d workers, %s, %.3f s\n", numDevices, numWorkers, output, wallSecs);
+  fprintf(stderr, "packets:        %lu (%.0f/s), %llu bytes written\n", packets, packets / wallSecs,
+          (unsigned long long)bytes);
+  fprintf(stderr, "dropped:        %lu (output full), skipped %lu, late %lu, underruns %lu\n", dropped, skipped, late,
+          underruns);
+  fprintf(stderr, "wakeups:        %lu (%.1f packets each)\n", wakeups, wakeups ? (double)packets / wakeups : 0.0);
+  if (lateness.count > 0)
+  {
+    fprintf(stderr, "lateness (us):  min=%lu mean=%lu p50<=%lu p99<=%lu p99.9<=%lu max=%lu\n",
+            (unsigned long)lateness.min, (unsigned long)(lateness.sum / lateness.count),
+            (unsigned long)StatsPercentile(&lateness, 500), (unsigned long)StatsPercentile(&lateness, 990),
+            (unsigned long)StatsPercentile(&lateness, 999), (unsigned long)lateness.max);
+  }
+  // the arenas and the files they read stay until the process exits
+  return failed ? 1 : 0;
+}
+
+#endif // !ARDUINO
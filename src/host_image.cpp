@@ -0,0 +1,139 @@
+/**
+ * @file host_image.cpp
+ * @brief Native build only: writes the playback image of the EDF file setup() loaded
+ */
+#ifndef ARDUINO
+
+#include <stdio.h>
+#include <string.h>
+#include "platform.h"
+#include "RecordRing.h"
+#include "SimplePacketMaker.h"
+#include "FramePacker.h"
+#include "EdfHeader.h"
+#include "PlaybackImage.h"
+
+extern SourceFile edfFile;
+extern EdfFileHeader edfHeader;
+extern RecordRing recordRing;
+extern int numOutArrayChans;
+extern int numOutArrayRows;
+extern int *sendChans;
+extern int numSendChans;
+extern int packetBits;
+extern int frameChannels;
+extern uint64_t samplingPeriodNum;
+extern uint32_t samplingPeriodDen;
+
+/**
+ * @brief Converts the EDF file into a playback image at path
+ *
+ * Records are taken from the record ring, so the samples are exactly the
+ * ones live playback would send: same channel choice, calibration and
+ * resampling. Rows are laid out for the packet format setup() chose:
+ * simple packets (the first 8 channels of the file, zero padded) or
+ * frameChannels-channel frames (the channels sent, repeated to fill).
+ *
+ * @return process exit code
+ */
+int MakePlaybackImage(const char *path)
+{
+  const int channels = frameChannels > 0 ? frameChannels : SIMPLE_PACKET_CHANNELS;
+  FramePacker packer;
+  if (frameChannels > 0 && !FramePackerCreate(&packer, channels, packetBits, 1))
+  {
+    fprintf(stderr, "no %d-channel %d-bit frame format\n", channels, packetBits);
+    return 1;
+  }
+
+  PlaybackImageHeader header;
+  header.channels = channels;
+  header.bits = packetBits;
+  header.rowsPerRecord = numOutArrayRows;
+  header.rowBytes = channels * packetBits / 8;
+  uint32_t rowsBytes = header.rowsPerRecord * header.rowBytes;
+  header.recordBytes = (rowsBytes + IMAGE_SECTOR_BYTES - 1) / IMAGE_SECTOR_BYTES * IMAGE_SECTOR_BYTES;
+  header.numRecords = 0;
+  header.periodNum = samplingPeriodNum;
+  header.periodDen = samplingPeriodDen;
+  header.recordDuration = edfHeader.hdr.datarecord_duration;
+  uint8_t mainHeader[256];
+  header.sourceBytes = edfFile.fileSize();
+  header.sourceHeaderCrc = 0;
+
+  FILE *out = fopen(path, "wb");
+  if (out == nullptr)
+  {
+    perror(path);
+    return 1;
+  }
+  uint8_t *record = new uint8_t[header.recordBytes > IMAGE_SECTOR_BYTES ? header.recordBytes : IMAGE_SECTOR_BYTES];
+  // a placeholder header until the record count is known
+  memset(record, 0, IMAGE_SECTOR_BYTES);
+  bool ok = fwrite(record, 1, IMAGE_SECTOR_BYTES, out) == IMAGE_SECTOR_BYTES;
+
+  RingSeekDone(&recordRing);
+  recordRing.loopSource = false;
+  while (ok && header.numRecords < (uint32_t)edfHeader.hdr.datarecords_in_file)
+  {
+    RingFill(&recordRing);
+    if (!RingHasRecord(&recordRing))
+    {
+      break;
+    }
+    int32_t **columns = RingCurrentRecord(&recordRing);
+    int32_t *sendColumns[FRAME_MAX_CHANNELS];
+    for (int i = 0; i < numSendChans && i < FRAME_MAX_CHANNELS; i++)
+    {
+      sendColumns[i] = columns[sendChans[i]];
+    }
+    memset(record, 0, header.recordBytes);
+    uint8_t *dest = record;
+    for (int row = 0; row < numOutArrayRows; row++)
+    {
+      if (frameChannels > 0)
+      {
+        dest = packer.writeRow(dest, sendColumns, numSendChans, row);
+        continue;
+      }
+      // as AppendSimplePacket does it
+      for (int chan = 0; chan < SIMPLE_PACKET_CHANNELS; chan++)
+      {
+        int32_t value = chan < numOutArrayChans ? columns[chan][row] : 0;
+        if (packetBits == 24)
+        {
+          PutInt24(dest, value);
+        }
+        else
+        {
+          PutInt16(dest, value);
+        }
+        dest += packetBits / 8;
+      }
+    }
+    ok = fwrite(record, 1, header.recordBytes, out) == header.recordBytes;
+    header.numRecords++;
+    RingReleaseRecord(&recordRing);
+  }
+
+  edfFile.rewind();
+  if (edfFile.read(mainHeader, sizeof(mainHeader)) == (int)sizeof(mainHeader))
+  {
+    header.sourceHeaderCrc = ImageCrc32(0, mainHeader, sizeof(mainHeader));
+  }
+  ImageEncodeHeader(&header, record);
+  ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(record, 1, IMAGE_SECTOR_BYTES, out) == IMAGE_SECTOR_BYTES;
+  ok = fclose(out) == 0 && ok;
+  delete[] record;
+  if (!ok || recordRing.sourceFailed)
+  {
+    fprintf(stderr, "%s: couldn't write the image\n", path);
+    return 1;
+  }
+  fprintf(stderr, "%s: %lu records of %lu rows, %lu channels, %lu-bit, %lu bytes each (%lu of samples)\n", path,
+          (unsigned long)header.numRecords, (unsigned long)header.rowsPerRecord, (unsigned long)header.channels,
+          (unsigned long)header.bits, (unsigned long)header.recordBytes, (unsigned long)rowsBytes);
+  return 0;
+}
+
+#endif // !ARDUINO
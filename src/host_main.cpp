@@ -0,0 +1,691 @@
+/**
+ * @file host_main.cpp
+ * @brief Entry point for the native (Linux) build
+ *
+ * Drives the same setup()/loop() as the Feather, through platform_host.cpp,
+ * and reports packets/sec and CPU time per packet when it stops.
+ *
+ * The tests under test/ are built with these sources too (pio test -e
+ * native); there main() is left out and they run the simulator through
+ * SimulatorMain in a child process.
+ *
+ *   volkseeg-sim [--sd-root DIR] [--out FILE|-] [--pty] [--mmap] [--fast]
+ *                [--packets N] [--seconds S] [--ring-records N] [--refill-thread]
+ *                [--packet-bits 16|24] [--catch-up burst|skip|resync] [--clock-offset US]
+ *                [--stats-every S] [--synthetic] [--gen-rate HZ] [--gen-chans N]
+ *                [--gen-line-noise UV] [--frame-chans N] [--frame-samples S]
+ *                [--link-budget BAUD] [--usb] [--usb-flush US] [--compress ROWS] [--keyframe N] [--rice-decode FILE]
+ *                [--make-image FILE] [--no-image] [--no-descriptor] [--no-events] [--stdin] [--source-socket PATH]
+ *                [--tx-policy block|drop-oldest|drop-newest] [--no-tx-queue]
+ *                [--notch HZ] [--bandpass LO HI] [--filter CHANS:NOTCH:LO:HI] [--decimate M]
+ *                [--bench-calibration] [--bench-packets] [--bench-header]
+ *                [--bench-resampler] [--bench-generator] [--bench-compression] [--bench-filter]
+ *                [--bench-seek-index GB] [--ram-budget KB]
+ *                [--devices N] [--device-workers W] [--device-out pty|null|udp:PORT]
+ */
+#ifndef ARDUINO
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <thread>
+#include "platform.h"
+#include "RecordRing.h"
+#include "SimplePacketMaker.h"
+#include "PacketScheduler.h"
+#include "microedf.h"
+#include "host_bench.h"
+#include "TimingStats.h"
+#include "FramePacker.h"
+#include "RiceCodec.h"
+#include "LinkAggregator.h"
+#include "PlaybackImage.h"
+#include "ChannelFilter.h"
+
+void setup();
+void loop();
+extern unsigned long numPacketsWritten;
+extern bool sourceReady;
+extern bool isOutputting;
+extern RecordRing recordRing;
+extern int numRingRecords;
+extern int packetBits;
+extern int catchUpPolicy;
+extern PacketScheduler scheduler;
+extern uint64_t samplingPeriodNum;
+extern uint32_t samplingPeriodDen;
+extern PacketRun packetRun;
+extern bool syntheticSource;
+extern uint32_t generatorRate;
+extern int generatorChans;
+extern int32_t generatorLineAmplitude;
+extern int frameChannels;
+extern int frameSamples;
+extern int riceRows;
+extern int riceKeyframeBlocks;
+extern bool usbLink;
+extern bool usePlaybackImage;
+extern bool useSeekIndex;
+extern bool usePlaybackDescriptor;
+extern bool usePlaylist;
+extern bool loopPlayback;
+extern bool eventFrames;
+extern bool txQueued;
+extern TxPolicy txPolicy;
+extern uint32_t usbFlushMicros;
+extern ChannelFilterConfig filterConfigs[];
+extern int numFilterConfigs;
+extern int filterDecimation;
+
+static volatile sig_atomic_t stopRequested = 0;
+static bool benchCalibration = false;
+static bool benchPackets = false;
+static bool benchHeader = false;
+static bool benchResampler = false;
+static bool benchGenerator = false;
+static bool benchCompression = false;
+static bool benchFilter = false;
+static double benchSeekGigabytes = 0;
+static const char *riceDecodePath = nullptr;
+static const char *makeImagePath = nullptr;
+static uint32_t linkBudgetBaud = 0;
+static unsigned long ramBudgetKilobytes = 0;
+static int numDevices = 0;
+static int numDeviceWorkers = 4;
+static const char *deviceOutput = "pty";
+
+static void OnSignal(int sig)
+{
+  (void)sig;
+  stopRequested = 1;
+}
+
+/**
+ * @brief Keeps the record ring topped up from its own thread
+ */
+static void RefillThread()
+{
+  while (!stopRequested)
+  {
+    if (!RingRefillStep(&recordRing))
+    {
+      struct timespec idle = {0, 100000};
+      nanosleep(&idle, nullptr);
+    }
+  }
+}
+
+static double ClockSecs(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void PrintUsage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  --sd-root DIR   directory standing in for the SD card root (default .)\n"
+          "  --out FILE      write packets to FILE, - for stdout (default -)\n"
+          "  --pty           write packets to a new pty, its name is printed on stderr\n"
+          "  --mmap          mmap the EDF file instead of reading it\n"
+          "  --fast          ignore packet deadlines, send as fast as possible\n"
+          "  --packets N     stop after N packets\n"
+          "  --seconds S     stop after S seconds\n"
+          "  --ring-records N  data records buffered ahead of the sender (default %d)\n"
+          "  --refill-thread   refill the record ring from a separate thread\n"
+          "  --packet-bits N   16 or 24-bit samples in packets (default: 24 for BDF, 16 for EDF)\n"
+          "  --catch-up P      burst, skip or resync: what to do with late packets (default burst)\n"
+          "  --clock-offset US start the 32-bit microsecond clock at US, e.g. 4294000000 to see it wrap\n"
+          "  --stats-every S   print the timing histograms every S seconds as well as at exit\n"
+          "  --synthetic       send generated test signals instead of reading an EDF file\n"
+          "  --gen-rate HZ     sample rate of the generated signals (default %u)\n"
+          "  --gen-chans N     number of generated channels, up to 8 (default %d)\n"
+          "  --gen-line-noise UV  add mains interference of this peak to every generated channel\n"
+          "  --frame-chans N   send N-channel frames (8, 16, 32 or 64) instead of simple packets\n"
+          "  --frame-samples S sample periods per frame, up to %d (default 1)\n"
+          "  --link-budget BAUD   print the highest sample rate of each packet layout at BAUD, then exit\n"
+          "  --usb             aggregate packets into USB-sized transfers as the Feather's USB link does\n"
+          "  --usb-flush US    longest a partly filled transfer waits for more packets (default %u)\n"
+          "  --make-image FILE convert the EDF file into a playback image for the packet layout, then exit\n"
+          "  --no-image        parse output.edf even if there's a playback image\n"
+          "  --no-descriptor   parse output.edf's header even if output.vpd has it, and don't write one\n"
+          "  --no-events       don't send the file's annotations as event frames\n"
+          "  --stdin           read output.edf from stdin as it arrives, e.g. from zstd -dc, instead of the SD card root\n"
+          "  --source-socket PATH  the same, from a Unix socket listening at PATH\n"
+          "  --tx-policy P     block, drop-oldest or drop-newest: what a write does when the transmit queue is full\n"
+          "                    (default drop-oldest; with --fast it always blocks)\n"
+          "  --no-tx-queue     write packets to the output directly instead of through the transmit queue\n"
+          "  --notch HZ        notch mains interference at HZ (50 or 60) out of every channel before it's sent\n"
+          "  --bandpass LO HI  band-pass every channel between LO and HI Hz, 0 for no lower or upper edge\n"
+          "  --filter CHANS:NOTCH:LO:HI  filters for channels CHANS (N or FIRST-LAST) in place of the ones above, e.g. 2-3:50:0.5:30\n"
+          "  --decimate M      send every Mth sample after an anti-alias low-pass, e.g. 4 for 1 kHz out at 250 Hz\n"
+          "  --compress ROWS   send losslessly compressed blocks of ROWS sample periods, up to %d\n"
+          "  --keyframe N      compressed blocks from one keyframe to the next (default %d)\n"
+          "  --rice-decode FILE   decode a captured compressed stream into 1-sample frames, then exit\n"
+          "  --bench-calibration  check and time the calibration kernels, then exit\n"
+          "  --bench-packets      check and time the packet serializers, then exit\n"
+          "  --bench-header       check and time loading a %d-signal header, then exit\n"
+          "  --bench-resampler    check and time the resampler at common rate ratios, then exit\n"
+          "  --bench-generator    check and time the synthetic signal generator, then exit\n"
+          "  --bench-compression  check and time compressing the source at several block sizes, then exit\n"
+          "  --bench-filter       check the filters' responses and time them against their cycles/sample budget, then exit\n"
+          "  --bench-seek-index GB  check and time the seek index on a GB-sized EDF+D file in /tmp, then exit\n"
+          "  --ram-budget KB      print the longest records of 8 to %d-signal files that fit in KB, then exit\n"
+          "  --devices N       run N independent virtual devices sending simple packets, each its own source and output\n"
+          "  --device-workers W   threads the virtual devices share (default %d)\n"
+          "  --device-out O    pty, null or udp:PORT (device i sends to localhost PORT+i) (default %s)\n",
+          prog, numRingRecords, (unsigned)generatorRate, generatorChans, FRAME_MAX_SAMPLES, (unsigned)usbFlushMicros, RICE_MAX_ROWS,
+          riceKeyframeBlocks, EDFLIB_MAXSIGNALS, EDFLIB_MAXSIGNALS, numDeviceWorkers, deviceOutput);
+}
+
+static bool ParseArgs(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (strcmp(arg, "--sd-root") == 0 && hasValue)
+    {
+      hostOptions.sdRoot = argv[++i];
+    }
+    else if (strcmp(arg, "--out") == 0 && hasValue)
+    {
+      hostOptions.outPath = argv[++i];
+    }
+    else if (strcmp(arg, "--pty") == 0)
+    {
+      hostOptions.usePty = true;
+    }
+    else if (strcmp(arg, "--mmap") == 0)
+    {
+      hostOptions.useMmap = true;
+    }
+    else if (strcmp(arg, "--fast") == 0)
+    {
+      hostOptions.freeRunning = true;
+    }
+    else if (strcmp(arg, "--packets") == 0 && hasValue)
+    {
+      hostOptions.maxPackets = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (strcmp(arg, "--seconds") == 0 && hasValue)
+    {
+      hostOptions.maxSeconds = atof(argv[++i]);
+    }
+    else if (strcmp(arg, "--ring-records") == 0 && hasValue)
+    {
+      numRingRecords = atoi(argv[++i]);
+      if (numRingRecords < 1)
+      {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--packet-bits") == 0 && hasValue)
+    {
+      packetBits = atoi(argv[++i]);
+      if (packetBits != 16 && packetBits != 24)
+      {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--catch-up") == 0 && hasValue)
+    {
+      const char *policy = argv[++i];
+      if (strcmp(policy, "burst") == 0)
+      {
+        catchUpPolicy = SCHED_CATCH_UP_BURST;
+      }
+      else if (strcmp(policy, "skip") == 0)
+      {
+        catchUpPolicy = SCHED_CATCH_UP_SKIP;
+      }
+      else if (strcmp(policy, "resync") == 0)
+      {
+        catchUpPolicy = SCHED_CATCH_UP_RESYNC;
+      }
+      else
+      {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--stats-every") == 0 && hasValue)
+    {
+#if TIMING_STATS
+      statsDumpSecs = strtoul(argv[++i], nullptr, 10);
+#else
+      fprintf(stderr, "built with TIMING_STATS=0, --stats-every ignored\n");
+      i++;
+#endif
+    }
+    else if (strcmp(arg, "--synthetic") == 0)
+    {
+      syntheticSource = true;
+    }
+    else if (strcmp(arg, "--gen-rate") == 0 && hasValue)
+    {
+      generatorRate = strtoul(argv[++i], nullptr, 10);
+      if (generatorRate < 1)
+      {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--gen-chans") == 0 && hasValue)
+    {
+      generatorChans = atoi(argv[++i]);
+      if (generatorChans < 1 || generatorChans > GEN_MAX_CHANNELS)
+      {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--gen-line-noise") == 0 && hasValue)
+    {
+      generatorLineAmplitude = atoi(argv[++i]);
+    }
+    else if (strcmp(arg, "--frame-chans") == 0 && hasValue)
+    {
+      frameChannels = atoi(argv[++i]);
+    }
+    else if (strcmp(arg, "--frame-samples") == 0 && hasValue)
+    {
+      frameSamples = atoi(argv[++i]);
+      if (frameSamples < 1 || frameSamples > FRAME_MAX_SAMPLES)
+      {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--link-budget") == 0 && hasValue)
+    {
+      linkBudgetBaud = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (strcmp(arg, "--ram-budget") == 0 && hasValue)
+    {
+      ramBudgetKilobytes = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (strcmp(arg, "--devices") == 0 && hasValue)
+    {
+      numDevices = atoi(argv[++i]);
+      if (numDevices < 1)
+      {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--device-workers") == 0 && hasValue)
+    {
+      numDeviceWorkers = atoi(argv[++i]);
+      if (numDeviceWorkers < 1)
+      {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--device-out") == 0 && hasValue)
+    {
+      deviceOutput = argv[++i];
+    }
+    else if (strcmp(arg, "--usb") == 0)
+    {
+      usbLink = true;
+    }
+    else if (strcmp(arg, "--usb-flush") == 0 && hasValue)
+    {
+      usbFlushMicros = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (strcmp(arg, "--make-image") == 0 && hasValue)
+    {
+      makeImagePath = argv[++i];
+      usePlaybackImage = false;
+    }
+    else if (strcmp(arg, "--no-image") == 0)
+    {
+      usePlaybackImage = false;
+    }
+    else if (strcmp(arg, "--no-descriptor") == 0)
+    {
+      usePlaybackDescriptor = false;
+    }
+    else if (strcmp(arg, "--no-events") == 0)
+    {
+      eventFrames = false;
+    }
+    else if (strcmp(arg, "--stdin") == 0)
+    {
+      hostOptions.sourceStream = "-";
+    }
+    else if (strcmp(arg, "--source-socket") == 0 && hasValue)
+    {
+      hostOptions.sourceStream = argv[++i];
+    }
+    else if (strcmp(arg, "--tx-policy") == 0 && hasValue)
+    {
+      const char *policy = argv[++i];
+      if (strcmp(policy, "block") == 0)
+      {
+        txPolicy = TX_BLOCK;
+      }
+      else if (strcmp(policy, "drop-oldest") == 0)
+      {
+        txPolicy = TX_DROP_OLDEST;
+      }
+      else if (strcmp(policy, "drop-newest") == 0)
+      {
+        txPolicy = TX_DROP_NEWEST;
+      }
+      else
+      {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--no-tx-queue") == 0)
+    {
+      txQueued = false;
+    }
+    else if (strcmp(arg, "--notch") == 0 && hasValue)
+    {
+      filterConfigs[0].notchHz = (float)atof(argv[++i]);
+    }
+    else if (strcmp(arg, "--bandpass") == 0 && i + 2 < argc)
+    {
+      filterConfigs[0].highPassHz = (float)atof(argv[++i]);
+      filterConfigs[0].lowPassHz = (float)atof(argv[++i]);
+    }
+    else if (strcmp(arg, "--filter") == 0 && hasValue)
+    {
+      if (numFilterConfigs == FILTER_MAX_CONFIGS)
+      {
+        return false;
+      }
+      ChannelFilterConfig *config = &filterConfigs[numFilterConfigs];
+      if (sscanf(argv[++i], "%d-%d:%f:%f:%f", &config->firstChan, &config->lastChan, &config->notchHz,
+                 &config->highPassHz, &config->lowPassHz) != 5)
+      {
+        if (sscanf(argv[i], "%d:%f:%f:%f", &config->firstChan, &config->notchHz, &config->highPassHz,
+                   &config->lowPassHz) != 4)
+        {
+          return false;
+        }
+        config->lastChan = config->firstChan;
+      }
+      numFilterConfigs++;
+    }
+    else if (strcmp(arg, "--decimate") == 0 && hasValue)
+    {
+      filterDecimation = atoi(argv[++i]);
+      if (filterDecimation < 1)
+      {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--compress") == 0 && hasValue)
+    {
+      riceRows = atoi(argv[++i]);
+      if (riceRows < 1 || riceRows > RICE_MAX_ROWS)
+      {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--keyframe") == 0 && hasValue)
+    {
+      riceKeyframeBlocks = atoi(argv[++i]);
+      if (riceKeyframeBlocks < 1)
+      {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--rice-decode") == 0 && hasValue)
+    {
+      riceDecodePath = argv[++i];
+    }
+    else if (strcmp(arg, "--clock-offset") == 0 && hasValue)
+    {
+      hostOptions.clockOffsetMicros = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (strcmp(arg, "--refill-thread") == 0)
+    {
+      hostOptions.refillThread = true;
+    }
+    else if (strcmp(arg, "--bench-calibration") == 0)
+    {
+      benchCalibration = true;
+    }
+    else if (strcmp(arg, "--bench-packets") == 0)
+    {
+      benchPackets = true;
+    }
+    else if (strcmp(arg, "--bench-header") == 0)
+    {
+      benchHeader = true;
+    }
+    else if (strcmp(arg, "--bench-resampler") == 0)
+    {
+      benchResampler = true;
+    }
+    else if (strcmp(arg, "--bench-generator") == 0)
+    {
+      benchGenerator = true;
+    }
+    else if (strcmp(arg, "--bench-compression") == 0)
+    {
+      benchCompression = true;
+    }
+    else if (strcmp(arg, "--bench-filter") == 0)
+    {
+      benchFilter = true;
+    }
+    else if (strcmp(arg, "--bench-seek-index") == 0 && hasValue)
+    {
+      benchSeekGigabytes = atof(argv[++i]);
+      if (benchSeekGigabytes <= 0)
+      {
+        return false;
+      }
+    }
+    else
+    {
+      return false;
+    }
+  }
+  if (hostOptions.sourceStream)
+  {
+    // a stream is read once, front to back: nothing to find in it ahead of time or go back to
+    usePlaybackImage = false;
+    usePlaylist = false;
+    useSeekIndex = false;
+    usePlaybackDescriptor = false;
+    loopPlayback = false;
+    // and a read waits for the producer, which the sender mustn't
+    hostOptions.refillThread = true;
+  }
+  return true;
+}
+
+/**
+ * @brief Runs the simulator with a command line, as main() does
+ *
+ * @return process exit code
+ */
+int SimulatorMain(int argc, char **argv)
+{
+  if (!ParseArgs(argc, argv))
+  {
+    PrintUsage(argv[0]);
+    return 2;
+  }
+  if (!TransportOpenHost())
+  {
+    return 1;
+  }
+  if (benchHeader)
+  {
+    TransportCloseHost();
+    return BenchHeaderParse();
+  }
+  if (benchResampler)
+  {
+    TransportCloseHost();
+    return BenchResampler();
+  }
+  if (linkBudgetBaud > 0)
+  {
+    TransportCloseHost();
+    LinkBudgetReport(linkBudgetBaud);
+    return 0;
+  }
+  if (ramBudgetKilobytes > 0)
+  {
+    TransportCloseHost();
+    return RamBudgetReport(ramBudgetKilobytes);
+  }
+  if (benchGenerator)
+  {
+    TransportCloseHost();
+    return BenchGenerator();
+  }
+  if (benchFilter)
+  {
+    TransportCloseHost();
+    return BenchChannelFilter();
+  }
+  if (benchSeekGigabytes > 0)
+  {
+    TransportCloseHost();
+    return BenchSeekIndex(benchSeekGigabytes);
+  }
+  if (riceDecodePath != nullptr)
+  {
+    int result = RiceDecodeFile(riceDecodePath);
+    TransportCloseHost();
+    return result;
+  }
+  if (benchPackets)
+  {
+    int result = BenchPacketSerializers();
+    TransportCloseHost();
+    return result;
+  }
+  signal(SIGINT, OnSignal);
+  signal(SIGTERM, OnSignal);
+  signal(SIGPIPE, OnSignal);
+
+  if (numDevices > 0)
+  {
+    TransportCloseHost();
+    return RunFleet(numDevices, numDeviceWorkers, deviceOutput, &stopRequested);
+  }
+  setup();
+  if (!sourceReady)
+  {
+    fprintf(stderr, "no EDF source %s %s\n", hostOptions.sourceStream ? "from" : "under",
+            hostOptions.sourceStream ? hostOptions.sourceStream : hostOptions.sdRoot);
+    TransportCloseHost();
+    return 1;
+  }
+  if (benchCalibration && !syntheticSource)
+  {
+    TransportCloseHost();
+    return BenchCalibrationAllChans();
+  }
+  if (makeImagePath != nullptr)
+  {
+    TransportCloseHost();
+    if (syntheticSource)
+    {
+      fprintf(stderr, "--make-image converts an EDF file, not the generator\n");
+      return 1;
+    }
+    return MakePlaybackImage(makeImagePath);
+  }
+  if (benchCompression)
+  {
+    TransportCloseHost();
+    return BenchCompression();
+  }
+
+  std::thread refiller;
+  if (hostOptions.refillThread)
+  {
+    recordRing.backgroundRefill = true;
+    refiller = std::thread(RefillThread);
+  }
+
+  double wallStart = ClockSecs(CLOCK_MONOTONIC);
+  double cpuStart = ClockSecs(CLOCK_PROCESS_CPUTIME_ID);
+  unsigned long packetsStart = numPacketsWritten;
+  while (!stopRequested)
+  {
+    loop();
+    if (hostOptions.maxPackets && numPacketsWritten - packetsStart >= hostOptions.maxPackets)
+    {
+      break;
+    }
+    if (hostOptions.maxSeconds > 0 && ClockSecs(CLOCK_MONOTONIC) - wallStart >= hostOptions.maxSeconds)
+    {
+      break;
+    }
+    if (hostOptions.sourceStream && !isOutputting && recordRing.endOfSource.load())
+    {
+      // the producer closed its end and every record it sent has gone out
+      break;
+    }
+  }
+  double wallSecs = ClockSecs(CLOCK_MONOTONIC) - wallStart;
+  double cpuSecs = ClockSecs(CLOCK_PROCESS_CPUTIME_ID) - cpuStart;
+  unsigned long packets = numPacketsWritten - packetsStart;
+  FlushPacketRun(&packetRun);
+  const LinkAggregator *link = TransportUsbLink();
+  const TxQueue *txQueue = TransportTxQueue();
+  stopRequested = 1;
+  if (refiller.joinable() && hostOptions.sourceStream)
+  {
+    // it may be waiting on a quiet producer for as long as it stays quiet
+    refiller.detach();
+  }
+  else if (refiller.joinable())
+  {
+    refiller.join();
+  }
+  TransportCloseHost();
+
+  fprintf(stderr, "packets:        %lu\n", packets);
+  fprintf(stderr, "wall time:      %.3f s\n", wallSecs);
+  if (packets > 0 && wallSecs > 0)
+  {
+    fprintf(stderr, "packets/sec:    %.0f\n", packets / wallSecs);
+    fprintf(stderr, "cpu per packet: %.1f ns\n", cpuSecs * 1e9 / packets);
+  }
+  fprintf(stderr, "ring underruns: %lu\n", recordRing.underruns);
+  if (link != nullptr)
+  {
+    AggregatorReport(link);
+  }
+  if (txQueue != nullptr)
+  {
+    TxQueueReport(txQueue);
+  }
+  if (!hostOptions.freeRunning)
+  {
+    // every deadline up to now should have had its packet, sent or skipped
+    uint64_t nowMicros = SchedulerNow(&scheduler);
+    uint64_t deadlinesPassed = nowMicros * samplingPeriodDen / samplingPeriodNum + 1;
+    fprintf(stderr, "late packets:   %lu (skipped %lu, resyncs %lu)\n", scheduler.latePackets,
+            scheduler.skippedPackets, scheduler.resyncs);
+    fprintf(stderr, "vs wall clock:  %lld packets after %.3f s on the packet clock\n",
+            (long long)numPacketsWritten - (long long)deadlinesPassed, nowMicros / 1e6);
+  }
+#if TIMING_STATS
+  fprintf(stderr, "timing (us):\n");
+  StatsDump();
+#endif
+  return 0;
+}
+
+#ifndef PIO_UNIT_TESTING
+int main(int argc, char **argv)
+{
+  return SimulatorMain(argc, argv);
+}
+#endif
+
+#endif // !ARDUINO
@@ -13,21 +13,56 @@
  *    packet format
  * 
  * Some things:
- * a. Only channels that are sampled at the same frequency as the first channel will be used
- * b. Annotation channels are not used
+ * a. Every channel is sent at the sampling frequency of the first channel;
+ *    channels sampled at other frequencies are resampled to it
+ * b. Annotation channels aren't sent as samples; with EVENT_FRAMES set,
+ *    their annotations are sent as event frames among the packets, at the
+ *    samples they belong to (see EventFrame.h)
  * c. In adhering to the simple packet spec it will always send 8 samples per packet
  *    -- if fewer than 8 qualifying channels in the EDF file, channels will be padded out
  *    -- if more than 8 qualifying channels, first 8 will be used.
+ * d. With FRAME_CHANNELS set, frames of 8 to 64 channels are sent instead
+ *    (see FramePacker.h), made of the qualifying channels, repeated if there
+ *    aren't enough
+ * e. If the card has a playback image (IMAGE_FILE_NAME, see PlaybackImage.h)
+ *    made from output.edf for the packet layout in use, it's played instead
+ *    of parsing the EDF file
+ * f. With RICE_BLOCK_ROWS set, the same channels are sent losslessly
+ *    compressed in blocks instead (see RiceCodec.h)
+ * g. Seeking by time in an EDF+D/BDF+D file goes by the start times in its
+ *    seek index (SEEK_INDEX_FILE_NAME, see SeekIndex.h), built on first use
+ * h. If the card has a playlist (PLAYLIST_FILE_NAME, see Playlist.h), the
+ *    files it lists are played one after the other instead of output.edf,
+ *    with no break in the packets or their counter
  *  
  */
 
+#include <limits.h>
+#include <stdio.h>
+#ifdef ARDUINO
 #include <Arduino.h>
-#include <SPI.h>
-#include "SdFat.h"
+#include <Adafruit_TinyUSB.h>
+#endif
+#include "platform.h"
 #include "microedf.h"
 #include "SimplePacketMaker.h"
-#include <Adafruit_TinyUSB.h>
-#include "helpers.h"
+#include "RecordRing.h"
+#include "Calibration.h"
+#include "Resampler.h"
+#include "ChannelFilter.h"
+#include "PacketScheduler.h"
+#include "EdfHeader.h"
+#include "TimingStats.h"
+#include "PlaybackCommand.h"
+#include "SignalGenerator.h"
+#include "FramePacker.h"
+#include "RiceCodec.h"
+#include "PlaybackImage.h"
+#include "SeekIndex.h"
+#include "PlaybackDescriptor.h"
+#include "Playlist.h"
+#include "SampleArena.h"
+#include "EventFrame.h"
 
 #define CS_PIN 6 //GPIO output pin for SD card select
 #define SEND_PACKET_TEST_PIN 9 //GPIO pin that gets twiddled when packet sent
@@ -35,412 +70,1558 @@
 #define GENERAL_TEST_PIN_2 11 //GPIO pin that gets twiddled for testing
 #define SD_INFO_DUMP false //true if we want to send SD card filesystem data to serial out
 #define GPIO_DEBUG true //if true, various GPIOs are toggled to indicate points reached in code
+#define RING_RECORDS 4 //number of data records buffered ahead of the sender
+#define IDLE_SLEEP_MICROS 1000 //how long loop() sleeps while stopped with nothing to read; commands wait at most this long
+#define RECORD_WAIT_MICROS 100 //how long WaitForRecord sleeps between looks while another thread reads the file
+#define CAL_BENCH false //true if we want to send calibration kernel cycles/sample to serial out at startup
+#define PACKET_BITS 0 //bits per sample in the packets sent, 16 or 24; 0 follows the file (24 for BDF, 16 for EDF)
+#define CATCH_UP_POLICY SCHED_CATCH_UP_BURST //what happens to packets whose deadline was missed, see PacketScheduler.h
+#define MAX_BURST_MICROS 250000 //with SCHED_CATCH_UP_BURST, packets later than this are skipped instead
+#define AUTO_START true //start sending packets at power up, otherwise wait for a start command
+#define LOOP_PLAYBACK true //go back to the first data record at the end of the file, otherwise stop there
+#define PLAYBACK_SPEED_PERCENT 100 //playback rate at power up in percent of real time, 0 for as fast as the link allows
+#define COMMAND_BYTES_PER_LOOP 8 //most command bytes taken per loop(), so commands never hold up a packet
+#define SYNTHETIC_SOURCE false //true to send generated test signals (generatorConfigs) instead of the EDF file
+#define GEN_SAMPLE_RATE 250 //samples/second of the generated signals
+#define GEN_CHANNELS 8 //generated channels, up to 8
+#define GEN_LINE_HZ 60 //mains frequency of the generated interference
+#define GEN_LINE_UV 0 //peak of the mains interference added to every generated channel, 0 for none
+#define GEN_MAX_ROWS_PER_RECORD 250 //generated records are 100 ms long, or this many samples if that's fewer
+#define SERIAL_BAUD 115200 //packet link baud rate
+#define FRAME_CHANNELS 0 //channels per frame: 8, 16, 32 or 64; 0 sends 8-channel simple packets instead
+#define FRAME_SAMPLES 1 //sample periods packed in each frame, up to 16
+#define LINK_BUDGET_REPORT false //true to print the highest sample rate of each packet layout at the link's baud rate on startup
+#define PLAYBACK_IMAGE true //play the card's playback image instead of output.edf when there's an up to date one for this packet layout
+#define RICE_BLOCK_ROWS 0 //sample periods per compressed block, up to 32; 0 sends uncompressed packets or frames
+#define PACKET_LINK_USB false //true to send packets over the USB CDC port instead of Serial1, the debug console moves to Serial1
+#define USB_FLUSH_MICROS 2000 //longest a partly filled USB transfer waits for more packets
+#define USB_EQUIVALENT_BAUD 8000000 //baud rate of a UART carrying what USB full speed CDC does, for the link budget
+#define RICE_KEYFRAME_BLOCKS 8 //compressed blocks from one keyframe to the next, where a receiver can pick up the stream
+#define SEEK_INDEX true //for EDF+D/BDF+D files, seek by time using an index of record start times kept next to output.edf
+#define PLAYLIST true //play the files listed in the card's playlist.txt one after the other, when there is one, instead of output.edf
+#define EVENT_FRAMES true //send the EDF+/BDF+ file's annotations as event frames among the packets
+#define TX_QUEUE true //queue packets for Serial1 and send them in the background by EasyDMA, so writing one never waits for the UART
+#define TX_QUEUE_POLICY TX_DROP_OLDEST //when the queue is full: TX_BLOCK waits, TX_DROP_OLDEST or TX_DROP_NEWEST drop a whole write; free running always waits
+#define PLAYBACK_DESCRIPTOR true //keep output.edf's parsed signal headers in output.vpd on the card, so boots after the first don't parse them again
+#define STARTUP_DELAY_MILLIS 0 //pause at power up before reading the card, e.g. to give a serial monitor time to open
+#define FILTER_NOTCH_HZ 0 //mains frequency notched out of every channel before it's sent, 50 or 60; 0 for none (filterConfigs can set channels apart)
+#define FILTER_HIGHPASS_HZ 0 //lower edge of the band-pass every channel goes through, 0 for none
+#define FILTER_LOWPASS_HZ 0 //upper edge of that band-pass, 0 for none
+#define FILTER_DECIMATE 1 //send every Nth sample, after an anti-alias low-pass, e.g. 4 to play a 1 kHz file out at 250 Hz; 1 sends them all
+#define FILTER_BENCH false //true to send the filters' cycles/sample to serial out at startup
+#define SAMPLE_ARENA_BYTES 0 //RAM set aside at build time for the record ring and channel tables; 0 allocates what the file needs once at startup
 
-unsigned long long GetCorrectedMicros();
-void Dump_sd_info(SdFat sd);
-void GetEdfField(int startOffset, int fieldLength);
-void GetAllEdfFields(); //reads values of first 
 void CreateOutArray();
 void RefillBuffer();
-void WriteNextSamples();
+bool RefillSlice(uint32_t budgetMicros);
+bool WaitForRecord();
 void WriteNextPacket();
-void WritePackets();
+void SkipNextPacket();
 void InvertPin(uint32_t pinNum);
+void PollCommands();
+void RestartScheduler();
+void SetupGenerator();
+void StartPlayback();
+void UseCurrentRecord();
+bool SetupImage();
+void SetupSeekIndex();
+int LoadHeader();
+void PreloadFirstRecord();
+void SetupPlaylist();
+void CheckPlaylist();
+bool PlaylistSlice(uint32_t budgetMicros);
+void PlaylistSwitched();
+void PrepareChannelCal(const edf_signal_struct *signal, CalibrationQ *cal);
+bool CreateArena(size_t bytes);
+size_t FileArenaBytes(int numSignals, int numColumns, int rows, int stagingSamps, int bytesPerSample);
+void SetupEvents();
+bool FiltersConfigured();
+void SetupFilters(const bool *chanUsed);
+void QueueRecordEvents(uint32_t firstSample, int32_t fromRow);
+void SendDueEvent();
 
-FatFile edfFile;
+SourceFile edfFile;
+SourceFile imageFile;
+PlaybackImageHeader imageHeader;
+bool usePlaybackImage = PLAYBACK_IMAGE;
+bool imageSource = false; // records come from the playback image, as packet rows
+const uint8_t *imageRecord; // rows of the record currently being sent, from the image
+SourceFile indexFile;
+SeekIndex seekIndex;
+bool useSeekIndex = SEEK_INDEX;
+bool seekIndexReady = false; // seeks by time go by seekIndex, the file is discontinuous
+const char *sourceName = "output.edf"; // the EDF file played, or the first of the playlist
+bool loopPlayback = LOOP_PLAYBACK;
+SourceFile descriptorFile;
+bool usePlaybackDescriptor = PLAYBACK_DESCRIPTOR;
+uint32_t setupStartMicros; // when setup() started, the time to the first packet is counted from it
+bool firstPacketSent = false;
+
+// playlist, see Playlist.h
+bool usePlaylist = PLAYLIST;
+Playlist playlist;
+bool playlistActive = false; // records come from the files in playlist, one after the other
+SourceFile spareFile;
+SourceFile *playingFile = &edfFile; // the playlist file being sent
+SourceFile *nextFile = &spareFile;  // the one after it, being got ready or queued in the ring
+CalibrationQ *playingCal; // calibration of playingFile's channels, chanCal to begin with
+CalibrationQ *nextCal;
+EdfFileHeader nextHeader;
+int playingIndex = 0;     // playlist entry being sent
+int preparingIndex = -1;  // entry being got ready to follow it, -1 to pick the next
+int queuedIndex = -1;     // entry queued in the ring to follow it, -1 until it's ready
+long playingRecords = -1; // data records in playingFile
+long queuedRecords = -1;
+uint32_t playingSourceNum = 0; // the ring's number for playingFile, see RingQueueSource
+int playlistStep = 0;     // what PlaylistSlice does next
+unsigned long playlistSliceMicros = 0; // longest playlist slice seen, used to fit them between packets
 bool sdInitialized = false;
 
-edfHeaderMain *fileHeader; // holds the EDF file's header struct
-int fileHeaderLength;
+// annotations, see EventFrame.h
+bool eventFrames = EVENT_FRAMES;
+bool *isAnnotation; // per channel, true for annotation signals
+EventQueue eventQueue;
+
+EdfFileHeader edfHeader; // parsed header of the EDF file
 
-short **outArray;
+int32_t **outArray; // calibrated columns of the record currently being sent, one per kept channel
+int numOutArrayChans; // channels kept in the ring: the file's first ones, as many as fit in a packet
+int32_t **sendColumns; // with frames, the columns of outArray that are sent, in order
+int *sendChans; // which channel each of sendColumns is
+int numSendChans;
 int numOutArrayRows;
+RecordRing recordRing;
+int numRingRecords = RING_RECORDS;
+SampleArena sampleArena; // the ring and the channel tables, see SampleArena.h
+#if SAMPLE_ARENA_BYTES > 0
+alignas(ARENA_ALIGN) static uint8_t arenaStorage[SAMPLE_ARENA_BYTES];
+#endif
+unsigned long refillSliceMicros = 0; // longest refill slice seen, used to fit slices between packets
 
-float outSamples[8];
-unsigned long nextMicros; //would prefer to make this a uint32_t to match micros() return type, but print/println won't accept that type
-unsigned long numPacketsWritten = 0; //would prefer to make this a uint32_t to match micros() return type, but print/println won't accept that type
+PacketRun packetRun; // packets encoded but not yet handed to the transport
+int packetBits = PACKET_BITS;
+int frameChannels = FRAME_CHANNELS;
+int frameSamples = FRAME_SAMPLES;
+FramePacker framePacker;
+bool useFrames = false;
+int riceRows = RICE_BLOCK_ROWS;
+int riceKeyframeBlocks = RICE_KEYFRAME_BLOCKS;
+RiceEncoder *riceEncoder = nullptr; // set if blocks are compressed
+bool usbLink = PACKET_LINK_USB;
+uint32_t usbFlushMicros = USB_FLUSH_MICROS;
+bool txQueued = TX_QUEUE;
+TxPolicy txPolicy = TX_QUEUE_POLICY;
+bool linkBackPressured = false; // last reported state of the USB link or the transmit queue
+PacketScheduler scheduler; // when each packet is due
+int catchUpPolicy = CATCH_UP_POLICY;
+unsigned long numPacketsWritten = 0; // packets sent or skipped, i.e. the next packet counter value; print/println won't accept a uint32_t
+int nextRow = 0; // row of the current record the next packet takes
+PlaybackCommandParser commandParser;
+uint32_t speedPercent = PLAYBACK_SPEED_PERCENT;
+bool freeRunning = false; // ignore deadlines, send as fast as the link allows
+bool seeking = false; // a seek has been asked for, packets wait until its first record is in
+int seekRow = 0; // row of that record to start from
 
 /*
  * Holds the first channel's sampling period.
- * We'll only use channels with the same sampling period.
- * This keeps code simple.
+ * Every channel is sent at this rate, resampled if it has to be.
  */
 double acceptedSamplingPeriodMicros;
+// the same period exactly: periodNum / periodDen microseconds
+uint64_t samplingPeriodNum;
+uint32_t samplingPeriodDen;
 // Array of lenghth = number of channels
-// Values set to true if that channel's sampling rate = accepted sampling rate
+// Values set to true if that channel is read from the file: it goes in a
+// packet and is either at the accepted sampling rate or can be resampled to it
 bool *isAcceptableSamplingFreq;
+// Array of length = number of channels, samples per data record of each channel
+int *chanSampsPerRecord;
+int maxChanSampsPerRecord; // most samples per data record of any channel that's read
+// the rest are only for the kept channels, numOutArrayChans long
+ChannelResampler *chanResampler; // table is null if it's at the accepted rate
+CalibrationQ *chanCal; // fixed-point form of each channel's calibration
 
-chanAttributes *chanAttr;
-
-/* holds the raw channel headers block from the edf file
-   which is later parsed into chanHeaders array */
-char *chanHeadersRaw;
-int chanHeadersRawLength;
+int numChans;
 
-// an array holding the channel header structs
-edfHeaderChan *chanHeaders; 
+// what each generated channel carries, with SYNTHETIC_SOURCE (extern, the host's device fleet uses it too)
+extern const GeneratorChannelConfig generatorConfigs[GEN_MAX_CHANNELS] = {
+  {GEN_SINE, 10, 0, 0, 100},          // 10 Hz alpha-like sine, 100 uV
+  {GEN_CHIRP, 1, 100, 10, 100},       // 1 to 100 Hz sweep every 10 s
+  {GEN_SQUARE, 1, 0, 0, 50},          // 1 Hz calibration square wave
+  {GEN_PINK_NOISE, 0, 0, 0, 30},      // background EEG-like noise
+  {GEN_SPIKES, 0.5f, 0, 0, 200},      // a spike every 2 s
+  {GEN_RAMP, 0, 0, 0, 32768},         // sample counter, every 16-bit value in turn
+  {GEN_SINE, 50, 0, 0, 20},           // 50 Hz
+  {GEN_SINE, 0.1f, 0, 0, 500},        // slow drift
+};
+bool syntheticSource = SYNTHETIC_SOURCE;
+uint32_t generatorRate = GEN_SAMPLE_RATE;
+int generatorChans = GEN_CHANNELS;
+int32_t generatorLineAmplitude = GEN_LINE_UV;
+SignalGenerator generator;
 
-int numChans;
+// filters of each channel, see ChannelFilter.h: channels firstChan to lastChan (-1 for the last there is) get the
+// entry's filters, and a later entry covering a channel replaces what earlier ones gave it
+ChannelFilterConfig filterConfigs[FILTER_MAX_CONFIGS] = {
+  {0, -1, FILTER_NOTCH_HZ, FILTER_HIGHPASS_HZ, FILTER_LOWPASS_HZ}, // every channel
+};
+int numFilterConfigs = 1;
+int filterDecimation = FILTER_DECIMATE;
+FilterBank filterBank;
 
-/* points to same memory address as chanHeaders, allows us to access as
-a char array instead of as array of edfHeaderChans */
-char *chanHeadersChars;
-bool isOutputting = true;
+bool isOutputting = AUTO_START;
+bool sourceReady = false; // false until setup() has a record buffered to send
 
 void setup()
 {
-  Serial1.begin(115200, SERIAL_8N1);
-  SdFat sd;
+  setupStartMicros = PlatformMicros();
+  if (usbLink)
+  {
+    TransportBeginUsb(usbFlushMicros);
+  }
+  else if (txQueued)
+  {
+    TransportBeginQueued(SERIAL_BAUD, txPolicy);
+  }
+  else
+  {
+    TransportBegin(SERIAL_BAUD);
+  }
+  DebugBegin();
 
-  pinMode(CS_PIN, OUTPUT); // SD card select
   if (GPIO_DEBUG)
   {
-    pinMode(SEND_PACKET_TEST_PIN, OUTPUT);
-    pinMode(GENERAL_TEST_PIN_1, OUTPUT);
-    pinMode(GENERAL_TEST_PIN_2, OUTPUT);
-    digitalWrite(SEND_PACKET_TEST_PIN, LOW);
+    DebugPinMode(SEND_PACKET_TEST_PIN);
+    DebugPinMode(GENERAL_TEST_PIN_1);
+    DebugPinMode(GENERAL_TEST_PIN_2);
+    DebugPinWrite(SEND_PACKET_TEST_PIN, false);
+  }
+
+  if (syntheticSource)
+  {
+    // no SD card needed
+    SetupGenerator();
+    StartPlayback();
+    return;
   }
 
-  if (!sd.begin(CS_PIN))
+  if (!StorageBegin(CS_PIN))
   {
-    Serial1.println("SD card initialization failed!");
+    TransportPrintln("SD card initialization failed!");
     return;
   }
 
   if (SD_INFO_DUMP)
   {
-    Dump_sd_info(sd);
-  }
-
-  // open the file for reading:
-  delay(1000);
-  edfFile = sd.open("output.edf", FILE_READ);
-  if (edfFile.isOpen())
-  {
-    edfFile.rewind(); //goes to beginning of file
-    
-    //Read EDF file header
-    fileHeaderLength = sizeof(edfHeaderMain);
-    fileHeader = (edfHeaderMain *)malloc(fileHeaderLength);
-    edfFile.read(fileHeader, fileHeaderLength);
-
-    // create an array of channel headers
-    numChans = ((String)fileHeader->numSignals).toInt();
-    chanHeaders = new edfHeaderChan[numChans];
-    chanHeadersRawLength = sizeof(edfHeaderChan) * numChans; // holds the entire set of channel headers as read from the edf file
-    chanHeadersRaw = (char *)malloc(chanHeadersRawLength);
-    edfFile.read(chanHeadersRaw, chanHeadersRawLength);
-    chanHeadersChars = (char *)chanHeaders;
-    GetAllEdfFields(); //reads EDF heasder files into channel structures
-    isAcceptableSamplingFreq = new bool[numChans];
-    free(chanHeadersRaw);
-
-    //Gets the samples/record for the first channel
-    //only channels with the same samples/second will be used for output
-    const int acceptedSampsPerRecord = ((String)chanHeaders[0].numDataSamplesPerRecord).toInt();
-    float recsPerSec = ((String)fileHeader->durationDataRcordsSecs).toFloat();
-    float acceptedSamplingPeriodSecs = 1.0/(acceptedSampsPerRecord * recsPerSec);
-    acceptedSamplingPeriodMicros = acceptedSamplingPeriodSecs * 1000000;
-    //acceptedSamplingPeriodMicros = 5000;
-    //isAcceptableSamplingFreq = new bool[numChans];
-    chanAttr = new chanAttributes[numChans];
-    chanAttr[0].isAcceptableSamplingFreq = true;
+    StorageDumpInfo();
+  }
+
+  if (STARTUP_DELAY_MILLIS > 0)
+  {
+    PlatformDelayMillis(STARTUP_DELAY_MILLIS);
+  }
+  SetupPlaylist();
+  if (usePlaybackImage && !playlistActive && SetupImage())
+  {
+    StartPlayback();
+    return;
+  }
+  if (StorageOpen(sourceName, edfFile))
+  {
+    //Read and validate the EDF file header, signal by signal, unless its descriptor has it already
+    int headerResult = LoadHeader();
+    if (headerResult != 0)
+    {
+      TransportPrint("bad EDF header: ");
+      TransportPrintln(EdfErrorString(headerResult));
+      return;
+    }
+    SetupSeekIndex();
+    const int sampleBits = edfHeader.layout.bytes_per_sample * 8;
+    if (packetBits == 0)
+    {
+      packetBits = sampleBits;
+    }
+    numChans = edfHeader.layout.total_signals;
+    // channels that can't go in a packet aren't read at all, or kept
+    const int packetChannels = frameChannels > 0 ? frameChannels : SIMPLE_PACKET_CHANNELS;
+    numOutArrayChans = numChans < packetChannels ? numChans : packetChannels;
+    const edf_signal_struct *signals = edfHeader.signals;
+
+    //Gets the samples/record for the first (non-annotation) channel
+    //every channel is sent at this many samples/second
+    int firstChan = 0;
+    while (firstChan < numChans - 1 && signals[firstChan].annotation)
+    {
+      firstChan++;
+    }
+    const int acceptedSampsPerRecord = signals[firstChan].smp_per_record;
+    if (edfHeader.hdr.datarecord_duration <= 0)
+    {
+      TransportPrintln("EDF data records have no duration");
+      return;
+    }
+    // datarecord_duration is in units of 100 ns
+    acceptedSamplingPeriodMicros = edfHeader.hdr.datarecord_duration / (10.0 * acceptedSampsPerRecord);
+    samplingPeriodNum = edfHeader.hdr.datarecord_duration;
+    samplingPeriodDen = 10 * acceptedSampsPerRecord;
+    numOutArrayRows = acceptedSampsPerRecord;
+    // the most any kept channel could need staged, before knowing which can be resampled
+    int stagingSamps = acceptedSampsPerRecord;
+    for (int i = 0; i < numOutArrayChans; i++)
+    {
+      if (!signals[i].annotation && signals[i].smp_per_record > stagingSamps)
+      {
+        stagingSamps = signals[i].smp_per_record;
+      }
+    }
+    if (!CreateArena(FileArenaBytes(numChans, numOutArrayChans, numOutArrayRows, stagingSamps,
+                                    edfHeader.layout.bytes_per_sample)))
+    {
+      return;
+    }
+    isAcceptableSamplingFreq = ArenaNew<bool>(&sampleArena, numChans, ARENA_CHANNELS);
+    chanSampsPerRecord = ArenaNew<int>(&sampleArena, numChans, ARENA_CHANNELS);
+    chanCal = ArenaNew<CalibrationQ>(&sampleArena, numOutArrayChans, ARENA_CHANNELS);
+    chanResampler = ArenaNew<ChannelResampler>(&sampleArena, numOutArrayChans, ARENA_CHANNELS);
+    sendChans = ArenaNew<int>(&sampleArena, numOutArrayChans, ARENA_CHANNELS);
+    sendColumns = ArenaNew<int32_t *>(&sampleArena, numOutArrayChans, ARENA_CHANNELS);
+    maxChanSampsPerRecord = acceptedSampsPerRecord;
 
     //get more attributes for each channel (beyond what's in header)
     for (int i = 0; i < numChans; i++)
     {
-      //Check each channel to see if samples/second is acceptable
-      int thisSampsPerRecord = ((String)chanHeaders[i].numDataSamplesPerRecord).toInt();
-      if (thisSampsPerRecord == acceptedSampsPerRecord)
+      //Check each channel to see if samples/second is acceptable, or can be resampled to it
+      //channels past the 8th never make it into a packet, so they aren't read at all
+      int thisSampsPerRecord = signals[i].smp_per_record;
+      chanSampsPerRecord[i] = thisSampsPerRecord;
+      if (i >= numOutArrayChans)
       {
-        chanAttr[i].isAcceptableSamplingFreq = true;
+        continue;
       }
-      else
+      bool isUsable = !signals[i].annotation;
+      if (isUsable && thisSampsPerRecord != acceptedSampsPerRecord)
       {
-        chanAttr[i].isAcceptableSamplingFreq = false;
+        isUsable = ResamplerCreate(&chanResampler[i], thisSampsPerRecord, acceptedSampsPerRecord);
       }
+      if (isUsable && thisSampsPerRecord > maxChanSampsPerRecord)
+      {
+        maxChanSampsPerRecord = thisSampsPerRecord;
+      }
+      isAcceptableSamplingFreq[i] = isUsable;
 
       //calibrate each channel
-      //first the multiplier
-      int digitalMin = ((String)chanHeaders[i].digitalMin).toInt();
-      int digitalMax = ((String)chanHeaders[i].digitalMax).toInt();
-      float physicalMin = CharArrayToFloat(chanHeaders[i].physicalMin, sizeof(chanHeaders[i].physicalMin));
-      float physicalMax = CharArrayToFloat(chanHeaders[i].physicalMax, sizeof(chanHeaders[i].physicalMax));
-
-      chanAttr[i].calMultiplier = (physicalMax - physicalMin)/(digitalMax - digitalMin);
-      chanAttr[i].calOffset = physicalMin - (chanAttr[i].calMultiplier * digitalMin);
+      PrepareChannelCal(&signals[i], &chanCal[i]);
     }
-    numOutArrayRows = ((String)chanHeaders[0].numDataSamplesPerRecord).toInt();
     CreateOutArray();
+    numSendChans = 0;
+    for (int i = 0; i < numOutArrayChans; i++)
+    {
+      if (isAcceptableSamplingFreq[i])
+      {
+        sendChans[numSendChans++] = i;
+      }
+    }
 
-    // populate outArray
-    RefillBuffer();
-    edfFile.close();
+    // populate the ring; the file stays open so loop() can keep refilling it
+    uint32_t dataStart = edfHeader.layout.header_bytes;
+    long numRecords = edfHeader.hdr.datarecords_in_file;
+    RingAttachSource(&recordRing, &edfFile, dataStart, numRecords, chanSampsPerRecord, isAcceptableSamplingFreq, chanCal,
+                     chanResampler);
+    recordRing.loopSource = loopPlayback;
+    SetupFilters(isAcceptableSamplingFreq);
+    SetupEvents();
+    PreloadFirstRecord();
+    UseCurrentRecord();
+    sourceReady = RingHasRecord(&recordRing);
+    if (playlistActive)
+    {
+      CheckPlaylist();
+    }
+    else
+    {
+      // the channel tables hold all playback needs from the signal headers
+      EdfFreeHeader(&edfHeader);
+    }
+
+    if (CAL_BENCH)
+    {
+      float fixedCycles, floatCycles;
+      char line[80];
+      BenchCalibration(&chanCal[0], &fixedCycles, &floatCycles);
+      // integer hundredths, printf may not have float support on the Feather
+      snprintf(line, sizeof(line), "calibration cycles/sample x100: fixed %ld, float %ld, using %s",
+               (long)(fixedCycles * 100), (long)(floatCycles * 100), CAL_FIXED_POINT ? "fixed" : "float");
+      TransportPrintln(line);
+    }
   }
   else
   {
     // if the file didn't open, print an error:
-    Serial1.println("error opening output.edf");
+    TransportPrint("error opening ");
+    TransportPrintln(sourceName);
   }
-  nextMicros = micros();
+  StartPlayback();
 }
 
-void loop()
+/**
+ * @brief Loads the EDF file's header from its descriptor when there's an up to date one,
+ *        otherwise parses it and writes one for next time
+ *
+ * The descriptor is only for output.edf, so it isn't used with a playlist.
+ *
+ * @return 0, or a negative EDFLIB_FILE_* error
+ */
+int LoadHeader()
 {
-  if (isOutputting)
+  const bool described = usePlaybackDescriptor && !playlistActive;
+  char line[120];
+  if (described)
   {
-    unsigned long long nowMicros = GetCorrectedMicros();
-    InvertPin(GENERAL_TEST_PIN_1);
-    if (nowMicros > nextMicros) 
+    const char *problem = "there isn't one";
+    if (StorageOpen(DESCRIPTOR_FILE_NAME, descriptorFile))
     {
-      if (GPIO_DEBUG)
+      int result = DescriptorLoad(&descriptorFile, &edfFile, &edfHeader);
+      descriptorFile.close();
+      if (result == 0)
       {
-        digitalWrite(GENERAL_TEST_PIN_2, HIGH);
+        return 0;
       }
-      WriteNextPacket();
-      nextMicros += acceptedSamplingPeriodMicros;
-      if (GPIO_DEBUG)
+      problem = DescriptorErrorString(result);
+    }
+    snprintf(line, sizeof(line), "%s: %s, parsing the header", DESCRIPTOR_FILE_NAME, problem);
+    DebugPrintln(line);
+  }
+  uint32_t started = PlatformMicros();
+  int headerResult = EdfReadHeader(&edfFile, &edfHeader);
+  if (headerResult == 0 && described)
+  {
+    uint32_t parseMicros = PlatformMicros() - started;
+    int result = StorageCreate(DESCRIPTOR_FILE_NAME, descriptorFile)
+                     ? DescriptorWrite(&descriptorFile, &edfFile, &edfHeader)
+                     : DESCRIPTOR_ERR_WRITE;
+    descriptorFile.close();
+    snprintf(line, sizeof(line), "header parsed in %lu us, writing %s: %s", (unsigned long)parseMicros,
+             DESCRIPTOR_FILE_NAME, DescriptorErrorString(result));
+    DebugPrintln(line);
+  }
+  return headerResult;
+}
+
+/**
+ * @brief Works out a channel's calibration from its header
+ */
+void PrepareChannelCal(const edf_signal_struct *signal, CalibrationQ *cal)
+{
+  chanAttributes attr;
+  attr.calMultiplier = (signal->phys_max - signal->phys_min)/(signal->dig_max - signal->dig_min);
+  attr.calOffset = signal->phys_min - (attr.calMultiplier * signal->dig_min);
+  CalibrationPrepare(cal, attr.calMultiplier, attr.calOffset, edfHeader.layout.bytes_per_sample * 8);
+}
+
+/**
+ * @brief Arena bytes playing an EDF file takes: its channel tables, the ring and its annotations
+ *
+ * @param numSignals signals in the file, annotation signals included
+ * @param numColumns of which the first numColumns are kept
+ * @param rows output samples per record
+ * @param stagingSamps most samples per record of any kept channel
+ */
+size_t FileArenaBytes(int numSignals, int numColumns, int rows, int stagingSamps, int bytesPerSample)
+{
+  return ArenaSize(numSignals * sizeof(int)) + 2 * ArenaSize(numSignals * sizeof(bool)) +
+         ArenaSize(numColumns * sizeof(ChannelResampler)) +
+         (playlistActive ? 2 : 1) * ArenaSize(numColumns * sizeof(CalibrationQ)) +
+         ArenaSize(numColumns * sizeof(int)) + ArenaSize(numColumns * sizeof(int32_t *)) +
+         RingArenaBytes(numRingRecords, numColumns, rows, stagingSamps, bytesPerSample) +
+         (eventFrames ? RingAnnotationArenaBytes(numRingRecords) : 0) +
+         (FiltersConfigured() ? FilterArenaBytes(numColumns) : 0);
+}
+
+/**
+ * @brief True if any channel is to be filtered, or the samples sent decimated
+ */
+bool FiltersConfigured()
+{
+  for (int i = 0; i < numFilterConfigs; i++)
+  {
+    const ChannelFilterConfig *config = &filterConfigs[i];
+    if (config->notchHz > 0 || config->highPassHz > 0 || config->lowPassHz > 0)
+    {
+      return true;
+    }
+  }
+  return filterDecimation > 1;
+}
+
+/**
+ * @brief Puts each kept channel through the filters filterConfigs gives it, then decimates by filterDecimation
+ *
+ * Call once the ring has its source. The filters run on the refill side,
+ * so the sender only ever sees filtered columns; with decimation, each
+ * record has numOutArrayRows / filterDecimation rows to send, one every
+ * filterDecimation sample periods.
+ *
+ * @param chanUsed which kept channels are read, the others are left as they are; null if all of them are
+ */
+void SetupFilters(const bool *chanUsed)
+{
+  if (!FiltersConfigured())
+  {
+    return;
+  }
+  char line[120];
+  const float sampleRate = (float)(samplingPeriodDen * 1000000.0 / samplingPeriodNum);
+  int decimation = filterDecimation;
+  if (decimation > 1 && numOutArrayRows % decimation != 0)
+  {
+    snprintf(line, sizeof(line), "can't decimate records of %d samples by %d, sending every sample", numOutArrayRows,
+             decimation);
+    DebugPrintln(line);
+    decimation = 1;
+  }
+  if (!FilterCreate(&filterBank, &sampleArena, numOutArrayChans, decimation))
+  {
+    TransportPrintln("not enough memory for the filters");
+    return;
+  }
+  for (int chan = 0; chan < numOutArrayChans; chan++)
+  {
+    filterBank.chanActive[chan] = !chanUsed || chanUsed[chan];
+    const ChannelFilterConfig *config = nullptr;
+    for (int i = 0; i < numFilterConfigs; i++)
+    {
+      if (chan >= filterConfigs[i].firstChan && (filterConfigs[i].lastChan < 0 || chan <= filterConfigs[i].lastChan))
       {
-        digitalWrite(GENERAL_TEST_PIN_2, LOW);
+        config = &filterConfigs[i];
       }
-      unsigned long nowSecs = nowMicros / 1000000;
+    }
+    bool designed = true;
+    if (config && config->notchHz > 0)
+    {
+      designed = FilterAddSection(&filterBank, chan, FILTER_NOTCH, config->notchHz, FILTER_NOTCH_Q, sampleRate) && designed;
+    }
+    if (config && config->highPassHz > 0)
+    {
+      designed = FilterAddSection(&filterBank, chan, FILTER_HIGH_PASS, config->highPassHz, 0.7071f, sampleRate) && designed;
+    }
+    if (config && config->lowPassHz > 0)
+    {
+      designed = FilterAddSection(&filterBank, chan, FILTER_LOW_PASS, config->lowPassHz, 0.7071f, sampleRate) && designed;
+    }
+    if (decimation > 1)
+    {
+      designed = FilterAddAntiAlias(&filterBank, chan, sampleRate) && designed;
+    }
+    if (!designed)
+    {
+      snprintf(line, sizeof(line), "channel %d: a filter isn't below %ld Hz, the Nyquist frequency, left out", chan,
+               (long)(sampleRate / 2));
+      DebugPrintln(line);
     }
   }
-  else
+  RingAttachFilter(&recordRing, &filterBank);
+  numOutArrayRows /= decimation;
+  samplingPeriodNum *= decimation;
+  acceptedSamplingPeriodMicros *= decimation;
+  snprintf(line, sizeof(line), "filters: %d sections per channel, %ld samples/s sent", filterBank.numSections,
+           (long)(sampleRate / decimation));
+  DebugPrintln(line);
+
+  if (FILTER_BENCH)
+  {
+    float cycles, scalarCycles;
+    BenchFilter(&filterBank, &cycles, &scalarCycles);
+    // integer hundredths, printf may not have float support on the Feather
+    snprintf(line, sizeof(line), "filter cycles/sample x100: %ld, budget %ld", (long)(cycles * 100),
+             (long)filterBank.numSections * FILTER_SECTION_BUDGET_CYCLES * 100);
+    TransportPrintln(line);
+  }
+}
+
+/**
+ * @brief Readies sampleArena for bytes of ring and channel tables, in the RAM set aside at build time if there is some
+ *
+ * @return false if there isn't enough
+ */
+bool CreateArena(size_t bytes)
+{
+#if SAMPLE_ARENA_BYTES > 0
+  if (bytes > sizeof(arenaStorage))
+  {
+    char line[120];
+    snprintf(line, sizeof(line), "SAMPLE_ARENA_BYTES is %lu, this file needs %lu", (unsigned long)sizeof(arenaStorage),
+             (unsigned long)bytes);
+    TransportPrintln(line);
+    return false;
+  }
+  bool created = ArenaCreate(&sampleArena, arenaStorage, sizeof(arenaStorage));
+#else
+  bool created = ArenaCreate(&sampleArena, nullptr, bytes);
+#endif
+  if (!created)
+  {
+    TransportPrintln("not enough memory for the record ring");
+  }
+  return created;
+}
+
+/**
+ * @brief Has the ring read the file's annotation signals, if it has any, for event frames
+ *
+ * Records from the playback image or the generator have no annotations.
+ */
+void SetupEvents()
+{
+  if (!eventFrames)
+  {
+    return;
+  }
+  isAnnotation = ArenaNew<bool>(&sampleArena, numChans, ARENA_CHANNELS);
+  for (int i = 0; isAnnotation && i < numChans; i++)
   {
-    //check if we've received anything
-    if (Serial1.available() > 0)
+    isAnnotation[i] = edfHeader.signals[i].annotation;
+  }
+  EventQueueClear(&eventQueue);
+  if (isAnnotation &&
+      RingAttachAnnotations(&recordRing, &sampleArena, isAnnotation, edfHeader.hdr.datarecord_duration))
+  {
+    DebugPrintln("annotations are sent as event frames");
+  }
+}
+
+/**
+ * @brief Plays the card's playlist, if it has one, starting with its first file
+ *
+ * The playback image and seek index are only for output.edf, so they
+ * aren't used with a playlist.
+ */
+void SetupPlaylist()
+{
+  if (!usePlaylist || !StorageOpen(PLAYLIST_FILE_NAME, spareFile))
+  {
+    return;
+  }
+  playlistActive = PlaylistRead(&spareFile, &playlist);
+  spareFile.close();
+  char line[120];
+  snprintf(line, sizeof(line), "%s: %d files, %d lines skipped", PLAYLIST_FILE_NAME, playlist.numFiles, playlist.skippedLines);
+  DebugPrintln(line);
+  if (playlistActive)
+  {
+    sourceName = playlist.names[0];
+  }
+}
+
+/**
+ * @brief Checks every file in the playlist can follow the first, before any is played
+ *
+ * Files that can't be opened or whose records are laid out differently are
+ * reported and dropped now, rather than when playback gets to them. Then
+ * the second file is got ready, so it's queued in the ring from the start.
+ */
+void CheckPlaylist()
+{
+  char line[120];
+  for (int i = 1; i < playlist.numFiles;)
+  {
+    const char *problem = "can't open it";
+    if (StorageOpen(playlist.names[i], spareFile))
     {
-      isOutputting = true;
+      int result = EdfReadHeader(&spareFile, &nextHeader);
+      problem = result != 0 ? EdfErrorString(result) : PlaylistMismatch(&edfHeader, &nextHeader);
+      EdfFreeHeader(&nextHeader);
+      spareFile.close();
     }
+    if (problem == nullptr)
+    {
+      i++;
+      continue;
+    }
+    snprintf(line, sizeof(line), "playlist: %s left out: %s", playlist.names[i], problem);
+    DebugPrintln(line);
+    PlaylistRemove(&playlist, i);
+  }
+  playingCal = chanCal;
+  nextCal = ArenaNew<CalibrationQ>(&sampleArena, numOutArrayChans, ARENA_CHANNELS);
+  playingRecords = edfHeader.hdr.datarecords_in_file;
+  recordRing.awaitSource = true;
+  while (PlaylistSlice(UINT32_MAX))
+  {
   }
 }
 
-unsigned long long GetCorrectedMicros()
+/**
+ * @brief Does the next step of getting the file after the one playing ready, if it fits before the next packet is due
+ *
+ * Steps are opening the file, reading its header and working out its
+ * calibration, and queueing it in the ring. Each is done only if it fits
+ * in the time until the next packet, unless the sender is close enough to
+ * the end of the file that waiting any longer could leave it without
+ * records.
+ *
+ * @param budgetMicros time until the next packet is due, UINT32_MAX if there's no deadline
+ * @return true if a step was done
+ */
+bool PlaylistSlice(uint32_t budgetMicros)
 {
-  static unsigned long long previousAccumulatedMicros = 0;
-  static unsigned long long previousRawMicros = 0;
-  static unsigned long long accumulatedMicros = 0;
-  unsigned long long currentRawMicros = micros();
-  //uint32_t sincePrevMicros;
-  if (accumulatedMicros > 4294000000)
+  if (!playlistActive || queuedIndex >= 0)
   {
-    Serial1.print("");
+    // nothing to do until the sender gets to the queued file
+    return false;
+  }
+  long recordsLeft = playingRecords - recordRing.slotRecordNum[recordRing.releasedCount.load() % recordRing.numSlots];
+  bool urgent = playingRecords > 0 && recordsLeft <= 2 * numRingRecords;
+  if (budgetMicros <= playlistSliceMicros && !urgent)
+  {
+    return false;
+  }
+  uint32_t startMicros = PlatformMicros();
+  char line[120];
+  if (playlistStep == 0)
+  {
+    if (preparingIndex < 0)
+    {
+      preparingIndex = playingIndex + 1;
+    }
+    if (preparingIndex >= playlist.numFiles)
+    {
+      if (!recordRing.loopSource.load())
+      {
+        // the ring stops at the end of this file
+        recordRing.awaitSource = false;
+        return false;
+      }
+      preparingIndex = 0;
+    }
+    if (StorageOpen(playlist.names[preparingIndex], *nextFile))
+    {
+      playlistStep = 1;
+    }
+    else
+    {
+      snprintf(line, sizeof(line), "playlist: %s skipped: can't open it", playlist.names[preparingIndex]);
+      DebugPrintln(line);
+      preparingIndex++;
+    }
   }
-  if (currentRawMicros >= previousRawMicros)
+  else if (playlistStep == 1)
   {
-    //sincePrevMicros = currentMicros - previousAccumulatedMicros;
-    accumulatedMicros += (currentRawMicros - previousRawMicros);
+    int result = EdfReadHeader(nextFile, &nextHeader);
+    const char *problem = result != 0 ? EdfErrorString(result) : PlaylistMismatch(&edfHeader, &nextHeader);
+    if (problem == nullptr)
+    {
+      for (int i = 0; i < numOutArrayChans; i++)
+      {
+        PrepareChannelCal(&nextHeader.signals[i], &nextCal[i]);
+      }
+      playlistStep = 2;
+    }
+    else
+    {
+      // changed since CheckPlaylist() looked at it
+      snprintf(line, sizeof(line), "playlist: %s skipped: %s", playlist.names[preparingIndex], problem);
+      DebugPrintln(line);
+      EdfFreeHeader(&nextHeader);
+      nextFile->close();
+      preparingIndex++;
+      playlistStep = 0;
+    }
   }
   else
   {
-    unsigned long long adjustedRaw = currentRawMicros + pow(2,26);
-    unsigned long long delta = adjustedRaw - previousRawMicros;
-    adjustedRaw = adjustedRaw % (unsigned long long)pow(2,26);
-    adjustedRaw = currentRawMicros;
+    queuedRecords = nextHeader.hdr.datarecords_in_file;
+    RingQueueSource(&recordRing, nextFile, nextHeader.layout.header_bytes, queuedRecords, nextCal);
+    recordRing.awaitSource = true;
+    EdfFreeHeader(&nextHeader);
+    queuedIndex = preparingIndex;
+    preparingIndex = -1;
+    playlistStep = 0;
   }
-  previousRawMicros = currentRawMicros;
-  previousAccumulatedMicros = accumulatedMicros;
-  return accumulatedMicros;
+  unsigned long sliceMicros = PlatformMicros() - startMicros;
+  if (sliceMicros > playlistSliceMicros)
+  {
+    playlistSliceMicros = sliceMicros;
+  }
+  return true;
 }
 
-void InvertPin(uint32_t pinNum)
+/**
+ * @brief Catches up with the ring having moved on to the queued playlist file
+ *
+ * The file and calibration that were playing are free once the sender is
+ * past them, to get the file after this one ready in.
+ */
+void PlaylistSwitched()
 {
-  if (GPIO_DEBUG)
+  playingSourceNum = RingCurrentSourceNum(&recordRing);
+  SourceFile *file = playingFile;
+  playingFile = nextFile;
+  nextFile = file;
+  nextFile->close();
+  CalibrationQ *cal = playingCal;
+  playingCal = nextCal;
+  nextCal = cal;
+  playingIndex = queuedIndex;
+  playingRecords = queuedRecords;
+  queuedIndex = -1;
+  char line[120];
+  snprintf(line, sizeof(line), "playing %s from packet %lu, its longest step getting ready was %lu us",
+           playlist.names[playingIndex], numPacketsWritten, playlistSliceMicros);
+  DebugPrintln(line);
+}
+
+/**
+ * @brief Plays the card's playback image if there's one for this packet layout
+ *
+ * It has to have been made from the output.edf on the card (if there is
+ * one), for the channel count and bit depth the packets use, or the EDF
+ * file is played instead.
+ *
+ * @return true if records come from the image
+ */
+bool SetupImage()
+{
+  if (!StorageOpen(IMAGE_FILE_NAME, imageFile))
   {
-    bool currVal = digitalRead(pinNum);
-    digitalWrite(pinNum, !currVal);
+    return false;
   }
+  char line[120];
+  int result = ImageReadHeader(&imageFile, &imageHeader);
+  const int channels = frameChannels > 0 ? frameChannels : SIMPLE_PACKET_CHANNELS;
+  const char *problem = result != 0 ? ImageErrorString(result) : nullptr;
+  if (!problem && FiltersConfigured())
+  {
+    // the image doesn't say which filters its rows went through
+    problem = "filters are set";
+  }
+  if (!problem && (imageHeader.channels != (uint32_t)channels || (packetBits != 0 && imageHeader.bits != (uint32_t)packetBits)))
+  {
+    problem = "made for another packet layout";
+  }
+  if (!problem && StorageOpen("output.edf", edfFile))
+  {
+    problem = ImageMatchesSource(&imageHeader, &edfFile) ? nullptr : "out of date with output.edf";
+    // the image has the file's records one for one, so its seek index serves the image too
+    if (!problem && EdfReadHeader(&edfFile, &edfHeader) == 0)
+    {
+      SetupSeekIndex();
+    }
+    edfFile.close();
+  }
+  if (problem)
+  {
+    snprintf(line, sizeof(line), "playback image not used: %s", problem);
+    DebugPrintln(line);
+    imageFile.close();
+    return false;
+  }
+
+  packetBits = imageHeader.bits;
+  numOutArrayRows = imageHeader.rowsPerRecord;
+  samplingPeriodNum = imageHeader.periodNum;
+  samplingPeriodDen = imageHeader.periodDen;
+  acceptedSamplingPeriodMicros = (double)samplingPeriodNum / samplingPeriodDen;
+  edfHeader.hdr.datarecord_duration = imageHeader.recordDuration;
+  // the image's rows already hold every channel sent
+  numSendChans = channels;
+  if (!CreateArena(RingImageArenaBytes(numRingRecords, numOutArrayRows, imageHeader.recordBytes)))
+  {
+    return false;
+  }
+  if (!RingCreateImage(&recordRing, &sampleArena, numRingRecords, numOutArrayRows, imageHeader.recordBytes))
+  {
+    TransportPrintln("not enough memory for the record ring");
+    return false;
+  }
+  RingAttachImage(&recordRing, &imageFile, IMAGE_SECTOR_BYTES, imageHeader.numRecords);
+  recordRing.loopSource = loopPlayback;
+  imageSource = true;
+  PreloadFirstRecord();
+  UseCurrentRecord();
+  sourceReady = RingHasRecord(&recordRing);
+  snprintf(line, sizeof(line), "playing %s: %lu records, %lu channels, %lu-bit", IMAGE_FILE_NAME,
+           (unsigned long)imageHeader.numRecords, (unsigned long)imageHeader.channels, (unsigned long)imageHeader.bits);
+  DebugPrintln(line);
+  return true;
 }
 
-void WriteNextSamples()
+/**
+ * @brief Opens the seek index of a discontinuous output.edf, building it if it's missing or out of date
+ *
+ * Building reads a few bytes of every data record, once; a multi-GB file
+ * takes a while on the Feather. Continuous files don't need an index, as
+ * their records are back to back in time. Leaves the EDF file at its
+ * first data record.
+ */
+void SetupSeekIndex()
 {
+  if (!useSeekIndex || !edfHeader.layout.discontinuous || playlistActive)
+  {
+    return;
+  }
+  char line[120];
+  const char *problem = "there isn't one";
+  int result = -1;
+  if (StorageOpen(SEEK_INDEX_FILE_NAME, indexFile))
+  {
+    result = SeekIndexOpen(&seekIndex, &indexFile, &edfFile, &edfHeader);
+    problem = SeekIndexErrorString(result);
+    indexFile.close();
+  }
+  if (result != 0)
+  {
+    snprintf(line, sizeof(line), "building %s: %s", SEEK_INDEX_FILE_NAME, problem);
+    DebugPrintln(line);
+    uint32_t started = PlatformMicros();
+    int badRecord = -1;
+    result = StorageCreate(SEEK_INDEX_FILE_NAME, indexFile) ? SeekIndexBuild(&indexFile, &edfFile, &edfHeader, &badRecord)
+                                                              : SEEK_INDEX_ERR_WRITE;
+    indexFile.close();
+    if (result == SEEK_INDEX_ERR_TAL)
+    {
+      snprintf(line, sizeof(line), "%s: record %d: %s", SEEK_INDEX_FILE_NAME, badRecord, SeekIndexErrorString(result));
+    }
+    else
+    {
+      snprintf(line, sizeof(line), "%s: %ld records in %lu ms: %s", SEEK_INDEX_FILE_NAME,
+               (long)edfHeader.hdr.datarecords_in_file, (unsigned long)((PlatformMicros() - started) / 1000),
+               SeekIndexErrorString(result));
+    }
+    DebugPrintln(line);
+  }
+  if (result == 0 && StorageOpen(SEEK_INDEX_FILE_NAME, indexFile))
+  {
+    result = SeekIndexOpen(&seekIndex, &indexFile, &edfFile, &edfHeader);
+  }
+  seekIndexReady = result == 0;
+  if (!seekIndexReady)
+  {
+    indexFile.close();
+    DebugPrintln("no seek index, seeking by time treats the file as continuous");
+  }
+  edfFile.seekSet(edfHeader.layout.header_bytes);
+}
 
+/**
+ * @brief Sets up the generator and a ring of generated records in place of the EDF file
+ *
+ * Records are 100 ms (GEN_MAX_ROWS_PER_RECORD samples at most), and
+ * edfHeader is filled in as if they came from a file, so seeking by time
+ * works the same.
+ */
+void SetupGenerator()
+{
+  if (packetBits == 0)
+  {
+    packetBits = 16;
+  }
+  numChans = generatorChans > GEN_MAX_CHANNELS ? GEN_MAX_CHANNELS : generatorChans;
+  numOutArrayChans = numChans;
+  int rows = generatorRate / 10;
+  rows = rows < 1 ? 1 : rows > GEN_MAX_ROWS_PER_RECORD ? GEN_MAX_ROWS_PER_RECORD : rows;
+  numOutArrayRows = rows;
+  maxChanSampsPerRecord = rows;
+  samplingPeriodNum = 1000000;
+  samplingPeriodDen = generatorRate;
+  acceptedSamplingPeriodMicros = 1e6 / generatorRate;
+  edfHeader.hdr.datarecord_duration = (long long)rows * 10000000 / generatorRate;
+  edfHeader.layout.bytes_per_sample = 2;
+  GeneratorCreate(&generator, numChans, generatorRate, generatorConfigs, GEN_LINE_HZ, generatorLineAmplitude);
+  if (!CreateArena(RingArenaBytes(numRingRecords, numChans, rows, rows, edfHeader.layout.bytes_per_sample) +
+                   ArenaSize(numChans * sizeof(int)) + ArenaSize(numChans * sizeof(int32_t *)) +
+                   (FiltersConfigured() ? FilterArenaBytes(numChans) : 0)))
+  {
+    return;
+  }
+  CreateOutArray();
+  RingAttachGenerator(&recordRing, &generator);
+  SetupFilters(nullptr);
+  RefillBuffer();
+  sendChans = ArenaNew<int>(&sampleArena, numChans, ARENA_CHANNELS);
+  sendColumns = ArenaNew<int32_t *>(&sampleArena, numChans, ARENA_CHANNELS);
+  for (numSendChans = 0; numSendChans < numChans; numSendChans++)
+  {
+    sendChans[numSendChans] = numSendChans;
+  }
+  UseCurrentRecord();
+  sourceReady = RingHasRecord(&recordRing);
 }
 
-void WriteNextPacket()
+/**
+ * @brief Gets ready to take commands and starts the packet timeline
+ */
+void StartPlayback()
 {
-  bool currentTestPinVal = digitalRead(SEND_PACKET_TEST_PIN);
-  if (GPIO_DEBUG)
+  const uint32_t linkBaud = usbLink ? USB_EQUIVALENT_BAUD : SERIAL_BAUD;
+  if (sampleArena.base)
+  {
+    char line[120];
+    ArenaReport(&sampleArena, line, sizeof(line));
+    DebugPrintln(line);
+  }
+  if (LINK_BUDGET_REPORT)
   {
-    digitalWrite(SEND_PACKET_TEST_PIN, !currentTestPinVal);
+    LinkBudgetReport(linkBaud);
   }
-  OutPacket outPacket;
-  unsigned long rowInBuffer = numPacketsWritten % numOutArrayRows;
-  outPacket.counter = numPacketsWritten % 32768; //32769 = 2e15;
-  for (int chan = 0; chan < numChans; chan++)
+  if (riceRows > 0 && imageSource)
   {
-    if (chan < 8)
+    DebugPrintln("compressed blocks need the EDF file, not the playback image; sending uncompressed");
+  }
+  else if (riceRows > 0)
+  {
+    // the block is as wide as a frame would be
+    int channels = frameChannels > 0 ? frameChannels : SIMPLE_PACKET_CHANNELS;
+    riceEncoder = new RiceEncoder;
+    char line[120];
+    if (sourceReady && numSendChans > 0 &&
+        RiceEncoderCreate(riceEncoder, channels, packetBits, riceRows, riceKeyframeBlocks))
     {
-      int32_t digitalOut = outArray[chan][rowInBuffer];
-      float physOut = (digitalOut * chanAttr[chan].calMultiplier) + chanAttr[chan].calOffset;
-      outPacket.values[chan] = (int32_t)physOut;
-//      if (chan == 4)
-//      {
-//        Serial1.print(physOut);
-//      }
+      snprintf(line, sizeof(line), "compressed blocks: %d channels, %d-bit, %d samples/block, keyframe every %d blocks",
+               channels, packetBits, riceRows, riceKeyframeBlocks);
     }
+    else
+    {
+      delete riceEncoder;
+      riceEncoder = nullptr;
+      snprintf(line, sizeof(line), "can't compress %d-channel blocks of %d samples, sending uncompressed", channels, riceRows);
+    }
+    DebugPrintln(line);
   }
-  SendOutPacket(&outPacket); 
-  numPacketsWritten++;
-  if (rowInBuffer == (numOutArrayRows - 1))
+  if (frameChannels > 0 && riceEncoder == nullptr)
   {
-    RefillBuffer();
+    useFrames = sourceReady && numSendChans > 0 && FramePackerCreate(&framePacker, frameChannels, packetBits, frameSamples);
+    char line[160];
+    if (useFrames)
+    {
+      // samples/second at 100% speed
+      uint32_t sampleRate = (uint32_t)(samplingPeriodDen * 1000000ULL / samplingPeriodNum);
+      uint32_t maxRate = LinkMaxSampleRate(linkBaud, framePacker.frameBytes, frameSamples);
+      snprintf(line, sizeof(line), "frames: %d channels (%d from the source), %d-bit, %d samples/frame, %lu of max %lu samples/s",
+               frameChannels, numSendChans < frameChannels ? numSendChans : frameChannels, packetBits, frameSamples,
+               (unsigned long)sampleRate, (unsigned long)maxRate);
+      if (sampleRate > maxRate)
+      {
+        DebugPrintln(line);
+        snprintf(line, sizeof(line), "warning: more than %lu baud can carry, packets will fall behind", (unsigned long)linkBaud);
+      }
+    }
+    else
+    {
+      snprintf(line, sizeof(line), "no %d-channel %d-bit frame format, sending simple packets", frameChannels, packetBits);
+    }
+    DebugPrintln(line);
+  }
+  if (imageSource && !useFrames)
+  {
+    // an 8-channel frame of one sample period is a simple packet
+    FramePackerCreate(&framePacker, SIMPLE_PACKET_CHANNELS, packetBits, 1);
   }
+  PlaybackCommandParserInit(&commandParser);
+  freeRunning = PlatformFreeRunning() || speedPercent == 0;
+  RestartScheduler();
 }
 
-void WritePackets()
+void loop()
 {
-  OutPacket outPacket;
-  for (int row = 0; row < numOutArrayRows; row++)
+  if (!sourceReady)
+  {
+    return;
+  }
+  PollCommands();
+  TransportPoll(0);
+  if (TransportBackPressured() != linkBackPressured)
   {
-    for (int chan = 0; chan < numChans; chan++)
+    linkBackPressured = !linkBackPressured;
+    const char *message = "the link caught up";
+    if (linkBackPressured)
+    {
+      // free-running waits for the link, so does a queue that blocks; only the others drop packets
+      message = freeRunning ? "the link isn't keeping up, sending waits for it"
+                : TransportTxQueue() != nullptr && txPolicy == TX_BLOCK ? "the link isn't keeping up, packets will be late"
+                : "the link isn't keeping up, packets will be dropped";
+    }
+    DebugPrintln(message);
+  }
+  if (seeking)
+  {
+    // wait for the seek and the record it lands on without blocking, commands keep coming in
+    if (!RingSeekDone(&recordRing) || !RingHasRecord(&recordRing))
+    {
+      RefillSlice(UINT32_MAX);
+      return;
+    }
+    seeking = false;
+    UseCurrentRecord();
+    nextRow = seekRow;
+    if (seekRow > 0)
+    {
+      // from the first row, AcquireNextRow queues them
+      QueueRecordEvents(numPacketsWritten - seekRow, seekRow);
+    }
+    RestartScheduler();
+  }
+  if (isOutputting && nextRow == 0 && recordRing.endOfSource.load() && !RingHasRecord(&recordRing))
+  {
+    // played to the end of the file with looping off
+    FlushPacketRun(&packetRun);
+    isOutputting = false;
+    DebugPrintln("end of file");
+  }
+  if (isOutputting)
+  {
+    InvertPin(GENERAL_TEST_PIN_1);
+    if (freeRunning && linkBackPressured)
+    {
+      // as fast as the link allows means no faster than the host reads
+      RefillSlice(UINT32_MAX);
+      return;
+    }
+    SchedulerAction action = freeRunning ? SCHEDULER_SEND : SchedulerNextAction(&scheduler);
+    if (action != SCHEDULER_IDLE && nextRow == 0 && !WaitForRecord())
+    {
+      // the end of the file turned up while waiting, playback stops above next time round
+      return;
+    }
+    if (action == SCHEDULER_SEND)
     {
-      if (chan < 8)
+      STATS_INTERVAL(STATS_PACKET_INTERVAL, PlatformMicros());
+      if (!freeRunning)
+      {
+        STATS_RECORD(STATS_LATENESS, scheduler.lastLateMicros);
+      }
+      if (GPIO_DEBUG)
+      {
+        DebugPinWrite(GENERAL_TEST_PIN_2, true);
+      }
+      WriteNextPacket();
+      SendDueEvent();
+      if (GPIO_DEBUG)
       {
-        int32_t digitalOut = outArray[chan][row];
-        float physOut = (digitalOut * chanAttr[chan].calMultiplier) + chanAttr[chan].calOffset;
-        outPacket.values[chan] = (int32_t)physOut;
+        DebugPinWrite(GENERAL_TEST_PIN_2, false);
       }
+      if (!firstPacketSent)
+      {
+        firstPacketSent = true;
+        char line[60];
+        snprintf(line, sizeof(line), "time to first packet: %lu us", (unsigned long)(PlatformMicros() - setupStartMicros));
+        DebugPrintln(line);
+      }
+      if (freeRunning)
+      {
+        // no idle time between packets, so interleave one slice per packet
+        RefillSlice(UINT32_MAX);
+        STATS_POLL(PlatformMicros());
+        PlaylistSlice(UINT32_MAX);
+      }
+    }
+    else if (action == SCHEDULER_SKIP)
+    {
+      SkipNextPacket();
+    }
+    else if (!RefillSlice(SchedulerMicrosUntilDue(&scheduler)) && !PlaylistSlice(SchedulerMicrosUntilDue(&scheduler)))
+    {
+      STATS_POLL(scheduler.lastRawMicros);
+      // a partly filled USB transfer mustn't sit out the sleep past its deadline
+      TransportPoll(SchedulerMicrosUntilDue(&scheduler));
+      // nothing that fits before the next packet, sleep until it's due instead of spinning
+      PlatformSleepUntil(scheduler.lastRawMicros + SchedulerMicrosUntilDue(&scheduler));
+    }
+  }
+  else
+  {
+    STATS_POLL(PlatformMicros());
+    if (!RefillSlice(UINT32_MAX) && !PlaylistSlice(UINT32_MAX))
+    {
+      // stopped with the ring full, nothing to do until a command comes in
+      PlatformSleepUntil(PlatformMicros() + IDLE_SLEEP_MICROS);
     }
-    SendOutPacket(&outPacket); 
   }
 }
 
+/**
+ * @brief Restarts the packet timeline from now, at the current playback speed
+ */
+void RestartScheduler()
+{
+  // at speedPercent of real time, the period is 100 / speedPercent times as long
+  uint64_t periodNum = samplingPeriodNum * 100;
+  uint64_t periodDen = (uint64_t)samplingPeriodDen * (speedPercent > 0 ? speedPercent : 100);
+  while (periodDen > UINT32_MAX)
+  {
+    periodNum >>= 1;
+    periodDen >>= 1;
+  }
+  SchedulerStart(&scheduler, periodNum, (uint32_t)periodDen, catchUpPolicy, MAX_BURST_MICROS);
+  if (TransportTxQueue() != nullptr)
+  {
+    // as fast as the link allows is paced by the link, so nothing is dropped
+    TransportSetTxPolicy(freeRunning ? TX_BLOCK : txPolicy);
+  }
+}
 
+/**
+ * @brief Continues playback from a row of a data record, once the ring has it
+ */
+void SeekTo(long record, int row)
+{
+  FlushPacketRun(&packetRun);
+  // annotations are queued again from the record the seek lands on
+  EventQueueClear(&eventQueue);
+  RingRequestSeek(&recordRing, record);
+  if (!recordRing.backgroundRefill)
+  {
+    RingRefillStep(&recordRing);
+  }
+  seeking = true;
+  seekRow = row;
+}
 
-void RefillBuffer()
+void HandleCommand(const PlaybackCommand *command)
 {
-  for (int col = 0; col < numChans; col++)
+  switch (command->type)
   {
-    if (isAcceptableSamplingFreq[col])
+  case PLAYBACK_CMD_START:
+    if (recordRing.endOfSource.load() && !RingHasRecord(&recordRing))
     {
-      //read the values for the next column in the record
-      char *ptrOutCol = (char *)(&(outArray[col][0]));
-      edfFile.read(ptrOutCol, numOutArrayRows * 2); // * 2 because two bytes per sample
+      // stopped at the end of the file, start again from the top
+      SeekTo(0, 0);
+    }
+    isOutputting = true;
+    RestartScheduler();
+    break;
+  case PLAYBACK_CMD_STOP:
+    FlushPacketRun(&packetRun);
+    isOutputting = false;
+    break;
+  case PLAYBACK_CMD_SEEK_RECORD:
+  {
+    // long is 32-bit on the Feather; a larger record number mustn't wrap negative and seek to the start
+    int64_t record = command->argument;
+    SeekTo(record > LONG_MAX ? LONG_MAX : (long)record, 0);
+    break;
+  }
+  case PLAYBACK_CMD_SEEK_MILLIS:
+  {
+    // datarecord_duration is in units of 100 ns
+    int64_t fileTime = command->argument * 10000LL;
+    int64_t recordDuration = edfHeader.hdr.datarecord_duration;
+    long record = (long)(fileTime / recordDuration);
+    int64_t offset = fileTime % recordDuration;
+    if (seekIndexReady && !SeekIndexFind(&seekIndex, fileTime, &record, &offset))
+    {
+      DebugPrintln("seek index unreadable");
+      break;
+    }
+    SeekTo(record, (int)(offset * numOutArrayRows / recordDuration));
+    break;
+  }
+  case PLAYBACK_CMD_LOOP:
+    recordRing.loopSource = command->argument != 0;
+    break;
+  case PLAYBACK_CMD_SPEED:
+    speedPercent = command->argument;
+    FlushPacketRun(&packetRun);
+    freeRunning = speedPercent == 0;
+    RestartScheduler();
+    break;
+  }
+}
+
+/**
+ * @brief Takes whatever command bytes have arrived, up to COMMAND_BYTES_PER_LOOP
+ */
+void PollCommands()
+{
+  PlaybackCommand command;
+  for (int i = 0; i < COMMAND_BYTES_PER_LOOP && TransportAvailable() > 0; i++)
+  {
+    int byte = TransportRead();
+    if (byte >= 0 && PlaybackCommandFeed(&commandParser, (uint8_t)byte, &command))
+    {
+      HandleCommand(&command);
+    }
+  }
+}
+
+void InvertPin(uint32_t pinNum)
+{
+  if (GPIO_DEBUG)
+  {
+    bool currVal = DebugPinRead(pinNum);
+    DebugPinWrite(pinNum, !currVal);
+  }
+}
 
-      // commented out code below checks what's coming in on one column
-      //if (col == 1)
-      /*
+/**
+ * @brief Waits for the record a new one of the packets starts, it should already be waiting in the ring
+ *
+ * @return false if the file ended, or failed, before there was one
+ */
+bool WaitForRecord()
+{
+  if (!RingHasRecord(&recordRing))
+  {
+    recordRing.underruns++;
+    while (!RingHasRecord(&recordRing) && !recordRing.sourceFailed && !recordRing.endOfSource.load())
+    {
+      if (!recordRing.backgroundRefill)
       {
-        Serial1.println(outArray[col][10]);
-        Serial1.println("----------------------------------");
-        Serial1.println("----------------------------------");
-        chanHeaders[col].label[15] = 0;
-        String chanLabel = chanHeaders[col].label;
-        Serial1.println(chanLabel);
-        Serial1.println("----------------------------------");
-        Serial1.println("----------------------------------");
-        Serial1.println(col);
-        for (int i = 0; i < numOutArrayRows; i++)
-        {
-          Serial1.println(outArray[col][i]);
-        }
+        RingRefillStep(&recordRing);
+      }
+      else
+      {
+        // the refill thread is reading it, let it have the CPU
+        PlatformSleepUntil(PlatformMicros() + RECORD_WAIT_MICROS);
       }
-      */
     }
-    else
+  }
+  return RingHasRecord(&recordRing);
+}
+
+/**
+ * @brief Makes sure the record holding the next packet's row is in outArray
+ * 
+ * @return which row of outArray the next packet takes
+ */
+unsigned long AcquireNextRow()
+{
+  unsigned long rowInBuffer = nextRow;
+  if (rowInBuffer == 0)
+  {
+    WaitForRecord();
+    UseCurrentRecord();
+    QueueRecordEvents(numPacketsWritten, INT32_MIN);
+  }
+  return rowInBuffer;
+}
+
+/**
+ * @brief Queues the annotations of the record packets are now taken from
+ *
+ * @param firstSample sample number of the record's first row
+ * @param fromRow annotations on rows before this one are left out, as
+ *        playback started after them
+ */
+void QueueRecordEvents(uint32_t firstSample, int32_t fromRow)
+{
+  int count;
+  const RecordEvent *events = RingCurrentEvents(&recordRing, &count);
+  for (int i = 0; i < count; i++)
+  {
+    if (events[i].row >= fromRow)
     {
-      int sampsThisRecord = ((String)chanHeaders[col].numDataSamplesPerRecord).toInt();
-      edfFile.seekCur(sampsThisRecord * 2);
+      EventQueuePush(&eventQueue, firstSample + events[i].row, events[i].durationMillis, events[i].text);
     }
   }
 }
 
-void GetAllEdfFields()
+/**
+ * @brief Sends the next annotation as an event frame, if the packet with its onset sample has gone
+ *
+ * At most one per packet, so annotations never hold up samples. Frames
+ * and compressed blocks aren't split: an event waits until the one being
+ * built is finished.
+ */
+void SendDueEvent()
 {
-  GetEdfField(0, 16);
-  GetEdfField(16, 80);
-  GetEdfField(96, 8);
-  GetEdfField(104, 8);
-  GetEdfField(112, 8);
-  GetEdfField(120, 8);
-  GetEdfField(128, 8);
-  GetEdfField(136, 80);
-  GetEdfField(216, 8);
-  GetEdfField(224, 32);
+  if (!EventQueueDue(&eventQueue, numPacketsWritten) || (useFrames && framePacker.rowsInFrame != 0) ||
+      (riceEncoder != nullptr && riceEncoder->rowsInBlock != 0))
+  {
+    return;
+  }
+  // whatever packets are waiting go first, they come before it
+  FlushPacketRun(&packetRun);
+  uint8_t frame[EVENT_FRAME_MAX_BYTES];
+  size_t frameBytes = EventQueueTakeFrame(&eventQueue, frame);
+  STATS_START(writeStart);
+  TransportWrite(frame, frameBytes);
+  STATS_STOP(STATS_SERIAL_WRITE, writeStart);
 }
 
 /**
- * @brief Creates the 2D Output Array
- * 
- * 
+ * @brief Moves on to the next packet, handing the record back once its last row is done
  */
-void CreateOutArray()
+void FinishRow(unsigned long rowInBuffer)
 {
-  // Create the 2D output array as a one-record buffer
-  outArray = new short *[numChans];
-  for (int chan = 0; chan < numChans; chan++)
+  numPacketsWritten++;
+  nextRow = rowInBuffer + 1;
+  if (nextRow == numOutArrayRows)
   {
-    outArray[chan] = new short[numOutArrayRows]; // fix at 8 columns
+    nextRow = 0;
+    if (RingHasRecord(&recordRing))
+    {
+      RingReleaseRecord(&recordRing);
+    }
   }
+}
 
-  // populate array with "fake data" - will be overwritten by real data 
-  // unless the channel isn't used
-  // all values in channel 0 are 0, all values in channel 1 are 1, etc
-  for (int col = 0; col < numChans; col++)
+void WriteNextPacket()
+{
+  bool currentTestPinVal = DebugPinRead(SEND_PACKET_TEST_PIN);
+  if (GPIO_DEBUG)
   {
-    for (int row = 0; row < numOutArrayRows; row++)
+    DebugPinWrite(SEND_PACKET_TEST_PIN, !currentTestPinVal);
+  }
+  unsigned long rowInBuffer = AcquireNextRow();
+  if (imageSource)
+  {
+    // the row is already what goes on the wire
+    bool frameDone = AppendFrameBytes(&packetRun, &framePacker, numPacketsWritten,
+                                      imageRecord + rowInBuffer * imageHeader.rowBytes);
+    if ((frameDone && !freeRunning) || PacketRunFull(&packetRun))
     {
-      if (col < 8)
-      {
-        outArray[col][row] = col;
-      }
+      FlushPacketRun(&packetRun);
+    }
+    FinishRow(rowInBuffer);
+    return;
+  }
+  if (riceEncoder != nullptr)
+  {
+    // a block goes out once its last sample period is due
+    size_t blockBytes = RiceAppendRow(riceEncoder, numPacketsWritten, sendColumns, numSendChans, rowInBuffer);
+    if (blockBytes > 0)
+    {
+      STATS_START(writeStart);
+      TransportWrite(riceEncoder->out, blockBytes);
+      STATS_STOP(STATS_SERIAL_WRITE, writeStart);
     }
+    FinishRow(rowInBuffer);
+    return;
+  }
+  if (useFrames)
+  {
+    bool frameDone = AppendFrameRow(&packetRun, &framePacker, numPacketsWritten, sendColumns, numSendChans, rowInBuffer);
+    if (frameDone && !freeRunning)
+    {
+      // on time, each frame goes out once its last sample period is due
+      FlushPacketRun(&packetRun);
+    }
+    FinishRow(rowInBuffer);
+    return;
   }
+  // samples are already calibrated by the refill, the first 8 channels go straight into the wire format
+  if (packetBits == 24)
+  {
+    AppendSimplePacket24(&packetRun, numPacketsWritten % 32768, outArray, numOutArrayChans, rowInBuffer);
+  }
+  else
+  {
+    AppendSimplePacket(&packetRun, numPacketsWritten % 32768, outArray, numOutArrayChans, rowInBuffer); //32769 = 2e15;
+  }
+  if (!freeRunning || PacketRunFull(&packetRun))
+  {
+    // on time, each packet goes out as soon as it's due; free running, in runs
+    FlushPacketRun(&packetRun);
+  }
+  FinishRow(rowInBuffer);
+}
+
+/**
+ * @brief Drops the next packet: its samples and counter value are skipped,
+ *        so the packets after it are still sent at the right time with the right data
+ */
+void SkipNextPacket()
+{
+  if ((useFrames && framePacker.rowsInFrame != 0) || (riceEncoder != nullptr && riceEncoder->rowsInBlock != 0))
+  {
+    // a frame or block that's been started has to be finished, skipping resumes at the next one
+    WriteNextPacket();
+    return;
+  }
+  FinishRow(AcquireNextRow());
 }
 
 /**
- * @brief Given the start amd length of the field within the header
- *        reads that field into the correct struct field for each channel
- *        
- * @param startOffset 
- * @param fieldLength 
+ * @brief Makes the ring's current record the one packets are taken from
  */
-void GetEdfField(int startOffset, int fieldLength)
-{
-  //char tempHolder[fieldLength];
-  int chanHeaderLength = sizeof(chanHeaders[0]); //chanHeaders[] is a global variable
-  for (int i = 0; i < numChans; i++)
-  {
-    int offsetInCharArray = (startOffset * numChans) + (i * fieldLength);
-    for (int j = 0; j < fieldLength; j++)
-    {
-      //grab the bytes
-      //tempHolder[j] = chanHeadersRaw[j + offsetInCharArray];
-      chanHeadersChars[j + (chanHeaderLength * i) + startOffset] = (chanHeadersRaw[j + offsetInCharArray]);
-    }
-  }
-  return;
-}
-
-void Dump_sd_info(SdFat sd)
-{
-  Serial1.print("Clusters:          ");
-  Serial1.println(sd.clusterCount());
-  Serial1.print("Blocks x Cluster:  ");
-  Serial1.println(sd.blocksPerCluster());
-  Serial1.print("Total Blocks:      ");
-  Serial1.println(sd.blocksPerCluster() * sd.clusterCount());
-  Serial1.println();
-  // print the type and size of the first FAT-type volume
-  uint32_t volumesize;
-  Serial1.print("Volume type is:    FAT");
-  Serial1.println(sd.fatType(), DEC);
-  volumesize = sd.blocksPerCluster(); // clusters are collections of blocks
-  volumesize *= sd.clusterCount();    // we'll have a lot of clusters
-  volumesize /= 2;                    // SD card blocks are always 512 bytes (2 blocks are 1KB)
-  Serial1.print("Volume size (Kb):  ");
-  Serial1.println(volumesize);
-  Serial1.print("Volume size (Mb):  ");
-  volumesize /= 1024;
-  Serial1.println(volumesize);
-  Serial1.print("Volume size (Gb):  ");
-  Serial1.println((float)volumesize / 1024.0);
-
-  // Note - sd.ls prints to Serial, not Serial1 -- not sure if can call
-  // differently to work with Serial1
-  Serial1.println("\nFiles found on the card (name, date and size in bytes): ");
-  sd.ls(LS_R | LS_DATE | LS_SIZE);
-  Serial1.println(" ");
-}
\ No newline at end of file
+void UseCurrentRecord()
+{
+  if (imageSource)
+  {
+    imageRecord = RingCurrentImage(&recordRing);
+    return;
+  }
+  if (playlistActive && RingCurrentSourceNum(&recordRing) != playingSourceNum)
+  {
+    PlaylistSwitched();
+  }
+  int32_t **record = RingCurrentRecord(&recordRing);
+  outArray = record;
+  for (int i = 0; i < numSendChans; i++)
+  {
+    sendColumns[i] = record[sendChans[i]];
+  }
+}
+
+/**
+ * @brief Reads just the record the first packet needs, so it can go out sooner;
+ *        loop() reads the rest of the ring between packets
+ */
+void PreloadFirstRecord()
+{
+  STATS_START(refillStart);
+  while (!RingHasRecord(&recordRing) && RingRefillStep(&recordRing))
+  {
+  }
+  STATS_STOP(STATS_REFILL, refillStart);
+}
+
+/**
+ * @brief Reads records into the ring until it's full
+ * 
+ * Only used before playback starts, by the generator, whose records cost no
+ * SD reads; once packets are going out the ring is topped up a slice at a
+ * time by RefillSlice.
+ */
+void RefillBuffer()
+{
+  STATS_START(refillStart);
+  RingFill(&recordRing);
+  STATS_STOP(STATS_REFILL, refillStart);
+}
+
+/**
+ * @brief Does one slice of refill work if it fits before the next packet is due
+ * 
+ * @param budgetMicros time until the next packet is due, UINT32_MAX if there's no deadline
+ * @return true if a slice was done
+ */
+bool RefillSlice(uint32_t budgetMicros)
+{
+  if (recordRing.backgroundRefill || RingIsFull(&recordRing))
+  {
+    return false;
+  }
+  if (budgetMicros <= refillSliceMicros)
+  {
+    return false;
+  }
+  uint32_t startMicros = PlatformMicros();
+  bool didWork = RingRefillStep(&recordRing);
+  unsigned long sliceMicros = PlatformMicros() - startMicros;
+  STATS_RECORD(STATS_REFILL, sliceMicros);
+  // don't let one slow SD transaction lock refilling out for good
+  unsigned long maxBudget = acceptedSamplingPeriodMicros / 2;
+  if (sliceMicros > refillSliceMicros)
+  {
+    refillSliceMicros = sliceMicros < maxBudget ? sliceMicros : maxBudget;
+  }
+  return didWork;
+}
+
+/**
+ * @brief Creates the ring of output records in sampleArena
+ * 
+ * Every slot is a one-record 2D array, one column per kept channel, populated
+ * with "fake data" that will be overwritten by real data unless the channel
+ * isn't used: all values in channel 0 are 0, all values in channel 1 are 1, etc
+ */
+void CreateOutArray()
+{
+  if (!RingCreate(&recordRing, &sampleArena, numRingRecords, numChans, numOutArrayChans, numOutArrayRows,
+                  maxChanSampsPerRecord, edfHeader.layout.bytes_per_sample))
+  {
+    TransportPrintln("not enough memory for the record ring");
+  }
+}
@@ -1,72 +1,525 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include "microedf.h"
 
-//this is the structure we initially read the header into
-struct edfhdrblock
+/* width of a field of the per-channel header, as laid out in edfHeaderChan */
+#define CHAN_FIELD_WIDTH(member) ((int)sizeof(((struct edfHeaderChan *)0)->member))
+
+#define HEADER_READ_CHUNK 512 /* bytes of the channel header block buffered at a time */
+
+/*
+ * The channel header block is stored field by field (every label, then
+ * every transducer type, ...). It's parsed in that order straight from the
+ * reader, through this one-chunk buffer, so it never has to be held in
+ * memory or reshuffled into per-channel structs.
+ */
+struct header_reader
 {
-    ///FILE      *file_hdl;
-    //char      path[1024];
-    //int       writemode;
-    char      version[32];
-    char      patient[81];
-    char      recording[81];
-    char      plus_patientcode[81];
-    char      plus_gender[16];
-    char      plus_birthdate[16];
-    char      plus_patient_name[81];
-    char      plus_patient_additional[81];
-    char      plus_startdate[16];
-    char      plus_admincode[81];
-    char      plus_technician[81];
-    char      plus_equipment[81];
-    char      plus_recording_additional[81];
-    long long l_starttime;
-    int       startdate_day;
-    int       startdate_month;
-    int       startdate_year;
-    int       starttime_second;
-    int       starttime_minute;
-    int       starttime_hour;
-    char      reserved[45];
-    int       hdrsize;
-    int       edfsignals;
-    long long datarecords;
-    int       recordsize;
-    int       annot_ch[EDFLIB_MAXSIGNALS];
-    int       nr_annot_chns;
-    int       mapped_signals[EDFLIB_MAXSIGNALS];
-    int       edf;
-    int       edfplus;
-    int       bdf;
-    int       bdfplus;
-    int       discontinuous;
-    int       signal_write_sequence_pos;
-    long long starttime_offset;
-    double    data_record_duration;
-    long long long_data_record_duration;
-    int       annots_in_file;
-    int       annotlist_sz;
-    int       total_annot_bytes;
-    int       eq_sf;
-    char      *wrbuf;
-    int       wrbufsize;
-    struct edfparamblock *edfparam;
+    edf_read_fn read;
+    void *ctx;
+    char buf[HEADER_READ_CHUNK];
+    int pos;
+    int len;
 };
 
+static bool reader_next_field(struct header_reader *reader, char *field, int width)
+{
+    while (width > 0)
+    {
+        if (reader->pos == reader->len)
+        {
+            reader->len = reader->read(reader->ctx, reader->buf, HEADER_READ_CHUNK);
+            reader->pos = 0;
+            if (reader->len <= 0)
+            {
+                return false;
+            }
+        }
+        int n = reader->len - reader->pos;
+        if (n > width)
+        {
+            n = width;
+        }
+        memcpy(field, reader->buf + reader->pos, n);
+        reader->pos += n;
+        field += n;
+        width -= n;
+    }
+    return true;
+}
+
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/* true if everything from field[pos] up to width is padding */
+static bool only_padding(const char *field, int pos, int width)
+{
+    for (; pos < width; pos++)
+    {
+        if (field[pos] != ' ' && field[pos] != '\0')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Parses a space-padded ASCII integer field, e.g. "-32768  "
+ *
+ * @return false if the field holds anything but an optionally signed integer
+ */
+bool edf_parse_int(const char *field, int width, long long *value)
+{
+    int pos = 0;
+    while (pos < width && field[pos] == ' ')
+    {
+        pos++;
+    }
+    bool negative = false;
+    if (pos < width && (field[pos] == '-' || field[pos] == '+'))
+    {
+        negative = field[pos] == '-';
+        pos++;
+    }
+    if (pos == width || !is_digit(field[pos]))
+    {
+        return false;
+    }
+    long long result = 0;
+    for (; pos < width && is_digit(field[pos]); pos++)
+    {
+        result = result * 10 + (field[pos] - '0');
+    }
+    *value = negative ? -result : result;
+    return only_padding(field, pos, width);
+}
+
+/**
+ * @brief Parses a space-padded ASCII decimal field into an integer count of
+ *        10^-decimals units, e.g. "0.25" with 7 decimals gives 2500000
+ *
+ * Digits past the requested number of decimals are ignored.
+ */
+bool edf_parse_fixed(const char *field, int width, int decimals, long long *value)
+{
+    int pos = 0;
+    while (pos < width && field[pos] == ' ')
+    {
+        pos++;
+    }
+    bool negative = false;
+    if (pos < width && (field[pos] == '-' || field[pos] == '+'))
+    {
+        negative = field[pos] == '-';
+        pos++;
+    }
+    long long result = 0;
+    int digits = 0;
+    for (; pos < width && is_digit(field[pos]); pos++, digits++)
+    {
+        result = result * 10 + (field[pos] - '0');
+    }
+    int fractionDigits = 0;
+    if (pos < width && field[pos] == '.')
+    {
+        for (pos++; pos < width && is_digit(field[pos]); pos++, digits++)
+        {
+            if (fractionDigits < decimals)
+            {
+                result = result * 10 + (field[pos] - '0');
+                fractionDigits++;
+            }
+        }
+    }
+    if (digits == 0)
+    {
+        return false;
+    }
+    for (; fractionDigits < decimals; fractionDigits++)
+    {
+        result *= 10;
+    }
+    *value = negative ? -result : result;
+    return only_padding(field, pos, width);
+}
+
+/**
+ * @brief Parses a space-padded ASCII decimal field, e.g. "-1000.00"
+ *
+ * Gives the correctly rounded float, the same as strtof. Mantissas up to
+ * 2^24 with up to 10 decimals are exact floats divided by an exact power of
+ * ten, a single correctly rounded operation; anything else (long mantissas,
+ * exponents) goes through strtof on a stack copy.
+ */
+bool edf_parse_float(const char *field, int width, float *value)
+{
+    static const float powersOfTen[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+    int pos = 0;
+    while (pos < width && field[pos] == ' ')
+    {
+        pos++;
+    }
+    int start = pos;
+    bool negative = false;
+    if (pos < width && (field[pos] == '-' || field[pos] == '+'))
+    {
+        negative = field[pos] == '-';
+        pos++;
+    }
+    unsigned long long mantissa = 0;
+    int digits = 0;
+    int decimals = 0;
+    for (; pos < width && is_digit(field[pos]); pos++, digits++)
+    {
+        mantissa = mantissa * 10 + (field[pos] - '0');
+    }
+    if (pos < width && field[pos] == '.')
+    {
+        for (pos++; pos < width && is_digit(field[pos]); pos++, digits++, decimals++)
+        {
+            mantissa = mantissa * 10 + (field[pos] - '0');
+        }
+    }
+    if (digits == 0)
+    {
+        return false;
+    }
+    if (only_padding(field, pos, width) && digits <= 18 && mantissa <= (1UL << 24) && decimals <= 10)
+    {
+        float result = (float)mantissa / powersOfTen[decimals];
+        *value = negative ? -result : result;
+        return true;
+    }
+
+    char copy[81];
+    int length = width - start < (int)sizeof(copy) - 1 ? width - start : (int)sizeof(copy) - 1;
+    memcpy(copy, field + start, length);
+    copy[length] = '\0';
+    char *end;
+    *value = strtof(copy, &end);
+    return end != copy && only_padding(copy, (int)(end - copy), length);
+}
+
+/* two ASCII digits, e.g. the "12" of "10.12.09" */
+static bool parse_two_digits(const char *field, int *value)
+{
+    if (!is_digit(field[0]) || !is_digit(field[1]))
+    {
+        return false;
+    }
+    *value = (field[0] - '0') * 10 + (field[1] - '0');
+    return true;
+}
+
+/* copies a space-padded field into a null-terminated string without the padding */
+static void copy_trimmed(char *dest, int destSize, const char *field, int width)
+{
+    while (width > 0 && (field[width - 1] == ' ' || field[width - 1] == '\0'))
+    {
+        width--;
+    }
+    if (width > destSize - 1)
+    {
+        width = destSize - 1;
+    }
+    memcpy(dest, field, width);
+    dest[width] = '\0';
+}
+
 /*
-int parse_edf(const char *path)
+ * Copies the next space-separated subfield of an EDF+ patient or recording
+ * field. "X" means unknown and gives an empty string; underscores stand in
+ * for spaces. With rest set, copies everything that's left instead.
+ */
+static int next_subfield(const char *field, int width, int pos, char *dest, int destSize, bool rest)
+{
+    while (pos < width && field[pos] == ' ')
+    {
+        pos++;
+    }
+    int start = pos;
+    while (pos < width && (rest || field[pos] != ' '))
+    {
+        pos++;
+    }
+    copy_trimmed(dest, destSize, field + start, pos - start);
+    if (strcmp(dest, "X") == 0)
+    {
+        dest[0] = '\0';
+    }
+    for (char *c = dest; *c; c++)
+    {
+        if (*c == '_')
+        {
+            *c = ' ';
+        }
+    }
+    return pos;
+}
+
+static void parse_plus_patient(const struct edfHeaderMain *raw, struct edf_hdr_struct *hdr)
+{
+    const char *field = raw->localPatientId;
+    int width = sizeof(raw->localPatientId);
+    char sex[16];
+    int pos = next_subfield(field, width, 0, hdr->patientcode, sizeof(hdr->patientcode), false);
+    pos = next_subfield(field, width, pos, sex, sizeof(sex), false);
+    strcpy(hdr->gender, sex[0] == 'M' ? "Male" : sex[0] == 'F' ? "Female" : "");
+    pos = next_subfield(field, width, pos, hdr->birthdate, sizeof(hdr->birthdate), false);
+    pos = next_subfield(field, width, pos, hdr->patient_name, sizeof(hdr->patient_name), false);
+    next_subfield(field, width, pos, hdr->patient_additional, sizeof(hdr->patient_additional), true);
+}
+
+static void parse_plus_recording(const struct edfHeaderMain *raw, struct edf_hdr_struct *hdr)
+{
+    const char *field = raw->localRecordingId;
+    int width = sizeof(raw->localRecordingId);
+    char skipped[16];
+    int pos = next_subfield(field, width, 0, skipped, sizeof(skipped), false);          /* "Startdate" */
+    pos = next_subfield(field, width, pos, skipped, sizeof(skipped), false);            /* dd-MMM-yyyy */
+    pos = next_subfield(field, width, pos, hdr->admincode, sizeof(hdr->admincode), false);
+    pos = next_subfield(field, width, pos, hdr->technician, sizeof(hdr->technician), false);
+    pos = next_subfield(field, width, pos, hdr->equipment, sizeof(hdr->equipment), false);
+    next_subfield(field, width, pos, hdr->recording_additional, sizeof(hdr->recording_additional), true);
+}
+
+/**
+ * @brief Parses and validates the 256-byte main header
+ *
+ * Works out the file type (EDF, EDF+, BDF, BDF+) and fills everything in
+ * hdr that doesn't depend on the signal headers. Also checks numHeaderBytes
+ * agrees with the number of signals.
+ *
+ * @return 0, or a negative EDFLIB_FILE_* error
+ */
+int edf_parse_main_header(const struct edfHeaderMain *raw, struct edf_hdr_struct *hdr, struct edf_layout_struct *layout)
+{
+    long long value;
+    memset(hdr, 0, sizeof(*hdr));
+    memset(layout, 0, sizeof(*layout));
+
+    bool bdf;
+    if (edf_parse_int(raw->FormatVersion, sizeof(raw->FormatVersion), &value) && value == 0)
+    {
+        bdf = false;
+    }
+    else if ((unsigned char)raw->FormatVersion[0] == 0xFF && memcmp(raw->FormatVersion + 1, "BIOSEMI", 7) == 0)
+    {
+        bdf = true;
+    }
+    else
+    {
+        return EDFLIB_FILE_CONTAINS_FORMAT_ERRORS;
+    }
+    bool plus = memcmp(raw->reserved, bdf ? "BDF+" : "EDF+", 4) == 0;
+    if (plus && raw->reserved[4] != 'C' && raw->reserved[4] != 'D')
+    {
+        return EDFLIB_FILE_CONTAINS_FORMAT_ERRORS;
+    }
+    layout->discontinuous = plus && raw->reserved[4] == 'D';
+    layout->bytes_per_sample = bdf ? 3 : 2;
+    hdr->filetype = bdf ? (plus ? EDFLIB_FILETYPE_BDFPLUS : EDFLIB_FILETYPE_BDF)
+                        : (plus ? EDFLIB_FILETYPE_EDFPLUS : EDFLIB_FILETYPE_EDF);
+
+    if (!edf_parse_int(raw->numSignals, sizeof(raw->numSignals), &value) || value < 1)
+    {
+        return EDFLIB_FILE_CONTAINS_FORMAT_ERRORS;
+    }
+    if (value > EDFLIB_MAXSIGNALS)
+    {
+        return EDFLIB_FILE_TOO_MANY_SIGNALS;
+    }
+    layout->total_signals = (int)value;
+
+    if (!edf_parse_int(raw->numHeaderBytes, sizeof(raw->numHeaderBytes), &value))
+    {
+        return EDFLIB_FILE_CONTAINS_FORMAT_ERRORS;
+    }
+    if (value != (long long)sizeof(struct edfHeaderChan) * (layout->total_signals + 1))
+    {
+        return EDFLIB_FILE_HEADER_SIZE_MISMATCH;
+    }
+    layout->header_bytes = (int)value;
+
+    /* -1 is allowed, it means the recording was still going when the header was written */
+    if (!edf_parse_int(raw->numDataRecords, sizeof(raw->numDataRecords), &value) || value < -1)
+    {
+        return EDFLIB_FILE_CONTAINS_FORMAT_ERRORS;
+    }
+    hdr->datarecords_in_file = value;
+
+    /* in units of 100 nanoseconds */
+    if (!edf_parse_fixed(raw->durationDataRcordsSecs, sizeof(raw->durationDataRcordsSecs), 7, &value) || value < 0)
+    {
+        return EDFLIB_FILE_CONTAINS_FORMAT_ERRORS;
+    }
+    hdr->datarecord_duration = value;
+    hdr->file_duration = hdr->datarecords_in_file > 0 ? value * hdr->datarecords_in_file : 0;
+
+    if (raw->startDate[2] != '.' || raw->startDate[5] != '.' || raw->startTime[2] != '.' || raw->startTime[5] != '.' ||
+        !parse_two_digits(raw->startDate, &hdr->startdate_day) ||
+        !parse_two_digits(raw->startDate + 3, &hdr->startdate_month) ||
+        !parse_two_digits(raw->startDate + 6, &hdr->startdate_year) ||
+        !parse_two_digits(raw->startTime, &hdr->starttime_hour) ||
+        !parse_two_digits(raw->startTime + 3, &hdr->starttime_minute) ||
+        !parse_two_digits(raw->startTime + 6, &hdr->starttime_second) ||
+        hdr->startdate_day < 1 || hdr->startdate_day > 31 || hdr->startdate_month < 1 || hdr->startdate_month > 12 ||
+        hdr->starttime_hour > 23 || hdr->starttime_minute > 59 || hdr->starttime_second > 59)
+    {
+        return EDFLIB_FILE_CONTAINS_FORMAT_ERRORS;
+    }
+    /* two-digit years, 1985 clipping date as in the EDF spec */
+    hdr->startdate_year += hdr->startdate_year >= 85 ? 1900 : 2000;
+
+    if (plus)
+    {
+        parse_plus_patient(raw, hdr);
+        parse_plus_recording(raw, hdr);
+    }
+    else
+    {
+        copy_trimmed(hdr->patient, sizeof(hdr->patient), raw->localPatientId, sizeof(raw->localPatientId));
+        copy_trimmed(hdr->recording, sizeof(hdr->recording), raw->localRecordingId, sizeof(raw->localRecordingId));
+    }
+    return 0;
+}
+
+/**
+ * @brief Parses and validates the channel header block in one pass
+ *
+ * Reads layout->total_signals channel headers through read, which has to
+ * deliver the bytes straight after the main header. Fills one entry of
+ * signals per signal (annotation signals included), the record layout, and
+ * hdr->edfsignals.
+ *
+ * @return 0, or a negative EDFLIB_FILE_* error
+ */
+int edf_parse_signal_headers(edf_read_fn read, void *ctx, struct edf_hdr_struct *hdr,
+                             struct edf_layout_struct *layout, struct edf_signal_struct *signals)
 {
-    struct edfhdrblock *hdr;
-    char *edf_hdr,
-    scratchpad[128],
-    scratchpad2[64];
+    struct header_reader reader;
+    reader.read = read;
+    reader.ctx = ctx;
+    reader.pos = 0;
+    reader.len = 0;
 
-    edf_hdr = (char *)calloc(1, 256);
-    //edf_hdr_struct *edfhdr;
-    edfhdr = (struct edfhdrblock *)calloc(1, sizeof(struct edfhdrblock));
+    bool plus = hdr->filetype == EDFLIB_FILETYPE_EDFPLUS || hdr->filetype == EDFLIB_FILETYPE_BDFPLUS;
+    bool bdf = layout->bytes_per_sample == 3;
+    long long digitalLimit = bdf ? 8388608 : 32768;
+    int numSignals = layout->total_signals;
+    char field[80];
+    long long value;
+    int i;
 
+    for (i = 0; i < numSignals; i++)
+    {
+        if (!reader_next_field(&reader, field, CHAN_FIELD_WIDTH(label)))
+        {
+            return EDFLIB_FILE_READ_ERROR;
+        }
+        copy_trimmed(signals[i].label, sizeof(signals[i].label), field, CHAN_FIELD_WIDTH(label));
+        signals[i].annotation = plus && memcmp(field, bdf ? "BDF Annotations " : "EDF Annotations ", 16) == 0;
+    }
+    /* transducer type and physical dimension aren't needed for playback */
+    for (i = 0; i < numSignals * 2; i++)
+    {
+        int width = i < numSignals ? CHAN_FIELD_WIDTH(transducerType) : CHAN_FIELD_WIDTH(physicalDimension);
+        if (!reader_next_field(&reader, field, width))
+        {
+            return EDFLIB_FILE_READ_ERROR;
+        }
+    }
+    for (i = 0; i < numSignals; i++)
+    {
+        if (!reader_next_field(&reader, field, CHAN_FIELD_WIDTH(physicalMin)))
+        {
+            return EDFLIB_FILE_READ_ERROR;
+        }
+        if (!edf_parse_float(field, CHAN_FIELD_WIDTH(physicalMin), &signals[i].phys_min))
+        {
+            return EDFLIB_FILE_CONTAINS_FORMAT_ERRORS;
+        }
+    }
+    for (i = 0; i < numSignals; i++)
+    {
+        if (!reader_next_field(&reader, field, CHAN_FIELD_WIDTH(physicalMax)))
+        {
+            return EDFLIB_FILE_READ_ERROR;
+        }
+        if (!edf_parse_float(field, CHAN_FIELD_WIDTH(physicalMax), &signals[i].phys_max) ||
+            signals[i].phys_max == signals[i].phys_min)
+        {
+            return EDFLIB_FILE_CONTAINS_FORMAT_ERRORS;
+        }
+    }
+    for (i = 0; i < numSignals; i++)
+    {
+        if (!reader_next_field(&reader, field, CHAN_FIELD_WIDTH(digitalMin)))
+        {
+            return EDFLIB_FILE_READ_ERROR;
+        }
+        if (!edf_parse_int(field, CHAN_FIELD_WIDTH(digitalMin), &value) || value < -digitalLimit || value >= digitalLimit)
+        {
+            return EDFLIB_FILE_CONTAINS_FORMAT_ERRORS;
+        }
+        signals[i].dig_min = (int)value;
+    }
+    for (i = 0; i < numSignals; i++)
+    {
+        if (!reader_next_field(&reader, field, CHAN_FIELD_WIDTH(digitalMax)))
+        {
+            return EDFLIB_FILE_READ_ERROR;
+        }
+        if (!edf_parse_int(field, CHAN_FIELD_WIDTH(digitalMax), &value) || value < -digitalLimit || value >= digitalLimit ||
+            value <= signals[i].dig_min)
+        {
+            return EDFLIB_FILE_CONTAINS_FORMAT_ERRORS;
+        }
+        signals[i].dig_max = (int)value;
+    }
+    /* prefiltering isn't needed either */
+    for (i = 0; i < numSignals; i++)
+    {
+        if (!reader_next_field(&reader, field, CHAN_FIELD_WIDTH(preFiltering)))
+        {
+            return EDFLIB_FILE_READ_ERROR;
+        }
+    }
+    int recordOffset = 0;
+    int edfSignals = 0;
+    bool hasAnnotations = false;
+    for (i = 0; i < numSignals; i++)
+    {
+        if (!reader_next_field(&reader, field, CHAN_FIELD_WIDTH(numDataSamplesPerRecord)))
+        {
+            return EDFLIB_FILE_READ_ERROR;
+        }
+        if (!edf_parse_int(field, CHAN_FIELD_WIDTH(numDataSamplesPerRecord), &value) || value < 1 || value > 0x1000000)
+        {
+            return EDFLIB_FILE_CONTAINS_FORMAT_ERRORS;
+        }
+        signals[i].smp_per_record = (int)value;
+        signals[i].record_offset = recordOffset;
+        recordOffset += signals[i].smp_per_record * layout->bytes_per_sample;
+        hasAnnotations = hasAnnotations || signals[i].annotation;
+        edfSignals += !signals[i].annotation;
+    }
+    for (i = 0; i < numSignals; i++)
+    {
+        if (!reader_next_field(&reader, field, CHAN_FIELD_WIDTH(reserved)))
+        {
+            return EDFLIB_FILE_READ_ERROR;
+        }
+    }
+    if (plus && !hasAnnotations)
+    {
+        return EDFLIB_FILE_NO_ANNOTATIONS_SIGNAL;
+    }
+    layout->record_bytes = recordOffset;
+    hdr->edfsignals = edfSignals;
+    return 0;
 }
-*/
\ No newline at end of file
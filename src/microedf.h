@@ -1,5 +1,19 @@
+#pragma once
+
 #include <stdbool.h>
 #define EDFLIB_MAXSIGNALS                (640)
+
+#define EDFLIB_FILETYPE_EDF                  0
+#define EDFLIB_FILETYPE_EDFPLUS              1
+#define EDFLIB_FILETYPE_BDF                  2
+#define EDFLIB_FILETYPE_BDFPLUS              3
+
+/* returned by the parser functions, all negative */
+#define EDFLIB_FILE_READ_ERROR              -1
+#define EDFLIB_FILE_CONTAINS_FORMAT_ERRORS  -2
+#define EDFLIB_FILE_TOO_MANY_SIGNALS        -3
+#define EDFLIB_FILE_HEADER_SIZE_MISMATCH    -4
+#define EDFLIB_FILE_NO_ANNOTATIONS_SIGNAL   -5
 struct edf_hdr_struct{            /* this structure contains all the relevant EDF header info and will be filled when calling the function edf_open_file_readonly() */
   int       handle;               /* a handle (identifier) used to distinguish the different files */
   int       filetype;             /* 0: EDF, 1: EDF+, 2: BDF, 3: BDF+, a negative number means an error */
@@ -62,4 +76,45 @@ struct chanAttributes
   bool  isAcceptableSamplingFreq;
   float calMultiplier;
   float calOffset;
-};
\ No newline at end of file
+};
+
+/* the parameters of one signal that playback needs, filled by edf_parse_signal_headers() */
+struct edf_signal_struct
+{
+  char  label[17];                /* null-terminated, trailing spaces removed */
+  float phys_min;
+  float phys_max;
+  int   dig_min;
+  int   dig_max;
+  int   smp_per_record;           /* samples of this signal in each data record */
+  int   record_offset;            /* byte offset of this signal's samples within a data record */
+  bool  annotation;               /* true for "EDF Annotations" / "BDF Annotations" signals */
+};
+
+/* where things are in the file, filled by edf_parse_main_header() and edf_parse_signal_headers() */
+struct edf_layout_struct
+{
+  int total_signals;              /* signals in the file, annotation signals included */
+  int header_bytes;               /* byte offset of the first data record */
+  int record_bytes;               /* size of one data record */
+  int bytes_per_sample;           /* 2 for EDF(+), 3 for BDF(+) */
+  bool discontinuous;             /* EDF+D / BDF+D */
+};
+
+/* supplies the next len bytes of the channel header block, returns how many it could */
+typedef int (*edf_read_fn)(void *ctx, void *buf, int len);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int edf_parse_main_header(const struct edfHeaderMain *raw, struct edf_hdr_struct *hdr, struct edf_layout_struct *layout);
+int edf_parse_signal_headers(edf_read_fn read, void *ctx, struct edf_hdr_struct *hdr,
+                             struct edf_layout_struct *layout, struct edf_signal_struct *signals);
+bool edf_parse_int(const char *field, int width, long long *value);
+bool edf_parse_float(const char *field, int width, float *value);
+bool edf_parse_fixed(const char *field, int width, int decimals, long long *value);
+
+#ifdef __cplusplus
+}
+#endif
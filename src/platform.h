@@ -0,0 +1,112 @@
+/**
+ * @file platform.h
+ * @brief Thin backend layer between the simulator and the hardware it runs on
+ *
+ * On the Feather (ARDUINO defined) these map onto TIMER4, Serial1 (or its
+ * UARTE by EasyDMA, from a TxQueue) or the USB CDC port, the GPIO pins and
+ * SdFat. On the native build they map onto clock_gettime(), a file
+ * descriptor (stdout, a file or a pty) and a plain or mmap'ed file that
+ * stands in for the SD card.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "TxQueue.h"
+
+#ifdef ARDUINO
+#include "SdFat.h"
+typedef FatFile SourceFile;
+#else
+/**
+ * @brief Host stand-in for FatFile, exposing the subset of its API we use
+ */
+class SourceFile
+{
+public:
+  bool open(const char *path, bool useMmap);
+  bool openStream(const char *path); // "-" for stdin, otherwise a Unix socket to connect to; forward only
+  bool create(const char *path); // empty, for writing
+  int write(const void *buf, size_t count);
+  bool isOpen() const { return fd >= 0; }
+  int read(void *buf, size_t count);
+  bool seekCur(int32_t offset);
+  bool seekSet(uint32_t pos);
+  void rewind() { seekSet(0); }
+  uint32_t curPosition() const { return (uint32_t)position; }
+  uint32_t fileSize() const { return (uint32_t)size; } // 0 for a stream, it isn't known
+  bool getModifyDateTime(uint16_t *date, uint16_t *time); // FAT format, local time
+  bool close();
+
+private:
+  int fd = -1;
+  uint8_t *map = nullptr;
+  uint64_t size = 0;
+  uint64_t position = 0;
+  bool stream = false; // a pipe or socket: reads may come up short, seeks only go forward, by reading
+
+  bool discard(uint64_t count);
+};
+
+/**
+ * @brief Options for the native build, filled in from the command line
+ */
+struct HostOptions
+{
+  const char *sdRoot = ".";      // directory that plays the part of the SD card root
+  const char *outPath = "-";     // "-" for stdout, otherwise a file to write packets to
+  bool usePty = false;           // create a pty and write packets to it instead of outPath
+  bool useMmap = false;          // mmap source files instead of reading them
+  bool freeRunning = false;      // ignore packet deadlines, send as fast as possible
+  unsigned long maxPackets = 0;  // stop after this many packets, 0 = run until interrupted
+  double maxSeconds = 0;         // stop after this many seconds, 0 = run until interrupted
+  bool refillThread = false;     // refill the record ring from its own thread instead of loop()
+  const char *sourceStream = nullptr; // "-" or a Unix socket path: output.edf is read from it, front to back
+  uint32_t clockOffsetMicros = 0; // added to PlatformMicros(), to try out its wraparound without waiting 71 minutes
+};
+
+extern HostOptions hostOptions;
+
+bool TransportOpenHost();
+void TransportCloseHost();
+void TransportCaptureHost(uint8_t *buf, size_t capacity, size_t *length);
+#endif
+
+// time
+uint32_t PlatformMicros();
+uint32_t PlatformCycles(); // free-running CPU cycle counter, for benchmarks
+void PlatformSleepUntil(uint32_t deadlineMicros); // may return early, never much late
+void PlatformDelayMillis(uint32_t ms);
+bool PlatformFreeRunning();
+
+// debug GPIOs, no-ops on the host
+void DebugPinMode(uint32_t pinNum);
+void DebugPinWrite(uint32_t pinNum, bool high);
+bool DebugPinRead(uint32_t pinNum);
+
+// debug console, separate from the packet link (USB serial on the Feather, stderr on the host)
+void DebugBegin();
+void DebugPrintln(const char *text);
+int DebugRead(); // next byte typed on the console, -1 if none
+
+// packet link (Serial1 on the Feather, or its USB CDC port after TransportBeginUsb)
+struct LinkAggregator;
+void TransportBegin(unsigned long baud);
+void TransportBeginQueued(unsigned long baud, TxPolicy policy); // writes are queued and sent in the background
+void TransportBeginUsb(uint32_t flushMicros); // the debug console moves to Serial1
+void TransportSetTxPolicy(TxPolicy policy); // after TransportBeginQueued
+const TxQueue *TransportTxQueue(); // null unless writes are queued
+size_t TransportWrite(const uint8_t *buf, size_t len);
+void TransportPoll(uint32_t idleMicros); // over USB, sends a partly filled transfer due within idleMicros
+bool TransportBackPressured(); // over USB or queued, the link isn't taking packets as fast as they're written
+const LinkAggregator *TransportUsbLink(); // null unless packets go over USB
+void TransportPrint(const char *text);
+void TransportPrintln(const char *text);
+int TransportAvailable();
+int TransportRead();
+
+// storage (the SD card on the Feather)
+bool StorageBegin(uint8_t csPin);
+bool StorageOpen(const char *name, SourceFile &file);
+bool StorageCreate(const char *name, SourceFile &file); // empty, for writing
+void StorageDumpInfo();
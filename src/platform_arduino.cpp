@@ -0,0 +1,475 @@
+/**
+ * @file platform_arduino.cpp
+ * @brief Feather nRF52840 backend: TIMER4, Serial1 or USB CDC, GPIOs and SdFat
+ */
+#ifdef ARDUINO
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <nrf_sdm.h>
+#include <nrf_soc.h>
+#include "platform.h"
+#include "LinkAggregator.h"
+#include "TxQueue.h"
+
+#define MICROS_TIMER NRF_TIMER4 //free-running 1 MHz time base, the SoftDevice and the core don't use it
+#define MICROS_TIMER_IRQn TIMER4_IRQn
+#define MICROS_TIMER_IRQ_PRIORITY 6 //low, and allowed to call FreeRTOS FromISR functions
+#define CC_WAKE 0    //compare channel that wakes PlatformSleepUntil
+#define CC_CAPTURE 1 //capture channel PlatformMicros reads the counter through
+#define LINK_UARTE NRF_UARTE0 //the UARTE behind Serial1, driven by EasyDMA directly once writes are queued
+#define LINK_DONE_EGU NRF_EGU3 //latches LINK_UARTE's ENDTX for PumpUarte, nothing else uses it or its interrupt
+#define LINK_DONE_IRQn SWI3_EGU3_IRQn
+#define LINK_DONE_IRQ_PRIORITY 6 //as MICROS_TIMER's, so the loop task's critical sections hold it off
+#define LINK_DONE_PPI 8 //PPI channel from ENDTX to LINK_DONE_EGU, none of the core's drivers use it
+
+// the volume has to outlive setup() so files stay readable from loop()
+static SdFat sd;
+static TaskHandle_t sleepingTask = nullptr;
+static bool usbTransport = false; // packets go over the USB CDC port (Serial), the console over Serial1
+static LinkAggregator usbLink;
+static bool queuedTransport = false; // packets go through txQueue, sent on Serial1's UARTE by EasyDMA
+static TxQueue txQueue;
+static volatile bool uarteSending = false; // an EasyDMA transfer of txQueue's claim is under way
+
+/**
+ * @brief Runs HFCLK from the 32 MHz crystal rather than the internal oscillator
+ *
+ * The timers count HFCLK, which on HFINT alone can be 1% off; the crystal
+ * is good to 40 ppm.
+ *
+ * @param wait true to wait for the crystal to settle, otherwise it's only asked for
+ */
+static void RequestHfxo(bool wait)
+{
+  uint8_t softDevice = 0;
+  sd_softdevice_is_enabled(&softDevice);
+  if (softDevice)
+  {
+    // the SoftDevice owns the clock and counts requests, it's never stopped under us
+    static bool requested = false;
+    if (!requested)
+    {
+      requested = true;
+      sd_clock_hfclk_request();
+    }
+    uint32_t running = 0;
+    while (wait && !running)
+    {
+      sd_clock_hfclk_is_running(&running);
+    }
+    return;
+  }
+  if ((NRF_CLOCK->HFCLKSTAT & (CLOCK_HFCLKSTAT_SRC_Msk | CLOCK_HFCLKSTAT_STATE_Msk)) ==
+      (CLOCK_HFCLKSTAT_SRC_Xtal << CLOCK_HFCLKSTAT_SRC_Pos | CLOCK_HFCLKSTAT_STATE_Running << CLOCK_HFCLKSTAT_STATE_Pos))
+  {
+    return;
+  }
+  NRF_CLOCK->EVENTS_HFCLKSTARTED = 0;
+  NRF_CLOCK->TASKS_HFCLKSTART = 1;
+  while (wait && !NRF_CLOCK->EVENTS_HFCLKSTARTED)
+  {
+  }
+}
+
+/**
+ * @brief Starts the 32-bit 1 MHz time base the first time it's needed
+ *
+ * micros() comes from the RTC, with 30.5 us steps; packet deadlines need
+ * better than that, and a compare event to wake up on.
+ */
+static void StartMicrosTimer()
+{
+  static bool started = false;
+  if (started)
+  {
+    return;
+  }
+  started = true;
+  RequestHfxo(true);
+  MICROS_TIMER->TASKS_STOP = 1;
+  MICROS_TIMER->MODE = TIMER_MODE_MODE_Timer;
+  MICROS_TIMER->BITMODE = TIMER_BITMODE_BITMODE_32Bit;
+  MICROS_TIMER->PRESCALER = 4; // 16 MHz / 2^4
+  MICROS_TIMER->TASKS_CLEAR = 1;
+  MICROS_TIMER->EVENTS_COMPARE[CC_WAKE] = 0;
+  MICROS_TIMER->INTENSET = TIMER_INTENSET_COMPARE0_Msk;
+  NVIC_SetPriority(MICROS_TIMER_IRQn, MICROS_TIMER_IRQ_PRIORITY);
+  NVIC_EnableIRQ(MICROS_TIMER_IRQn);
+  MICROS_TIMER->TASKS_START = 1;
+}
+
+extern "C" void TIMER4_IRQHandler(void)
+{
+  if (MICROS_TIMER->EVENTS_COMPARE[CC_WAKE])
+  {
+    MICROS_TIMER->EVENTS_COMPARE[CC_WAKE] = 0;
+    BaseType_t woken = pdFALSE;
+    if (sleepingTask)
+    {
+      vTaskNotifyGiveFromISR(sleepingTask, &woken);
+    }
+    portYIELD_FROM_ISR(woken);
+  }
+}
+
+uint32_t PlatformMicros()
+{
+  StartMicrosTimer();
+  MICROS_TIMER->TASKS_CAPTURE[CC_CAPTURE] = 1;
+  return MICROS_TIMER->CC[CC_CAPTURE];
+}
+
+/**
+ * @brief Blocks the loop task until the timer reaches deadlineMicros
+ *
+ * The compare interrupt notifies the task, so the CPU is free (or asleep)
+ * in between rather than spinning on the time.
+ */
+void PlatformSleepUntil(uint32_t deadlineMicros)
+{
+  StartMicrosTimer();
+  // without the SoftDevice, the core's USB driver stops the crystal when the cable comes out
+  RequestHfxo(false);
+  sleepingTask = xTaskGetCurrentTaskHandle();
+  MICROS_TIMER->CC[CC_WAKE] = deadlineMicros;
+  int32_t waitMicros = (int32_t)(deadlineMicros - PlatformMicros());
+  // checked after arming, a deadline that passed while arming would never fire
+  if (waitMicros <= 0)
+  {
+    return;
+  }
+  // the timeout only matters if the interrupt is somehow lost
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMicros / 1000 + 2));
+}
+
+uint32_t PlatformCycles()
+{
+  // DWT cycle counter, switched on the first time it's asked for
+  if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk))
+  {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  }
+  return DWT->CYCCNT;
+}
+
+void PlatformDelayMillis(uint32_t ms)
+{
+  delay(ms);
+}
+
+bool PlatformFreeRunning()
+{
+  return false;
+}
+
+void DebugPinMode(uint32_t pinNum)
+{
+  pinMode(pinNum, OUTPUT);
+}
+
+void DebugPinWrite(uint32_t pinNum, bool high)
+{
+  digitalWrite(pinNum, high ? HIGH : LOW);
+}
+
+bool DebugPinRead(uint32_t pinNum)
+{
+  return digitalRead(pinNum);
+}
+
+void DebugBegin()
+{
+  if (usbTransport)
+  {
+    Serial1.begin(115200, SERIAL_8N1);
+    return;
+  }
+  Serial.begin(115200);
+}
+
+void DebugPrintln(const char *text)
+{
+  if (usbTransport)
+  {
+    Serial1.println(text);
+  }
+  // don't block on a console nobody has opened
+  else if (Serial)
+  {
+    Serial.println(text);
+  }
+}
+
+int DebugRead()
+{
+  if (usbTransport)
+  {
+    return Serial1.available() > 0 ? Serial1.read() : -1;
+  }
+  return Serial.available() > 0 ? Serial.read() : -1;
+}
+
+void TransportBegin(unsigned long baud)
+{
+  Serial1.begin(baud, SERIAL_8N1);
+}
+
+/**
+ * @brief Gives txQueue's claim back once the UARTE has sent it, and starts it on the next one
+ *
+ * Run from LINK_DONE_EGU's interrupt as each transfer ends, so the queue
+ * drains while the loop task sleeps, and from the task after a write, to
+ * start an idle UARTE. The UARTE's own interrupt is Serial1's, and its
+ * handler, run for every received byte, clears ENDTX before it could be
+ * seen; ENDTX is passed on through PPI to an EGU event instead.
+ */
+static void PumpUarte()
+{
+  if (LINK_DONE_EGU->EVENTS_TRIGGERED[0])
+  {
+    LINK_DONE_EGU->EVENTS_TRIGGERED[0] = 0;
+    // read back, so the interrupt isn't taken again for the event just cleared
+    (void)LINK_DONE_EGU->EVENTS_TRIGGERED[0];
+    if (uarteSending)
+    {
+      TxQueueRelease(&txQueue);
+      uarteSending = false;
+    }
+  }
+  if (uarteSending)
+  {
+    return;
+  }
+  const uint8_t *bytes;
+  size_t len = TxQueueClaim(&txQueue, &bytes);
+  if (len == 0)
+  {
+    return;
+  }
+  LINK_UARTE->TXD.PTR = (uint32_t)bytes;
+  LINK_UARTE->TXD.MAXCNT = len;
+  LINK_UARTE->TASKS_STARTTX = 1;
+  uarteSending = true;
+}
+
+extern "C" void SWI3_EGU3_IRQHandler(void)
+{
+  PumpUarte();
+}
+
+/**
+ * @brief PumpUarte from the loop task, which the interrupt mustn't run into with a transfer half started
+ */
+static void PumpUarteFromTask()
+{
+  taskENTER_CRITICAL();
+  PumpUarte();
+  taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief Lets a TX_BLOCK write wait for room without holding up other tasks
+ */
+static void WaitUarte()
+{
+  PumpUarteFromTask();
+  yield();
+}
+
+/**
+ * @brief Sends packets on Serial1 from a queue, by EasyDMA, so a write never waits for the UART
+ *
+ * Serial1 still sets up the pins and baud rate and receives commands; only
+ * transmitting is taken over.
+ */
+void TransportBeginQueued(unsigned long baud, TxPolicy policy)
+{
+  Serial1.begin(baud, SERIAL_8N1);
+  LINK_UARTE->INTENCLR = UARTE_INTENCLR_ENDTX_Msk;
+  NRF_PPI->CH[LINK_DONE_PPI].EEP = (uint32_t)&LINK_UARTE->EVENTS_ENDTX;
+  NRF_PPI->CH[LINK_DONE_PPI].TEP = (uint32_t)&LINK_DONE_EGU->TASKS_TRIGGER[0];
+  NRF_PPI->CHENSET = 1u << LINK_DONE_PPI;
+  TxQueueCreate(&txQueue, policy, WaitUarte);
+  LINK_DONE_EGU->EVENTS_TRIGGERED[0] = 0;
+  LINK_DONE_EGU->INTENSET = EGU_INTENSET_TRIGGERED0_Msk;
+  NVIC_SetPriority(LINK_DONE_IRQn, LINK_DONE_IRQ_PRIORITY);
+  NVIC_ClearPendingIRQ(LINK_DONE_IRQn);
+  NVIC_EnableIRQ(LINK_DONE_IRQn);
+  queuedTransport = true;
+}
+
+void TransportSetTxPolicy(TxPolicy policy)
+{
+  txQueue.policy.store(policy);
+}
+
+const TxQueue *TransportTxQueue()
+{
+  return queuedTransport ? &txQueue : nullptr;
+}
+
+/**
+ * @brief Gives the CDC port what fits in its TX FIFO, so Serial.write() never waits for the host
+ */
+static size_t UsbSinkWrite(const uint8_t *buf, size_t len)
+{
+  int room = Serial.availableForWrite();
+  if (room <= 0)
+  {
+    return 0;
+  }
+  return Serial.write(buf, len < (size_t)room ? len : (size_t)room);
+}
+
+static void UsbSinkFlush()
+{
+  // TinyUSB sends a transfer by itself once it has a full one, short ones need a push
+  Serial.flush();
+}
+
+/**
+ * @brief Sends packets over the USB CDC port, aggregated into full bulk transfers
+ *
+ * The baud rate means nothing over USB; the port runs as fast as the host reads it.
+ */
+void TransportBeginUsb(uint32_t flushMicros)
+{
+  usbTransport = true;
+  Serial.begin(115200);
+  AggregatorCreate(&usbLink, flushMicros, UsbSinkWrite, UsbSinkFlush);
+}
+
+size_t TransportWrite(const uint8_t *buf, size_t len)
+{
+  if (usbTransport)
+  {
+    return AggregatorWrite(&usbLink, buf, len, PlatformMicros());
+  }
+  if (queuedTransport)
+  {
+    size_t queued = TxQueueWrite(&txQueue, buf, len);
+    PumpUarteFromTask();
+    return queued;
+  }
+  return Serial1.write(buf, len);
+}
+
+void TransportPoll(uint32_t idleMicros)
+{
+  if (usbTransport)
+  {
+    AggregatorPoll(&usbLink, PlatformMicros(), idleMicros);
+  }
+  if (queuedTransport)
+  {
+    // normally the interrupt has already done it
+    PumpUarteFromTask();
+  }
+}
+
+bool TransportBackPressured()
+{
+  return (usbTransport && usbLink.backPressured) || (queuedTransport && TxQueueBackPressured(&txQueue));
+}
+
+const LinkAggregator *TransportUsbLink()
+{
+  return usbTransport ? &usbLink : nullptr;
+}
+
+void TransportPrint(const char *text)
+{
+  if (usbTransport || queuedTransport)
+  {
+    TransportWrite((const uint8_t *)text, strlen(text));
+    return;
+  }
+  Serial1.print(text);
+}
+
+void TransportPrintln(const char *text)
+{
+  if (usbTransport || queuedTransport)
+  {
+    TransportPrint(text);
+    TransportWrite((const uint8_t *)"\r\n", 2);
+    return;
+  }
+  Serial1.println(text);
+}
+
+int TransportAvailable()
+{
+  return usbTransport ? Serial.available() : Serial1.available();
+}
+
+int TransportRead()
+{
+  return usbTransport ? Serial.read() : Serial1.read();
+}
+
+bool StorageBegin(uint8_t csPin)
+{
+  pinMode(csPin, OUTPUT); // SD card select
+  return sd.begin(csPin);
+}
+
+bool StorageOpen(const char *name, SourceFile &file)
+{
+  return file.open(name, O_RDONLY);
+}
+
+bool StorageCreate(const char *name, SourceFile &file)
+{
+  return file.open(name, O_RDWR | O_CREAT | O_TRUNC);
+}
+
+/* a Print that writes through TransportWrite, so what's printed waits its turn behind queued packets */
+class TransportPrinter : public Print
+{
+public:
+  size_t write(uint8_t c) override
+  {
+    return TransportWrite(&c, 1);
+  }
+
+  size_t write(const uint8_t *buf, size_t len) override
+  {
+    return TransportWrite(buf, len);
+  }
+};
+
+void StorageDumpInfo()
+{
+  TransportPrinter out;
+  out.print("Clusters:          ");
+  out.println(sd.clusterCount());
+  out.print("Blocks x Cluster:  ");
+  out.println(sd.blocksPerCluster());
+  out.print("Total Blocks:      ");
+  out.println(sd.blocksPerCluster() * sd.clusterCount());
+  out.println();
+  // print the type and size of the first FAT-type volume
+  uint32_t volumesize;
+  out.print("Volume type is:    FAT");
+  out.println(sd.fatType(), DEC);
+  volumesize = sd.blocksPerCluster(); // clusters are collections of blocks
+  volumesize *= sd.clusterCount();    // we'll have a lot of clusters
+  volumesize /= 2;                    // SD card blocks are always 512 bytes (2 blocks are 1KB)
+  out.print("Volume size (Kb):  ");
+  out.println(volumesize);
+  out.print("Volume size (Mb):  ");
+  volumesize /= 1024;
+  out.println(volumesize);
+  out.print("Volume size (Gb):  ");
+  out.println((float)volumesize / 1024.0);
+
+  out.println("\nFiles found on the card (name, date and size in bytes): ");
+  sd.ls(&out, LS_R | LS_DATE | LS_SIZE);
+  out.println(" ");
+}
+
+#endif // ARDUINO
@@ -0,0 +1,691 @@
+/**
+ * @file platform_host.cpp
+ * @brief Native (Linux) backend: clock_gettime(), an fd for the link and
+ *        plain or mmap'ed files for the SD card
+ */
+#ifndef ARDUINO
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "platform.h"
+#include "LinkAggregator.h"
+
+HostOptions hostOptions;
+
+static int outFd = -1;
+static bool ownsOutFd = false;
+static uint8_t *captureBuf = nullptr; // if set, TransportWrite appends here instead
+static size_t captureCapacity = 0;
+static size_t *captureLength = nullptr;
+static bool usbTransport = false; // writes go through usbLink, as over the Feather's USB port
+static LinkAggregator usbLink;
+static bool queuedTransport = false; // writes go through txQueue, sent by txWriter
+static TxQueue txQueue;
+static std::thread txWriter;
+static int txWakeFd = -1; // eventfd the producer bumps after each write
+static std::atomic<bool> txStopping(false);
+
+static uint64_t MonotonicNanos()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const uint64_t startNanos = MonotonicNanos();
+
+uint32_t PlatformMicros()
+{
+  // truncated to 32 bits so it wraps exactly like the Feather's timer does
+  return (uint32_t)((MonotonicNanos() - startNanos) / 1000) + hostOptions.clockOffsetMicros;
+}
+
+/**
+ * @brief Sleeps until PlatformMicros() reaches deadlineMicros, on an absolute
+ *        CLOCK_MONOTONIC deadline so a late wakeup doesn't push later ones back
+ */
+void PlatformSleepUntil(uint32_t deadlineMicros)
+{
+  if (hostOptions.freeRunning)
+  {
+    // no waiting as fast as possible, but a refill thread still gets the CPU
+    sched_yield();
+    return;
+  }
+  uint64_t elapsedMicros = (MonotonicNanos() - startNanos) / 1000;
+  int32_t waitMicros = (int32_t)(deadlineMicros - ((uint32_t)elapsedMicros + hostOptions.clockOffsetMicros));
+  if (waitMicros <= 0)
+  {
+    return;
+  }
+  uint64_t wakeNanos = startNanos + (elapsedMicros + waitMicros) * 1000;
+  struct timespec ts;
+  ts.tv_sec = wakeNanos / 1000000000ULL;
+  ts.tv_nsec = wakeNanos % 1000000000ULL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+  {
+  }
+}
+
+uint32_t PlatformCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return (uint32_t)__rdtsc();
+#else
+  // no portable cycle counter, nanoseconds will have to do
+  return (uint32_t)MonotonicNanos();
+#endif
+}
+
+void PlatformDelayMillis(uint32_t ms)
+{
+  if (hostOptions.freeRunning)
+  {
+    return;
+  }
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+  {
+  }
+}
+
+bool PlatformFreeRunning()
+{
+  return hostOptions.freeRunning;
+}
+
+void DebugPinMode(uint32_t pinNum)
+{
+  (void)pinNum;
+}
+
+void DebugPinWrite(uint32_t pinNum, bool high)
+{
+  (void)pinNum;
+  (void)high;
+}
+
+bool DebugPinRead(uint32_t pinNum)
+{
+  (void)pinNum;
+  return false;
+}
+
+void DebugBegin()
+{
+}
+
+void DebugPrintln(const char *text)
+{
+  fprintf(stderr, "%s\n", text);
+}
+
+int DebugRead()
+{
+  // nothing to type into; the host dumps at exit and every --stats-every seconds instead
+  return -1;
+}
+
+/**
+ * @brief Opens whatever hostOptions says should stand in for Serial1
+ *
+ * @return true if there's somewhere to write packets to
+ */
+bool TransportOpenHost()
+{
+  if (hostOptions.usePty)
+  {
+    outFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (outFd < 0 || grantpt(outFd) != 0 || unlockpt(outFd) != 0)
+    {
+      perror("posix_openpt");
+      return false;
+    }
+    // raw mode so packet bytes aren't translated by the line discipline
+    struct termios tio;
+    tcgetattr(outFd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(outFd, TCSANOW, &tio);
+    fprintf(stderr, "packets on %s\n", ptsname(outFd));
+    ownsOutFd = true;
+  }
+  else if (strcmp(hostOptions.outPath, "-") == 0)
+  {
+    outFd = STDOUT_FILENO;
+  }
+  else
+  {
+    outFd = ::open(hostOptions.outPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outFd < 0)
+    {
+      perror(hostOptions.outPath);
+      return false;
+    }
+    ownsOutFd = true;
+  }
+  return true;
+}
+
+void TransportCloseHost()
+{
+  if (queuedTransport && txWriter.joinable())
+  {
+    // the writer sends what's queued before it stops
+    txStopping.store(true);
+    uint64_t one = 1;
+    (void)!::write(txWakeFd, &one, sizeof(one));
+    txWriter.join();
+    ::close(txWakeFd);
+  }
+  if (usbTransport && outFd >= 0)
+  {
+    // a last go at what's still held; a pty nobody reads keeps the rest
+    AggregatorPoll(&usbLink, PlatformMicros(), usbLink.flushMicros);
+  }
+  if (ownsOutFd && outFd >= 0)
+  {
+    ::close(outFd);
+  }
+  outFd = -1;
+  ownsOutFd = false;
+}
+
+/**
+ * @brief Diverts everything written to the transport into memory
+ *
+ * Bytes that don't fit in capacity are dropped. Pass a null buf to go back
+ * to writing to the real output.
+ */
+void TransportCaptureHost(uint8_t *buf, size_t capacity, size_t *length)
+{
+  captureBuf = buf;
+  captureCapacity = capacity;
+  captureLength = length;
+  if (length)
+  {
+    *length = 0;
+  }
+}
+
+void TransportBegin(unsigned long baud)
+{
+  (void)baud;
+}
+
+/**
+ * @brief Writes to the link fd, returning early instead of waiting if it's non-blocking and full
+ */
+static size_t WriteFd(const uint8_t *buf, size_t len)
+{
+  size_t written = 0;
+  while (written < len)
+  {
+    ssize_t n = ::write(outFd, buf + written, len - written);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      break;
+    }
+    written += n;
+  }
+  return written;
+}
+
+static void FlushFd()
+{
+  // nothing held back below write()
+}
+
+/**
+ * @brief Stand-in for the Feather's EasyDMA: sends what's queued on the link fd
+ *
+ * Sleeps in poll() until there's something queued, or, on a pty whose
+ * reader has fallen behind, until the pty has room. Once stopping, it
+ * gives a pty nobody reads 100 ms to take the rest.
+ */
+static void TxWriterThread()
+{
+  const uint8_t *bytes = nullptr;
+  size_t claimed = 0;
+  size_t sent = 0;
+  for (;;)
+  {
+    if (claimed == 0)
+    {
+      claimed = TxQueueClaim(&txQueue, &bytes);
+      sent = 0;
+    }
+    if (claimed > 0)
+    {
+      sent += WriteFd(bytes + sent, claimed - sent);
+      if (sent == claimed)
+      {
+        TxQueueRelease(&txQueue);
+        claimed = 0;
+        continue;
+      }
+    }
+    else if (txStopping.load())
+    {
+      return;
+    }
+    struct pollfd fds[2] = {{txWakeFd, POLLIN, 0}, {outFd, POLLOUT, 0}};
+    int ready = poll(fds, claimed > 0 ? 2 : 1, txStopping.load() ? 100 : -1);
+    if (ready == 0)
+    {
+      return;
+    }
+    if (fds[0].revents & POLLIN)
+    {
+      uint64_t count;
+      (void)!::read(txWakeFd, &count, sizeof(count));
+    }
+  }
+}
+
+static void WaitWriter()
+{
+  sched_yield();
+}
+
+/**
+ * @brief Stand-in for the Feather's queued Serial1: the same queue, drained by a writer thread
+ *
+ * A pty is made non-blocking, so a reader that stops reading fills the
+ * queue and its policy decides what's dropped, as a slow UART would.
+ */
+void TransportBeginQueued(unsigned long baud, TxPolicy policy)
+{
+  (void)baud;
+  txWakeFd = eventfd(0, EFD_NONBLOCK);
+  if (txWakeFd < 0)
+  {
+    perror("eventfd");
+    return;
+  }
+  TxQueueCreate(&txQueue, policy, WaitWriter);
+  if (hostOptions.usePty)
+  {
+    fcntl(outFd, F_SETFL, fcntl(outFd, F_GETFL) | O_NONBLOCK);
+  }
+  txStopping.store(false);
+  txWriter = std::thread(TxWriterThread);
+  queuedTransport = true;
+}
+
+void TransportSetTxPolicy(TxPolicy policy)
+{
+  txQueue.policy.store(policy);
+}
+
+const TxQueue *TransportTxQueue()
+{
+  return queuedTransport ? &txQueue : nullptr;
+}
+
+/**
+ * @brief Stand-in for the Feather's USB transport: the same aggregation in front of the link fd
+ *
+ * A pty is made non-blocking, so a reader that stops reading fills the
+ * pty's buffer and back-pressures the aggregator as a USB host would.
+ */
+void TransportBeginUsb(uint32_t flushMicros)
+{
+  usbTransport = true;
+  AggregatorCreate(&usbLink, flushMicros, WriteFd, FlushFd);
+  if (hostOptions.usePty)
+  {
+    fcntl(outFd, F_SETFL, fcntl(outFd, F_GETFL) | O_NONBLOCK);
+  }
+}
+
+size_t TransportWrite(const uint8_t *buf, size_t len)
+{
+  if (captureBuf)
+  {
+    size_t room = captureCapacity - *captureLength;
+    size_t n = len < room ? len : room;
+    memcpy(captureBuf + *captureLength, buf, n);
+    *captureLength += n;
+    return n;
+  }
+  if (usbTransport)
+  {
+    return AggregatorWrite(&usbLink, buf, len, PlatformMicros());
+  }
+  if (queuedTransport)
+  {
+    size_t queued = TxQueueWrite(&txQueue, buf, len);
+    uint64_t one = 1;
+    (void)!::write(txWakeFd, &one, sizeof(one));
+    return queued;
+  }
+  return WriteFd(buf, len);
+}
+
+void TransportPoll(uint32_t idleMicros)
+{
+  if (usbTransport)
+  {
+    AggregatorPoll(&usbLink, PlatformMicros(), idleMicros);
+  }
+}
+
+bool TransportBackPressured()
+{
+  return (usbTransport && usbLink.backPressured) || (queuedTransport && TxQueueBackPressured(&txQueue));
+}
+
+const LinkAggregator *TransportUsbLink()
+{
+  return usbTransport ? &usbLink : nullptr;
+}
+
+void TransportPrint(const char *text)
+{
+  TransportWrite((const uint8_t *)text, strlen(text));
+}
+
+void TransportPrintln(const char *text)
+{
+  TransportPrint(text);
+  TransportWrite((const uint8_t *)"\r\n", 2);
+}
+
+int TransportAvailable()
+{
+  // only a pty has anything coming back the other way
+  int pending = 0;
+  if (!hostOptions.usePty || ioctl(outFd, FIONREAD, &pending) != 0)
+  {
+    return 0;
+  }
+  return pending;
+}
+
+int TransportRead()
+{
+  uint8_t c;
+  if (TransportAvailable() <= 0 || ::read(outFd, &c, 1) != 1)
+  {
+    return -1;
+  }
+  return c;
+}
+
+bool StorageBegin(uint8_t csPin)
+{
+  (void)csPin;
+  struct stat st;
+  return stat(hostOptions.sdRoot, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool StorageOpen(const char *name, SourceFile &file)
+{
+  if (hostOptions.sourceStream && strcmp(name, "output.edf") == 0)
+  {
+    return file.openStream(hostOptions.sourceStream);
+  }
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", hostOptions.sdRoot, name);
+  return file.open(path, hostOptions.useMmap);
+}
+
+bool StorageCreate(const char *name, SourceFile &file)
+{
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", hostOptions.sdRoot, name);
+  return file.create(path);
+}
+
+void StorageDumpInfo()
+{
+  fprintf(stderr, "SD card root: %s\n", hostOptions.sdRoot);
+}
+
+bool SourceFile::open(const char *path, bool useMmap)
+{
+  close();
+  fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    close();
+    return false;
+  }
+  size = st.st_size;
+  position = 0;
+  if (useMmap && size > 0)
+  {
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+      close();
+      return false;
+    }
+    map = (uint8_t *)mapped;
+    madvise(map, size, MADV_SEQUENTIAL);
+  }
+  return true;
+}
+
+/**
+ * @brief Opens stdin, or connects to a listening Unix socket, to read an EDF file from as it's produced
+ *
+ * Nothing has to be on disk, or even written yet: a recorder or a
+ * decompressor (zstd -dc) can be at the other end.
+ */
+bool SourceFile::openStream(const char *path)
+{
+  close();
+  if (strcmp(path, "-") == 0)
+  {
+    fd = dup(STDIN_FILENO);
+  }
+  else
+  {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+      return false;
+    }
+    strcpy(addr.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+      close();
+      return false;
+    }
+  }
+  stream = fd >= 0;
+  return stream;
+}
+
+int SourceFile::read(void *buf, size_t count)
+{
+  if (fd < 0)
+  {
+    return -1;
+  }
+  if (stream)
+  {
+    // a pipe gives what the writer has written so far, keep reading until count or the end
+    size_t got = 0;
+    while (got < count)
+    {
+      ssize_t n = ::read(fd, (uint8_t *)buf + got, count - got);
+      if (n < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (n < 0)
+      {
+        return got > 0 ? (int)got : -1;
+      }
+      if (n == 0)
+      {
+        break;
+      }
+      got += n;
+    }
+    position += got;
+    return (int)got;
+  }
+  if (position >= size)
+  {
+    return 0;
+  }
+  if (count > size - position)
+  {
+    count = size - position;
+  }
+  if (map)
+  {
+    memcpy(buf, map + position, count);
+    position += count;
+    return (int)count;
+  }
+  ssize_t n = pread(fd, buf, count, position);
+  if (n < 0)
+  {
+    return -1;
+  }
+  position += n;
+  return (int)n;
+}
+
+bool SourceFile::create(const char *path)
+{
+  close();
+  fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  return fd >= 0;
+}
+
+int SourceFile::write(const void *buf, size_t count)
+{
+  if (fd < 0 || map)
+  {
+    return -1;
+  }
+  ssize_t n = pwrite(fd, buf, count, position);
+  if (n < 0)
+  {
+    return -1;
+  }
+  position += n;
+  size = position > size ? position : size;
+  return (int)n;
+}
+
+/**
+ * @brief The file's modification time packed as FAT stores it, as SdFat's FatFile gives it
+ */
+bool SourceFile::getModifyDateTime(uint16_t *date, uint16_t *time)
+{
+  struct stat st;
+  struct tm local;
+  if (fd < 0 || fstat(fd, &st) != 0 || localtime_r(&st.st_mtime, &local) == nullptr)
+  {
+    return false;
+  }
+  *date = (uint16_t)((local.tm_year - 80) << 9 | (local.tm_mon + 1) << 5 | local.tm_mday);
+  *time = (uint16_t)(local.tm_hour << 11 | local.tm_min << 5 | local.tm_sec / 2);
+  return true;
+}
+
+bool SourceFile::seekCur(int32_t offset)
+{
+  if (stream)
+  {
+    // not through seekSet, a stream can go on past 4 GB
+    return offset >= 0 && discard((uint64_t)offset);
+  }
+  return seekSet((uint32_t)(position + offset));
+}
+
+/**
+ * @brief Moves a stream on by reading and dropping bytes
+ *
+ * @return false if it ended first
+ */
+bool SourceFile::discard(uint64_t count)
+{
+  uint8_t scratch[4096];
+  while (count > 0)
+  {
+    size_t chunk = count < sizeof(scratch) ? (size_t)count : sizeof(scratch);
+    if (read(scratch, chunk) != (int)chunk)
+    {
+      return false;
+    }
+    count -= chunk;
+  }
+  return true;
+}
+
+/**
+ * @brief Moves to pos; a stream can only go forward, or stay where it is
+ */
+bool SourceFile::seekSet(uint32_t pos)
+{
+  if (stream)
+  {
+    return pos >= position && discard(pos - position);
+  }
+  if (fd < 0 || pos > size)
+  {
+    return false;
+  }
+  position = pos;
+  return true;
+}
+
+bool SourceFile::close()
+{
+  if (map)
+  {
+    munmap(map, size);
+    map = nullptr;
+  }
+  if (fd >= 0)
+  {
+    ::close(fd);
+    fd = -1;
+  }
+  size = 0;
+  position = 0;
+  stream = false;
+  return true;
+}
+
+#endif // !ARDUINO
@@ -0,0 +1,105 @@
+/**
+ * @file sim_harness.h
+ * @brief Runs the simulator from a test, in a forked child, and reads back what it sent
+ *
+ * Shared by the suites that play files end to end. The simulator is linked
+ * into each test (test_build_src = yes) with its main() left out, and run
+ * through SimulatorMain in a child process with the command line a user
+ * would give it, so every run starts from fresh globals.
+ */
+#pragma once
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <sys/wait.h>
+
+int SimulatorMain(int argc, char **argv);
+
+static inline double MonotonicSecs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Runs the simulator with args in a forked child, its stdin, stdout and stderr on the fds given
+ *
+ * Doesn't return in the child.
+ */
+static inline pid_t ForkSimulator(const std::vector<const char *> &args, int inFd, int outFd, int errFd)
+{
+  // nothing buffered before the fork may come out twice
+  fflush(nullptr);
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    dup2(inFd, STDIN_FILENO);
+    dup2(outFd, STDOUT_FILENO);
+    dup2(errFd, STDERR_FILENO);
+    std::vector<char *> argv;
+    argv.push_back((char *)"volkseeg-sim");
+    for (const char *arg : args)
+    {
+      argv.push_back((char *)arg);
+    }
+    argv.push_back(nullptr);
+    int status = SimulatorMain((int)argv.size() - 1, argv.data());
+    fflush(nullptr);
+    _exit(status);
+  }
+  return pid;
+}
+
+/**
+ * @brief Runs the simulator with args to the end, stdout to /dev/null
+ *
+ * @param logPath its stderr, nullptr for /dev/null
+ * @param inputPath read on its stdin, nullptr for /dev/null
+ * @return its exit status, -1 if it couldn't be run
+ */
+static inline int RunSimulator(const std::vector<const char *> &args, const char *logPath = nullptr,
+                               const char *inputPath = nullptr)
+{
+  int nullFd = ::open("/dev/null", O_RDWR);
+  int logFd = logPath ? ::open(logPath, O_WRONLY | O_CREAT | O_TRUNC, 0644) : nullFd;
+  int inFd = inputPath ? ::open(inputPath, O_RDONLY) : nullFd;
+  pid_t pid = ForkSimulator(args, inFd, nullFd, logFd);
+  if (inFd != nullFd)
+  {
+    close(inFd);
+  }
+  if (logFd != nullFd)
+  {
+    close(logFd);
+  }
+  close(nullFd);
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) != pid)
+  {
+    return -1;
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/**
+ * @brief Reads a whole capture file
+ */
+static inline bool ReadCapture(const char *path, std::vector<uint8_t> *capture)
+{
+  FILE *in = fopen(path, "rb");
+  if (in == nullptr)
+  {
+    return false;
+  }
+  fseek(in, 0, SEEK_END);
+  capture->resize(ftell(in));
+  fseek(in, 0, SEEK_SET);
+  bool read = fread(capture->data(), 1, capture->size(), in) == capture->size();
+  fclose(in);
+  return read;
+}
@@ -0,0 +1,379 @@
+/**
+ * @file test_main.cpp
+ * @brief Benchmarks that guard the packet path, compared with a baseline, pio test -e native
+ *
+ * Header parse, ring refill per record of test_edf/output.edf, 16 and 24-bit
+ * calibration and the simple packet and 64-channel frame serializers are
+ * each run SUITE_ROUNDS times, interleaved, and the median time of each is
+ * reported with its change against the committed baseline.txt. Those
+ * numbers belong to the reference machine its first line names, and on
+ * any other, or a shared or throttled one, they can move a long way on
+ * their own, so they never fail a test.
+ *
+ * A baseline taken on this host is what fails one. It's stored, untracked,
+ * in baseline.local.txt:
+ *
+ *     pio test -e native -f test_bench_suite -a --save
+ *
+ * and from then on a median more than SUITE_REGRESSION_PERCENT slower than
+ * it there gets up to SUITE_RETRIES fresh sets of rounds, in case something
+ * else had the CPU, and fails its test if it stays that slow. After a
+ * change that moves the numbers, store new reference ones with
+ * -a --save-reference on the reference machine and commit them with it.
+ */
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <unity.h>
+#include "platform.h"
+#include "Calibration.h"
+#include "host_bench.h"
+
+#define SUITE_SD_ROOT "test_edf" //the card whose output.edf the refill benchmark reads; pio test runs tests from the project directory
+#define SUITE_BASELINE_PATH "test/test_bench_suite/baseline.txt" //the reference machine's, committed, only reported against
+#define SUITE_LOCAL_BASELINE_PATH "test/test_bench_suite/baseline.local.txt" //this host's, from -a --save, untracked
+#define SUITE_ROUNDS 9 //runs of each benchmark, the median kept
+#define SUITE_REGRESSION_PERCENT 50 //slower than this host's baseline by more than this is a regression
+#define SUITE_RETRIES 2 //more sets of SUITE_ROUNDS a result that looks like a regression gets
+#define SUITE_MAX_RESULTS 16
+
+void setup();
+extern bool sourceReady;
+extern bool usePlaybackDescriptor;
+
+struct SuiteResult
+{
+  const char *name;
+  const char *unit;
+  double value; // median time, lower is better
+};
+
+static SuiteResult results[] = {
+  {"header_parse_640", "ms", 0},
+  {"refill_record", "us/record", 0},
+  {"calibrate16_fixed", "cycles/sample", 0},
+  {"calibrate16_float", "cycles/sample", 0},
+  {"calibrate24_fixed", "cycles/sample", 0},
+  {"calibrate24_float", "cycles/sample", 0},
+  {"simple_packet16", "ns/packet", 0},
+  {"simple_packet24", "ns/packet", 0},
+  {"frame64_16", "ns/row", 0},
+  {"frame64_24", "ns/row", 0},
+};
+
+/* a baseline file's results, and the host it was stored on if it says */
+struct Baseline
+{
+  char host[64];
+  char names[SUITE_MAX_RESULTS][40];
+  double values[SUITE_MAX_RESULTS];
+  int count;
+};
+
+// each result's times from its latest set of rounds
+static double samples[SUITE_MAX_RESULTS][SUITE_ROUNDS];
+static int numSamples[SUITE_MAX_RESULTS];
+
+static Baseline reference, local;
+static char hostName[64] = "unknown";
+static bool gated; // local is this host's, so a regression fails
+
+static CalibrationQ cal16, cal24;
+
+/**
+ * @brief Runs results[index]'s benchmark once and keeps the time as one of its samples
+ */
+static void RunOne(int index)
+{
+  float cycles[2];
+  double value;
+  switch (index)
+  {
+  case 0:
+    value = TimeHeaderParse();
+    break;
+  case 1:
+    value = TimeRefillRecord();
+    break;
+  case 2:
+  case 3:
+    BenchCalibration(&cal16, &cycles[0], &cycles[1]);
+    value = cycles[index - 2];
+    break;
+  case 4:
+  case 5:
+    BenchCalibration(&cal24, &cycles[0], &cycles[1]);
+    value = cycles[index - 4];
+    break;
+  case 6:
+    value = TimeSerializer(16, 0);
+    break;
+  case 7:
+    value = TimeSerializer(24, 0);
+    break;
+  case 8:
+    value = TimeSerializer(16, 16);
+    break;
+  default:
+    value = TimeSerializer(24, 24);
+    break;
+  }
+  samples[index][numSamples[index]++] = value;
+  if (numSamples[index] == SUITE_ROUNDS)
+  {
+    std::sort(samples[index], samples[index] + SUITE_ROUNDS);
+    results[index].value = samples[index][SUITE_ROUNDS / 2];
+    numSamples[index] = 0;
+  }
+}
+
+/**
+ * @brief Runs every benchmark SUITE_ROUNDS times, interleaved so a slow spell doesn't hit just one
+ */
+static void RunSuite()
+{
+  const int numResults = sizeof(results) / sizeof(results[0]);
+  for (int round = 0; round < SUITE_ROUNDS; round++)
+  {
+    for (int index = 0; index < numResults; index++)
+    {
+      RunOne(index);
+    }
+  }
+}
+
+/**
+ * @brief Reads a baseline, one "name time unit" line each, # for comments
+ *
+ * @return false if there's no such file
+ */
+static bool LoadBaseline(const char *path, Baseline *baseline)
+{
+  FILE *in = fopen(path, "r");
+  if (in == nullptr)
+  {
+    return false;
+  }
+  char line[160];
+  while (baseline->count < SUITE_MAX_RESULTS && fgets(line, sizeof(line), in) != nullptr)
+  {
+    if (line[0] == '#')
+    {
+      sscanf(line, "# host: %63s", baseline->host);
+    }
+    else if (sscanf(line, "%39s %lf", baseline->names[baseline->count], &baseline->values[baseline->count]) == 2)
+    {
+      baseline->count++;
+    }
+  }
+  fclose(in);
+  return true;
+}
+
+/**
+ * @brief Stores the results as a baseline: the reference machine's, or this host's
+ */
+static bool SaveBaseline(const char *path, bool isReference)
+{
+  FILE *out = fopen(path, "w");
+  if (out == nullptr)
+  {
+    perror(path);
+    return false;
+  }
+  char cpuName[64] = "unknown";
+  FILE *cpu = fopen("/proc/cpuinfo", "r");
+  char line[160];
+  while (cpu != nullptr && fgets(line, sizeof(line), cpu) != nullptr)
+  {
+    if (sscanf(line, "model name : %63[^\n]", cpuName) == 1)
+    {
+      break;
+    }
+  }
+  if (cpu != nullptr)
+  {
+    fclose(cpu);
+  }
+  if (isReference)
+  {
+    fprintf(out, "# reference machine: %s\n", cpuName);
+  }
+  else
+  {
+    fprintf(out, "# host: %s\n# cpu: %s\n", hostName, cpuName);
+  }
+  fprintf(out, "# median of %d: name time unit (lower is better)\n", SUITE_ROUNDS);
+  for (const SuiteResult &result : results)
+  {
+    fprintf(out, "%s %.3f %s\n", result.name, result.value, result.unit);
+  }
+  return fclose(out) == 0;
+}
+
+/**
+ * @brief Percent change of a result against its time in a baseline
+ *
+ * @return false if the baseline hasn't got it
+ */
+static bool ChangeFrom(const Baseline *baseline, const SuiteResult &result, double *stored, double *change)
+{
+  for (int i = 0; i < baseline->count; i++)
+  {
+    if (strcmp(baseline->names[i], result.name) == 0)
+    {
+      *stored = baseline->values[i];
+      *change = (result.value / *stored - 1) * 100;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Reports a result against the reference baseline, and fails if it's a regression against this host's
+ */
+static void CheckResult(int index)
+{
+  const SuiteResult &result = results[index];
+  char line[200];
+  double stored, change;
+  bool compared = gated && ChangeFrom(&local, result, &stored, &change);
+  for (int retry = 0; compared && retry < SUITE_RETRIES && change > SUITE_REGRESSION_PERCENT; retry++)
+  {
+    for (int round = 0; round < SUITE_ROUNDS; round++)
+    {
+      RunOne(index);
+    }
+    ChangeFrom(&local, result, &stored, &change);
+  }
+  int length = snprintf(line, sizeof(line), "%s %.3f %s", result.name, result.value, result.unit);
+  if (compared)
+  {
+    length += snprintf(line + length, sizeof(line) - length, ", this host %.3f, %+.1f%%", stored, change);
+  }
+  double referenceValue, referenceChange;
+  if (ChangeFrom(&reference, result, &referenceValue, &referenceChange))
+  {
+    snprintf(line + length, sizeof(line) - length, ", reference %.3f, %+.1f%%", referenceValue, referenceChange);
+  }
+  else
+  {
+    snprintf(line + length, sizeof(line) - length, ", not in the reference baseline");
+  }
+  TEST_MESSAGE(line);
+  if (compared)
+  {
+    TEST_ASSERT_TRUE_MESSAGE(change <= SUITE_REGRESSION_PERCENT, "slower than this host's baseline");
+  }
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_header_parse()
+{
+  CheckResult(0);
+}
+
+void test_refill_record()
+{
+  CheckResult(1);
+}
+
+void test_calibrate16_fixed()
+{
+  CheckResult(2);
+}
+
+void test_calibrate16_float()
+{
+  CheckResult(3);
+}
+
+void test_calibrate24_fixed()
+{
+  CheckResult(4);
+}
+
+void test_calibrate24_float()
+{
+  CheckResult(5);
+}
+
+void test_simple_packet16()
+{
+  CheckResult(6);
+}
+
+void test_simple_packet24()
+{
+  CheckResult(7);
+}
+
+void test_frame64_16()
+{
+  CheckResult(8);
+}
+
+void test_frame64_24()
+{
+  CheckResult(9);
+}
+
+int main(int argc, char **argv)
+{
+  bool save = argc > 1 && strcmp(argv[1], "--save") == 0;
+  bool saveReference = argc > 1 && strcmp(argv[1], "--save-reference") == 0;
+  gethostname(hostName, sizeof(hostName) - 1);
+  hostOptions.sdRoot = SUITE_SD_ROOT;
+  hostOptions.outPath = "/dev/null";
+  hostOptions.freeRunning = true;
+  // parse the header every time rather than leave a descriptor on the card
+  usePlaybackDescriptor = false;
+  if (!TransportOpenHost())
+  {
+    return 1;
+  }
+  setup();
+  if (!sourceReady)
+  {
+    fprintf(stderr, "no output.edf under %s\n", SUITE_SD_ROOT);
+    return 1;
+  }
+  CalibrationPrepare(&cal16, 0.1f, 0, 16);
+  CalibrationPrepare(&cal24, 0.03125f, 0, 24);
+  RunSuite();
+  if (save || saveReference)
+  {
+    TransportCloseHost();
+    return SaveBaseline(save ? SUITE_LOCAL_BASELINE_PATH : SUITE_BASELINE_PATH, saveReference) ? 0 : 1;
+  }
+  LoadBaseline(SUITE_BASELINE_PATH, &reference);
+  gated = LoadBaseline(SUITE_LOCAL_BASELINE_PATH, &local) && strcmp(local.host, hostName) == 0;
+  if (!gated)
+  {
+    fprintf(stderr, "no %s from this host, results are only reported; store one with -a --save\n",
+            SUITE_LOCAL_BASELINE_PATH);
+  }
+  UNITY_BEGIN();
+  RUN_TEST(test_header_parse);
+  RUN_TEST(test_refill_record);
+  RUN_TEST(test_calibrate16_fixed);
+  RUN_TEST(test_calibrate16_float);
+  RUN_TEST(test_calibrate24_fixed);
+  RUN_TEST(test_calibrate24_float);
+  RUN_TEST(test_simple_packet16);
+  RUN_TEST(test_simple_packet24);
+  RUN_TEST(test_frame64_16);
+  RUN_TEST(test_frame64_24);
+  // regressions are run again, so the source stays open until here
+  TransportCloseHost();
+  return UNITY_END();
+}
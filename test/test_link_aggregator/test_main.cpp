@@ -0,0 +1,236 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of LinkAggregator's transfers, flush deadline and back-pressure, pio test -e native
+ *
+ * The sink is a fake that keeps every byte it takes and takes no more than
+ * sinkRoom at a time, so a test can play a host that reads everything, one
+ * that stops reading and one that takes a few bytes now and then. Packets
+ * written carry their sequence number, so what reaches the sink shows
+ * whether any was split, reordered or lost other than by a dropped write.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <unity.h>
+#include "LinkAggregator.h"
+
+#define AGG_PACKET_BYTES 20 //a simple packet
+#define AGG_FLUSH_MICROS 2000
+
+static std::vector<uint8_t> sunk; // every byte the sink took, in order
+static std::vector<size_t> sinkWrites; // bytes taken by each sink write
+static size_t sinkRoom; // most bytes the sink takes in one write
+static int sinkFlushes;
+static LinkAggregator agg;
+
+static size_t FakeSinkWrite(const uint8_t *buf, size_t len)
+{
+  size_t taken = len < sinkRoom ? len : sinkRoom;
+  sunk.insert(sunk.end(), buf, buf + taken);
+  if (taken > 0)
+  {
+    sinkWrites.push_back(taken);
+  }
+  return taken;
+}
+
+static void FakeSinkFlush()
+{
+  sinkFlushes++;
+}
+
+/**
+ * @brief Writes packet number seq: its number in the first 4 bytes, then bytes derived from it
+ */
+static size_t WritePacket(uint32_t seq, uint32_t nowMicros)
+{
+  uint8_t packet[AGG_PACKET_BYTES];
+  memcpy(packet, &seq, sizeof(seq));
+  for (int i = sizeof(seq); i < AGG_PACKET_BYTES; i++)
+  {
+    packet[i] = (uint8_t)(seq * 7 + i);
+  }
+  return AggregatorWrite(&agg, packet, sizeof(packet), nowMicros);
+}
+
+/**
+ * @brief Checks the sink got whole, intact packets in order, and returns their numbers
+ */
+static std::vector<uint32_t> SunkPackets()
+{
+  TEST_ASSERT_EQUAL_size_t_MESSAGE(0, sunk.size() % AGG_PACKET_BYTES, "a packet was split");
+  std::vector<uint32_t> seqs;
+  for (size_t pos = 0; pos < sunk.size(); pos += AGG_PACKET_BYTES)
+  {
+    uint32_t seq;
+    memcpy(&seq, &sunk[pos], sizeof(seq));
+    for (int i = sizeof(seq); i < AGG_PACKET_BYTES; i++)
+    {
+      TEST_ASSERT_EQUAL_UINT8_MESSAGE((uint8_t)(seq * 7 + i), sunk[pos + i], "a packet was corrupted");
+    }
+    TEST_ASSERT_TRUE_MESSAGE(seqs.empty() || seq > seqs.back(), "packets out of order");
+    seqs.push_back(seq);
+  }
+  return seqs;
+}
+
+void setUp()
+{
+  sunk.clear();
+  sinkWrites.clear();
+  sinkRoom = SIZE_MAX;
+  sinkFlushes = 0;
+  AggregatorCreate(&agg, AGG_FLUSH_MICROS, FakeSinkWrite, FakeSinkFlush);
+}
+
+void tearDown()
+{
+}
+
+void test_only_whole_transfers_before_the_deadline()
+{
+  // 16 packets are 5 transfers; every write that completes one hands it over at once
+  for (uint32_t seq = 0; seq < 16; seq++)
+  {
+    TEST_ASSERT_EQUAL_size_t(AGG_PACKET_BYTES, WritePacket(seq, seq * 10));
+    TEST_ASSERT_EQUAL_size_t((seq + 1) * AGG_PACKET_BYTES / LINK_TRANSFER_BYTES * LINK_TRANSFER_BYTES, sunk.size());
+    AggregatorPoll(&agg, seq * 10, 0);
+  }
+  for (size_t taken : sinkWrites)
+  {
+    TEST_ASSERT_EQUAL_size_t(0, taken % LINK_TRANSFER_BYTES);
+  }
+  TEST_ASSERT_EQUAL_size_t(16 * AGG_PACKET_BYTES % LINK_TRANSFER_BYTES, AggregatorPending(&agg));
+  TEST_ASSERT_EQUAL_INT(0, sinkFlushes);
+  TEST_ASSERT_EQUAL_UINT32(0, agg.shortFlushes);
+  TEST_ASSERT_FALSE(agg.backPressured);
+}
+
+void test_short_transfer_flushed_on_the_deadline()
+{
+  WritePacket(0, 1000);
+  // a later write doesn't move the deadline, it runs from the oldest byte held
+  WritePacket(1, 1500);
+  AggregatorPoll(&agg, 1000 + AGG_FLUSH_MICROS - 1, 0);
+  TEST_ASSERT_EQUAL_size_t(0, sunk.size());
+  AggregatorPoll(&agg, 1000 + AGG_FLUSH_MICROS, 0);
+  TEST_ASSERT_EQUAL_size_t(2 * AGG_PACKET_BYTES, sunk.size());
+  TEST_ASSERT_EQUAL_INT(1, sinkFlushes);
+  TEST_ASSERT_EQUAL_UINT32(1, agg.shortFlushes);
+  TEST_ASSERT_EQUAL_size_t(0, AggregatorPending(&agg));
+}
+
+void test_short_transfer_flushed_ahead_of_idle_time()
+{
+  WritePacket(0, 0);
+  // the caller is about to sleep past the deadline, so it goes now
+  AggregatorPoll(&agg, 100, AGG_FLUSH_MICROS - 101);
+  TEST_ASSERT_EQUAL_size_t(0, sunk.size());
+  AggregatorPoll(&agg, 100, AGG_FLUSH_MICROS - 100);
+  TEST_ASSERT_EQUAL_size_t(AGG_PACKET_BYTES, sunk.size());
+  TEST_ASSERT_EQUAL_INT(1, sinkFlushes);
+}
+
+void test_deadline_of_a_tail_left_by_a_transfer()
+{
+  // 4 packets at 0, 100, 200, 300 us: the fourth completes a transfer, its last 16 bytes are left
+  for (uint32_t seq = 0; seq < 4; seq++)
+  {
+    WritePacket(seq, seq * 100);
+  }
+  TEST_ASSERT_EQUAL_size_t(LINK_TRANSFER_BYTES, sunk.size());
+  AggregatorPoll(&agg, 300 + AGG_FLUSH_MICROS - 1, 0);
+  TEST_ASSERT_EQUAL_size_t(LINK_TRANSFER_BYTES, sunk.size());
+  AggregatorPoll(&agg, 300 + AGG_FLUSH_MICROS, 0);
+  TEST_ASSERT_EQUAL_size_t(4 * AGG_PACKET_BYTES, sunk.size());
+}
+
+void test_deadline_across_the_clock_wrap()
+{
+  const uint32_t written = UINT32_MAX - 500;
+  WritePacket(0, written);
+  AggregatorPoll(&agg, written + AGG_FLUSH_MICROS - 1, 0);
+  TEST_ASSERT_EQUAL_size_t(0, sunk.size());
+  AggregatorPoll(&agg, written + AGG_FLUSH_MICROS, 0);
+  TEST_ASSERT_EQUAL_size_t(AGG_PACKET_BYTES, sunk.size());
+}
+
+void test_back_pressure_drops_whole_writes()
+{
+  sinkRoom = 0;
+  uint32_t seq = 0, accepted = 0;
+  while (WritePacket(seq, seq) == AGG_PACKET_BYTES)
+  {
+    accepted++;
+    seq++;
+    TEST_ASSERT_TRUE(agg.backPressured || seq * AGG_PACKET_BYTES < LINK_TRANSFER_BYTES);
+  }
+  TEST_ASSERT_EQUAL_UINT32(LINK_AGGREGATOR_BYTES / AGG_PACKET_BYTES, accepted);
+  TEST_ASSERT_EQUAL_UINT32(1, agg.stalls);
+  TEST_ASSERT_EQUAL_UINT32(1, agg.droppedWrites);
+  TEST_ASSERT_EQUAL_UINT32(AGG_PACKET_BYTES, agg.droppedBytes);
+  TEST_ASSERT_EQUAL_size_t(accepted * AGG_PACKET_BYTES, AggregatorPending(&agg));
+  // a short flush would only be turned down as well
+  AggregatorPoll(&agg, seq + AGG_FLUSH_MICROS * 10, 0);
+  TEST_ASSERT_EQUAL_INT(0, sinkFlushes);
+  TEST_ASSERT_TRUE(agg.backPressured);
+
+  // the host takes a little: still behind
+  sinkRoom = LINK_TRANSFER_BYTES;
+  AggregatorPoll(&agg, seq, 0);
+  TEST_ASSERT_TRUE(agg.backPressured);
+  TEST_ASSERT_EQUAL_UINT32(1, agg.stalls);
+
+  // it catches up, what was held goes out; one more write is sent with it
+  sinkRoom = SIZE_MAX;
+  AggregatorPoll(&agg, seq, 0);
+  TEST_ASSERT_FALSE(agg.backPressured);
+  seq++;
+  TEST_ASSERT_EQUAL_size_t(AGG_PACKET_BYTES, WritePacket(seq, seq));
+  AggregatorPoll(&agg, seq + AGG_FLUSH_MICROS, 0);
+  TEST_ASSERT_EQUAL_size_t(0, AggregatorPending(&agg));
+  std::vector<uint32_t> seqs = SunkPackets();
+  TEST_ASSERT_EQUAL_size_t(accepted + 1, seqs.size());
+  for (uint32_t i = 0; i < accepted; i++)
+  {
+    TEST_ASSERT_EQUAL_UINT32(i, seqs[i]);
+  }
+  // the dropped one is the only gap
+  TEST_ASSERT_EQUAL_UINT32(accepted + 1, seqs[accepted]);
+  TEST_ASSERT_EQUAL_UINT32(1, agg.stalls);
+}
+
+void test_slow_host_loses_only_whole_packets()
+{
+  // a host that takes a few bytes now and then, often less than a transfer, and less than is written
+  srand(1);
+  uint32_t accepted = 0;
+  const uint32_t numPackets = 20000;
+  for (uint32_t seq = 0; seq < numPackets; seq++)
+  {
+    sinkRoom = rand() % 3 == 0 ? 0 : rand() % 24;
+    accepted += WritePacket(seq, seq * 50) == AGG_PACKET_BYTES;
+    AggregatorPoll(&agg, seq * 50, rand() % 100);
+  }
+  sinkRoom = SIZE_MAX;
+  AggregatorPoll(&agg, numPackets * 50 + AGG_FLUSH_MICROS, 0);
+  std::vector<uint32_t> seqs = SunkPackets();
+  TEST_ASSERT_EQUAL_size_t(accepted, seqs.size());
+  TEST_ASSERT_EQUAL_UINT32(numPackets - accepted, agg.droppedWrites);
+  TEST_ASSERT_GREATER_THAN(0, agg.droppedWrites);
+  TEST_ASSERT_EQUAL_UINT32(agg.bytesWritten, agg.bytesSent);
+  TEST_ASSERT_FALSE(agg.backPressured);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_only_whole_transfers_before_the_deadline);
+  RUN_TEST(test_short_transfer_flushed_on_the_deadline);
+  RUN_TEST(test_short_transfer_flushed_ahead_of_idle_time);
+  RUN_TEST(test_deadline_of_a_tail_left_by_a_transfer);
+  RUN_TEST(test_deadline_across_the_clock_wrap);
+  RUN_TEST(test_back_pressure_drops_whole_writes);
+  RUN_TEST(test_slow_host_loses_only_whole_packets);
+  return UNITY_END();
+}
@@ -0,0 +1,399 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of the playback command parser and of the commands played out by the simulator, pio test -e native
+ *
+ * The parser is fed frames byte by byte: every command, noise between
+ * frames, bad checksums and unknown commands, and real frames that start
+ * inside a dropped one. Seeking, stopping and speed are tested end to end,
+ * as a PC would use them: the simulator runs output.edf in a child process
+ * with --pty, the commands are written to the pty and the packets read back
+ * from it. A packet's samples are checked against a free-running capture of
+ * the file from the top, by where in the file the seek should have landed;
+ * the counter isn't, it counts packets sent.
+ */
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+#include <sys/wait.h>
+#include <unity.h>
+#include "PlaybackCommand.h"
+#include "SimplePacketMaker.h"
+#include "../sim_harness.h"
+
+#define COMMAND_SD_ROOT "test_edf" //the card whose output.edf is played; pio test runs tests from the project directory
+#define COMMAND_ROWS_PER_RECORD 200 //rows per data record of test_edf/output.edf, 1 s at 200 Hz
+#define COMMAND_REF_PACKETS 30000 //packets of the capture from the top, 150 records
+#define COMMAND_CHECK_PACKETS 400 //packets checked after each seek, across a record boundary
+#define COMMAND_QUIET_MS 300 //no packets for this long after a stop means it stopped
+#define COMMAND_RATE_SECS 1.5 //how long each speed's packet rate is measured
+#define COMMAND_MAX_RATE_ERROR 0.05 //largest error of a measured rate against the speed asked for
+
+/* a simulator playing output.edf to a pty, and the pty */
+struct PtySession
+{
+  pid_t pid;
+  int fd;
+  FILE *err; // its stderr
+};
+
+static std::vector<uint8_t> reference; // COMMAND_REF_PACKETS packets from the top, free-running
+static PtySession session = {-1, -1, nullptr}; // closed after every test
+
+/**
+ * @brief Captures the first COMMAND_REF_PACKETS packets of output.edf, as fast as they come
+ */
+static bool CaptureReference()
+{
+  FILE *capture = tmpfile();
+  int nullFd = ::open("/dev/null", O_RDWR);
+  char packets[16];
+  snprintf(packets, sizeof(packets), "%d", COMMAND_REF_PACKETS);
+  pid_t pid = ForkSimulator({"--sd-root", COMMAND_SD_ROOT, "--fast", "--no-image", "--no-descriptor", "--no-events",
+                             "--packets", packets, "--out", "-"},
+                            nullFd, fileno(capture), nullFd);
+  close(nullFd);
+  int status;
+  bool ran = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  reference.resize((size_t)COMMAND_REF_PACKETS * SIMPLE_PACKET_BYTES);
+  rewind(capture);
+  bool read = fread(reference.data(), 1, reference.size(), capture) == reference.size();
+  fclose(capture);
+  return ran && read;
+}
+
+/**
+ * @brief Starts the simulator playing output.edf in real time to a pty, and opens the pty raw
+ */
+static bool OpenSession()
+{
+  // a file rather than a pipe, a pipe nobody reads would stop it once full
+  session.err = tmpfile();
+  int nullFd = ::open("/dev/null", O_RDWR);
+  session.pid = ForkSimulator({"--sd-root", COMMAND_SD_ROOT, "--pty", "--no-image", "--no-descriptor", "--no-events"},
+                              nullFd, nullFd, fileno(session.err));
+  close(nullFd);
+  char line[256], ptyName[128] = "";
+  const double until = MonotonicSecs() + 5;
+  while (ptyName[0] == '\0' && MonotonicSecs() < until)
+  {
+    usleep(10000);
+    rewind(session.err);
+    while (ptyName[0] == '\0' && fgets(line, sizeof(line), session.err) != nullptr)
+    {
+      sscanf(line, "packets on %127s", ptyName);
+    }
+  }
+  session.fd = ptyName[0] ? ::open(ptyName, O_RDWR | O_NOCTTY) : -1;
+  if (session.fd < 0)
+  {
+    return false;
+  }
+  // no echo of the commands, no translation of either's bytes
+  struct termios tio;
+  tcgetattr(session.fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(session.fd, TCSANOW, &tio);
+  return true;
+}
+
+static void CloseSession()
+{
+  if (session.fd >= 0)
+  {
+    close(session.fd);
+  }
+  if (session.pid > 0)
+  {
+    kill(session.pid, SIGTERM);
+    waitpid(session.pid, nullptr, 0);
+  }
+  if (session.err != nullptr)
+  {
+    fclose(session.err);
+  }
+  session = {-1, -1, nullptr};
+}
+
+static void SendCommand(uint8_t type, uint32_t argument)
+{
+  uint8_t frame[PLAYBACK_CMD_BYTES];
+  PlaybackCommandEncode(type, argument, frame);
+  TEST_ASSERT_EQUAL_INT(PLAYBACK_CMD_BYTES, ::write(session.fd, frame, sizeof(frame)));
+}
+
+/**
+ * @brief Stops playback and reads what was already sent, until nothing comes for COMMAND_QUIET_MS
+ *
+ * @return false if packets kept coming
+ */
+static bool StopAndDrain()
+{
+  SendCommand(PLAYBACK_CMD_STOP, 0);
+  uint8_t buf[4096];
+  struct pollfd pfd = {session.fd, POLLIN, 0};
+  const double until = MonotonicSecs() + 5;
+  while (MonotonicSecs() < until)
+  {
+    if (poll(&pfd, 1, COMMAND_QUIET_MS) <= 0)
+    {
+      return true;
+    }
+    if (::read(session.fd, buf, sizeof(buf)) <= 0)
+    {
+      return false;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Reads the next count whole packets
+ *
+ * @param arrivals when each arrived, or nullptr
+ * @return false if they didn't all come within a few seconds
+ */
+static bool ReadPackets(int count, std::vector<uint8_t> *packets, std::vector<double> *arrivals)
+{
+  packets->clear();
+  if (arrivals != nullptr)
+  {
+    arrivals->clear();
+  }
+  const size_t wanted = (size_t)count * SIMPLE_PACKET_BYTES;
+  uint8_t buf[SIMPLE_PACKET_BYTES];
+  struct pollfd pfd = {session.fd, POLLIN, 0};
+  while (packets->size() < wanted)
+  {
+    if (poll(&pfd, 1, 3000) <= 0)
+    {
+      return false;
+    }
+    // at most the rest of the packet, so every arrival is one packet's last byte
+    size_t rest = SIMPLE_PACKET_BYTES - packets->size() % SIMPLE_PACKET_BYTES;
+    ssize_t got = ::read(session.fd, buf, rest);
+    if (got <= 0)
+    {
+      return false;
+    }
+    packets->insert(packets->end(), buf, buf + got);
+    if (arrivals != nullptr && (size_t)got == rest)
+    {
+      arrivals->push_back(MonotonicSecs());
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Checks packets' samples are the reference's from firstPacket on, and that their counter runs on
+ */
+static void CheckPackets(const std::vector<uint8_t> &packets, long firstPacket)
+{
+  TEST_ASSERT_TRUE_MESSAGE(firstPacket + (long)(packets.size() / SIMPLE_PACKET_BYTES) <= COMMAND_REF_PACKETS,
+                           "past the end of the reference");
+  for (size_t pos = 0; pos < packets.size(); pos += SIMPLE_PACKET_BYTES)
+  {
+    const uint8_t *at = &packets[pos];
+    TEST_ASSERT_EQUAL_UINT8(0xFF, at[0]);
+    TEST_ASSERT_EQUAL_UINT8(0xFF, at[1]);
+    if (pos > 0)
+    {
+      uint32_t counter = at[2] | at[3] << 8;
+      uint32_t previous = at[2 - SIMPLE_PACKET_BYTES] | at[3 - SIMPLE_PACKET_BYTES] << 8;
+      TEST_ASSERT_EQUAL_UINT32((previous + 1) % 32768, counter);
+    }
+    const uint8_t *expected = &reference[(firstPacket + pos / SIMPLE_PACKET_BYTES) * SIMPLE_PACKET_BYTES];
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expected + 4, at + 4, SIMPLE_PACKET_BYTES - 4, "samples aren't the file's");
+  }
+}
+
+/**
+ * @brief Feeds bytes to parser one at a time, and keeps the commands they complete
+ */
+static int FeedAll(PlaybackCommandParser *parser, const uint8_t *bytes, int length, PlaybackCommand *commands)
+{
+  int found = 0;
+  for (int i = 0; i < length; i++)
+  {
+    if (PlaybackCommandFeed(parser, bytes[i], &commands[found]))
+    {
+      found++;
+    }
+  }
+  return found;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+  CloseSession();
+}
+
+void test_every_command_round_trips()
+{
+  const uint32_t arguments[] = {0, 1, 0xA5, 0xA5A5A5A5, 0x12345678, 0xFFFFFFFF};
+  PlaybackCommandParser parser;
+  PlaybackCommandParserInit(&parser);
+  for (uint8_t type = PLAYBACK_CMD_START; type <= PLAYBACK_CMD_SPEED; type++)
+  {
+    for (uint32_t argument : arguments)
+    {
+      uint8_t frame[PLAYBACK_CMD_BYTES];
+      PlaybackCommandEncode(type, argument, frame);
+      PlaybackCommand command;
+      TEST_ASSERT_EQUAL_INT(1, FeedAll(&parser, frame, PLAYBACK_CMD_BYTES, &command));
+      TEST_ASSERT_EQUAL_UINT8(type, command.type);
+      TEST_ASSERT_EQUAL_UINT32(argument, command.argument);
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, parser.badFrames);
+}
+
+void test_noise_between_frames_is_skipped()
+{
+  uint8_t bytes[32] = {0x00, 0x13, 0xFF, 0x5A};
+  PlaybackCommandEncode(PLAYBACK_CMD_SEEK_RECORD, 42, bytes + 4);
+  bytes[11] = 0x7E;
+  PlaybackCommandEncode(PLAYBACK_CMD_LOOP, 1, bytes + 12);
+  PlaybackCommandParser parser;
+  PlaybackCommandParserInit(&parser);
+  PlaybackCommand commands[2];
+  TEST_ASSERT_EQUAL_INT(2, FeedAll(&parser, bytes, 19, commands));
+  TEST_ASSERT_EQUAL_UINT8(PLAYBACK_CMD_SEEK_RECORD, commands[0].type);
+  TEST_ASSERT_EQUAL_UINT32(42, commands[0].argument);
+  TEST_ASSERT_EQUAL_UINT8(PLAYBACK_CMD_LOOP, commands[1].type);
+  TEST_ASSERT_EQUAL_UINT32(0, parser.badFrames);
+}
+
+void test_bad_frames_are_dropped()
+{
+  uint8_t bytes[3 * PLAYBACK_CMD_BYTES];
+  PlaybackCommandEncode(PLAYBACK_CMD_SPEED, 200, bytes);
+  bytes[6] ^= 0x01; // checksum
+  PlaybackCommandEncode(PLAYBACK_CMD_START, 0, bytes + PLAYBACK_CMD_BYTES);
+  // a correct checksum on a command that doesn't exist
+  bytes[PLAYBACK_CMD_BYTES + 1] = PLAYBACK_CMD_SPEED + 1;
+  bytes[PLAYBACK_CMD_BYTES + 6] = (uint8_t)(0 - (PLAYBACK_CMD_SPEED + 1));
+  PlaybackCommandEncode(PLAYBACK_CMD_STOP, 0, bytes + 2 * PLAYBACK_CMD_BYTES);
+  PlaybackCommandParser parser;
+  PlaybackCommandParserInit(&parser);
+  PlaybackCommand command;
+  TEST_ASSERT_EQUAL_INT(1, FeedAll(&parser, bytes, sizeof(bytes), &command));
+  TEST_ASSERT_EQUAL_UINT8(PLAYBACK_CMD_STOP, command.type);
+  TEST_ASSERT_EQUAL_UINT32(2, parser.badFrames);
+}
+
+void test_resync_inside_a_bad_frame()
+{
+  // a frame cut short after each of its first six bytes, then a whole one that starts inside what's taken for the first
+  for (int cut = 1; cut < PLAYBACK_CMD_BYTES; cut++)
+  {
+    uint8_t bytes[2 * PLAYBACK_CMD_BYTES];
+    PlaybackCommandEncode(PLAYBACK_CMD_SEEK_MILLIS, 0x01020304, bytes);
+    PlaybackCommandEncode(PLAYBACK_CMD_SEEK_RECORD, 7, bytes + cut);
+    PlaybackCommandParser parser;
+    PlaybackCommandParserInit(&parser);
+    PlaybackCommand command;
+    TEST_ASSERT_EQUAL_INT(1, FeedAll(&parser, bytes, cut + PLAYBACK_CMD_BYTES, &command));
+    TEST_ASSERT_EQUAL_UINT8(PLAYBACK_CMD_SEEK_RECORD, command.type);
+    TEST_ASSERT_EQUAL_UINT32(7, command.argument);
+    TEST_ASSERT_EQUAL_UINT32(1, parser.badFrames);
+  }
+}
+
+void test_resync_past_a_false_sync()
+{
+  // a sync byte in the argument of a bad frame isn't a frame either, the one after it is
+  uint8_t bytes[16];
+  PlaybackCommandEncode(PLAYBACK_CMD_SEEK_RECORD, 0xA5A5, bytes);
+  bytes[6] ^= 0x80;
+  PlaybackCommandEncode(PLAYBACK_CMD_START, 0, bytes + PLAYBACK_CMD_BYTES);
+  PlaybackCommandParser parser;
+  PlaybackCommandParserInit(&parser);
+  PlaybackCommand command;
+  TEST_ASSERT_EQUAL_INT(1, FeedAll(&parser, bytes, 2 * PLAYBACK_CMD_BYTES, &command));
+  TEST_ASSERT_EQUAL_UINT8(PLAYBACK_CMD_START, command.type);
+}
+
+void test_seek_and_stop()
+{
+  TEST_ASSERT_TRUE_MESSAGE(OpenSession(), "no pty from the simulator");
+  std::vector<uint8_t> packets;
+  struct Seek
+  {
+    uint8_t type;
+    uint32_t argument;
+    long firstPacket;
+  };
+  const Seek seeks[] = {
+    {PLAYBACK_CMD_SEEK_RECORD, 100, 100L * COMMAND_ROWS_PER_RECORD},
+    // 1 s records: 12.345 s is row 69 of record 12
+    {PLAYBACK_CMD_SEEK_MILLIS, 12345, 12L * COMMAND_ROWS_PER_RECORD + 69},
+    {PLAYBACK_CMD_SEEK_RECORD, 0, 0},
+    {PLAYBACK_CMD_SEEK_MILLIS, 140999, 140L * COMMAND_ROWS_PER_RECORD + 199},
+  };
+  for (const Seek &seek : seeks)
+  {
+    TEST_ASSERT_TRUE_MESSAGE(StopAndDrain(), "packets kept coming after a stop");
+    SendCommand(seek.type, seek.argument);
+    SendCommand(PLAYBACK_CMD_SPEED, 0);
+    SendCommand(PLAYBACK_CMD_START, 0);
+    bool read = ReadPackets(COMMAND_CHECK_PACKETS, &packets, nullptr);
+    TEST_ASSERT_TRUE_MESSAGE(read, "packets stopped after a seek");
+    CheckPackets(packets, seek.firstPacket);
+  }
+}
+
+void test_speed()
+{
+  TEST_ASSERT_TRUE_MESSAGE(OpenSession(), "no pty from the simulator");
+  const uint32_t speeds[] = {100, 250, 50};
+  std::vector<uint8_t> packets;
+  std::vector<double> arrivals;
+  for (uint32_t speed : speeds)
+  {
+    TEST_ASSERT_TRUE_MESSAGE(StopAndDrain(), "packets kept coming after a stop");
+    SendCommand(PLAYBACK_CMD_SPEED, speed);
+    SendCommand(PLAYBACK_CMD_START, 0);
+    const int count = (int)(COMMAND_RATE_SECS * COMMAND_ROWS_PER_RECORD * speed / 100);
+    bool read = ReadPackets(count, &packets, &arrivals);
+    TEST_ASSERT_TRUE_MESSAGE(read, "packets stopped");
+    // from the second packet, the first may have been written before the restart
+    double rate = (arrivals.size() - 2) / (arrivals.back() - arrivals[1]);
+    double expected = COMMAND_ROWS_PER_RECORD * speed / 100.0;
+    char line[80];
+    snprintf(line, sizeof(line), "speed %u%%: %.1f packets/s, %.0f expected", (unsigned)speed, rate, expected);
+    TEST_MESSAGE(line);
+    TEST_ASSERT_TRUE_MESSAGE(fabs(rate / expected - 1) <= COMMAND_MAX_RATE_ERROR, "packet rate isn't the speed asked for");
+  }
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_every_command_round_trips);
+  RUN_TEST(test_noise_between_frames_is_skipped);
+  RUN_TEST(test_bad_frames_are_dropped);
+  RUN_TEST(test_resync_inside_a_bad_frame);
+  RUN_TEST(test_resync_past_a_false_sync);
+  if (CaptureReference())
+  {
+    RUN_TEST(test_seek_and_stop);
+    RUN_TEST(test_speed);
+  }
+  else
+  {
+    fprintf(stderr, "no capture of %s/output.edf to check seeks against\n", COMMAND_SD_ROOT);
+  }
+  return UNITY_END();
+}
@@ -0,0 +1,175 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests that a playlist plays its files back to back without a seam, pio test -e native
+ *
+ * A playlist of the card's output.edf listed twice, under two names, must
+ * send exactly the bytes that output.edf played on its own and looped
+ * sends: same samples, counter running on across the handoff, event frames
+ * in the same places, nothing dropped or repeated where one file ends and
+ * the next begins, and the same again when the list wraps. Both run in the
+ * simulator, in child processes, free-running for PLAYLIST_PASSES times
+ * through the list; each comparison is repeated with a ring of two
+ * records, so the next file's first records have almost nowhere to wait,
+ * with a refill thread, and with 24-bit packets. A name in the list that
+ * doesn't open is left out at startup, so it mustn't leave a gap either.
+ */
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <sys/stat.h>
+#include <unity.h>
+#include "../sim_harness.h"
+
+#define PLAYLIST_SD_ROOT "test_edf" //the card whose output.edf is listed; pio test runs tests from the project directory
+#define PLAYLIST_FILE_PACKETS 120000 //packets in test_edf/output.edf, 600 records of 200 rows
+#define PLAYLIST_PASSES 2.5 //times through the list, so it wraps and stops partway through a file
+
+static char scratchDir[] = "/tmp/volkseeg-test-playlist-XXXXXX"; // the two cards and their captures
+static char singleDir[sizeof(scratchDir) + 8]; // output.edf, in scratchDir/single
+static char listDir[sizeof(scratchDir) + 8];   // a.edf and b.edf, both output.edf, and playlist.txt, in scratchDir/list
+
+/**
+ * @brief Plays sdRoot free-running with extra options, and returns what it sent
+ */
+static void Capture(const char *sdRoot, const std::vector<const char *> &options, std::vector<uint8_t> *capture)
+{
+  char outPath[PATH_MAX], packets[16];
+  snprintf(outPath, sizeof(outPath), "%s/capture.bin", scratchDir);
+  snprintf(packets, sizeof(packets), "%ld", (long)(PLAYLIST_PASSES * 2 * PLAYLIST_FILE_PACKETS));
+  std::vector<const char *> args = {"--sd-root", sdRoot, "--fast", "--no-descriptor", "--packets", packets,
+                                    "--out", outPath};
+  args.insert(args.end(), options.begin(), options.end());
+  TEST_ASSERT_EQUAL_INT_MESSAGE(0, RunSimulator(args), "the simulator failed");
+  bool read = ReadCapture(outPath, capture);
+  unlink(outPath);
+  TEST_ASSERT_TRUE_MESSAGE(read, "no capture");
+}
+
+/**
+ * @brief Checks the playlist sends what output.edf looped does, with the same options
+ */
+static void CheckSameBytes(const std::vector<const char *> &options)
+{
+  std::vector<uint8_t> single, list;
+  Capture(singleDir, options, &single);
+  Capture(listDir, options, &list);
+  // at least a packet per row, most of them 16 or 24-bit simple packets
+  TEST_ASSERT_GREATER_OR_EQUAL((size_t)(PLAYLIST_PASSES * 2 * PLAYLIST_FILE_PACKETS * 20), single.size());
+  TEST_ASSERT_EQUAL_size_t(single.size(), list.size());
+  size_t at = 0;
+  while (at < single.size() && single[at] == list[at])
+  {
+    at++;
+  }
+  char line[80];
+  snprintf(line, sizeof(line), "captures differ from byte %lu", (unsigned long)at);
+  TEST_ASSERT_TRUE_MESSAGE(at == single.size(), line);
+}
+
+/**
+ * @brief Links dir/name to the card's output.edf
+ */
+static bool LinkCardFile(const char *dir, const char *name)
+{
+  char path[PATH_MAX], source[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/output.edf", PLAYLIST_SD_ROOT);
+  if (realpath(path, source) == nullptr)
+  {
+    return false;
+  }
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  return symlink(source, path) == 0;
+}
+
+static bool MakeCards()
+{
+  snprintf(singleDir, sizeof(singleDir), "%s/single", scratchDir);
+  snprintf(listDir, sizeof(listDir), "%s/list", scratchDir);
+  if (mkdir(singleDir, 0755) != 0 || mkdir(listDir, 0755) != 0 || !LinkCardFile(singleDir, "output.edf") ||
+      !LinkCardFile(listDir, "a.edf") || !LinkCardFile(listDir, "b.edf"))
+  {
+    return false;
+  }
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/playlist.txt", listDir);
+  FILE *out = fopen(path, "w");
+  if (out == nullptr)
+  {
+    return false;
+  }
+  fputs("# output.edf twice, with a name that isn't on the card between\n"
+        "a.edf\n"
+        "missing.edf\n"
+        "\n"
+        "b.edf\n",
+        out);
+  return fclose(out) == 0;
+}
+
+static void RemoveCards()
+{
+  const char *files[][2] = {{singleDir, "output.edf"}, {listDir, "a.edf"}, {listDir, "b.edf"}, {listDir, "playlist.txt"}};
+  char path[PATH_MAX];
+  for (const auto &file : files)
+  {
+    snprintf(path, sizeof(path), "%s/%s", file[0], file[1]);
+    unlink(path);
+  }
+  rmdir(singleDir);
+  rmdir(listDir);
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_handoff_matches_looping()
+{
+  CheckSameBytes({});
+}
+
+void test_handoff_with_a_two_record_ring()
+{
+  CheckSameBytes({"--ring-records", "2"});
+}
+
+void test_handoff_with_a_refill_thread()
+{
+  CheckSameBytes({"--refill-thread", "--mmap"});
+}
+
+void test_handoff_in_24_bit_packets()
+{
+  CheckSameBytes({"--packet-bits", "24"});
+}
+
+int main()
+{
+  if (mkdtemp(scratchDir) == nullptr)
+  {
+    perror(scratchDir);
+    return 1;
+  }
+  if (!MakeCards())
+  {
+    fprintf(stderr, "can't set up the cards under %s\n", scratchDir);
+    RemoveCards();
+    rmdir(scratchDir);
+    return 1;
+  }
+  UNITY_BEGIN();
+  RUN_TEST(test_handoff_matches_looping);
+  RUN_TEST(test_handoff_with_a_two_record_ring);
+  RUN_TEST(test_handoff_with_a_refill_thread);
+  RUN_TEST(test_handoff_in_24_bit_packets);
+  RemoveCards();
+  rmdir(scratchDir);
+  return UNITY_END();
+}
@@ -0,0 +1,813 @@
+/**
+ * @file test_main.cpp
+ * @brief End-to-end replay tests of the bytes on the wire against the EDF they came from, pio test -e native
+ *
+ * Every check runs the simulator itself, in a child process with the
+ * command line a user would give it, and decodes what it sent with a
+ * reference decoder written from the packet format alone. The expected
+ * samples come from a separate, deliberately plain reading of the file:
+ * every header field parsed with the C library, every sample calibrated
+ * with the float expression the sender has always used,
+ *
+ *     (int32_t)((digital * calMultiplier) + calOffset)
+ *
+ * and cut to the packet's 16 or 24 bits. The files replayed are the
+ * card's output.edf and fixtures written here to cover what it doesn't:
+ * negative gains, physical values past 16 and 24 bits, gains below one
+ * (truncation towards zero), more signals than a packet carries, an
+ * annotation signal among the data, BDF, and one-sample records. Each is
+ * played from the file, mmap'ed with a refill thread, from a playback
+ * image and in the other packet width, for VERIFY_PACKETS packets, past a
+ * counter wrap, and once through from stdin; the first run parses the
+ * header and writes a playback descriptor, the others load that. A paced
+ * run of output.edf read from a pty checks the counter and the packet
+ * rate; with -a --soak only a longer paced run is made, and its arrival
+ * jitter checked too, best on a quiet machine.
+ */
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unity.h>
+#include "platform.h"
+#include "EventFrame.h"
+#include "PlaybackDescriptor.h"
+#include "SimplePacketMaker.h"
+#include "../sim_harness.h"
+
+#define REPLAY_SD_ROOT "test_edf" //the card whose output.edf is replayed; pio test runs tests from the project directory
+#define VERIFY_PACKETS 40000 //packets checked per run, enough for the 15-bit counter to wrap
+#define VERIFY_MAX_SIGNALS 16 //most signals in a file the reference reads
+#define VERIFY_MAX_NAME 15 //longest fixture name
+#define VERIFY_TIMING_SECS 3 //paced playback timed from a pty
+#define VERIFY_SETTLE_MICROS 200000 //timed packets arriving this soon after the pty is opened are left out, they were queued
+#define VERIFY_MAX_RATE_PPM 2000 //largest error of the packet rate over the timed run
+#define VERIFY_SOAK_SECS 60 //paced playback timed by the soak test, -a --soak
+#define VERIFY_MAX_JITTER_MICROS 5000 //widest spread of packet arrivals around the ideal timeline in the soak test, a packet period at 200 Hz
+
+static char scratchDir[] = "/tmp/volkseeg-test-replay-XXXXXX"; // fixtures, images and captures
+
+struct RefSignal
+{
+  float physMin;
+  float physMax;
+  int digMin;
+  int digMax;
+  int samples;      // per record
+  int offset;       // bytes into a record
+  bool annotation;
+};
+
+/**
+ * @brief A whole EDF or BDF file, as the reference reads it
+ */
+struct RefFile
+{
+  bool bdf;
+  int numSignals;
+  int headerBytes;
+  long numRecords;
+  double recordSecs;
+  int recordBytes;
+  int rows;         // samples per record of the first data signal, the rate packets go at
+  RefSignal signals[VERIFY_MAX_SIGNALS];
+  std::vector<uint8_t> bytes;
+};
+
+struct FixtureSignal
+{
+  const char *physMin;
+  const char *physMax;
+  int digMin;
+  int digMax;
+  bool annotation;
+};
+
+/**
+ * @brief A file written for the checks, see WriteFixture
+ */
+struct Fixture
+{
+  const char *name;
+  bool bdf;
+  bool plus;
+  const char *duration; // seconds per record
+  int samples;          // per record, every signal
+  long numRecords;
+  int numSignals;
+  FixtureSignal signals[VERIFY_MAX_SIGNALS];
+};
+
+static const Fixture fixtures[] = {
+  {"edf-wide", false, true, "0.25", 64, 40, 12,
+   {{"-3276.8", "3276.7", -32768, 32767, false},   // the usual 0.1 uV steps
+    {"3276.7", "-3276.8", -32768, 32767, false},   // negative gain
+    {"-100000", "100000", -32768, 32767, false},   // past 16 bits, packets keep the low 16
+    {"-1", "1", -32768, 32767, true},
+    {"0", "1", 0, 1000, false},                    // gain below one, truncated towards zero
+    {"-0.5", "0.5", -32768, 32767, false},
+    {"-200", "200", -2048, 2047, false},           // a 12-bit converter
+    {"-8388608", "8388607", -32768, 32767, false}, // gain 256
+    {"-3276.8", "3276.7", -32768, 32767, false},   // the 9th and later never go in a packet
+    {"-3276.8", "3276.7", -32768, 32767, false},
+    {"-3276.8", "3276.7", -32768, 32767, false},
+    {"-3276.8", "3276.7", -32768, 32767, false}}},
+  {"bdf-24", true, true, "1", 100, 20, 6,
+   {{"-262144", "262144", -8388608, 8388607, false},       // about 1/32 steps
+    {"-8388608", "8388607", -8388608, 8388607, false},
+    {"1000", "-1000", -8388608, 8388607, false},
+    {"-9999999", "9999999", -8388608, 8388607, false},     // past 24 bits, packets keep the low 24
+    {"0", "10", 0, 8388607, false},
+    {"-1", "1", -8388608, 8388607, true}}},
+  {"edf-tiny", false, false, "0.004", 1, 1000, 2,
+   {{"-3276.8", "3276.7", -32768, 32767, false},
+    {"-500", "500", -32768, 32767, false}}},
+};
+
+struct VerifyResult
+{
+  long packets;
+  long events;
+  long badSync;        // bytes skipped looking for a packet
+  long counterBreaks;  // packets whose counter wasn't the one after the last
+  long mismatches;     // samples that weren't the expected ones
+  long firstBadPacket; // -1 if none
+  int firstBadChan;
+  int32_t got;
+  int32_t expected;
+};
+
+/**
+ * @brief Copies a space-padded header field into text and trims it
+ */
+static const char *Field(const RefFile *ref, int offset, int width, char *text)
+{
+  memcpy(text, &ref->bytes[offset], width);
+  text[width] = '\0';
+  for (int end = width - 1; end >= 0 && text[end] == ' '; end--)
+  {
+    text[end] = '\0';
+  }
+  return text;
+}
+
+/**
+ * @brief Reads a whole EDF or BDF file into ref
+ */
+static bool RefLoad(const char *path, RefFile *ref)
+{
+  FILE *in = fopen(path, "rb");
+  if (in == nullptr)
+  {
+    perror(path);
+    return false;
+  }
+  fseek(in, 0, SEEK_END);
+  ref->bytes.resize(ftell(in));
+  fseek(in, 0, SEEK_SET);
+  bool read = fread(ref->bytes.data(), 1, ref->bytes.size(), in) == ref->bytes.size();
+  fclose(in);
+  if (!read || ref->bytes.size() < 256)
+  {
+    return false;
+  }
+  char text[81];
+  ref->bdf = ref->bytes[0] == 0xFF;
+  ref->headerBytes = atoi(Field(ref, 184, 8, text));
+  ref->numRecords = atol(Field(ref, 236, 8, text));
+  ref->recordSecs = atof(Field(ref, 244, 8, text));
+  ref->numSignals = atoi(Field(ref, 252, 4, text));
+  int ns = ref->numSignals;
+  if (ns < 1 || ns > VERIFY_MAX_SIGNALS || (size_t)ref->headerBytes > ref->bytes.size())
+  {
+    return false;
+  }
+  // field-major: ns labels, ns transducer types, ns dimensions, ...
+  int base = 256;
+  const int bytesPerSample = ref->bdf ? 3 : 2;
+  ref->recordBytes = 0;
+  ref->rows = 0;
+  for (int i = 0; i < ns; i++)
+  {
+    RefSignal *sig = &ref->signals[i];
+    sig->annotation = strcmp(Field(ref, base + i * 16, 16, text), ref->bdf ? "BDF Annotations" : "EDF Annotations") == 0;
+    sig->physMin = strtof(Field(ref, base + ns * 104 + i * 8, 8, text), nullptr);
+    sig->physMax = strtof(Field(ref, base + ns * 112 + i * 8, 8, text), nullptr);
+    sig->digMin = atoi(Field(ref, base + ns * 120 + i * 8, 8, text));
+    sig->digMax = atoi(Field(ref, base + ns * 128 + i * 8, 8, text));
+    sig->samples = atoi(Field(ref, base + ns * 216 + i * 8, 8, text));
+    sig->offset = ref->recordBytes;
+    ref->recordBytes += sig->samples * bytesPerSample;
+    if (ref->rows == 0 && !sig->annotation)
+    {
+      ref->rows = sig->samples;
+    }
+  }
+  return ref->rows > 0 && ref->headerBytes + ref->numRecords * ref->recordBytes <= (long)ref->bytes.size();
+}
+
+/**
+ * @brief True if a channel's samples go out as they are in the file; the
+ *        rest are left out (annotations) or resampled, and not checked
+ */
+static bool RefChecked(const RefFile *ref, int chan)
+{
+  return chan < ref->numSignals && !ref->signals[chan].annotation && ref->signals[chan].samples == ref->rows;
+}
+
+/**
+ * @brief The calibrated value a packet should carry for one channel of a sample period
+ *
+ * @param row sample period from the start of the file, counting round again after the last
+ */
+static int32_t RefExpected(const RefFile *ref, long row, int chan)
+{
+  if (chan >= ref->numSignals || ref->signals[chan].annotation)
+  {
+    // zero padded
+    return 0;
+  }
+  const RefSignal *sig = &ref->signals[chan];
+  long record = row / ref->rows % ref->numRecords;
+  int sample = row % ref->rows;
+  const uint8_t *at = &ref->bytes[ref->headerBytes + record * ref->recordBytes + sig->offset];
+  int32_t digital;
+  if (ref->bdf)
+  {
+    at += sample * 3;
+    digital = (int32_t)((uint32_t)at[0] << 8 | (uint32_t)at[1] << 16 | (uint32_t)at[2] << 24) >> 8;
+  }
+  else
+  {
+    at += sample * 2;
+    digital = (int16_t)(at[0] | at[1] << 8);
+  }
+  float calMultiplier = (sig->physMax - sig->physMin) / (sig->digMax - sig->digMin);
+  float calOffset = sig->physMin - (calMultiplier * sig->digMin);
+  return (int32_t)((digital * calMultiplier) + calOffset);
+}
+
+/**
+ * @brief Decodes a captured stream of simple packets and event frames and compares it with the file
+ *
+ * Counters are checked modulo 32768 against the packet's place in the
+ * stream, and each packet's samples against the row of the file it stands
+ * for, playback looping back to the first record after the last.
+ */
+static void CheckCapture(const RefFile *ref, const std::vector<uint8_t> &capture, int packetBits, VerifyResult *result)
+{
+  memset(result, 0, sizeof(*result));
+  result->firstBadPacket = -1;
+  const size_t packetBytes = packetBits == 24 ? SIMPLE_PACKET24_BYTES : SIMPLE_PACKET_BYTES;
+  const int sampleBytes = packetBits / 8;
+  const uint32_t mask = packetBits == 24 ? 0xFFFFFF : 0xFFFF;
+  const long totalRows = (long)ref->numRecords * ref->rows;
+  long packet = 0;
+  size_t pos = 0;
+  while (pos + 4 <= capture.size())
+  {
+    const uint8_t *at = &capture[pos];
+    if (at[0] != 0xFF || at[1] != 0xFF)
+    {
+      result->badSync++;
+      pos++;
+      continue;
+    }
+    long eventBytes = EventFrameLength(at, capture.size() - pos);
+    if (eventBytes < 0)
+    {
+      break;
+    }
+    if (eventBytes > 0)
+    {
+      result->events++;
+      pos += eventBytes;
+      continue;
+    }
+    if (pos + packetBytes > capture.size())
+    {
+      break;
+    }
+    uint32_t counter = at[2] | at[3] << 8;
+    if (counter != (uint32_t)(packet % 32768))
+    {
+      result->counterBreaks++;
+      // carry on from the packet the counter says this is
+      packet += ((long)counter - packet % 32768 + 32768) % 32768;
+    }
+    for (int chan = 0; chan < SIMPLE_PACKET_CHANNELS; chan++)
+    {
+      if (chan < ref->numSignals && !RefChecked(ref, chan) && !ref->signals[chan].annotation)
+      {
+        continue;
+      }
+      const uint8_t *sample = at + 4 + chan * sampleBytes;
+      uint32_t got = sample[0] | sample[1] << 8 | (packetBits == 24 ? sample[2] << 16 : 0);
+      int32_t expected = RefExpected(ref, packet % totalRows, chan);
+      if (got != ((uint32_t)expected & mask))
+      {
+        if (result->mismatches++ == 0)
+        {
+          result->firstBadPacket = packet;
+          result->firstBadChan = chan;
+          result->got = got;
+          result->expected = expected & mask;
+        }
+      }
+    }
+    result->packets++;
+    packet++;
+    pos += packetBytes;
+  }
+}
+
+/**
+ * @brief Writes a fixture as dir/output.edf
+ *
+ * Sample n of a signal cycles through its digital minimum and maximum, 0,
+ * -1 and 1 (where they're in range), then four scrambled values; each
+ * annotation signal holds just the record's timekeeping TAL.
+ */
+static bool WriteFixture(const Fixture *fixture, const char *dir)
+{
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/output.edf", dir);
+  FILE *out = fopen(path, "wb");
+  if (out == nullptr)
+  {
+    perror(path);
+    return false;
+  }
+  const int ns = fixture->numSignals;
+  const int bytesPerSample = fixture->bdf ? 3 : 2;
+  std::vector<char> header(256 * (ns + 1), ' ');
+  auto put = [&](int offset, int width, const char *text) {
+    size_t length = strlen(text);
+    memcpy(&header[offset], text, length < (size_t)width ? length : width);
+  };
+  char text[81];
+  if (fixture->bdf)
+  {
+    header[0] = (char)0xFF;
+    put(1, 7, "BIOSEMI");
+  }
+  else
+  {
+    put(0, 8, "0");
+  }
+  put(8, 80, "X X X X");
+  put(88, 80, "Startdate 01-JAN-2020 X X fixture");
+  put(168, 8, "01.01.20");
+  put(176, 8, "00.00.00");
+  snprintf(text, sizeof(text), "%d", 256 * (ns + 1));
+  put(184, 8, text);
+  put(192, 44, fixture->plus ? (fixture->bdf ? "BDF+C" : "EDF+C") : "");
+  snprintf(text, sizeof(text), "%ld", fixture->numRecords);
+  put(236, 8, text);
+  put(244, 8, fixture->duration);
+  snprintf(text, sizeof(text), "%d", ns);
+  put(252, 4, text);
+  for (int i = 0; i < ns; i++)
+  {
+    const FixtureSignal *sig = &fixture->signals[i];
+    put(256 + i * 16, 16, sig->annotation ? (fixture->bdf ? "BDF Annotations" : "EDF Annotations") : "EEG");
+    put(256 + ns * 96 + i * 8, 8, sig->annotation ? "" : "uV");
+    put(256 + ns * 104 + i * 8, 8, sig->physMin);
+    put(256 + ns * 112 + i * 8, 8, sig->physMax);
+    snprintf(text, sizeof(text), "%d", sig->digMin);
+    put(256 + ns * 120 + i * 8, 8, text);
+    snprintf(text, sizeof(text), "%d", sig->digMax);
+    put(256 + ns * 128 + i * 8, 8, text);
+    snprintf(text, sizeof(text), "%d", fixture->samples);
+    put(256 + ns * 216 + i * 8, 8, text);
+  }
+  bool written = fwrite(header.data(), 1, header.size(), out) == header.size();
+
+  const double recordSecs = atof(fixture->duration);
+  std::vector<uint8_t> record(ns * fixture->samples * bytesPerSample);
+  for (long r = 0; r < fixture->numRecords && written; r++)
+  {
+    uint8_t *at = record.data();
+    for (int i = 0; i < ns; i++)
+    {
+      const FixtureSignal *sig = &fixture->signals[i];
+      int bytes = fixture->samples * bytesPerSample;
+      if (sig->annotation)
+      {
+        memset(at, 0, bytes);
+        int length = snprintf(text, sizeof(text), "+%g\x14\x14", r * recordSecs);
+        memcpy(at, text, length < bytes ? length : bytes);
+        at += bytes;
+        continue;
+      }
+      for (int s = 0; s < fixture->samples; s++)
+      {
+        uint32_t n = (uint32_t)(r * fixture->samples + s);
+        int32_t value;
+        switch (n % 8)
+        {
+        case 0:
+          value = sig->digMin;
+          break;
+        case 1:
+          value = sig->digMax;
+          break;
+        case 2:
+          value = 0;
+          break;
+        case 3:
+          value = -1;
+          break;
+        case 4:
+          value = 1;
+          break;
+        default:
+          value = sig->digMin + (int32_t)((n * 2654435761u + i * 40503u) % (uint32_t)(sig->digMax - sig->digMin + 1));
+          break;
+        }
+        value = value < sig->digMin ? sig->digMin : value > sig->digMax ? sig->digMax : value;
+        for (int b = 0; b < bytesPerSample; b++)
+        {
+          *at++ = (uint8_t)(value >> (8 * b));
+        }
+      }
+    }
+    written = fwrite(record.data(), 1, record.size(), out) == record.size();
+  }
+  return fclose(out) == 0 && written;
+}
+
+/**
+ * @brief Deletes the playback descriptor the simulator left in dir
+ */
+static void RemoveDescriptor(const char *dir)
+{
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, DESCRIPTOR_FILE_NAME);
+  unlink(path);
+}
+
+/**
+ * @brief Replays the file in dir one way and checks every packet
+ *
+ * @param variant what the run is called in the report
+ * @param extra options added to the simulator's command line
+ * @param inputPath piped to its stdin, which it then plays once through; nullptr if it doesn't
+ * @return true if it ran and every check passed
+ */
+static bool VerifyRun(const RefFile *ref, const char *dir, const char *name, const char *variant,
+                      const std::vector<const char *> &extra, int packetBits, const char *inputPath)
+{
+  char capturePath[PATH_MAX], logPath[PATH_MAX], packets[16];
+  snprintf(capturePath, sizeof(capturePath), "%s/capture.bin", dir);
+  snprintf(logPath, sizeof(logPath), "%s/sim.log", dir);
+  snprintf(packets, sizeof(packets), "%d", VERIFY_PACKETS);
+  std::vector<const char *> args = {"--sd-root", dir, "--fast", "--packets", packets, "--out", capturePath};
+  args.insert(args.end(), extra.begin(), extra.end());
+  int status = RunSimulator(args, logPath, inputPath);
+  std::vector<uint8_t> capture;
+  if (status != 0 || !ReadCapture(capturePath, &capture))
+  {
+    fprintf(stderr, "%-10s %-20s simulator failed (exit %d), see %s\n", name, variant, status, logPath);
+    return false;
+  }
+  VerifyResult result;
+  CheckCapture(ref, capture, packetBits, &result);
+  long wanted = VERIFY_PACKETS;
+  if (inputPath && ref->numRecords * ref->rows < wanted)
+  {
+    // a stream doesn't loop
+    wanted = ref->numRecords * ref->rows;
+  }
+  bool passed = (inputPath ? result.packets == wanted : result.packets >= wanted) && result.badSync == 0 && result.counterBreaks == 0 &&
+                result.mismatches == 0;
+  fprintf(stderr, "%-10s %-20s %6ld packets, %4ld event frames, %ld sync errors, %ld counter breaks, %ld mismatches: %s\n",
+          name, variant, result.packets, result.events, result.badSync, result.counterBreaks, result.mismatches,
+          passed ? "ok" : "FAILED");
+  if (result.mismatches > 0)
+  {
+    fprintf(stderr, "           first mismatch: packet %ld channel %d, sent 0x%06lx, expected 0x%06lx\n",
+            result.firstBadPacket, result.firstBadChan, (unsigned long)(uint32_t)result.got,
+            (unsigned long)(uint32_t)result.expected);
+  }
+  unlink(capturePath);
+  if (passed)
+  {
+    unlink(logPath);
+  }
+  return passed;
+}
+
+/**
+ * @brief Every way of replaying the file in dir, see the file comment
+ */
+static int VerifyFile(const char *dir, const char *name)
+{
+  char edfPath[PATH_MAX], imagePath[PATH_MAX], logPath[PATH_MAX];
+  snprintf(edfPath, sizeof(edfPath), "%s/output.edf", dir);
+  snprintf(imagePath, sizeof(imagePath), "%s/output.vpi", dir);
+  snprintf(logPath, sizeof(logPath), "%s/sim.log", dir);
+  RefFile ref;
+  if (!RefLoad(edfPath, &ref))
+  {
+    fprintf(stderr, "%-10s can't read %s\n", name, edfPath);
+    return 1;
+  }
+  int unchecked = 0;
+  for (int chan = 0; chan < ref.numSignals && chan < SIMPLE_PACKET_CHANNELS; chan++)
+  {
+    unchecked += !RefChecked(&ref, chan) && !ref.signals[chan].annotation;
+  }
+  fprintf(stderr, "%-10s %s, %d signals, %ld records of %d samples%s\n", name, ref.bdf ? "BDF" : "EDF", ref.numSignals,
+          ref.numRecords, ref.rows, unchecked ? " (resampled channels not checked)" : "");
+  const int nativeBits = ref.bdf ? 24 : 16;
+  const int otherBits = ref.bdf ? 16 : 24;
+  const char *otherBitsArg = ref.bdf ? "16" : "24";
+  int failures = 0;
+  failures += !VerifyRun(&ref, dir, name, "file", {"--no-image"}, nativeBits, nullptr);
+  failures += !VerifyRun(&ref, dir, name, "mmap, refill thread", {"--no-image", "--mmap", "--refill-thread"}, nativeBits,
+                         nullptr);
+  failures += !VerifyRun(&ref, dir, name, ref.bdf ? "16-bit packets" : "24-bit packets",
+                         {"--no-image", "--packet-bits", otherBitsArg}, otherBits, nullptr);
+  failures += !VerifyRun(&ref, dir, name, "stdin", {"--stdin"}, nativeBits, edfPath);
+  if (RunSimulator({"--sd-root", dir, "--make-image", imagePath}, logPath, nullptr) != 0)
+  {
+    fprintf(stderr, "%-10s %-20s --make-image failed, see %s\n", name, "image", logPath);
+    failures++;
+  }
+  else
+  {
+    failures += !VerifyRun(&ref, dir, name, "image", {}, nativeBits, nullptr);
+    unlink(imagePath);
+  }
+  return failures;
+}
+
+/**
+ * @brief Plays the file in dir at its own rate to a pty, and checks when its packets arrive
+ *
+ * Each packet's arrival is compared with the ideal timeline through the
+ * first one timed: the spread of those differences is the jitter, and the
+ * slope of a straight line fitted through them the rate error, so one late
+ * packet at the end doesn't count as a slow clock. The counter must run on
+ * and the rate error stay within VERIFY_MAX_RATE_PPM; the jitter depends on
+ * how busy the machine running the test is, so it's only checked when
+ * maxJitterMicros is given.
+ *
+ * @param maxJitterMicros widest jitter that passes, -1 to only report it
+ */
+static int VerifyTiming(const char *dir, int secs, long maxJitterMicros)
+{
+  RefFile ref;
+  char edfPath[PATH_MAX];
+  snprintf(edfPath, sizeof(edfPath), "%s/output.edf", dir);
+  if (!RefLoad(edfPath, &ref))
+  {
+    return 1;
+  }
+  const double periodSecs = ref.recordSecs / ref.rows;
+  const size_t packetBytes = ref.bdf ? SIMPLE_PACKET24_BYTES : SIMPLE_PACKET_BYTES;
+  int errPipe[2];
+  if (pipe(errPipe) != 0)
+  {
+    return 1;
+  }
+  char seconds[16];
+  snprintf(seconds, sizeof(seconds), "%d", secs);
+  int nullFd = ::open("/dev/null", O_RDWR);
+  pid_t pid = ForkSimulator({"--sd-root", dir, "--pty", "--no-image", "--seconds", seconds}, nullFd, nullFd, errPipe[1]);
+  close(nullFd);
+  close(errPipe[1]);
+  FILE *err = fdopen(errPipe[0], "r");
+  char line[256], ptyName[128] = "";
+  while (ptyName[0] == '\0' && fgets(line, sizeof(line), err) != nullptr)
+  {
+    sscanf(line, "packets on %127s", ptyName);
+  }
+  int fd = ptyName[0] ? ::open(ptyName, O_RDONLY | O_NOCTTY) : -1;
+  if (fd < 0)
+  {
+    fprintf(stderr, "timing: no pty from the simulator\n");
+    fclose(err);
+    waitpid(pid, nullptr, 0);
+    return 1;
+  }
+  struct termios tio;
+  tcgetattr(fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(fd, TCSANOW, &tio);
+
+  // arrival of each packet, by where it is in the stream
+  const double opened = MonotonicSecs();
+  std::vector<uint8_t> pending;
+  long packet = -1, timed = 0, counterBreaks = 0;
+  long firstPacket = 0;
+  double firstSecs = 0, minOffset = 0, maxOffset = 0;
+  // least-squares fit of offset against time
+  double sumT = 0, sumOffset = 0, sumTT = 0, sumTOffset = 0;
+  uint8_t buf[4096];
+  struct pollfd pfd = {fd, POLLIN, 0};
+  // it stops sending after --seconds, so a long enough pause is the end of the run
+  while (poll(&pfd, 1, 3000) > 0)
+  {
+    ssize_t got = ::read(fd, buf, sizeof(buf));
+    if (got <= 0)
+    {
+      break;
+    }
+    double now = MonotonicSecs();
+    pending.insert(pending.end(), buf, buf + got);
+    size_t pos = 0;
+    while (pos + packetBytes <= pending.size())
+    {
+      long eventBytes = EventFrameLength(&pending[pos], pending.size() - pos);
+      if (eventBytes < 0)
+      {
+        break;
+      }
+      if (eventBytes > 0)
+      {
+        pos += eventBytes;
+        continue;
+      }
+      if (pending[pos] != 0xFF || pending[pos + 1] != 0xFF)
+      {
+        pos++;
+        continue;
+      }
+      long counter = pending[pos + 2] | pending[pos + 3] << 8;
+      long next = packet + 1;
+      if (packet >= 0 && counter != next % 32768)
+      {
+        counterBreaks++;
+      }
+      packet = packet < 0 ? counter : next + (counter - next % 32768 + 32768) % 32768;
+      pos += packetBytes;
+      if (now - opened < VERIFY_SETTLE_MICROS / 1e6)
+      {
+        continue;
+      }
+      if (timed == 0)
+      {
+        firstPacket = packet;
+        firstSecs = now;
+      }
+      double offset = (now - firstSecs) - (packet - firstPacket) * periodSecs;
+      minOffset = timed == 0 || offset < minOffset ? offset : minOffset;
+      maxOffset = timed == 0 || offset > maxOffset ? offset : maxOffset;
+      double t = now - firstSecs;
+      sumT += t;
+      sumOffset += offset;
+      sumTT += t * t;
+      sumTOffset += t * offset;
+      timed++;
+    }
+    pending.erase(pending.begin(), pending.begin() + pos);
+  }
+  close(fd);
+  while (fgets(line, sizeof(line), err) != nullptr)
+  {
+  }
+  fclose(err);
+  waitpid(pid, nullptr, 0);
+
+  double jitterMicros = (maxOffset - minOffset) * 1e6;
+  double spread = timed * sumTT - sumT * sumT;
+  double ratePpm = spread > 0 ? fabs((timed * sumTOffset - sumT * sumOffset) / spread) * 1e6 : 1e6;
+  bool passed = timed > 1 && counterBreaks == 0 && ratePpm <= VERIFY_MAX_RATE_PPM &&
+                (maxJitterMicros < 0 || jitterMicros <= maxJitterMicros);
+  fprintf(stderr, "timing     %.0f Hz for %d s   %6ld packets timed, %ld counter breaks, jitter %.0f us, rate error %.0f ppm: %s\n",
+          1 / periodSecs, secs, timed, counterBreaks, jitterMicros, ratePpm, passed ? "ok" : "FAILED");
+  return passed ? 0 : 1;
+}
+
+/**
+ * @brief Replays the card's output.edf every way, then times it, in a scratch directory
+ *
+ * The file is reached through a link, so the image and captures go in the
+ * scratch directory rather than on the card.
+ *
+ * @param soak only time it, for VERIFY_SOAK_SECS with the jitter checked
+ * @return how many checks failed
+ */
+static int ReplayCard(bool soak)
+{
+  // scratchDir/output, sized so paths under it fit in PATH_MAX
+  char sub[sizeof(scratchDir) + 8], path[PATH_MAX], source[PATH_MAX];
+  snprintf(sub, sizeof(sub), "%s/output", scratchDir);
+  mkdir(sub, 0755);
+  snprintf(path, sizeof(path), "%s/output.edf", REPLAY_SD_ROOT);
+  bool linked = realpath(path, source) != nullptr;
+  snprintf(path, sizeof(path), "%s/output.edf", sub);
+  int failures = 0;
+  if (!linked || symlink(source, path) != 0)
+  {
+    fprintf(stderr, "no output.edf under %s\n", REPLAY_SD_ROOT);
+    failures++;
+  }
+  else if (soak)
+  {
+    failures += VerifyTiming(sub, VERIFY_SOAK_SECS, VERIFY_MAX_JITTER_MICROS);
+  }
+  else
+  {
+    failures += VerifyFile(sub, "output");
+    failures += VerifyTiming(sub, VERIFY_TIMING_SECS, -1);
+  }
+  unlink(path);
+  RemoveDescriptor(sub);
+  rmdir(sub);
+  return failures;
+}
+
+/**
+ * @brief Writes a fixture to a scratch directory and replays it every way
+ *
+ * @return how many checks failed
+ */
+static int ReplayFixture(const Fixture *fixture)
+{
+  // scratchDir/<name>, sized so paths under it fit in PATH_MAX
+  char sub[sizeof(scratchDir) + VERIFY_MAX_NAME + 1], path[PATH_MAX];
+  snprintf(sub, sizeof(sub), "%s/%s", scratchDir, fixture->name);
+  mkdir(sub, 0755);
+  snprintf(path, sizeof(path), "%s/output.edf", sub);
+  if (!WriteFixture(fixture, sub))
+  {
+    return 1;
+  }
+  int failures = VerifyFile(sub, fixture->name);
+  unlink(path);
+  RemoveDescriptor(sub);
+  rmdir(sub);
+  return failures;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_card_output_edf()
+{
+  TEST_ASSERT_EQUAL_INT(0, ReplayCard(false));
+}
+
+void test_card_timing_soak()
+{
+  TEST_ASSERT_EQUAL_INT(0, ReplayCard(true));
+}
+
+void test_fixture_edf_wide()
+{
+  TEST_ASSERT_EQUAL_INT(0, ReplayFixture(&fixtures[0]));
+}
+
+void test_fixture_bdf_24()
+{
+  TEST_ASSERT_EQUAL_INT(0, ReplayFixture(&fixtures[1]));
+}
+
+void test_fixture_edf_tiny()
+{
+  TEST_ASSERT_EQUAL_INT(0, ReplayFixture(&fixtures[2]));
+}
+
+int main(int argc, char **argv)
+{
+  // pio test -e native -f test_replay -a --soak
+  bool soak = argc > 1 && strcmp(argv[1], "--soak") == 0;
+  if (mkdtemp(scratchDir) == nullptr)
+  {
+    perror(scratchDir);
+    return 1;
+  }
+  UNITY_BEGIN();
+  if (soak)
+  {
+    RUN_TEST(test_card_timing_soak);
+  }
+  else
+  {
+    RUN_TEST(test_card_output_edf);
+    RUN_TEST(test_fixture_edf_wide);
+    RUN_TEST(test_fixture_bdf_24);
+    RUN_TEST(test_fixture_edf_tiny);
+  }
+  if (rmdir(scratchDir) != 0)
+  {
+    fprintf(stderr, "logs of the failed runs are under %s\n", scratchDir);
+  }
+  return UNITY_END();
+}